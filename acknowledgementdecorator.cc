@@ -31,6 +31,8 @@
 #include "siot/connection.h"
 #include "siot/server.h"
 
+#include <errno.h>
+
 #include <string>
 
 namespace toolbox
@@ -53,32 +55,107 @@ AcknowledgementDecorator::~AcknowledgementDecorator()
 string
 AcknowledgementDecorator::Receive(size_t maxlen, int flags)
 {
-	const size_t len = maxlen - buffer_.length();
-	string data = wrapped_->Receive(maxlen > buffer_.length() ? len : 0,
-			flags);
-	if (data.length() > 0)
-		buffer_ += data;
+	return ReceiveBuffer(maxlen, flags).AsString();
+}
 
-	if (buffer_.length() > max_buffer_size_)
+Buffer
+AcknowledgementDecorator::ReceiveBuffer(size_t maxlen, int flags)
+{
+	const size_t len = maxlen - buffer_.Size();
+	buffer_.Append(wrapped_->ReceiveBuffer(maxlen > buffer_.Size() ?
+				len : 0, flags));
+
+	if (buffer_.Size() > max_buffer_size_)
 		throw ClientConnectionException("buffer size exceeded",
 				"The specified buffer size has been exceeded");
 
 	if (autoack_)
 	{
-		data = buffer_;
-		buffer_ = string();
+		Buffer data = std::move(buffer_);
+		buffer_ = Buffer();
 		return data;
 	}
 
 	return buffer_;
 }
 
+ssize_t
+AcknowledgementDecorator::ReceiveInto(char* buf, size_t len, int flags)
+{
+	if (len > buffer_.Size())
+		buffer_.Append(wrapped_->ReceiveBuffer(len - buffer_.Size(),
+					flags));
+
+	if (buffer_.Size() > max_buffer_size_)
+		throw ClientConnectionException("buffer size exceeded",
+				"The specified buffer size has been exceeded");
+
+	len = buffer_.CopyTo(buf, len);
+	if (autoack_)
+		buffer_ = buffer_.Slice(len);
+	return len;
+}
+
+IOResult
+AcknowledgementDecorator::TryReceiveBuffer(Buffer* data, size_t maxlen,
+		int flags)
+{
+	Buffer more;
+	IOResult result = wrapped_->TryReceiveBuffer(&more,
+			maxlen > buffer_.Size() ? maxlen - buffer_.Size() : 0,
+			flags);
+
+	buffer_.Append(more);
+	if (buffer_.Size() > max_buffer_size_)
+		return IOResult(kIOError, 0, ENOBUFS);
+	if (result.status == kIOError)
+		return result;
+
+	if (autoack_)
+	{
+		*data = std::move(buffer_);
+		buffer_ = Buffer();
+	}
+	else
+		*data = buffer_;
+
+	if (!data->IsEmpty())
+		return IOResult(kIOOk, data->Size());
+	return result;
+}
+
+IOResult
+AcknowledgementDecorator::TryReceiveInto(char* buf, size_t len, int flags)
+{
+	IOResult result;
+
+	if (len > buffer_.Size())
+	{
+		Buffer more;
+		result = wrapped_->TryReceiveBuffer(&more,
+				len - buffer_.Size(), flags);
+		buffer_.Append(more);
+	}
+
+	if (buffer_.Size() > max_buffer_size_)
+		return IOResult(kIOError, 0, ENOBUFS);
+	if (result.status == kIOError)
+		return result;
+
+	len = buffer_.CopyTo(buf, len);
+	if (autoack_)
+		buffer_ = buffer_.Slice(len);
+	if (len > 0 || result.IsOk())
+		return IOResult(kIOOk, len);
+	return result;
+}
+
 bool
 AcknowledgementDecorator::Acknowledge(size_t bytes)
 {
-	if (bytes > buffer_.length())
+	if (bytes > buffer_.Size())
 		return false;
-	buffer_ = buffer_.substr(bytes);
+	buffer_ = buffer_.Slice(bytes);
 	return true;
 }
 
@@ -94,6 +171,38 @@ AcknowledgementDecorator::Send(string data, int flags)
 	return wrapped_->Send(data, flags);
 }
 
+ssize_t
+AcknowledgementDecorator::SendVector(const BufferView* views, size_t count, int flags)
+{
+	return wrapped_->SendVector(views, count, flags);
+}
+
+ssize_t
+AcknowledgementDecorator::SendBuffer(const Buffer& data, int flags)
+{
+	return wrapped_->SendBuffer(data, flags);
+}
+
+IOResult
+AcknowledgementDecorator::TrySendVector(const BufferView* views,
+		size_t count, int flags)
+{
+	return wrapped_->TrySendVector(views, count, flags);
+}
+
+ssize_t
+AcknowledgementDecorator::SendZeroCopy(const char* data, size_t len,
+		google::protobuf::Closure* release, int flags)
+{
+	return wrapped_->SendZeroCopy(data, len, release, flags);
+}
+
+ssize_t
+AcknowledgementDecorator::SendFile(int fd, off_t offset, size_t len)
+{
+	return wrapped_->SendFile(fd, offset, len);
+}
+
 string
 AcknowledgementDecorator::PeerAsText()
 {
@@ -109,7 +218,7 @@ AcknowledgementDecorator::GetServer()
 bool
 AcknowledgementDecorator::IsEOF()
 {
-	return wrapped_->IsEOF() && buffer_.length() == 0;
+	return wrapped_->IsEOF() && buffer_.IsEmpty();
 }
 
 uint64_t
@@ -124,6 +233,90 @@ AcknowledgementDecorator::SetBlocking(bool blocking)
 	wrapped_->SetBlocking(blocking);
 }
 
+void
+AcknowledgementDecorator::SetWriteQueue(size_t low_watermark, size_t high_watermark)
+{
+	wrapped_->SetWriteQueue(low_watermark, high_watermark);
+}
+
+size_t
+AcknowledgementDecorator::GetWriteQueueSize()
+{
+	return wrapped_->GetWriteQueueSize();
+}
+
+void
+AcknowledgementDecorator::FlushWriteQueue()
+{
+	wrapped_->FlushWriteQueue();
+}
+
+void
+AcknowledgementDecorator::SetZeroCopyThreshold(size_t threshold)
+{
+	wrapped_->SetZeroCopyThreshold(threshold);
+}
+
+bool
+AcknowledgementDecorator::ProcessErrorQueue()
+{
+	return wrapped_->ProcessErrorQueue();
+}
+
+void
+AcknowledgementDecorator::ApplySocketOptions(const SocketOptions& options)
+{
+	wrapped_->ApplySocketOptions(options);
+}
+
+void
+AcknowledgementDecorator::SetSchedulingClass(const string& cls, uint32_t weight)
+{
+	wrapped_->SetSchedulingClass(cls, weight);
+}
+
+const string&
+AcknowledgementDecorator::GetSchedulingClass()
+{
+	return wrapped_->GetSchedulingClass();
+}
+
+uint32_t
+AcknowledgementDecorator::GetSchedulingWeight()
+{
+	return wrapped_->GetSchedulingWeight();
+}
+
+int
+AcknowledgementDecorator::GetIncomingCPU()
+{
+	return wrapped_->GetIncomingCPU();
+}
+
+void
+AcknowledgementDecorator::SetWorkerShard(int shard)
+{
+	wrapped_->SetWorkerShard(shard);
+}
+
+int
+AcknowledgementDecorator::GetWorkerShard()
+{
+	return wrapped_->GetWorkerShard();
+}
+
+void
+AcknowledgementDecorator::SetListener(int listener)
+{
+	wrapped_->SetListener(listener);
+}
+
+int
+AcknowledgementDecorator::GetListener()
+{
+	return wrapped_->GetListener();
+}
+
 void
 AcknowledgementDecorator::Shutdown()
 {
@@ -140,7 +333,7 @@ AcknowledgementDecorator::Shutdown()
 bool
 AcknowledgementDecorator::IsShutdown()
 {
-	return wrapped_->IsShutdown();
+	return Connection::IsShutdown() || wrapped_->IsShutdown();
 }
 
 }  // namespace siot
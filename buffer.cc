@@ -0,0 +1,307 @@
+/*-
+ * Copyright (c) 2026 Caoimhe Chaos <caoimhechaos@protonmail.com>,
+ *                    Ancient Solutions. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions  of source code must retain  the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions  in   binary  form  must   reproduce  the  above
+ *    copyright  notice, this  list  of conditions  and the  following
+ *    disclaimer in the  documentation and/or other materials provided
+ *    with the distribution.
+ *
+ * THIS  SOFTWARE IS  PROVIDED BY  ANCIENT SOLUTIONS  AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO,  THE IMPLIED WARRANTIES OF  MERCHANTABILITY AND FITNESS
+ * FOR A  PARTICULAR PURPOSE  ARE DISCLAIMED.  IN  NO EVENT  SHALL THE
+ * FOUNDATION  OR CONTRIBUTORS  BE  LIABLE FOR  ANY DIRECT,  INDIRECT,
+ * INCIDENTAL,   SPECIAL,    EXEMPLARY,   OR   CONSEQUENTIAL   DAMAGES
+ * (INCLUDING, BUT NOT LIMITED  TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE,  DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT  LIABILITY,  OR  TORT  (INCLUDING NEGLIGENCE  OR  OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <string>
+
+#include <string.h>
+
+#include "siot/buffer.h"
+#include "siot/bufferpool.h"
+#include "siot/connection.h"
+
+namespace toolbox
+{
+namespace siot
+{
+// Memory referred to by one or more buffers.
+class BufferStorage
+{
+public:
+	virtual ~BufferStorage()
+	{
+	}
+};
+
+namespace
+{
+class StringStorage : public BufferStorage
+{
+public:
+	explicit StringStorage(string&& data)
+	: data_(std::move(data))
+	{
+	}
+
+	const string& Get() const
+	{
+		return data_;
+	}
+
+private:
+	const string data_;
+};
+
+class PooledStorage : public BufferStorage
+{
+public:
+	explicit PooledStorage(PooledBuffer* pooled)
+	: pooled_(pooled)
+	{
+	}
+
+	virtual ~PooledStorage()
+	{
+		delete pooled_;
+	}
+
+	const char* Get() const
+	{
+		return pooled_->Get();
+	}
+
+private:
+	PooledBuffer* const pooled_;
+};
+}  // anonymous namespace
+
+const size_t Buffer::npos;
+
+Buffer::Buffer()
+: size_(0)
+{
+}
+
+Buffer::Buffer(string&& data)
+: size_(data.size())
+{
+	if (size_ == 0)
+		return;
+
+	StringStorage* storage = new StringStorage(std::move(data));
+	Piece p = { std::shared_ptr<BufferStorage>(storage),
+		storage->Get().data(), size_ };
+	pieces_.push_back(p);
+}
+
+Buffer::Buffer(const char* data, size_t length)
+: Buffer(string(data, length))
+{
+}
+
+Buffer::Buffer(PooledBuffer* pooled, size_t length)
+: size_(length)
+{
+	PooledStorage* storage = new PooledStorage(pooled);
+	Piece p = { std::shared_ptr<BufferStorage>(storage), storage->Get(),
+		length };
+
+	if (length > 0)
+		pieces_.push_back(p);
+}
+
+Buffer::Buffer(const Buffer& other)
+: pieces_(other.pieces_), size_(other.size_)
+{
+}
+
+Buffer::Buffer(Buffer&& other)
+: pieces_(std::move(other.pieces_)), size_(other.size_)
+{
+	other.pieces_.clear();
+	other.size_ = 0;
+}
+
+Buffer&
+Buffer::operator=(const Buffer& other)
+{
+	pieces_ = other.pieces_;
+	size_ = other.size_;
+	return *this;
+}
+
+Buffer&
+Buffer::operator=(Buffer&& other)
+{
+	pieces_ = std::move(other.pieces_);
+	size_ = other.size_;
+	other.pieces_.clear();
+	other.size_ = 0;
+	return *this;
+}
+
+Buffer::~Buffer()
+{
+}
+
+const char*
+Buffer::Data() const
+{
+	if (pieces_.empty())
+		return "";
+
+	if (pieces_.size() > 1)
+	{
+		// Join the chain into one piece so the data is contiguous.
+		string joined = AsString();
+		StringStorage* storage = new StringStorage(std::move(joined));
+		Piece p = { std::shared_ptr<BufferStorage>(storage),
+			storage->Get().data(), size_ };
+
+		pieces_.clear();
+		pieces_.push_back(p);
+	}
+
+	return pieces_[0].data;
+}
+
+size_t
+Buffer::Size() const
+{
+	return size_;
+}
+
+bool
+Buffer::IsEmpty() const
+{
+	return size_ == 0;
+}
+
+string
+Buffer::AsString() const
+{
+	string ret;
+
+	ret.reserve(size_);
+	for (const Piece& p : pieces_)
+		ret.append(p.data, p.length);
+	return ret;
+}
+
+Buffer
+Buffer::Slice(size_t offset, size_t length) const
+{
+	Buffer ret;
+
+	if (offset >= size_)
+		return ret;
+	length = std::min(length, size_ - offset);
+
+	for (const Piece& p : pieces_)
+	{
+		if (length == 0)
+			break;
+
+		if (offset >= p.length)
+		{
+			offset -= p.length;
+			continue;
+		}
+
+		Piece slice = p;
+		slice.data += offset;
+		slice.length = std::min(length, p.length - offset);
+		ret.pieces_.push_back(slice);
+		ret.size_ += slice.length;
+		length -= slice.length;
+		offset = 0;
+	}
+
+	return ret;
+}
+
+void
+Buffer::Append(const Buffer& other)
+{
+	pieces_.insert(pieces_.end(), other.pieces_.begin(),
+			other.pieces_.end());
+	size_ += other.size_;
+}
+
+size_t
+Buffer::Find(char c, size_t from) const
+{
+	size_t pos = 0;
+
+	for (const Piece& p : pieces_)
+	{
+		if (from < pos + p.length)
+		{
+			size_t skip = from > pos ? from - pos : 0;
+			const void* found = memchr(p.data + skip, c,
+					p.length - skip);
+
+			if (found)
+				return pos + (static_cast<const char*>(found) -
+						p.data);
+		}
+		pos += p.length;
+	}
+
+	return npos;
+}
+
+size_t
+Buffer::CopyTo(char* dest, size_t length, size_t offset) const
+{
+	size_t copied = 0;
+
+	for (const Piece& p : pieces_)
+	{
+		if (copied == length)
+			break;
+
+		if (offset >= p.length)
+		{
+			offset -= p.length;
+			continue;
+		}
+
+		size_t len = std::min(length - copied, p.length - offset);
+		memcpy(dest + copied, p.data + offset, len);
+		copied += len;
+		offset = 0;
+	}
+
+	return copied;
+}
+
+size_t
+Buffer::CountSegments() const
+{
+	return pieces_.size();
+}
+
+BufferView
+Buffer::GetSegment(size_t n) const
+{
+	return BufferView(pieces_[n].data, pieces_[n].length);
+}
+}  // namespace siot
+}  // namespace toolbox
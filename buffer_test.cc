@@ -0,0 +1,103 @@
+/**
+ * Tests for the buffers handed to the connection callbacks.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string.h>
+
+#include <string>
+
+#include "siot/buffer.h"
+#include "siot/bufferpool.h"
+
+namespace toolbox
+{
+namespace siot
+{
+namespace testing
+{
+using std::string;
+
+class BufferTest : public ::testing::Test
+{
+};
+
+TEST_F(BufferTest, HoldsData)
+{
+	string data("Hey, buddy!");
+	Buffer buf(std::move(data));
+
+	EXPECT_FALSE(buf.IsEmpty());
+	EXPECT_EQ(11, buf.Size());
+	EXPECT_EQ("Hey, buddy!", string(buf.Data(), buf.Size()));
+	EXPECT_EQ("Hey, buddy!", buf.AsString());
+}
+
+TEST_F(BufferTest, Empty)
+{
+	Buffer buf((string()));
+
+	EXPECT_TRUE(buf.IsEmpty());
+	EXPECT_EQ(0, buf.Size());
+	EXPECT_EQ("", buf.AsString());
+}
+
+TEST_F(BufferTest, Slice)
+{
+	Buffer buf(string("Hey, buddy!"));
+	Buffer slice = buf.Slice(5, 5);
+
+	EXPECT_EQ(5, slice.Size());
+	EXPECT_EQ("buddy", slice.AsString());
+	// The slice refers to the same memory.
+	EXPECT_EQ(buf.Data() + 5, slice.Data());
+
+	EXPECT_EQ("buddy!", buf.Slice(5).AsString());
+	EXPECT_EQ("!", buf.Slice(10, 100).AsString());
+	EXPECT_TRUE(buf.Slice(11).IsEmpty());
+}
+
+TEST_F(BufferTest, Chain)
+{
+	Buffer buf(string("Hey, "));
+	char copy[8];
+
+	buf.Append(Buffer(string("bud")));
+	buf.Append(Buffer("dy!", 3));
+
+	EXPECT_EQ(3, buf.CountSegments());
+	EXPECT_EQ(11, buf.Size());
+	EXPECT_EQ("Hey, buddy!", buf.AsString());
+	EXPECT_EQ(7, buf.Find('d'));
+	EXPECT_EQ(8, buf.Find('d', 8));
+	EXPECT_EQ(Buffer::npos, buf.Find('x'));
+
+	EXPECT_EQ("y, bu", buf.Slice(2, 5).AsString());
+	EXPECT_EQ(2, buf.Slice(2, 5).CountSegments());
+
+	EXPECT_EQ(6, buf.CopyTo(copy, 8, 5));
+	EXPECT_EQ("buddy!", string(copy, 6));
+
+	// Accessing the data directly joins the pieces.
+	EXPECT_EQ("Hey, buddy!", string(buf.Data(), buf.Size()));
+	EXPECT_EQ(1, buf.CountSegments());
+}
+
+TEST_F(BufferTest, Pooled)
+{
+	PooledBuffer* pooled = new PooledBuffer(100);
+	memcpy(pooled->Get(), "Hey, buddy!", 11);
+
+	Buffer buf(pooled, 11);
+	Buffer slice = buf.Slice(5);
+	buf = Buffer();
+
+	// The memory stays around as long as some buffer refers to it.
+	EXPECT_EQ("buddy!", slice.AsString());
+	EXPECT_EQ(pooled->Get() + 5, slice.Data());
+}
+
+}  // namespace testing
+}  // namespace siot
+}  // namespace toolbox
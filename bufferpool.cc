@@ -0,0 +1,438 @@
+/*-
+ * Copyright (c) 2026 Caoimhe Chaos <caoimhechaos@protonmail.com>,
+ *                    Ancient Solutions. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions  of source code must retain  the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions  in   binary  form  must   reproduce  the  above
+ *    copyright  notice, this  list  of conditions  and the  following
+ *    disclaimer in the  documentation and/or other materials provided
+ *    with the distribution.
+ *
+ * THIS  SOFTWARE IS  PROVIDED BY  ANCIENT SOLUTIONS  AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO,  THE IMPLIED WARRANTIES OF  MERCHANTABILITY AND FITNESS
+ * FOR A  PARTICULAR PURPOSE  ARE DISCLAIMED.  IN  NO EVENT  SHALL THE
+ * FOUNDATION  OR CONTRIBUTORS  BE  LIABLE FOR  ANY DIRECT,  INDIRECT,
+ * INCIDENTAL,   SPECIAL,    EXEMPLARY,   OR   CONSEQUENTIAL   DAMAGES
+ * (INCLUDING, BUT NOT LIMITED  TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE,  DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT  LIABILITY,  OR  TORT  (INCLUDING NEGLIGENCE  OR  OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif /* HAVE_SYS_MMAN_H */
+
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include <thread++/mutex.h>
+#include <toolbox/expvar.h>
+#include <toolbox/scopedptr.h>
+
+#include "siot/bufferpool.h"
+#include "threadplacement.h"
+
+namespace toolbox
+{
+namespace siot
+{
+using std::string;
+using threadpp::Mutex;
+using threadpp::MutexLock;
+
+static ExpMap<int64_t> pool_hits("siot-buffer-pool-hits");
+static ExpMap<int64_t> pool_misses("siot-buffer-pool-misses");
+static ExpVar<int64_t> pool_resident("siot-buffer-pool-resident-bytes");
+static ExpVar<int64_t> pool_remote_releases("siot-buffer-pool-remote-releases");
+
+// Size of the slabs buffers are carved from. This is the size of a huge
+// page on most platforms.
+static const size_t kSlabSize = 2 << 20;
+
+// Number of buffers moved between the thread caches and the shared pool at
+// a time, and the number of buffers a thread cache may hold per class
+// before it gives some back.
+static const size_t kBatchSize = 16;
+static const size_t kMaxCached = 4 * kBatchSize;
+
+static const size_t kSizeClasses[] = {
+	BufferPool::kSmallBufferSize,
+	BufferPool::kMediumBufferSize,
+	BufferPool::kLargeBufferSize,
+};
+static const int kNumSizeClasses =
+	sizeof(kSizeClasses) / sizeof(kSizeClasses[0]);
+
+// Records which node the slabs belong to, so buffers can be given back to
+// the right pool. Slabs are aligned to kSlabSize, so the lower bits of the
+// entries hold the index of the node (plus one, so 0 means unused). Slabs
+// are never freed, so entries are never removed either.
+static const size_t kSlabTableSize = 1 << 16;
+static std::atomic<uintptr_t> slab_table[kSlabTableSize];
+
+static void
+RegisterSlab(char* slab, int node)
+{
+	const uintptr_t key = reinterpret_cast<uintptr_t>(slab);
+	const uintptr_t entry = key | (node + 1);
+
+	for (size_t i = 0; i < kSlabTableSize; ++i)
+	{
+		size_t pos = (key / kSlabSize + i) % kSlabTableSize;
+		uintptr_t expected = 0;
+
+		if (slab_table[pos].compare_exchange_strong(expected, entry))
+			return;
+	}
+
+	// Buffers of slabs which aren't in the table just stay with
+	// whichever thread releases them.
+}
+
+// Returns the index of the node of the slab containing "buf", or -1 if it
+// isn't known.
+static int
+SlabNode(char* buf)
+{
+	const uintptr_t key = reinterpret_cast<uintptr_t>(buf) &
+		~(kSlabSize - 1);
+
+	for (size_t i = 0; i < kSlabTableSize; ++i)
+	{
+		uintptr_t entry = slab_table[(key / kSlabSize + i) %
+			kSlabTableSize].load(std::memory_order_relaxed);
+
+		if (entry == 0)
+			return -1;
+		if ((entry & ~(kSlabSize - 1)) == key)
+			return (entry & (kSlabSize - 1)) - 1;
+	}
+
+	return -1;
+}
+
+// Returns the index of the smallest size class holding "size" bytes, or
+// -1 if there is none.
+static int
+SizeClass(size_t size)
+{
+	for (int i = 0; i < kNumSizeClasses; ++i)
+		if (size <= kSizeClasses[i])
+			return i;
+	return -1;
+}
+
+namespace
+{
+// The part of the pool which is shared between all threads running on the
+// NUMA node with the index "node".
+class SharedPool
+{
+public:
+	explicit SharedPool(int node)
+	: mtx_(Mutex::Create()), node_(node), huge_pages_(false), resident_(0)
+	{
+	}
+
+	// Moves up to kBatchSize buffers of "cls" into "out", allocating a
+	// new slab if there are none left.
+	void Refill(int cls, std::vector<char*>* out)
+	{
+		MutexLock l(mtx_.Get());
+		std::vector<char*>& free = free_[cls];
+
+		if (free.empty())
+		{
+			AllocateSlabLocked(cls);
+			pool_misses.Add(std::to_string(kSizeClasses[cls]), 1);
+		}
+		else
+			pool_hits.Add(std::to_string(kSizeClasses[cls]), 1);
+
+		while (!free.empty() && out->size() < kBatchSize)
+		{
+			out->push_back(free.back());
+			free.pop_back();
+		}
+	}
+
+	// Takes back the buffers of "cls" in "in", starting at "from".
+	void Drain(int cls, std::vector<char*>* in, size_t from)
+	{
+		MutexLock l(mtx_.Get());
+
+		free_[cls].insert(free_[cls].end(), in->begin() + from,
+				in->end());
+		in->resize(from);
+	}
+
+	void SetHugePages(bool enable)
+	{
+		MutexLock l(mtx_.Get());
+		huge_pages_ = enable;
+	}
+
+	size_t GetResidentSize()
+	{
+		MutexLock l(mtx_.Get());
+		return resident_;
+	}
+
+private:
+	void AllocateSlabLocked(int cls)
+	{
+		const std::vector<NUMANode>& nodes = GetNUMANodes();
+		char* slab = 0;
+
+#ifdef HAVE_SYS_MMAN_H
+		void* mem = MAP_FAILED;
+#ifdef MAP_HUGETLB
+		// Huge pages are always aligned to their size.
+		if (huge_pages_)
+			mem = mmap(0, kSlabSize, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS |
+					MAP_HUGETLB, -1, 0);
+#endif /* MAP_HUGETLB */
+		if (mem != MAP_FAILED)
+			slab = static_cast<char*>(mem);
+		else
+		{
+			// Map twice the size and cut off the ends, which
+			// leaves a slab aligned to its size.
+			mem = mmap(0, 2 * kSlabSize, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (mem != MAP_FAILED)
+			{
+				char* base = static_cast<char*>(mem);
+				uintptr_t offset = reinterpret_cast<uintptr_t>(
+						base) & (kSlabSize - 1);
+
+				slab = offset ? base + kSlabSize - offset :
+					base;
+				if (slab > base)
+					munmap(base, slab - base);
+				munmap(slab + kSlabSize, kSlabSize -
+						(slab - base));
+			}
+		}
+
+		// The pages are only placed once they're first used, so
+		// binding the slab now is still in time.
+		if (slab && nodes.size() > 1)
+		{
+			BindMemoryToNUMANode(slab, kSlabSize,
+					nodes[node_].id);
+			RegisterSlab(slab, node_);
+		}
+#endif /* HAVE_SYS_MMAN_H */
+		if (!slab)
+			slab = new char[kSlabSize];
+
+		for (size_t off = 0; off + kSizeClasses[cls] <= kSlabSize;
+				off += kSizeClasses[cls])
+			free_[cls].push_back(slab + off);
+
+		resident_ += kSlabSize;
+		pool_resident.Add(kSlabSize);
+	}
+
+	ScopedPtr<Mutex> mtx_;
+	std::vector<char*> free_[kNumSizeClasses];
+	const int node_;
+	bool huge_pages_;
+	size_t resident_;
+};
+
+// The buffers cached by a single thread. They are handed back to the
+// shared pools when the thread exits.
+struct ThreadCache
+{
+	ThreadCache();
+	~ThreadCache();
+
+	// Index of the node the thread took its first buffer on, or -1 if
+	// it hasn't taken any buffers yet.
+	int node;
+	std::vector<char*> free[kNumSizeClasses];
+
+	// Buffers from the pools of other nodes, by node and size class,
+	// which are collected to be given back in batches.
+	std::vector<std::vector<char*> > remote;
+};
+}  // anonymous namespace
+
+static std::vector<SharedPool*>*
+CreateSharedPools()
+{
+	std::vector<SharedPool*>* pools = new std::vector<SharedPool*>;
+
+	for (size_t i = 0; i < GetNUMANodes().size(); ++i)
+		pools->push_back(new SharedPool(i));
+	return pools;
+}
+
+// One pool per NUMA node. Never destroyed, since thread caches may still
+// give buffers back to them during shutdown.
+static std::vector<SharedPool*>&
+GetSharedPools()
+{
+	static std::vector<SharedPool*>* pools = CreateSharedPools();
+	return *pools;
+}
+
+ThreadCache::ThreadCache()
+: node(-1)
+{
+}
+
+ThreadCache::~ThreadCache()
+{
+	std::vector<SharedPool*>& pools = GetSharedPools();
+
+	for (int i = 0; i < kNumSizeClasses; ++i)
+		if (!free[i].empty())
+			pools[node < 0 ? 0 : node]->Drain(i, &free[i], 0);
+
+	for (size_t i = 0; i < remote.size(); ++i)
+		if (!remote[i].empty())
+			pools[i / kNumSizeClasses]->Drain(i % kNumSizeClasses,
+					&remote[i], 0);
+}
+
+static thread_local ThreadCache cache;
+
+const size_t BufferPool::kSmallBufferSize;
+const size_t BufferPool::kMediumBufferSize;
+const size_t BufferPool::kLargeBufferSize;
+
+char*
+BufferPool::Allocate(size_t size)
+{
+	int cls = SizeClass(size);
+
+	if (cls < 0)
+	{
+		pool_misses.Add("oversized", 1);
+		return new char[size];
+	}
+
+	// Threads are expected to stay on their node, so this is only
+	// determined once.
+	if (cache.node < 0)
+		cache.node = GetNUMANodeIndex(GetCurrentCPU());
+
+	std::vector<char*>& free = cache.free[cls];
+	if (free.empty())
+		GetSharedPools()[cache.node]->Refill(cls, &free);
+	else
+		pool_hits.Add(std::to_string(kSizeClasses[cls]), 1);
+
+	char* buf = free.back();
+	free.pop_back();
+	return buf;
+}
+
+void
+BufferPool::Release(char* buf, size_t size)
+{
+	int cls = SizeClass(size);
+
+	if (cls < 0)
+	{
+		delete [] buf;
+		return;
+	}
+
+	std::vector<SharedPool*>& pools = GetSharedPools();
+	if (cache.node < 0)
+		cache.node = GetNUMANodeIndex(GetCurrentCPU());
+
+	// Buffers from other nodes are collected and sent home, so they
+	// don't end up being used far away from their memory.
+	int node = pools.size() > 1 ? SlabNode(buf) : -1;
+	if (node >= 0 && node != cache.node)
+	{
+		if (cache.remote.empty())
+			cache.remote.resize(pools.size() * kNumSizeClasses);
+
+		std::vector<char*>& remote =
+			cache.remote[node * kNumSizeClasses + cls];
+		remote.push_back(buf);
+		pool_remote_releases.Add(1);
+		if (remote.size() >= kBatchSize)
+			pools[node]->Drain(cls, &remote, 0);
+		return;
+	}
+
+	std::vector<char*>& free = cache.free[cls];
+	free.push_back(buf);
+	if (free.size() > kMaxCached)
+		pools[cache.node]->Drain(cls, &free, kMaxCached - kBatchSize);
+}
+
+size_t
+BufferPool::Capacity(size_t size)
+{
+	int cls = SizeClass(size);
+
+	if (cls < 0)
+		return size;
+	return kSizeClasses[cls];
+}
+
+void
+BufferPool::SetHugePages(bool enable)
+{
+	for (SharedPool* pool : GetSharedPools())
+		pool->SetHugePages(enable);
+}
+
+size_t
+BufferPool::GetResidentSize()
+{
+	size_t resident = 0;
+
+	for (SharedPool* pool : GetSharedPools())
+		resident += pool->GetResidentSize();
+	return resident;
+}
+
+PooledBuffer::PooledBuffer(size_t size)
+: data_(BufferPool::Allocate(size)), size_(BufferPool::Capacity(size))
+{
+}
+
+PooledBuffer::~PooledBuffer()
+{
+	BufferPool::Release(data_, size_);
+}
+
+char*
+PooledBuffer::Get() const
+{
+	return data_;
+}
+
+size_t
+PooledBuffer::Size() const
+{
+	return size_;
+}
+}  // namespace siot
+}  // namespace toolbox
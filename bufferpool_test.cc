@@ -0,0 +1,88 @@
+/**
+ * Tests for the I/O buffer pool.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string.h>
+
+#include <set>
+#include <thread>
+
+#include "siot/bufferpool.h"
+
+namespace toolbox
+{
+namespace siot
+{
+namespace testing
+{
+class BufferPoolTest : public ::testing::Test
+{
+};
+
+TEST_F(BufferPoolTest, SizeClasses)
+{
+	EXPECT_EQ(4096, BufferPool::Capacity(1));
+	EXPECT_EQ(4096, BufferPool::Capacity(4096));
+	EXPECT_EQ(16384, BufferPool::Capacity(4097));
+	EXPECT_EQ(65536, BufferPool::Capacity(65536));
+	EXPECT_EQ(100000, BufferPool::Capacity(100000));
+}
+
+TEST_F(BufferPoolTest, ReusesBuffers)
+{
+	char* buf = BufferPool::Allocate(16384);
+	size_t resident = BufferPool::GetResidentSize();
+
+	EXPECT_LT(0, resident);
+	memset(buf, 'x', 16384);
+	BufferPool::Release(buf, 16384);
+
+	// The same thread gets its buffer right back.
+	EXPECT_EQ(buf, BufferPool::Allocate(10000));
+	BufferPool::Release(buf, 10000);
+	EXPECT_EQ(resident, BufferPool::GetResidentSize());
+}
+
+TEST_F(BufferPoolTest, DistinctBuffers)
+{
+	std::set<char*> seen;
+	char* bufs[100];
+
+	for (int i = 0; i < 100; ++i)
+	{
+		bufs[i] = BufferPool::Allocate(4096);
+		EXPECT_TRUE(seen.insert(bufs[i]).second);
+	}
+	for (int i = 0; i < 100; ++i)
+		BufferPool::Release(bufs[i], 4096);
+}
+
+TEST_F(BufferPoolTest, AcrossThreads)
+{
+	char* buf = 0;
+	std::thread t([&buf]() {
+		buf = BufferPool::Allocate(65536);
+	});
+	t.join();
+
+	// Buffers may be returned by a different thread.
+	ASSERT_NE(nullptr, buf);
+	memset(buf, 'x', 65536);
+	BufferPool::Release(buf, 65536);
+}
+
+TEST_F(BufferPoolTest, PooledBuffer)
+{
+	PooledBuffer small(100);
+	PooledBuffer large(200000);
+
+	EXPECT_EQ(4096, small.Size());
+	EXPECT_EQ(200000, large.Size());
+	memset(large.Get(), 'x', large.Size());
+}
+
+}  // namespace testing
+}  // namespace siot
+}  // namespace toolbox
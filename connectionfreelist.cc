@@ -0,0 +1,114 @@
+/*-
+ * Copyright (c) 2026 Caoimhe Chaos <caoimhechaos@protonmail.com>,
+ *                    Ancient Solutions. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions  of source code must retain  the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions  in   binary  form  must   reproduce  the  above
+ *    copyright  notice, this  list  of conditions  and the  following
+ *    disclaimer in the  documentation and/or other materials provided
+ *    with the distribution.
+ *
+ * THIS  SOFTWARE IS  PROVIDED BY  ANCIENT SOLUTIONS  AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO,  THE IMPLIED WARRANTIES OF  MERCHANTABILITY AND FITNESS
+ * FOR A  PARTICULAR PURPOSE  ARE DISCLAIMED.  IN  NO EVENT  SHALL THE
+ * FOUNDATION  OR CONTRIBUTORS  BE  LIABLE FOR  ANY DIRECT,  INDIRECT,
+ * INCIDENTAL,   SPECIAL,    EXEMPLARY,   OR   CONSEQUENTIAL   DAMAGES
+ * (INCLUDING, BUT NOT LIMITED  TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE,  DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT  LIABILITY,  OR  TORT  (INCLUDING NEGLIGENCE  OR  OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <map>
+#include <new>
+
+#include <thread++/mutex.h>
+#include <toolbox/expvar.h>
+
+#include "connectionfreelist.h"
+
+namespace toolbox
+{
+namespace siot
+{
+using threadpp::Mutex;
+using threadpp::MutexLock;
+
+static ExpMap<int64_t> freelist_allocations("siot-connection-allocations");
+
+ConnectionFreelist::ConnectionFreelist(size_t object_size, size_t max_cached)
+: object_size_(object_size), max_cached_(max_cached), mtx_(Mutex::Create())
+{
+}
+
+ConnectionFreelist::~ConnectionFreelist()
+{
+	for (void* ptr : free_)
+		::operator delete(ptr);
+}
+
+ConnectionFreelist*
+ConnectionFreelist::ForSize(size_t object_size)
+{
+	// Never destroyed, connections may still be shut down during exit.
+	static Mutex* mtx = Mutex::Create();
+	static std::map<size_t, ConnectionFreelist*>* freelists =
+		new std::map<size_t, ConnectionFreelist*>;
+	MutexLock l(mtx);
+	ConnectionFreelist*& freelist = (*freelists)[object_size];
+
+	if (!freelist)
+		freelist = new ConnectionFreelist(object_size,
+				kMaxCachedConnections);
+	return freelist;
+}
+
+void*
+ConnectionFreelist::Allocate(size_t size)
+{
+	if (size == object_size_)
+	{
+		MutexLock l(mtx_.Get());
+
+		if (!free_.empty())
+		{
+			void* ptr = free_.back();
+			free_.pop_back();
+			freelist_allocations.Add("reused", 1);
+			return ptr;
+		}
+	}
+
+	freelist_allocations.Add("new", 1);
+	return ::operator new(size);
+}
+
+void
+ConnectionFreelist::Release(void* ptr, size_t size)
+{
+	if (!ptr)
+		return;
+
+	if (size == object_size_)
+	{
+		MutexLock l(mtx_.Get());
+
+		if (free_.size() < max_cached_)
+		{
+			free_.push_back(ptr);
+			return;
+		}
+	}
+
+	::operator delete(ptr);
+}
+}  // namespace siot
+}  // namespace toolbox
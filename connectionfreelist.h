@@ -0,0 +1,81 @@
+/*-
+ * Copyright (c) 2026 Caoimhe Chaos <caoimhechaos@protonmail.com>,
+ *                    Ancient Solutions. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions  of source code must retain  the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions  in   binary  form  must   reproduce  the  above
+ *    copyright  notice, this  list  of conditions  and the  following
+ *    disclaimer in the  documentation and/or other materials provided
+ *    with the distribution.
+ *
+ * THIS  SOFTWARE IS  PROVIDED BY  ANCIENT SOLUTIONS  AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO,  THE IMPLIED WARRANTIES OF  MERCHANTABILITY AND FITNESS
+ * FOR A  PARTICULAR PURPOSE  ARE DISCLAIMED.  IN  NO EVENT  SHALL THE
+ * FOUNDATION  OR CONTRIBUTORS  BE  LIABLE FOR  ANY DIRECT,  INDIRECT,
+ * INCIDENTAL,   SPECIAL,    EXEMPLARY,   OR   CONSEQUENTIAL   DAMAGES
+ * (INCLUDING, BUT NOT LIMITED  TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE,  DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT  LIABILITY,  OR  TORT  (INCLUDING NEGLIGENCE  OR  OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INCLUDED_CONNECTIONFREELIST_H
+#define INCLUDED_CONNECTIONFREELIST_H 1
+
+#include <stddef.h>
+
+#include <vector>
+
+#include <thread++/mutex.h>
+#include <toolbox/scopedptr.h>
+
+namespace toolbox
+{
+namespace siot
+{
+// Keeps the memory of destroyed connection objects around so it can be
+// reused for the next connection, rather than going back to the allocator
+// every time. This is meant to back the class specific operator new and
+// delete of a connection type; objects of any other size are passed on to
+// the global allocator.
+class ConnectionFreelist
+{
+public:
+	// Number of objects kept around for reuse by the freelists returned
+	// from ForSize().
+	static const size_t kMaxCachedConnections = 1024;
+
+	// Creates a freelist for objects of "object_size" bytes, holding on
+	// to at most "max_cached" of them.
+	ConnectionFreelist(size_t object_size, size_t max_cached);
+	virtual ~ConnectionFreelist();
+
+	// Returns the freelist shared by all connection types whose objects
+	// are "object_size" bytes large, creating it on first use.
+	static ConnectionFreelist* ForSize(size_t object_size);
+
+	// Returns memory for an object of "size" bytes.
+	void* Allocate(size_t size);
+
+	// Takes back the memory at "ptr", which was used for an object of
+	// "size" bytes.
+	void Release(void* ptr, size_t size);
+
+private:
+	const size_t object_size_;
+	const size_t max_cached_;
+	ScopedPtr<threadpp::Mutex> mtx_;
+	std::vector<void*> free_;
+};
+}  // namespace siot
+}  // namespace toolbox
+
+#endif /* INCLUDED_CONNECTIONFREELIST_H */
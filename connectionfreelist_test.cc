@@ -0,0 +1,68 @@
+/**
+ * Tests for the freelist recycling connection objects.
+ */
+
+#include <gtest/gtest.h>
+
+#include "connectionfreelist.h"
+
+namespace toolbox
+{
+namespace siot
+{
+namespace testing
+{
+class ConnectionFreelistTest : public ::testing::Test
+{
+};
+
+TEST_F(ConnectionFreelistTest, ReusesMemory)
+{
+	ConnectionFreelist freelist(128, 2);
+	void* one = freelist.Allocate(128);
+	void* two = freelist.Allocate(128);
+
+	EXPECT_NE(one, two);
+	freelist.Release(one, 128);
+	EXPECT_EQ(one, freelist.Allocate(128));
+
+	freelist.Release(one, 128);
+	freelist.Release(two, 128);
+}
+
+TEST_F(ConnectionFreelistTest, OtherSizes)
+{
+	ConnectionFreelist freelist(128, 2);
+	void* small = freelist.Allocate(64);
+
+	// Objects of a different size never end up on the list.
+	freelist.Release(small, 64);
+	void* same = freelist.Allocate(128);
+	EXPECT_NE(small, same);
+	freelist.Release(same, 128);
+}
+
+TEST_F(ConnectionFreelistTest, ForSize)
+{
+	ConnectionFreelist* freelist = ConnectionFreelist::ForSize(128);
+
+	// Connection types of the same size share their freelist.
+	EXPECT_EQ(freelist, ConnectionFreelist::ForSize(128));
+	EXPECT_NE(freelist, ConnectionFreelist::ForSize(64));
+}
+
+TEST_F(ConnectionFreelistTest, Limit)
+{
+	ConnectionFreelist freelist(128, 1);
+	void* one = freelist.Allocate(128);
+	void* two = freelist.Allocate(128);
+
+	freelist.Release(one, 128);
+	freelist.Release(two, 128);
+	EXPECT_EQ(one, freelist.Allocate(128));
+	freelist.Release(one, 128);
+}
+
+}  // namespace testing
+}  // namespace siot
+}  // namespace toolbox
@@ -0,0 +1,211 @@
+/*-
+ * Copyright (c) 2026 Caoimhe Chaos <caoimhechaos@protonmail.com>,
+ *                    Ancient Solutions. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions  of source code must retain  the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions  in   binary  form  must   reproduce  the  above
+ *    copyright  notice, this  list  of conditions  and the  following
+ *    disclaimer in the  documentation and/or other materials provided
+ *    with the distribution.
+ *
+ * THIS  SOFTWARE IS  PROVIDED BY  ANCIENT SOLUTIONS  AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO,  THE IMPLIED WARRANTIES OF  MERCHANTABILITY AND FITNESS
+ * FOR A  PARTICULAR PURPOSE  ARE DISCLAIMED.  IN  NO EVENT  SHALL THE
+ * FOUNDATION  OR CONTRIBUTORS  BE  LIABLE FOR  ANY DIRECT,  INDIRECT,
+ * INCIDENTAL,   SPECIAL,    EXEMPLARY,   OR   CONSEQUENTIAL   DAMAGES
+ * (INCLUDING, BUT NOT LIMITED  TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE,  DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT  LIABILITY,  OR  TORT  (INCLUDING NEGLIGENCE  OR  OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include <clib/clib.h>
+
+#include "siot/coroutine.h"
+#include "siot/server.h"
+
+namespace toolbox
+{
+namespace siot
+{
+namespace testing
+{
+#ifdef SIOT_HAVE_COROUTINES
+using threadpp::ClosureThread;
+using google::protobuf::NewCallback;
+
+Task<int>
+Answer()
+{
+	co_return 42;
+}
+
+Task<int>
+AddOne()
+{
+	int answer = co_await Answer();
+	co_return answer + 1;
+}
+
+Task<void>
+StoreResult(std::atomic<int>* result)
+{
+	*result = co_await AddOne();
+}
+
+Task<void>
+Throw()
+{
+	throw ServerSetupException("thrown");
+	co_return;
+}
+
+Task<void>
+Catch(std::atomic<bool>* caught)
+{
+	try
+	{
+		co_await Throw();
+	}
+	catch (ServerSetupException& e)
+	{
+		*caught = true;
+	}
+}
+
+// Reads a line, waits a bit and sends the first 5 bytes back.
+Task<void>
+Echo(Connection* conn, std::atomic<bool>* slept)
+{
+	Buffer data = co_await AsyncReceive(conn);
+
+	co_await Sleep(conn, std::chrono::milliseconds(10));
+	*slept = true;
+	co_await AsyncSend(conn, data.Slice(0, 5));
+
+	// Wait until the other side goes away.
+	data = co_await AsyncReceive(conn);
+	EXPECT_TRUE(data.IsEmpty());
+	EXPECT_TRUE(conn->IsEOF());
+	conn->GetServer()->Shutdown();
+}
+
+Task<void>
+Wait(Server* srv, std::atomic<bool>* done)
+{
+	co_await Sleep(srv, std::chrono::milliseconds(10));
+	*done = true;
+}
+
+class EchoCallback : public ConnectionCallback
+{
+public:
+	EchoCallback()
+	: slept(false)
+	{
+	}
+
+	virtual void ConnectionEstablished(Connection* conn)
+	{
+		Spawn(Echo(conn, &slept));
+	}
+
+	virtual void DataReady(Connection* conn)
+	{
+		ADD_FAILURE() << "DataReady() called for a coroutine";
+	}
+
+	std::atomic<bool> slept;
+};
+
+TEST(CoroutineTest, NestedTasks)
+{
+	std::atomic<int> result(0);
+
+	Spawn(StoreResult(&result));
+	EXPECT_EQ(43, result);
+}
+
+TEST(CoroutineTest, Exceptions)
+{
+	std::atomic<bool> caught(false);
+
+	Spawn(Catch(&caught));
+	EXPECT_TRUE(caught);
+}
+
+TEST(CoroutineTest, Sleep)
+{
+	std::atomic<bool> done(false);
+	ScopedPtr<Server> srv(0);
+	EchoCallback* cb = new EchoCallback();
+
+	ASSERT_NO_THROW(srv.Reset(new Server("[::1]:12354", cb, 1)));
+
+	Spawn(Wait(srv.Get(), &done));
+	EXPECT_FALSE(done);
+	for (int i = 0; i < 100 && !done; ++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	EXPECT_TRUE(done);
+}
+
+TEST(CoroutineTest, Echo)
+{
+	struct addrinfo *info;
+	char buf[5];
+	int sock;
+	ScopedPtr<Server> srv(0);
+	EchoCallback* cb = new EchoCallback();
+
+	ASSERT_NO_THROW(srv.Reset(new Server("[::1]:12353", cb, 1)));
+
+	ClosureThread ct(NewCallback(srv.Get(), &Server::Listen));
+	ct.Start();
+
+	EXPECT_NE(-1, sock = socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP))
+		<< "Error creating socket: " << strerror(errno);
+
+	EXPECT_EQ(0, c_str2addrinfo("[::1]:12353", &info))
+		<< "Error converting to addrinfo: " << strerror(errno);
+	EXPECT_EQ(0, c_connect2addrinfo(sock, info))
+		<< "Error connecting: " << strerror(errno);
+	freeaddrinfo(info);
+
+	EXPECT_EQ(12, send(sock, "Hello World\n", 12, 0))
+		<< "Error sending: " << strerror(errno);
+	EXPECT_EQ(5, recv(sock, buf, 5, 0))
+		<< "Error receiving: " << strerror(errno);
+	EXPECT_EQ("Hello", string(buf, 5));
+	EXPECT_TRUE(cb->slept);
+
+	EXPECT_EQ(0, shutdown(sock, SHUT_RDWR))
+		<< "Error shutting down: " << strerror(errno);
+	EXPECT_EQ(0, close(sock))
+		<< "Error closing socket: " << strerror(errno);
+
+	ct.WaitForFinished();
+}
+#endif /* SIOT_HAVE_COROUTINES */
+}  // namespace testing
+}  // namespace siot
+}  // namespace toolbox
@@ -0,0 +1,621 @@
+/*-
+ * Copyright (c) 2026 Caoimhe Chaos <caoimhechaos@protonmail.com>,
+ *                    Ancient Solutions. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions  of source code must retain  the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions  in   binary  form  must   reproduce  the  above
+ *    copyright  notice, this  list  of conditions  and the  following
+ *    disclaimer in the  documentation and/or other materials provided
+ *    with the distribution.
+ *
+ * THIS  SOFTWARE IS  PROVIDED BY  ANCIENT SOLUTIONS  AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO,  THE IMPLIED WARRANTIES OF  MERCHANTABILITY AND FITNESS
+ * FOR A  PARTICULAR PURPOSE  ARE DISCLAIMED.  IN  NO EVENT  SHALL THE
+ * FOUNDATION  OR CONTRIBUTORS  BE  LIABLE FOR  ANY DIRECT,  INDIRECT,
+ * INCIDENTAL,   SPECIAL,    EXEMPLARY,   OR   CONSEQUENTIAL   DAMAGES
+ * (INCLUDING, BUT NOT LIMITED  TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE,  DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT  LIABILITY,  OR  TORT  (INCLUDING NEGLIGENCE  OR  OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif /* HAVE_SYS_TYPES_H */
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif /* HAVE_SYS_SOCKET_H */
+#ifdef HAVE_NETINET_IN_H
+#include <netinet/in.h>
+#endif /* HAVE_NETINET_IN_H */
+#ifdef HAVE_NETINET_UDP_H
+#include <netinet/udp.h>
+#endif /* HAVE_NETINET_UDP_H */
+#ifdef HAVE_NETDB_H
+#include <netdb.h>
+#endif /* HAVE_NETDB_H */
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+#ifdef HAVE_SYS_ERRNO_H
+#include <sys/errno.h>
+#endif /* HAVE_SYS_ERRNO_H */
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif /* HAVE_ERRNO_H */
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif /* HAVE_STRING_H */
+
+#include <poll.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <memory>
+
+// TODO(caoimhe): get rid of this hack
+#define HAVE_CLIB_HASH_H 1
+#include <clib/clib.h>
+
+#include <toolbox/expvar.h>
+
+#include "siot/bufferpool.h"
+#include "siot/connection.h"
+#include "siot/datagramserver.h"
+#include "siot/server.h"
+
+#ifndef HAVE_STRERROR
+#define strerror(x) std::to_string(x)
+#endif /* HAVE_STRERROR */
+
+namespace toolbox
+{
+namespace siot
+{
+static ExpVar<int64_t> datagrams_received("siot-datagrams-received");
+static ExpVar<int64_t> datagrams_sent("siot-datagrams-sent");
+static ExpMap<int64_t> datagram_errors("siot-datagram-errors");
+
+// The most messages handed to the system in one call by SendBatch().
+static const size_t kMaxSendMessages = 64;
+
+// The most pieces of memory a single batch passed to the system may
+// consist of.
+static const size_t kMaxSendIOVecs = 1024;
+
+// Limits for coalescing datagrams into one write with send offload: the
+// system takes at most 64 segments, and the whole write must still fit
+// into a single IP packet, headers included.
+static const size_t kMaxOffloadSegments = 64;
+static const size_t kMaxOffloadBytes = 65000;
+
+#ifndef HAVE_RECVMMSG
+// Platforms without recvmmsg() don't have this either. The emulations
+// below transfer a single message at a time.
+struct mmsghdr
+{
+	struct msghdr msg_hdr;
+	unsigned int msg_len;
+};
+#endif /* !HAVE_RECVMMSG */
+
+// Receives up to "count" messages from "fd" into "msgs". Returns the
+// number of messages received, or -1 on error.
+static int
+ReceiveMessages(int fd, struct mmsghdr* msgs, unsigned int count, int flags)
+{
+#ifdef HAVE_RECVMMSG
+	return recvmmsg(fd, msgs, count, flags, 0);
+#else /* !HAVE_RECVMMSG */
+	ssize_t len = recvmsg(fd, &msgs[0].msg_hdr, flags);
+	if (len == -1)
+		return -1;
+	msgs[0].msg_len = len;
+	return 1;
+#endif /* HAVE_RECVMMSG */
+}
+
+// Sends the "count" messages in "msgs" on "fd". Returns the number of
+// messages sent, or -1 if not even the first one could be sent.
+static int
+SendMessages(int fd, struct mmsghdr* msgs, unsigned int count, int flags)
+{
+#ifdef HAVE_SENDMMSG
+	return sendmmsg(fd, msgs, count, flags);
+#else /* !HAVE_SENDMMSG */
+	unsigned int sent;
+
+	for (sent = 0; sent < count; ++sent)
+	{
+		ssize_t len = sendmsg(fd, &msgs[sent].msg_hdr, flags);
+		if (len == -1)
+			return sent > 0 ? sent : -1;
+		msgs[sent].msg_len = len;
+	}
+	return sent;
+#endif /* HAVE_SENDMMSG */
+}
+
+// Returns the size of the segments the system coalesced the datagram
+// received in "msg" from, or 0 if it wasn't coalesced.
+static size_t
+OffloadSegmentSize(struct msghdr* msg)
+{
+#ifdef UDP_GRO
+	for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(msg); cmsg;
+			cmsg = CMSG_NXTHDR(msg, cmsg))
+		if (cmsg->cmsg_level == IPPROTO_UDP &&
+				cmsg->cmsg_type == UDP_GRO)
+		{
+			int size;
+			memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+			return size > 0 ? size : 0;
+		}
+#endif /* UDP_GRO */
+	return 0;
+}
+
+// Determines whether the datagrams "a" and "b" go to the same peer.
+static bool
+SamePeer(const Datagram& a, const Datagram& b)
+{
+	return a.peer_length == b.peer_length &&
+		memcmp(&a.peer, &b.peer, a.peer_length) == 0;
+}
+
+Datagram::Datagram()
+: peer_length(0)
+{
+	memset(&peer, 0, sizeof(peer));
+}
+
+Datagram::Datagram(const Buffer& data, const struct sockaddr* peer,
+		socklen_t peer_length)
+: data(data), peer_length(std::min<socklen_t>(peer_length,
+			sizeof(this->peer)))
+{
+	memset(&this->peer, 0, sizeof(this->peer));
+	memcpy(&this->peer, peer, this->peer_length);
+}
+
+Datagram
+Datagram::Reply(const Buffer& data) const
+{
+	return Datagram(data, (const struct sockaddr*) &peer, peer_length);
+}
+
+string
+Datagram::PeerAsText() const
+{
+	struct sockaddr_storage addr = peer;
+	ScopedPtr<char> addr_str(c_sockaddr2str(&addr));
+	return addr_str.Get();
+}
+
+DatagramCallback::~DatagramCallback()
+{
+}
+
+void
+DatagramCallback::DatagramsReceived(DatagramServer* server,
+		const std::vector<Datagram>& batch)
+{
+	for (const Datagram& dgram : batch)
+		DatagramReceived(server, dgram);
+}
+
+void
+DatagramCallback::ReceiveFailed(std::string msg)
+{
+}
+
+DatagramServer::DatagramServer(std::string addr, DatagramCallback* callback,
+		uint32_t num_threads)
+: callback_(callback), executor_(new threadpp::ThreadPool(num_threads)),
+	server_(0), batch_size_(32), max_datagram_size_(2048),
+	receive_offload_(false), send_offload_(true), running_(true),
+	info_(0), fd_(-1)
+{
+	Init(addr);
+}
+
+DatagramServer::DatagramServer(std::string addr, DatagramCallback* callback,
+		Server* server)
+: callback_(callback), executor_(0), server_(server), batch_size_(32),
+	max_datagram_size_(2048), receive_offload_(false),
+	send_offload_(true), running_(true), info_(0), fd_(-1)
+{
+	Init(addr);
+}
+
+void
+DatagramServer::Init(const std::string& addr)
+{
+	int error = c_str2addrinfo(addr.c_str(), &info_);
+	if (error)
+		throw ServerSetupException(string(gai_strerror(error)));
+
+	fd_ = socket(info_->ai_family, SOCK_DGRAM, 0);
+	if (fd_ == -1)
+	{
+		freeaddrinfo(info_);
+		info_ = 0;
+		throw ServerSetupException(strerror(errno));
+	}
+
+	if (pipe(wakeup_) == -1)
+	{
+		close(fd_);
+		freeaddrinfo(info_);
+		info_ = 0;
+		throw ServerSetupException(strerror(errno));
+	}
+}
+
+DatagramServer::~DatagramServer()
+{
+	if (info_)
+	{
+		freeaddrinfo(info_);
+		info_ = 0;
+	}
+	close(fd_);
+	close(wakeup_[0]);
+	close(wakeup_[1]);
+}
+
+DatagramServer*
+DatagramServer::SetBatchSize(size_t batch_size)
+{
+	batch_size_ = std::max<size_t>(batch_size, 1);
+	return this;
+}
+
+DatagramServer*
+DatagramServer::SetMaxDatagramSize(size_t size)
+{
+	max_datagram_size_ = size;
+	return this;
+}
+
+DatagramServer*
+DatagramServer::SetReceiveOffload(bool enable)
+{
+	receive_offload_ = enable;
+	return this;
+}
+
+DatagramServer*
+DatagramServer::SetSendOffload(bool enable)
+{
+	send_offload_ = enable;
+	return this;
+}
+
+DatagramServer*
+DatagramServer::SetSocketOptions(const SocketOptions& options)
+{
+	socket_options_ = options;
+	return this;
+}
+
+void
+DatagramServer::Execute(Closure* c)
+{
+	if (server_)
+		server_->Execute(c);
+	else
+		executor_->Add(c);
+}
+
+void
+DatagramServer::Shutdown()
+{
+	running_ = false;
+	if (write(wakeup_[1], "", 1) == -1)
+		datagram_errors.Add("wakeup: " + string(strerror(errno)), 1);
+}
+
+void
+DatagramServer::Deliver(std::vector<Datagram>* batch)
+{
+	ScopedPtr<std::vector<Datagram> > b(batch);
+	callback_->DatagramsReceived(this, *batch);
+}
+
+void
+DatagramServer::Listen()
+{
+	socket_options_.ApplyToListener(fd_);
+
+	if (receive_offload_)
+	{
+#ifdef UDP_GRO
+		int one = 1;
+		if (setsockopt(fd_, IPPROTO_UDP, UDP_GRO, &one,
+					sizeof(one)) == -1)
+		{
+			datagram_errors.Add("UDP_GRO", 1);
+			receive_offload_ = false;
+		}
+#else /* !UDP_GRO */
+		receive_offload_ = false;
+#endif /* UDP_GRO */
+	}
+
+	if (c_bind2addrinfo(fd_, info_))
+		throw ServerSetupException(strerror(errno));
+
+	// Coalesced datagrams can be as large as a datagram can get.
+	const size_t buffer_size = receive_offload_ ?
+		BufferPool::kLargeBufferSize : max_datagram_size_;
+#ifdef UDP_GRO
+	const size_t control_size = CMSG_SPACE(sizeof(int));
+#else /* !UDP_GRO */
+	const size_t control_size = 0;
+#endif /* UDP_GRO */
+
+	std::vector<std::unique_ptr<PooledBuffer> > buffers(batch_size_);
+	std::vector<struct mmsghdr> msgs(batch_size_);
+	std::vector<struct iovec> iovs(batch_size_);
+	std::vector<struct sockaddr_storage> addrs(batch_size_);
+	std::vector<char> control(batch_size_ * control_size + 1);
+
+	for (std::unique_ptr<PooledBuffer>& buf : buffers)
+		buf.reset(new PooledBuffer(buffer_size));
+
+	while (running_)
+	{
+		for (size_t i = 0; i < batch_size_; ++i)
+		{
+			struct msghdr* hdr = &msgs[i].msg_hdr;
+
+			memset(hdr, 0, sizeof(*hdr));
+			iovs[i].iov_base = buffers[i]->Get();
+			iovs[i].iov_len = buffer_size;
+			hdr->msg_name = &addrs[i];
+			hdr->msg_namelen = sizeof(addrs[i]);
+			hdr->msg_iov = &iovs[i];
+			hdr->msg_iovlen = 1;
+			if (control_size > 0)
+			{
+				hdr->msg_control = &control[i * control_size];
+				hdr->msg_controllen = control_size;
+			}
+		}
+
+		int n = ReceiveMessages(fd_, msgs.data(), batch_size_,
+				MSG_DONTWAIT);
+		if (n == -1)
+		{
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+			{
+				// Wait for more datagrams, or for Shutdown().
+				struct pollfd pfd[2];
+				pfd[0].fd = fd_;
+				pfd[0].events = POLLIN;
+				pfd[1].fd = wakeup_[0];
+				pfd[1].events = POLLIN;
+				if (poll(pfd, 2, -1) == -1 && errno != EINTR)
+					throw ServerSetupException("poll: " +
+						string(strerror(errno)));
+			}
+			else if (errno != EINTR)
+			{
+				// E.g. ICMP errors for datagrams sent earlier.
+				string errmsg = strerror(errno);
+				callback_->ReceiveFailed(errmsg);
+				datagram_errors.Add("recvmmsg: " + errmsg, 1);
+			}
+			continue;
+		}
+
+		std::vector<Datagram>* batch = new std::vector<Datagram>;
+		batch->reserve(n);
+		for (int i = 0; i < n; ++i)
+		{
+			struct msghdr* hdr = &msgs[i].msg_hdr;
+			size_t length = msgs[i].msg_len;
+
+			if (hdr->msg_flags & MSG_TRUNC)
+			{
+				// The buffer is reused for the next batch.
+				datagram_errors.Add("truncated", 1);
+				continue;
+			}
+
+			Buffer data(buffers[i].release(), length);
+			buffers[i].reset(new PooledBuffer(buffer_size));
+
+			size_t segment = OffloadSegmentSize(hdr);
+			if (segment == 0 || segment >= length)
+				batch->push_back(Datagram(data,
+						(struct sockaddr*) &addrs[i],
+						hdr->msg_namelen));
+			else
+				for (size_t off = 0; off < length;
+						off += segment)
+					batch->push_back(Datagram(
+						data.Slice(off, segment),
+						(struct sockaddr*) &addrs[i],
+						hdr->msg_namelen));
+		}
+
+		if (batch->empty())
+		{
+			delete batch;
+			continue;
+		}
+
+		datagrams_received.Add(batch->size());
+		Execute(google::protobuf::NewCallback(this,
+					&DatagramServer::Deliver, batch));
+	}
+}
+
+bool
+DatagramServer::Send(const Datagram& dgram)
+{
+	return SendBatch(&dgram, 1) == 1;
+}
+
+size_t
+DatagramServer::SendBatch(const std::vector<Datagram>& dgrams)
+{
+	return SendBatch(dgrams.data(), dgrams.size());
+}
+
+size_t
+DatagramServer::SendBatch(const Datagram* dgrams, size_t count)
+{
+	size_t sent = 0;
+
+	while (sent < count)
+	{
+		size_t n = SendSome(dgrams + sent, count - sent);
+		if (n == 0)
+			break;
+		sent += n;
+	}
+
+	datagrams_sent.Add(sent);
+	return sent;
+}
+
+size_t
+DatagramServer::SendSome(const Datagram* dgrams, size_t count)
+{
+#ifdef UDP_SEGMENT
+	const bool offload = send_offload_;
+	const size_t control_size = CMSG_SPACE(sizeof(uint16_t));
+#else /* !UDP_SEGMENT */
+	const bool offload = false;
+	const size_t control_size = 0;
+#endif /* UDP_SEGMENT */
+	struct mmsghdr msgs[kMaxSendMessages];
+	size_t covered[kMaxSendMessages];
+	size_t first_iov[kMaxSendMessages];
+	std::vector<struct iovec> iovs;
+	std::vector<char> control(kMaxSendMessages * control_size + 1);
+	size_t nmsgs = 0;
+	size_t i = 0;
+
+	memset(msgs, 0, sizeof(msgs));
+	while (i < count && nmsgs < kMaxSendMessages)
+	{
+		const Datagram& first = dgrams[i];
+		const size_t segment = first.data.Size();
+		size_t total = segment;
+		size_t n = 1;
+
+		// Datagrams of the same size to the same peer can be handed
+		// to the system in one go, which splits them up again. Only
+		// the last of them may be shorter.
+		if (offload && segment > 0)
+			while (i + n < count && n < kMaxOffloadSegments)
+			{
+				const Datagram& next = dgrams[i + n];
+				size_t size = next.data.Size();
+
+				if (size == 0 || size > segment ||
+						total + size > kMaxOffloadBytes ||
+						!SamePeer(first, next))
+					break;
+				total += size;
+				++n;
+				if (size < segment)
+					break;
+			}
+
+		size_t pieces = 0;
+		for (size_t j = 0; j < n; ++j)
+			pieces += dgrams[i + j].data.CountSegments();
+		if (nmsgs > 0 && iovs.size() + pieces > kMaxSendIOVecs)
+			break;
+
+		first_iov[nmsgs] = iovs.size();
+		for (size_t j = 0; j < n; ++j)
+		{
+			const Buffer& data = dgrams[i + j].data;
+			for (size_t k = 0; k < data.CountSegments(); ++k)
+			{
+				BufferView view = data.GetSegment(k);
+				struct iovec iov;
+				iov.iov_base = const_cast<char*>(view.data);
+				iov.iov_len = view.length;
+				iovs.push_back(iov);
+			}
+		}
+
+		struct msghdr* hdr = &msgs[nmsgs].msg_hdr;
+		hdr->msg_name = const_cast<struct sockaddr_storage*>(
+				&first.peer);
+		hdr->msg_namelen = first.peer_length;
+		hdr->msg_iovlen = iovs.size() - first_iov[nmsgs];
+#ifdef UDP_SEGMENT
+		if (n > 1)
+		{
+			uint16_t size = segment;
+
+			hdr->msg_control = &control[nmsgs * control_size];
+			hdr->msg_controllen = control_size;
+			struct cmsghdr* cmsg = CMSG_FIRSTHDR(hdr);
+			cmsg->cmsg_level = IPPROTO_UDP;
+			cmsg->cmsg_type = UDP_SEGMENT;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(size));
+			memcpy(CMSG_DATA(cmsg), &size, sizeof(size));
+		}
+#endif /* UDP_SEGMENT */
+
+		covered[nmsgs++] = n;
+		i += n;
+	}
+
+	// The vector is complete now, so its memory stays where it is.
+	for (size_t m = 0; m < nmsgs; ++m)
+		msgs[m].msg_hdr.msg_iov = iovs.data() + first_iov[m];
+
+	int sent;
+	do
+		sent = SendMessages(fd_, msgs, nmsgs, 0);
+	while (sent == -1 && errno == EINTR);
+
+	if (sent == -1)
+	{
+		int error = errno;
+
+		// Not all network devices can split up datagrams. In that
+		// case, we send them one by one from now on.
+		if (covered[0] > 1 && (error == EIO || error == EINVAL ||
+					error == EOPNOTSUPP))
+		{
+			datagram_errors.Add("UDP_SEGMENT", 1);
+			send_offload_ = false;
+			return SendSome(dgrams, count);
+		}
+
+		datagram_errors.Add("sendmmsg: " + string(strerror(error)), 1);
+		errno = error;
+		return 0;
+	}
+
+	size_t done = 0;
+	for (int m = 0; m < sent; ++m)
+		done += covered[m];
+	return done;
+}
+}  // namespace siot
+}  // namespace toolbox
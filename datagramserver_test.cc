@@ -0,0 +1,212 @@
+/**
+ * Tests for the datagram server.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <clib/clib.h>
+
+#include "siot/datagramserver.h"
+#include "siot/server.h"
+
+namespace toolbox
+{
+namespace siot
+{
+namespace testing
+{
+using threadpp::ClosureThread;
+using google::protobuf::NewCallback;
+
+// Answers every datagram with its contents.
+class EchoCallback : public DatagramCallback
+{
+public:
+	virtual void DatagramReceived(DatagramServer* server,
+			const Datagram& dgram)
+	{
+		server->Send(dgram.Reply(dgram.data));
+	}
+};
+
+// Answers each batch of datagrams with a single batch of replies.
+class BatchEchoCallback : public DatagramCallback
+{
+public:
+	BatchEchoCallback() : batches(0) {}
+
+	virtual void DatagramReceived(DatagramServer* server,
+			const Datagram& dgram)
+	{
+		ADD_FAILURE() << "Datagram not received as part of a batch";
+	}
+
+	virtual void DatagramsReceived(DatagramServer* server,
+			const std::vector<Datagram>& batch)
+	{
+		std::vector<Datagram> replies;
+
+		++batches;
+		for (const Datagram& dgram : batch)
+			replies.push_back(dgram.Reply(dgram.data));
+		EXPECT_EQ(replies.size(), server->SendBatch(replies));
+	}
+
+	std::atomic<int> batches;
+};
+
+class DatagramServerTest : public ::testing::Test
+{
+protected:
+	// Creates a UDP socket sending to "addr".
+	int Connect(const char* addr)
+	{
+		struct addrinfo *info;
+		int sock;
+
+		EXPECT_NE(-1, sock = socket(AF_INET6, SOCK_DGRAM, 0))
+			<< "Error creating socket: " << strerror(errno);
+		EXPECT_EQ(0, c_str2addrinfo(addr, &info))
+			<< "Error converting to addrinfo: " << strerror(errno);
+		EXPECT_EQ(0, connect(sock, info->ai_addr, info->ai_addrlen))
+			<< "Error connecting: " << strerror(errno);
+		freeaddrinfo(info);
+		return sock;
+	}
+
+	// Sends "data" on "sock" until the server answers, since it may not
+	// be listening yet, and returns the answer.
+	string Ping(int sock, const string& data)
+	{
+		char buf[2048];
+
+		for (int i = 0; i < 50; ++i)
+		{
+			struct pollfd pfd;
+
+			EXPECT_EQ((ssize_t) data.length(),
+					send(sock, data.data(), data.length(),
+						0))
+				<< "Error sending: " << strerror(errno);
+			pfd.fd = sock;
+			pfd.events = POLLIN;
+			if (poll(&pfd, 1, 100) == 1)
+			{
+				ssize_t len = recv(sock, buf, sizeof(buf), 0);
+				if (len >= 0)
+					return string(buf, len);
+			}
+
+			// Probably refused since the server isn't bound yet.
+			usleep(20000);
+		}
+		return "";
+	}
+};
+
+TEST_F(DatagramServerTest, Echo)
+{
+	ScopedPtr<DatagramServer> srv(0);
+
+	ASSERT_NO_THROW(srv.Reset(new DatagramServer("[::1]:12355",
+					new EchoCallback, 2)));
+
+	ClosureThread ct(NewCallback(srv.Get(), &DatagramServer::Listen));
+	ct.Start();
+
+	int sock = Connect("[::1]:12355");
+	EXPECT_EQ("Hello World", Ping(sock, "Hello World"));
+	EXPECT_EQ("", Ping(sock, ""));
+	close(sock);
+
+	srv->Shutdown();
+	ct.WaitForFinished();
+}
+
+TEST_F(DatagramServerTest, BatchWithOffload)
+{
+	ScopedPtr<DatagramServer> srv(0);
+	BatchEchoCallback* cb = new BatchEchoCallback;
+	char buf[2048];
+
+	ASSERT_NO_THROW(srv.Reset(new DatagramServer("[::1]:12356", cb, 1)));
+	srv->SetReceiveOffload(true)->SetSendOffload(true);
+
+	ClosureThread ct(NewCallback(srv.Get(), &DatagramServer::Listen));
+	ct.Start();
+
+	int sock = Connect("[::1]:12356");
+	EXPECT_EQ("ping", Ping(sock, "ping"));
+
+	// Equal sized datagrams can be coalesced on the way in and out, but
+	// must arrive one by one all the same. The last one is shorter.
+	for (int i = 0; i < 20; ++i)
+	{
+		string data(i < 19 ? 1000 : 10, 'a' + i);
+		EXPECT_EQ((ssize_t) data.length(),
+				send(sock, data.data(), data.length(), 0));
+	}
+
+	for (int i = 0; i < 20; ++i)
+	{
+		struct pollfd pfd;
+		pfd.fd = sock;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, 5000) != 1)
+		{
+			ADD_FAILURE() << "Reply " << i << " lost";
+			break;
+		}
+
+		ssize_t len = recv(sock, buf, sizeof(buf), 0);
+		EXPECT_EQ(i < 19 ? 1000 : 10, len);
+		EXPECT_EQ(string(len, 'a' + i), string(buf, len));
+	}
+	EXPECT_GE(cb->batches, 2);
+	close(sock);
+
+	srv->Shutdown();
+	ct.WaitForFinished();
+}
+
+TEST_F(DatagramServerTest, Truncated)
+{
+	ScopedPtr<DatagramServer> srv(0);
+
+	ASSERT_NO_THROW(srv.Reset(new DatagramServer("[::1]:12357",
+					new EchoCallback, 1)));
+	srv->SetMaxDatagramSize(16);
+
+	ClosureThread ct(NewCallback(srv.Get(), &DatagramServer::Listen));
+	ct.Start();
+
+	int sock = Connect("[::1]:12357");
+	EXPECT_EQ("short", Ping(sock, "short"));
+
+	// Datagrams which don't fit are dropped rather than cut short.
+	string data(100, 'x');
+	EXPECT_EQ(100, send(sock, data.data(), data.length(), 0));
+	EXPECT_EQ("next", Ping(sock, "next"));
+	close(sock);
+
+	srv->Shutdown();
+	ct.WaitForFinished();
+}
+}  // namespace testing
+}  // namespace siot
+}  // namespace toolbox
@@ -0,0 +1,150 @@
+/*-
+ * Copyright (c) 2026 Caoimhe Chaos <caoimhechaos@protonmail.com>,
+ *                    Ancient Solutions. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions  of source code must retain  the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions  in   binary  form  must   reproduce  the  above
+ *    copyright  notice, this  list  of conditions  and the  following
+ *    disclaimer in the  documentation and/or other materials provided
+ *    with the distribution.
+ *
+ * THIS  SOFTWARE IS  PROVIDED BY  ANCIENT SOLUTIONS  AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO,  THE IMPLIED WARRANTIES OF  MERCHANTABILITY AND FITNESS
+ * FOR A  PARTICULAR PURPOSE  ARE DISCLAIMED.  IN  NO EVENT  SHALL THE
+ * FOUNDATION  OR CONTRIBUTORS  BE  LIABLE FOR  ANY DIRECT,  INDIRECT,
+ * INCIDENTAL,   SPECIAL,    EXEMPLARY,   OR   CONSEQUENTIAL   DAMAGES
+ * (INCLUDING, BUT NOT LIMITED  TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE,  DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT  LIABILITY,  OR  TORT  (INCLUDING NEGLIGENCE  OR  OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <chrono>
+#include <set>
+#include <string>
+
+#include <toolbox/expvar.h>
+#include <thread++/mutex.h>
+
+#include "fairscheduler.h"
+
+namespace toolbox
+{
+namespace siot
+{
+using threadpp::Mutex;
+using threadpp::MutexLock;
+
+static ExpMap<int64_t> class_queue_depth("siot-scheduler-queue-depth");
+static ExpMap<int64_t> class_wait_time("siot-scheduler-wait-time-usec");
+static ExpMap<int64_t> class_dispatched("siot-scheduler-dispatched");
+
+FairScheduler::SchedulingClass::SchedulingClass()
+: weight(1), deficit(0)
+{
+}
+
+FairScheduler::FairScheduler()
+: mtx_(Mutex::Create())
+{
+}
+
+FairScheduler::~FairScheduler()
+{
+}
+
+void
+FairScheduler::Add(const string& cls, uint32_t weight, Closure* c)
+{
+	Task t;
+	t.closure = c;
+	t.queued = std::chrono::steady_clock::now();
+
+	MutexLock l(mtx_.Get());
+	SchedulingClass& sc = classes_[cls];
+
+	sc.weight = weight > 0 ? weight : 1;
+	if (sc.tasks.empty())
+		active_.push_back(cls);
+	sc.tasks.push_back(t);
+	class_queue_depth.Add(cls, 1);
+}
+
+void
+FairScheduler::RunNext()
+{
+	Task t;
+	string cls;
+
+	{
+		MutexLock l(mtx_.Get());
+
+		if (active_.empty())
+			return;
+
+		cls = active_.front();
+		SchedulingClass& sc = classes_[cls];
+
+		// Start of a new turn for this class.
+		if (sc.deficit == 0)
+			sc.deficit = sc.weight;
+
+		t = sc.tasks.front();
+		sc.tasks.pop_front();
+		--sc.deficit;
+
+		if (sc.tasks.empty())
+		{
+			// Classes don't get to save up their turn.
+			sc.deficit = 0;
+			active_.pop_front();
+		}
+		else if (sc.deficit == 0)
+		{
+			// Turn's over, move to the back of the line.
+			active_.pop_front();
+			active_.push_back(cls);
+		}
+	}
+
+	class_queue_depth.Add(cls, -1);
+	class_dispatched.Add(cls, 1);
+	class_wait_time.Add(cls,
+			std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::steady_clock::now() -
+				t.queued).count());
+
+	t.closure->Run();
+}
+
+const string*
+FairScheduler::Intern(const string& cls)
+{
+	// Never destroyed, connections may still be shut down during exit.
+	static Mutex* mtx = Mutex::Create();
+	static std::set<string>* names = new std::set<string>;
+	MutexLock l(mtx);
+
+	return &*names->insert(cls).first;
+}
+
+size_t
+FairScheduler::GetQueueDepth(const string& cls)
+{
+	MutexLock l(mtx_.Get());
+	std::map<string, SchedulingClass>::iterator it = classes_.find(cls);
+
+	if (it == classes_.end())
+		return 0;
+	return it->second.tasks.size();
+}
+}  // namespace siot
+}  // namespace toolbox
@@ -0,0 +1,103 @@
+/*-
+ * Copyright (c) 2026 Caoimhe Chaos <caoimhechaos@protonmail.com>,
+ *                    Ancient Solutions. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions  of source code must retain  the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions  in   binary  form  must   reproduce  the  above
+ *    copyright  notice, this  list  of conditions  and the  following
+ *    disclaimer in the  documentation and/or other materials provided
+ *    with the distribution.
+ *
+ * THIS  SOFTWARE IS  PROVIDED BY  ANCIENT SOLUTIONS  AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO,  THE IMPLIED WARRANTIES OF  MERCHANTABILITY AND FITNESS
+ * FOR A  PARTICULAR PURPOSE  ARE DISCLAIMED.  IN  NO EVENT  SHALL THE
+ * FOUNDATION  OR CONTRIBUTORS  BE  LIABLE FOR  ANY DIRECT,  INDIRECT,
+ * INCIDENTAL,   SPECIAL,    EXEMPLARY,   OR   CONSEQUENTIAL   DAMAGES
+ * (INCLUDING, BUT NOT LIMITED  TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE,  DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT  LIABILITY,  OR  TORT  (INCLUDING NEGLIGENCE  OR  OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INCLUDED_FAIRSCHEDULER_H
+#define INCLUDED_FAIRSCHEDULER_H 1
+
+#include <chrono>
+#include <deque>
+#include <list>
+#include <map>
+#include <string>
+
+#include <google/protobuf/stubs/common.h>
+#include <thread++/mutex.h>
+#include <toolbox/scopedptr.h>
+
+namespace toolbox
+{
+namespace siot
+{
+using google::protobuf::Closure;
+using std::string;
+
+// Distributes the callbacks of a server across the scheduling classes of
+// their connections using deficit round robin. Every class gets to run up
+// to "weight" callbacks in a row before the next class gets its turn, so
+// classes with a higher weight get a proportionally larger share of the
+// worker threads.
+class FairScheduler
+{
+public:
+	FairScheduler();
+	virtual ~FairScheduler();
+
+	// Queues the closure "c" in the scheduling class "cls", which is
+	// set to have the weight "weight". A weight of 0 is treated as 1.
+	void Add(const string& cls, uint32_t weight, Closure* c);
+
+	// Runs the next closure which is due according to the scheduling
+	// policy. This should be invoked once per closure added, typically
+	// from a worker thread.
+	void RunNext();
+
+	// Returns the number of closures waiting in the class "cls".
+	size_t GetQueueDepth(const string& cls);
+
+	// Returns the single copy of the class name "cls" shared by all
+	// connections in that class. The copies are kept for the lifetime of
+	// the process, so they can be referred to without any locking.
+	static const string* Intern(const string& cls);
+
+private:
+	struct Task
+	{
+		Closure* closure;
+		std::chrono::steady_clock::time_point queued;
+	};
+
+	struct SchedulingClass
+	{
+		SchedulingClass();
+
+		std::deque<Task> tasks;
+		uint32_t weight;
+		uint32_t deficit;
+	};
+
+	ScopedPtr<threadpp::Mutex> mtx_;
+	std::map<string, SchedulingClass> classes_;
+
+	// Names of all classes with pending tasks, in round robin order.
+	std::list<string> active_;
+};
+}  // namespace siot
+}  // namespace toolbox
+
+#endif /* INCLUDED_FAIRSCHEDULER_H */
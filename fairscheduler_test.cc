@@ -0,0 +1,103 @@
+/**
+ * Tests for the scheduler distributing callbacks across connection classes.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <google/protobuf/stubs/common.h>
+
+#include "fairscheduler.h"
+
+namespace toolbox
+{
+namespace siot
+{
+namespace testing
+{
+using google::protobuf::NewCallback;
+using std::string;
+
+static void
+Record(string* order, char c)
+{
+	*order += c;
+}
+
+class FairSchedulerTest : public ::testing::Test
+{
+};
+
+TEST_F(FairSchedulerTest, SingleClassIsFIFO)
+{
+	FairScheduler sched;
+	string order;
+
+	sched.Add("", 1, NewCallback(&Record, &order, 'a'));
+	sched.Add("", 1, NewCallback(&Record, &order, 'b'));
+	sched.Add("", 1, NewCallback(&Record, &order, 'c'));
+	EXPECT_EQ(3, sched.GetQueueDepth(""));
+
+	for (int i = 0; i < 3; ++i)
+		sched.RunNext();
+
+	EXPECT_EQ("abc", order);
+	EXPECT_EQ(0, sched.GetQueueDepth(""));
+
+	// Running with nothing queued is harmless.
+	sched.RunNext();
+	EXPECT_EQ("abc", order);
+}
+
+TEST_F(FairSchedulerTest, WeightedRoundRobin)
+{
+	FairScheduler sched;
+	string order;
+
+	for (int i = 0; i < 4; ++i)
+		sched.Add("bulk", 1, NewCallback(&Record, &order, 'b'));
+	for (int i = 0; i < 4; ++i)
+		sched.Add("interactive", 3, NewCallback(&Record, &order, 'i'));
+
+	EXPECT_EQ(4, sched.GetQueueDepth("bulk"));
+	EXPECT_EQ(4, sched.GetQueueDepth("interactive"));
+	EXPECT_EQ(0, sched.GetQueueDepth("unknown"));
+
+	for (int i = 0; i < 8; ++i)
+		sched.RunNext();
+
+	EXPECT_EQ("biiibibb", order);
+}
+
+TEST_F(FairSchedulerTest, IdleClassDoesNotSaveUp)
+{
+	FairScheduler sched;
+	string order;
+
+	sched.Add("interactive", 3, NewCallback(&Record, &order, 'i'));
+	sched.RunNext();
+
+	for (int i = 0; i < 3; ++i)
+		sched.Add("bulk", 1, NewCallback(&Record, &order, 'b'));
+	for (int i = 0; i < 3; ++i)
+		sched.Add("interactive", 3, NewCallback(&Record, &order, 'i'));
+
+	for (int i = 0; i < 6; ++i)
+		sched.RunNext();
+
+	EXPECT_EQ("ibiiibb", order);
+}
+
+TEST_F(FairSchedulerTest, Intern)
+{
+	const string* bulk = FairScheduler::Intern("bulk");
+
+	EXPECT_EQ("bulk", *bulk);
+	EXPECT_EQ(bulk, FairScheduler::Intern(string("bu") + "lk"));
+	EXPECT_NE(bulk, FairScheduler::Intern("interactive"));
+}
+
+}  // namespace testing
+}  // namespace siot
+}  // namespace toolbox
@@ -47,43 +47,109 @@ LineBufferDecorator::~LineBufferDecorator()
 {
 }
 
+bool
+LineBufferDecorator::NextLine(Buffer* line, IOResult* result)
+{
+	size_t pos;
+	char cr;
+
+	while ((pos = remainder_.Find('\n')) == Buffer::npos &&
+			!wrapped_->IsEOF())
+	{
+		Buffer data;
+
+		if (result)
+			*result = wrapped_->TryReceiveBuffer(&data);
+		else
+			data = wrapped_->ReceiveBuffer();
+		if (data.IsEmpty())
+			break;
+		remainder_.Append(data);
+	}
+
+	// Still haven't found anything? Then we should give up. Either we're
+	// at the end, then IsEOF() will be set, or we'll be more lucky in the
+	// next round.
+	if (pos == Buffer::npos)
+		return false;
+
+	if (pos > 0 && remainder_.CopyTo(&cr, 1, pos - 1) == 1 && cr == '\r')
+	{
+		*line = remainder_.Slice(0, pos - 1);
+		line->Append(Buffer("\n", 1));
+	}
+	else
+		*line = remainder_.Slice(0, pos + 1);
+
+	remainder_ = remainder_.Slice(pos + 1);
+	return true;
+}
+
 string
 LineBufferDecorator::Receive(size_t ignored, int flags)
 {
-	if (remaining_lines_.size() == 0)
+	return ReceiveBuffer(ignored, flags).AsString();
+}
+
+Buffer
+LineBufferDecorator::ReceiveBuffer(size_t ignored, int flags)
+{
+	Buffer line;
+
+	if (!partial_.IsEmpty())
+		line = std::move(partial_);
+	else
+		NextLine(&line);
+	return line;
+}
+
+ssize_t
+LineBufferDecorator::ReceiveInto(char* buf, size_t len, int flags)
+{
+	if (len == 0 || (partial_.IsEmpty() && !NextLine(&partial_)))
+		return 0;
+
+	// Whatever doesn't fit is returned by the next call.
+	len = partial_.CopyTo(buf, len);
+	partial_ = partial_.Slice(len);
+	return len;
+}
+
+IOResult
+LineBufferDecorator::TryReceiveBuffer(Buffer* data, size_t ignored,
+		int flags)
+{
+	IOResult result(kIOWouldBlock);
+
+	if (!partial_.IsEmpty())
+		*data = std::move(partial_);
+	else if (!NextLine(data, &result))
+		*data = Buffer();
+
+	if (!data->IsEmpty())
+		return IOResult(kIOOk, data->Size());
+	if (result.status == kIOError)
+		return result;
+	return IOResult(IsEOF() ? kIOClosed : kIOWouldBlock);
+}
+
+IOResult
+LineBufferDecorator::TryReceiveInto(char* buf, size_t len, int flags)
+{
+	IOResult result(kIOWouldBlock);
+
+	if (len == 0)
+		return IOResult();
+	if (partial_.IsEmpty() && !NextLine(&partial_, &result))
 	{
-		while (remainder_.rfind("\n") == string::npos &&
-				!wrapped_->IsEOF())
-		{
-			string data = wrapped_->Receive();
-			if (data.length() > 0)
-				remainder_ += data;
-			else
-				break;
-		}
-
-		string::size_type sz;
-		while ((sz = remainder_.find("\n")) != string::npos)
-		{
-			if (remainder_[sz-1] == '\r')
-				remaining_lines_.push_back(
-						remainder_.substr(0, sz-1));
-			else
-				remaining_lines_.push_back(
-						remainder_.substr(0, sz));
-			remainder_ = remainder_.substr(sz + 1);
-		}
-
-		// Still haven't found anything? Then we should give up.
-		// Either we're at the end, then IsEOF() will be set, or
-		// we'll be more lucky in the next round.
-		if (remaining_lines_.size() == 0)
-			return "";
+		if (result.status == kIOError)
+			return result;
+		return IOResult(IsEOF() ? kIOClosed : kIOWouldBlock);
 	}
 
-	string ret = remaining_lines_.front();
-	remaining_lines_.pop_front();
-	return ret + "\n";
+	len = partial_.CopyTo(buf, len);
+	partial_ = partial_.Slice(len);
+	return IOResult(kIOOk, len);
 }
 
 ssize_t
@@ -92,6 +158,38 @@ LineBufferDecorator::Send(string data, int flags)
 	return wrapped_->Send(data, flags);
 }
 
+ssize_t
+LineBufferDecorator::SendVector(const BufferView* views, size_t count, int flags)
+{
+	return wrapped_->SendVector(views, count, flags);
+}
+
+ssize_t
+LineBufferDecorator::SendBuffer(const Buffer& data, int flags)
+{
+	return wrapped_->SendBuffer(data, flags);
+}
+
+IOResult
+LineBufferDecorator::TrySendVector(const BufferView* views, size_t count,
+		int flags)
+{
+	return wrapped_->TrySendVector(views, count, flags);
+}
+
+ssize_t
+LineBufferDecorator::SendZeroCopy(const char* data, size_t len,
+		google::protobuf::Closure* release, int flags)
+{
+	return wrapped_->SendZeroCopy(data, len, release, flags);
+}
+
+ssize_t
+LineBufferDecorator::SendFile(int fd, off_t offset, size_t len)
+{
+	return wrapped_->SendFile(fd, offset, len);
+}
+
 string
 LineBufferDecorator::PeerAsText()
 {
@@ -107,7 +205,8 @@ LineBufferDecorator::GetServer()
 bool
 LineBufferDecorator::IsEOF()
 {
-	return wrapped_->IsEOF() && remaining_lines_.size() == 0;
+	return wrapped_->IsEOF() && partial_.IsEmpty() &&
+		remainder_.Find('\n') == Buffer::npos;
 }
 
 uint64_t
@@ -122,6 +221,90 @@ LineBufferDecorator::SetBlocking(bool blocking)
 	wrapped_->SetBlocking(blocking);
 }
 
+void
+LineBufferDecorator::SetWriteQueue(size_t low_watermark, size_t high_watermark)
+{
+	wrapped_->SetWriteQueue(low_watermark, high_watermark);
+}
+
+size_t
+LineBufferDecorator::GetWriteQueueSize()
+{
+	return wrapped_->GetWriteQueueSize();
+}
+
+void
+LineBufferDecorator::FlushWriteQueue()
+{
+	wrapped_->FlushWriteQueue();
+}
+
+void
+LineBufferDecorator::SetZeroCopyThreshold(size_t threshold)
+{
+	wrapped_->SetZeroCopyThreshold(threshold);
+}
+
+bool
+LineBufferDecorator::ProcessErrorQueue()
+{
+	return wrapped_->ProcessErrorQueue();
+}
+
+void
+LineBufferDecorator::ApplySocketOptions(const SocketOptions& options)
+{
+	wrapped_->ApplySocketOptions(options);
+}
+
+void
+LineBufferDecorator::SetSchedulingClass(const string& cls, uint32_t weight)
+{
+	wrapped_->SetSchedulingClass(cls, weight);
+}
+
+const string&
+LineBufferDecorator::GetSchedulingClass()
+{
+	return wrapped_->GetSchedulingClass();
+}
+
+uint32_t
+LineBufferDecorator::GetSchedulingWeight()
+{
+	return wrapped_->GetSchedulingWeight();
+}
+
+int
+LineBufferDecorator::GetIncomingCPU()
+{
+	return wrapped_->GetIncomingCPU();
+}
+
+void
+LineBufferDecorator::SetWorkerShard(int shard)
+{
+	wrapped_->SetWorkerShard(shard);
+}
+
+int
+LineBufferDecorator::GetWorkerShard()
+{
+	return wrapped_->GetWorkerShard();
+}
+
+void
+LineBufferDecorator::SetListener(int listener)
+{
+	wrapped_->SetListener(listener);
+}
+
+int
+LineBufferDecorator::GetListener()
+{
+	return wrapped_->GetListener();
+}
+
 void
 LineBufferDecorator::Shutdown()
 {
@@ -138,7 +321,7 @@ LineBufferDecorator::Shutdown()
 bool
 LineBufferDecorator::IsShutdown()
 {
-	return wrapped_->IsShutdown();
+	return Connection::IsShutdown() || wrapped_->IsShutdown();
 }
 
 }  // namespace siot
@@ -21,6 +21,7 @@ namespace siot
 namespace testing
 {
 using ::testing::Return;
+using ::testing::_;
 
 class MockConnection : public Connection
 {
@@ -91,6 +92,85 @@ TEST_F(LineBufferDecoratorTest, MultiLineOnePacket)
 	EXPECT_EQ("", lb.Receive());
 }
 
+TEST_F(LineBufferDecoratorTest, SendVector)
+{
+	MockConnection mc;
+	LineBufferDecorator lb(&mc);
+	string greeting("hello ");
+	BufferView views[] = { greeting, BufferView("world\n", 6) };
+
+	EXPECT_CALL(mc, Send("hello world\n", 0))
+		.WillOnce(Return(12));
+
+	EXPECT_EQ(12, lb.SendVector(views, 2));
+}
+
+TEST_F(LineBufferDecoratorTest, ReceiveInto)
+{
+	MockConnection mc;
+	LineBufferDecorator lb(&mc);
+	char buf[8];
+
+	EXPECT_CALL(mc, Receive(-1, 0))
+		.WillOnce(Return("hello world\nHi!\r\n"));
+	EXPECT_CALL(mc, IsEOF())
+		.WillOnce(Return(false));
+
+	EXPECT_EQ(8, lb.ReceiveInto(buf, sizeof(buf)));
+	EXPECT_EQ("hello wo", string(buf, 8));
+	EXPECT_EQ(4, lb.ReceiveInto(buf, sizeof(buf)));
+	EXPECT_EQ("rld\n", string(buf, 4));
+	EXPECT_EQ(4, lb.ReceiveInto(buf, sizeof(buf)));
+	EXPECT_EQ("Hi!\n", string(buf, 4));
+}
+
+TEST_F(LineBufferDecoratorTest, ReceiveBuffer)
+{
+	MockConnection mc;
+	LineBufferDecorator lb(&mc);
+
+	EXPECT_CALL(mc, Receive(-1, 0))
+		.WillOnce(Return("hello "))
+		.WillOnce(Return("world\r\nHow's life?\n"));
+	EXPECT_CALL(mc, IsEOF())
+		.WillRepeatedly(Return(false));
+
+	// A line spanning two reads.
+	Buffer line = lb.ReceiveBuffer();
+	EXPECT_EQ("hello world\n", line.AsString());
+	EXPECT_EQ(3, line.CountSegments());
+
+	EXPECT_EQ("How's life?\n", lb.ReceiveBuffer().AsString());
+}
+
+TEST_F(LineBufferDecoratorTest, TryReceive)
+{
+	MockConnection mc;
+	LineBufferDecorator lb(&mc);
+	Buffer line;
+
+	EXPECT_CALL(mc, Receive(_, MSG_DONTWAIT))
+		.WillOnce(Return("hello world\nHow's"))
+		.WillOnce(Return(""))
+		.WillOnce(Return(" life?\n"));
+	EXPECT_CALL(mc, IsEOF())
+		.WillRepeatedly(Return(false));
+
+	IOResult result = lb.TryReceiveBuffer(&line);
+	EXPECT_EQ(kIOOk, result.status);
+	EXPECT_EQ(12, result.length);
+	EXPECT_EQ("hello world\n", line.AsString());
+
+	// Half a line isn't enough.
+	result = lb.TryReceiveBuffer(&line);
+	EXPECT_EQ(kIOWouldBlock, result.status);
+	EXPECT_TRUE(line.IsEmpty());
+
+	result = lb.TryReceiveBuffer(&line);
+	EXPECT_EQ(kIOOk, result.status);
+	EXPECT_EQ("How's life?\n", line.AsString());
+}
+
 }  // namespace testing
 }  // namespace siot
 }  // namespace toolbox
@@ -0,0 +1,421 @@
+/*-
+ * Copyright (c) 2026 Caoimhe Chaos <caoimhechaos@protonmail.com>,
+ *                    Ancient Solutions. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions  of source code must retain  the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions  in   binary  form  must   reproduce  the  above
+ *    copyright  notice, this  list  of conditions  and the  following
+ *    disclaimer in the  documentation and/or other materials provided
+ *    with the distribution.
+ *
+ * THIS  SOFTWARE IS  PROVIDED BY  ANCIENT SOLUTIONS  AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO,  THE IMPLIED WARRANTIES OF  MERCHANTABILITY AND FITNESS
+ * FOR A  PARTICULAR PURPOSE  ARE DISCLAIMED.  IN  NO EVENT  SHALL THE
+ * FOUNDATION  OR CONTRIBUTORS  BE  LIABLE FOR  ANY DIRECT,  INDIRECT,
+ * INCIDENTAL,   SPECIAL,    EXEMPLARY,   OR   CONSEQUENTIAL   DAMAGES
+ * (INCLUDING, BUT NOT LIMITED  TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE,  DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT  LIABILITY,  OR  TORT  (INCLUDING NEGLIGENCE  OR  OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif /* HAVE_SYS_TYPES_H */
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif /* HAVE_SYS_SOCKET_H */
+#ifdef HAVE_SYS_ERRNO_H
+#include <sys/errno.h>
+#endif /* HAVE_SYS_ERRNO_H */
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif /* HAVE_ERRNO_H */
+
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include "siot/bufferpool.h"
+#include "siot/loopbackconnection.h"
+#include "siot/server.h"
+
+namespace toolbox
+{
+namespace siot
+{
+// Data sent to one end which hasn't been received yet.
+struct LoopbackRing
+{
+	std::vector<char> data;
+	size_t head;
+	size_t size;
+};
+
+struct LoopbackConnection::Channel
+{
+	explicit Channel(size_t capacity);
+
+	std::mutex mtx;
+	std::condition_variable cv;
+
+	// Number of threads waiting for "cv", so it only has to be signalled
+	// if someone is actually waiting.
+	int waiting;
+
+	// Everything below is indexed by the side of the end it belongs to:
+	// the data sent to it, whether it has been shut down, whether its
+	// server has been told that the peer went away, and the server it
+	// is part of.
+	LoopbackRing rings[2];
+	bool closed[2];
+	bool hung_up[2];
+	Server* servers[2];
+	int ids[2];
+};
+
+LoopbackConnection::Channel::Channel(size_t capacity)
+: waiting(0)
+{
+	for (int i = 0; i < 2; ++i)
+	{
+		rings[i].data.resize(capacity > 0 ? capacity : 1);
+		rings[i].head = 0;
+		rings[i].size = 0;
+		closed[i] = false;
+		hung_up[i] = false;
+		servers[i] = 0;
+		ids[i] = 0;
+	}
+}
+
+void
+LoopbackConnection::CreatePair(LoopbackConnection** one,
+		LoopbackConnection** two, size_t capacity)
+{
+	std::shared_ptr<Channel> channel(new Channel(capacity));
+
+	*one = new LoopbackConnection(channel, 0);
+	*two = new LoopbackConnection(channel, 1);
+}
+
+LoopbackConnection::LoopbackConnection(
+		const std::shared_ptr<Channel>& channel, int side)
+: channel_(channel), side_(side), server_(0), blocking_(true), eof_(false),
+	last_use_(time(NULL))
+{
+}
+
+LoopbackConnection::~LoopbackConnection()
+{
+}
+
+bool
+LoopbackConnection::Attach(Server* server, int id)
+{
+	std::lock_guard<std::mutex> l(channel_->mtx);
+
+	server_ = server;
+	blocking_ = false;
+	channel_->servers[side_] = server;
+	channel_->ids[side_] = id;
+	return channel_->rings[side_].size > 0 || channel_->closed[1 - side_];
+}
+
+ssize_t
+LoopbackConnection::Read(char* buf, size_t len, bool wait)
+{
+	Server* hang_up = 0;
+	int id = 0;
+	ssize_t ret;
+
+	last_use_ = time(NULL);
+	{
+		std::unique_lock<std::mutex> l(channel_->mtx);
+		LoopbackRing& ring = channel_->rings[side_];
+
+		while (ring.size == 0 && !channel_->closed[1 - side_] && wait)
+		{
+			++channel_->waiting;
+			channel_->cv.wait(l);
+			--channel_->waiting;
+		}
+
+		if (ring.size == 0 && channel_->closed[1 - side_])
+		{
+			// Everything has been read, so the peer is gone for
+			// good now. The server only has to hear about it once.
+			eof_ = true;
+			if (!channel_->hung_up[side_])
+			{
+				channel_->hung_up[side_] = true;
+				hang_up = channel_->servers[side_];
+				id = channel_->ids[side_];
+			}
+			ret = 0;
+		}
+		else if (ring.size == 0)
+		{
+			errno = EAGAIN;
+			return -1;
+		}
+		else
+		{
+			const size_t capacity = ring.data.size();
+			size_t n = std::min(len, ring.size);
+			size_t first = std::min(n, capacity - ring.head);
+
+			memcpy(buf, &ring.data[ring.head], first);
+			memcpy(buf + first, &ring.data[0], n - first);
+			ring.head = (ring.head + n) % capacity;
+			ring.size -= n;
+
+			if (channel_->waiting > 0)
+				channel_->cv.notify_all();
+			ret = n;
+		}
+	}
+
+	if (hang_up)
+		hang_up->NotifyHangUp(id);
+	return ret;
+}
+
+ssize_t
+LoopbackConnection::Write(const BufferView* views, size_t count, bool wait)
+{
+	const int peer = 1 - side_;
+	ssize_t total = 0;
+	size_t offset = 0;
+
+	last_use_ = time(NULL);
+	while (count > 0)
+	{
+		Server* notify = 0;
+		int id = 0;
+
+		// "offset" is how much of the first piece was already sent.
+		if (offset == views[0].length)
+		{
+			++views;
+			--count;
+			offset = 0;
+			continue;
+		}
+
+		{
+			std::unique_lock<std::mutex> l(channel_->mtx);
+			LoopbackRing& ring = channel_->rings[peer];
+			const size_t capacity = ring.data.size();
+
+			while (ring.size == capacity && !channel_->closed[peer] &&
+					wait)
+			{
+				++channel_->waiting;
+				channel_->cv.wait(l);
+				--channel_->waiting;
+			}
+
+			if (channel_->closed[peer])
+			{
+				if (total > 0)
+					break;
+				errno = EPIPE;
+				return -1;
+			}
+			if (ring.size == capacity)
+				break;
+
+			// The server is only told when data arrives on an
+			// empty ring; until the ring is drained, the reader
+			// still knows there's more.
+			if (ring.size == 0 && channel_->servers[peer])
+			{
+				notify = channel_->servers[peer];
+				id = channel_->ids[peer];
+			}
+
+			while (count > 0 && ring.size < capacity)
+			{
+				size_t tail = (ring.head + ring.size) % capacity;
+				size_t n = std::min(views[0].length - offset,
+						capacity - ring.size);
+				size_t first = std::min(n, capacity - tail);
+
+				memcpy(&ring.data[tail], views[0].data + offset,
+						first);
+				memcpy(&ring.data[0], views[0].data + offset +
+						first, n - first);
+				ring.size += n;
+				offset += n;
+				total += n;
+
+				if (offset == views[0].length)
+				{
+					++views;
+					--count;
+					offset = 0;
+				}
+			}
+
+			if (channel_->waiting > 0)
+				channel_->cv.notify_all();
+		}
+
+		if (notify)
+			notify->NotifyReadable(id);
+	}
+
+	if (total == 0 && count > 0)
+	{
+		errno = EAGAIN;
+		return -1;
+	}
+	return total;
+}
+
+string
+LoopbackConnection::Receive(size_t maxlen, int flags)
+{
+	if (maxlen <= 0 || maxlen > BufferPool::kLargeBufferSize)
+		maxlen = BufferPool::kLargeBufferSize;
+
+	PooledBuffer buf(maxlen);
+	ssize_t len = ReceiveInto(buf.Get(), maxlen, flags);
+
+	return string(buf.Get(), len > 0 ? len : 0);
+}
+
+ssize_t
+LoopbackConnection::ReceiveInto(char* buf, size_t len, int flags)
+{
+	return Read(buf, len, blocking_ && !(flags & MSG_DONTWAIT));
+}
+
+IOResult
+LoopbackConnection::TryReceiveInto(char* buf, size_t len, int flags)
+{
+	ssize_t ret = Read(buf, len, false);
+
+	if (ret > 0)
+		return IOResult(kIOOk, ret);
+	if (ret == 0)
+		return IOResult(len > 0 ? kIOClosed : kIOOk);
+	return IOResult(kIOWouldBlock);
+}
+
+ssize_t
+LoopbackConnection::Send(string data, int flags)
+{
+	BufferView view(data);
+	return SendVector(&view, 1, flags);
+}
+
+ssize_t
+LoopbackConnection::SendVector(const BufferView* views, size_t count,
+		int flags)
+{
+	return Write(views, count, !(flags & MSG_DONTWAIT));
+}
+
+IOResult
+LoopbackConnection::TrySendVector(const BufferView* views, size_t count,
+		int flags)
+{
+	ssize_t ret = Write(views, count, false);
+
+	if (ret >= 0)
+		return IOResult(kIOOk, ret);
+	if (errno == EPIPE)
+		return IOResult(kIOClosed);
+	return IOResult(kIOWouldBlock);
+}
+
+string
+LoopbackConnection::PeerAsText()
+{
+	return "loopback";
+}
+
+Server*
+LoopbackConnection::GetServer()
+{
+	return server_;
+}
+
+bool
+LoopbackConnection::IsEOF()
+{
+	return eof_;
+}
+
+uint64_t
+LoopbackConnection::GetLastUse()
+{
+	return last_use_;
+}
+
+void
+LoopbackConnection::SetBlocking(bool blocking)
+{
+	blocking_ = blocking;
+}
+
+void
+LoopbackConnection::Shutdown()
+{
+	const int peer = 1 - side_;
+	Server* notify = 0;
+	bool pending;
+	int id = 0;
+
+	eof_ = true;
+	Deregister();
+
+	// Ensure we're the only ones operating on the connection.
+	Lock();
+	{
+		std::lock_guard<std::mutex> l(channel_->mtx);
+
+		channel_->closed[side_] = true;
+		channel_->servers[side_] = 0;
+		if (channel_->waiting > 0)
+			channel_->cv.notify_all();
+
+		// If the peer still has data to read, it finds out about us
+		// being gone once it has read it.
+		pending = channel_->rings[peer].size > 0;
+		if (!channel_->hung_up[peer] && channel_->servers[peer])
+		{
+			notify = channel_->servers[peer];
+			id = channel_->ids[peer];
+			if (!pending)
+				channel_->hung_up[peer] = true;
+		}
+	}
+
+	if (notify && pending)
+		notify->NotifyReadable(id);
+	else if (notify)
+		notify->NotifyHangUp(id);
+
+	delete this;
+}
+}  // namespace siot
+}  // namespace toolbox
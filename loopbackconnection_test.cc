@@ -0,0 +1,155 @@
+/**
+ * Tests for the in-memory loopback connection.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <string>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "siot/loopbackconnection.h"
+
+namespace toolbox
+{
+namespace siot
+{
+namespace testing
+{
+class LoopbackConnectionTest : public ::testing::Test
+{
+};
+
+TEST_F(LoopbackConnectionTest, ReadWrite)
+{
+	LoopbackConnection* one;
+	LoopbackConnection* two;
+
+	LoopbackConnection::CreatePair(&one, &two);
+
+	EXPECT_EQ(11, one->Send("Hey, buddy!"));
+	EXPECT_EQ("Hey, buddy!", two->Receive());
+
+	EXPECT_EQ(11, two->Send("Hey, buddy!"));
+	EXPECT_EQ("Hey, buddy!", one->Receive());
+	EXPECT_EQ("loopback", one->PeerAsText());
+
+	one->Shutdown();
+	two->Shutdown();
+}
+
+TEST_F(LoopbackConnectionTest, WrapAround)
+{
+	LoopbackConnection* one;
+	LoopbackConnection* two;
+	string header("Hey, ");
+	string body("buddy!");
+	BufferView views[] = { header, body };
+	char buf[8];
+
+	LoopbackConnection::CreatePair(&one, &two, 16);
+
+	// Leave the ring half read, so the next message wraps around.
+	EXPECT_EQ(11, one->SendVector(views, 2));
+	EXPECT_EQ(8, two->ReceiveInto(buf, sizeof(buf)));
+	EXPECT_EQ("Hey, bud", string(buf, 8));
+	EXPECT_EQ(11, one->SendVector(views, 2));
+	EXPECT_EQ("dy!Hey, buddy!", two->Receive());
+
+	// A full ring takes no more.
+	string big(32, 'x');
+	IOResult result = one->TrySendBuffer(Buffer(big.data(), big.size()));
+	EXPECT_EQ(kIOOk, result.status);
+	EXPECT_EQ(16, result.length);
+	EXPECT_EQ(kIOWouldBlock,
+			one->TrySendBuffer(Buffer(big.data(), big.size())).status);
+	EXPECT_EQ(-1, one->Send(big, MSG_DONTWAIT));
+	EXPECT_EQ(EAGAIN, errno);
+
+	one->Shutdown();
+	two->Shutdown();
+}
+
+TEST_F(LoopbackConnectionTest, Waiting)
+{
+	LoopbackConnection* one;
+	LoopbackConnection* two;
+	string big(1 << 20, 'x');
+	string received;
+	char buf[16];
+
+	LoopbackConnection::CreatePair(&one, &two, 4096);
+
+	EXPECT_EQ(-1, two->ReceiveInto(buf, sizeof(buf), MSG_DONTWAIT));
+	EXPECT_EQ(EAGAIN, errno);
+
+	// Sending waits for the reader to make space, and receiving waits
+	// for the writer to send more.
+	std::thread reader([&]() {
+		while (received.size() < big.size())
+			received += two->Receive();
+	});
+	EXPECT_EQ((ssize_t) big.size(), one->Send(big));
+	reader.join();
+	EXPECT_EQ(big, received);
+
+	one->Shutdown();
+	two->Shutdown();
+}
+
+TEST_F(LoopbackConnectionTest, Shutdown)
+{
+	LoopbackConnection* one;
+	LoopbackConnection* two;
+	char buf[32];
+
+	LoopbackConnection::CreatePair(&one, &two);
+
+	// What was sent before can still be received.
+	EXPECT_EQ(11, one->Send("Hey, buddy!"));
+	one->Shutdown();
+
+	EXPECT_FALSE(two->IsEOF());
+	EXPECT_EQ("Hey, buddy!", two->Receive());
+	EXPECT_EQ(kIOClosed, two->TryReceiveInto(buf, sizeof(buf)).status);
+	EXPECT_TRUE(two->IsEOF());
+	EXPECT_EQ(0, two->ReceiveInto(buf, sizeof(buf)));
+
+	EXPECT_EQ(-1, two->Send("Hey, buddy!"));
+	EXPECT_EQ(EPIPE, errno);
+	EXPECT_EQ(kIOClosed, two->TrySendBuffer(Buffer("Hey", 3)).status);
+
+	two->Shutdown();
+}
+
+TEST_F(LoopbackConnectionTest, ShutdownWakesReader)
+{
+	LoopbackConnection* one;
+	LoopbackConnection* two;
+	char buf[32];
+	ssize_t ret = -1;
+
+	LoopbackConnection::CreatePair(&one, &two);
+
+	std::thread reader([&]() {
+		ret = two->ReceiveInto(buf, sizeof(buf));
+	});
+	usleep(10000);
+	one->Shutdown();
+	reader.join();
+
+	EXPECT_EQ(0, ret);
+	two->Shutdown();
+}
+
+}  // namespace testing
+}  // namespace siot
+}  // namespace toolbox
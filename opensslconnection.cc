@@ -31,7 +31,13 @@
 #include "config.h"
 #endif /* HAVE_CONFIG_H */
 
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
 #include <time.h>
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif /* HAVE_FCNTL_H */
 #ifdef HAVE_SYS_SOCKET_H
 #include <sys/socket.h>
 #endif /* HAVE_SYS_SOCKET_H */
@@ -41,6 +47,8 @@
 #include <toolbox/qsingleton.h>
 #include <toolbox/scopedptr.h>
 
+#include "siot/bufferpool.h"
+#include "connectionfreelist.h"
 #include "opensslconnection.h"
 
 namespace toolbox
@@ -52,6 +60,9 @@ namespace ssl
 using threadpp::Mutex;
 using threadpp::MutexLock;
 
+// Maximum amount of plaintext carried in a single TLS record.
+static const size_t kMaxRecordSize = 16384;
+
 OpenSSLConfig::OpenSSLConfig()
 {
 	CRYPTO_malloc_init();
@@ -61,12 +72,28 @@ OpenSSLConfig::OpenSSLConfig()
 	OpenSSL_add_all_algorithms();
 }
 
-OpenSSLConnection::OpenSSLConnection(Server* srv, int socketid,                            
-		struct sockaddr_storage* peer,
+void*
+OpenSSLConnection::operator new(size_t size)
+{
+	return ConnectionFreelist::ForSize(sizeof(OpenSSLConnection))
+		->Allocate(size);
+}
+
+void
+OpenSSLConnection::operator delete(void* ptr, size_t size)
+{
+	ConnectionFreelist::ForSize(sizeof(OpenSSLConnection))
+		->Release(ptr, size);
+}
+
+OpenSSLConnection::OpenSSLConnection(Server* srv, int socketid,
+		const struct sockaddr_storage* peer,
 		const ServerSSLContext* context)
 : UNIXSocketConnection(srv, socketid, peer),
 	openssl_cfg_(QSingleton<OpenSSLConfig>::GetInstance()),
-	blocking_(true), last_use_(time(NULL)), ssl_mtx_(Mutex::Create())
+	blocking_(!(fcntl(socketid, F_GETFL, 0) & O_NONBLOCK)),
+	last_use_(time(NULL)), read_mtx_(Mutex::Create()),
+	send_mtx_(Mutex::Create()), ssl_mtx_(Mutex::Create())
 {
 	const SSL_METHOD* meth = SSLv23_server_method();
 	int ret;
@@ -96,87 +123,426 @@ OpenSSLConnection::OpenSSLConnection(Server* srv, int socketid,
 				ERR_error_string(ret, NULL));
 	}
 
-	if ((ret = SSL_set_fd(ssl_handle_, socketid)) <= 0)
-		throw ClientConnectionException("SSL_set_fd:"
+	network_in_ = BIO_new(BIO_s_mem());
+	network_out_ = BIO_new(BIO_s_mem());
+	if (!network_in_ || !network_out_)
+	{
+		ret = ERR_get_error();
+		throw ClientConnectionException("BIO_new:"
 				+ std::to_string(ret),
 				ERR_error_string(ret, NULL));
+	}
+	SSL_set_bio(ssl_handle_, network_in_, network_out_);
+	SSL_set_accept_state(ssl_handle_);
 
-	if ((ret = SSL_accept(ssl_handle_)) <= 0)
-		throw ClientConnectionException("SSL_accept:"
-				+ std::to_string(ret),
-				ERR_error_string(ret, NULL));
+	Handshake();
 }
 
 OpenSSLConnection::~OpenSSLConnection()
 {
 }
 
+void
+OpenSSLConnection::Handshake()
+{
+	MutexLock rl(read_mtx_.Get());
+	MutexLock sl(send_mtx_.Get());
+
+	while (true)
+	{
+		int ret, err;
+
+		{
+			MutexLock l(ssl_mtx_.Get());
+			ret = SSL_do_handshake(ssl_handle_);
+			err = SSL_get_error(ssl_handle_, ret);
+		}
+
+		if (!PumpOutput())
+			throw ClientConnectionException("send:"
+					+ string(strerror(errno)),
+					strerror(errno));
+		if (ret > 0)
+			return;
+
+		if (err != SSL_ERROR_WANT_READ)
+			throw ClientConnectionException("SSL_accept:"
+					+ std::to_string(ret),
+					ERR_error_string(ret, NULL));
+		if (!PumpInput(0))
+			throw ClientConnectionException("SSL_accept:eof",
+					"Connection closed during handshake");
+	}
+}
+
+bool
+OpenSSLConnection::PumpOutput(bool wait)
+{
+	string out;
+
+	// Whatever the socket didn't take last time has to go out first.
+	out.swap(unsent_);
+
+	{
+		MutexLock l(ssl_mtx_.Get());
+		size_t pending = BIO_ctrl_pending(network_out_);
+
+		if (pending > 0)
+		{
+			size_t offset = out.size();
+
+			out.resize(offset + pending);
+			BIO_read(network_out_, &out[offset], pending);
+		}
+	}
+
+	if (out.empty())
+		return true;
+
+	BufferView view(out);
+	if (wait)
+		return UNIXSocketConnection::SendVector(&view, 1) >= 0;
+
+	// The records are encrypted already, so the rest has to be kept
+	// around until the socket takes it.
+	IOResult res = UNIXSocketConnection::TrySendVector(&view, 1);
+	if (res.status != kIOOk && res.status != kIOWouldBlock)
+	{
+		errno = res.status == kIOClosed ? EPIPE : res.error;
+		return false;
+	}
+
+	out.erase(0, res.length);
+	unsent_.swap(out);
+	return true;
+}
+
+bool
+OpenSSLConnection::PumpInput(int flags)
+{
+	PooledBuffer buf(BufferPool::kMediumBufferSize);
+	ssize_t len;
+
+	// The socket itself may be non-blocking even if we're asked to wait.
+	while ((len = UNIXSocketConnection::ReceiveInto(buf.Get(), buf.Size(),
+					flags)) == -1 &&
+			(errno == EAGAIN || errno == EWOULDBLOCK) &&
+			!(flags & MSG_DONTWAIT) && WaitForSocket(POLLIN))
+		;
+
+	if (len <= 0)
+		return false;
+
+	MutexLock l(ssl_mtx_.Get());
+	BIO_write(network_in_, buf.Get(), len);
+	return true;
+}
+
 void
 OpenSSLConnection::Shutdown()
 {
 	// Ensure we're the only ones operating on the connection.
-	MutexLock l(ssl_mtx_);
 	Deregister();
 	Lock();
-	int is_down = SSL_get_shutdown(ssl_handle_);
-	if (is_down >= 0)
-		SSL_shutdown(ssl_handle_);
-	SSL_free(ssl_handle_);
-	SSL_CTX_free(ssl_ctx_);
-	delete this;
+
+	{
+		MutexLock sl(send_mtx_.Get());
+
+		{
+			MutexLock l(ssl_mtx_.Get());
+			if (!(SSL_get_shutdown(ssl_handle_) &
+						SSL_SENT_SHUTDOWN))
+				SSL_shutdown(ssl_handle_);
+		}
+
+		// The peer may be gone already, in which case there's
+		// nobody left to tell.
+		PumpOutput();
+	}
+
+	{
+		MutexLock l(ssl_mtx_.Get());
+		SSL_free(ssl_handle_);
+		SSL_CTX_free(ssl_ctx_);
+		ssl_handle_ = 0;
+		ssl_ctx_ = 0;
+	}
+
+	// Closes the socket and frees the connection without giving up the
+	// lock in between.
+	CloseAndDelete();
 }
 
 string
 OpenSSLConnection::Receive(size_t maxlen, int flags)
 {
-	MutexLock l(ssl_mtx_);
-	size_t len = SSL_pending(ssl_handle_);
-	int blen;
-	last_use_ = time(NULL);
+	if (maxlen <= 0 || maxlen > BufferPool::kLargeBufferSize)
+		maxlen = BufferPool::kLargeBufferSize;
+
+	PooledBuffer buf(maxlen);
+	ssize_t len = ReceiveInto(buf.Get(), maxlen, flags);
+
+	return string(buf.Get(), len);
+}
+
+Buffer
+OpenSSLConnection::ReceiveBuffer(size_t maxlen, int flags)
+{
+	if (maxlen <= 0 || maxlen > BufferPool::kLargeBufferSize)
+		maxlen = BufferPool::kLargeBufferSize;
+
+	// The data is read straight into pooled memory, which the buffer then
+	// takes over.
+	ScopedPtr<PooledBuffer> buf(new PooledBuffer(maxlen));
+	ssize_t len = ReceiveInto(buf->Get(), maxlen, flags);
 
-	if (len == 0 && !blocking_)
-		return string();
 	if (len <= 0)
-		len = maxlen <= 0 || maxlen > 65536 ? 65536 : maxlen;
-	if (maxlen > 0 && len > maxlen)
-		len = maxlen;
+		return Buffer();
+	return Buffer(buf.Release(), len);
+}
 
-	const ScopedPtr<char> buf(new char[len]);
-	if ((blen = SSL_read(ssl_handle_, buf.Get(), len)) <= 0)
+int
+OpenSSLConnection::Read(char* buf, size_t len, int netflags, int* err)
+{
+	while (true)
 	{
-		unsigned long errv = SSL_get_error(ssl_handle_, blen);
-		if (errv == SSL_ERROR_SYSCALL)
-			throw ClientConnectionException("SSL_read:"
-					+ string(strerror(errno)),
-					strerror(errno));
-		throw ClientConnectionException("SSL_read:"
-				+ std::to_string(errv),
-				ERR_error_string(errv, NULL));
+		int ret;
+		bool output;
+
+		{
+			MutexLock l(ssl_mtx_.Get());
+			ret = SSL_read(ssl_handle_, buf, len);
+			*err = SSL_get_error(ssl_handle_, ret);
+			output = BIO_ctrl_pending(network_out_) > 0;
+		}
+
+		// Reading may make OpenSSL want to reply, e.g. to a key
+		// update.
+		if (output)
+		{
+			MutexLock sl(send_mtx_.Get());
+			if (!PumpOutput(!(netflags & MSG_DONTWAIT)))
+			{
+				*err = SSL_ERROR_SYSCALL;
+				return -1;
+			}
+		}
+
+		if (ret > 0 || *err != SSL_ERROR_WANT_READ)
+			return ret;
+
+		// The socket is read without holding ssl_mtx_, so senders can
+		// go ahead while we wait.
+		if (!PumpInput(netflags))
+			return ret;
 	}
+}
+
+ssize_t
+OpenSSLConnection::ReceiveInto(char* buf, size_t len, int flags)
+{
+	MutexLock rl(read_mtx_.Get());
+	const int netflags = (blocking_ && !(flags & MSG_DONTWAIT)) ? 0 :
+		MSG_DONTWAIT;
+	int err;
+	int ret;
+
+	last_use_ = time(NULL);
+	ret = Read(buf, len, netflags, &err);
+
+	if (ret > 0)
+		return ret;
+	if (err == SSL_ERROR_ZERO_RETURN || err == SSL_ERROR_WANT_READ)
+		return 0;
+	if (err == SSL_ERROR_SYSCALL)
+		throw ClientConnectionException("SSL_read:"
+				+ string(strerror(errno)),
+				strerror(errno));
+	throw ClientConnectionException("SSL_read:"
+			+ std::to_string(err),
+			ERR_error_string(err, NULL));
+}
+
+IOResult
+OpenSSLConnection::TryReceiveInto(char* buf, size_t len, int flags)
+{
+	MutexLock rl(read_mtx_.Get());
+	int err;
+	int ret;
+
+	last_use_ = time(NULL);
+	ret = Read(buf, len, MSG_DONTWAIT, &err);
 
-	return string(buf.Get(), blen);
+	if (ret > 0)
+		return IOResult(kIOOk, ret);
+	if (err == SSL_ERROR_ZERO_RETURN)
+		return IOResult(kIOClosed);
+	if (err == SSL_ERROR_WANT_READ)
+		return IOResult(UNIXSocketConnection::IsEOF() ? kIOClosed :
+				kIOWouldBlock);
+	if (err == SSL_ERROR_SYSCALL)
+		return IOResult(kIOError, 0, errno);
+	return IOResult(kIOError, 0, EPROTO);
 }
 
 ssize_t
 OpenSSLConnection::Send(string data, int flags)
 {
-	MutexLock l(ssl_mtx_);
-	int ret = SSL_write(ssl_handle_, data.data(), data.size());
-	last_use_ = time(NULL);
+	BufferView view(data);
+	return SendVector(&view, 1, flags);
+}
 
-	if (ret <= 0)
-	{
-		unsigned long errv = SSL_get_error(ssl_handle_, ret);
-		if (errv == SSL_ERROR_SYSCALL)
-			throw ClientConnectionException("SSL_read:"
-					+ string(strerror(errno)),
-					strerror(errno));
+ssize_t
+OpenSSLConnection::SendVector(const BufferView* views, size_t count,
+		int flags)
+{
+	MutexLock l(send_mtx_.Get());
+	int err;
+	ssize_t ret = WriteVector(views, count, &err);
+
+	if (ret >= 0)
+		return ret;
+	if (err == SSL_ERROR_SYSCALL)
 		throw ClientConnectionException("SSL_write:"
-				+ std::to_string(errv),
-				ERR_error_string(errv, NULL));
+				+ string(strerror(errno)),
+				strerror(errno));
+	throw ClientConnectionException("SSL_write:"
+			+ std::to_string(err),
+			ERR_error_string(err, NULL));
+}
+
+// Encrypted data which the socket doesn't take right away goes to the write
+// queue if it's enabled; otherwise, it is kept in unsent_ and no further
+// data is encrypted until the socket has taken it.
+IOResult
+OpenSSLConnection::TrySendVector(const BufferView* views, size_t count,
+		int flags)
+{
+	MutexLock l(send_mtx_.Get());
+	int err;
+	ssize_t ret;
+
+	if (!unsent_.empty())
+	{
+		if (!PumpOutput(false))
+			return IOResult(kIOError, 0, errno);
+		if (!unsent_.empty())
+			return IOResult(kIOWouldBlock);
 	}
 
-	return ssize_t(ret);
+	ret = WriteVector(views, count, &err, false);
+	if (ret >= 0)
+		return IOResult(unsent_.empty() ? kIOOk : kIOWouldBlock, ret);
+	if (err == SSL_ERROR_SYSCALL)
+		return IOResult(kIOError, 0, errno);
+	return IOResult(kIOError, 0, EPROTO);
+}
+
+ssize_t
+OpenSSLConnection::WriteVector(const BufferView* views, size_t count,
+		int* err, bool wait)
+{
+	string record;
+	ssize_t total = 0;
+
+	// Every SSL_write() produces at least one record of its own, so
+	// small pieces are collected until they fill a whole record. Pieces
+	// which are larger than that are written directly.
+	record.reserve(kMaxRecordSize);
+	for (size_t i = 0; i < count; ++i)
+	{
+		const BufferView& v = views[i];
+
+		if (record.size() + v.length <= kMaxRecordSize)
+		{
+			record.append(v.data, v.length);
+			continue;
+		}
+
+		if (!record.empty())
+		{
+			if (Write(record.data(), record.size(), err, wait) <= 0)
+				return -1;
+			total += record.size();
+			record.clear();
+
+			// Don't encrypt more than the socket can take.
+			if (!unsent_.empty())
+				return total;
+		}
+
+		if (v.length >= kMaxRecordSize)
+		{
+			if (Write(v.data, v.length, err, wait) <= 0)
+				return -1;
+			total += v.length;
+			if (!unsent_.empty())
+				return total;
+		}
+		else
+			record.append(v.data, v.length);
+	}
+
+	if (!record.empty())
+	{
+		if (Write(record.data(), record.size(), err, wait) <= 0)
+			return -1;
+		total += record.size();
+	}
+
+	return total;
+}
+
+// The data has to be encrypted before it can go out, so there is always a
+// copy and "release" can be run right away.
+ssize_t
+OpenSSLConnection::SendZeroCopy(const char* data, size_t len,
+		google::protobuf::Closure* release, int flags)
+{
+	BufferView view(data, len);
+	ssize_t ret = SendVector(&view, 1, flags);
+	release->Run();
+	return ret;
+}
+
+// The file contents have to be encrypted, so they can't be handed to
+// sendfile().
+ssize_t
+OpenSSLConnection::SendFile(int fd, off_t offset, size_t len)
+{
+	return Connection::SendFile(fd, offset, len);
+}
+
+void
+OpenSSLConnection::SetZeroCopyThreshold(size_t threshold)
+{
+}
+
+int
+OpenSSLConnection::Write(const char* data, size_t len, int* err, bool wait)
+{
+	int ret;
+
+	{
+		MutexLock l(ssl_mtx_.Get());
+		ret = SSL_write(ssl_handle_, data, len);
+		last_use_ = time(NULL);
+
+		if (ret <= 0)
+		{
+			*err = SSL_get_error(ssl_handle_, ret);
+			return ret;
+		}
+	}
+
+	// Send the records right away, so large writes don't pile up in
+	// memory.
+	if (!PumpOutput(wait))
+	{
+		*err = SSL_ERROR_SYSCALL;
+		return -1;
+	}
+	return ret;
 }
 
 uint64_t
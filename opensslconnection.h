@@ -27,6 +27,7 @@
  * OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <atomic>
 #include <string>
 
 #include <openssl/ssl.h>
@@ -52,6 +53,12 @@ public:
 };
 
 // This class represents a connection using OpenSSL for encryption.
+//
+// OpenSSL only ever talks to memory buffers, so the SSL object is locked
+// just for the time it takes to encrypt or decrypt data. The socket itself
+// is read and written outside of that lock, with separate locks for the
+// reading and the writing side, so a thread waiting for data doesn't keep
+// other threads from sending.
 class OpenSSLConnection : public UNIXSocketConnection
 {
 public:
@@ -59,24 +66,87 @@ public:
 	// "socketid", connected to "peer", and kick off negociation with
 	// the settings specified in "context".
 	OpenSSLConnection(Server* srv, int socketid,
-		       	struct sockaddr_storage* peer,
+		       	const struct sockaddr_storage* peer,
 			const ServerSSLContext* context);
 	virtual ~OpenSSLConnection();
 
+	// Connection objects are recycled through a freelist.
+	static void* operator new(size_t size);
+	static void operator delete(void* ptr, size_t size);
+
 	// Implements Connection.
 	virtual string Receive(size_t maxlen = -1, int flags = 0);
+	virtual ssize_t ReceiveInto(char* buf, size_t len, int flags = 0);
+	virtual Buffer ReceiveBuffer(size_t maxlen = -1, int flags = 0);
+	virtual IOResult TryReceiveInto(char* buf, size_t len, int flags = 0);
 	virtual ssize_t Send(string data, int flags = 0);
+	virtual ssize_t SendVector(const BufferView* views, size_t count,
+			int flags = 0);
+	virtual IOResult TrySendVector(const BufferView* views, size_t count,
+			int flags = 0);
+	virtual ssize_t SendZeroCopy(const char* data, size_t len,
+			google::protobuf::Closure* release, int flags = 0);
+	virtual ssize_t SendFile(int fd, off_t offset, size_t len);
+	virtual void SetZeroCopyThreshold(size_t threshold);
 	virtual uint64_t GetLastUse();
 	virtual void SetBlocking(bool blocking = true);
 	virtual void Shutdown();
 
 private:
+	// Encrypts "len" bytes from "data" and sends them as PumpOutput(wait)
+	// does. Returns the result of SSL_write() and stores the
+	// SSL_get_error() code in "err"; a failure to send is reported as
+	// SSL_ERROR_SYSCALL. Must be called with send_mtx_ held.
+	int Write(const char* data, size_t len, int* err, bool wait = true);
+
+	// Encrypts and sends the pieces in "views", packing small ones into
+	// full records. Returns the number of bytes sent, or -1 with the error
+	// in "err" if a write failed. Unless "wait" is set, this stops as soon
+	// as the socket doesn't take any more, leaving the rest in unsent_.
+	// Must be called with send_mtx_ held.
+	ssize_t WriteVector(const BufferView* views, size_t count, int* err,
+			bool wait = true);
+
+	// Decrypts up to "len" bytes into "buf", reading from the network with
+	// "netflags" as needed. Returns the result of SSL_read() and stores
+	// the SSL_get_error() code in "err". Must be called with read_mtx_
+	// held.
+	int Read(char* buf, size_t len, int netflags, int* err);
+
+	// Sends whatever OpenSSL wants to go out over the network, after the
+	// data in unsent_. Unless "wait" is set, whatever the socket doesn't
+	// take right away is kept in unsent_. Returns false if that failed,
+	// with errno set. Must be called with send_mtx_ held.
+	bool PumpOutput(bool wait = true);
+
+	// Reads data from the network and hands it to OpenSSL, waiting for
+	// it unless "flags" contains MSG_DONTWAIT. Returns false if there was
+	// nothing to read. Must be called with read_mtx_ held.
+	bool PumpInput(int flags);
+
+	// Negotiates the session with the client.
+	void Handshake();
+
 	const OpenSSLConfig& openssl_cfg_;
-	bool blocking_;
-	uint64_t last_use_;
+	std::atomic<bool> blocking_;
+	std::atomic<uint64_t> last_use_;
 	SSL_CTX* ssl_ctx_;
 	SSL* ssl_handle_;
-	threadpp::Mutex* ssl_mtx_;
+
+	// The ends of the memory buffers OpenSSL reads from and writes to.
+	// They are owned by ssl_handle_.
+	BIO* network_in_;
+	BIO* network_out_;
+
+	// Encrypted data which the socket didn't take yet. Protected by
+	// send_mtx_.
+	string unsent_;
+
+	// Lock order: read_mtx_ or send_mtx_ before ssl_mtx_. ssl_mtx_ is
+	// never held while waiting for the network.
+	ScopedPtr<threadpp::Mutex> read_mtx_;
+	ScopedPtr<threadpp::Mutex> send_mtx_;
+	ScopedPtr<threadpp::Mutex> ssl_mtx_;
 };
 }  // namespace ssl
 }  // namespace siot
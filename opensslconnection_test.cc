@@ -13,7 +13,9 @@
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 
+#include <chrono>
 #include <iostream>
+#include <thread>
 
 #include "opensslconnection.h"
 
@@ -96,11 +98,180 @@ TEST_F(OpenSSLConnectionTest, ReadWrite)
 	EXPECT_EQ(strlen(buf), SSL_write(ssl, buf, strlen(buf)));
 	EXPECT_EQ("Hey, buddy!", sslc.Receive());
 
+	string header("Hey, ");
+	string body("buddy!");
+	BufferView views[] = { header, body };
+	memset(buf, 0, sizeof(buf));
+	EXPECT_EQ(11, sslc.SendVector(views, 2));
+	EXPECT_EQ(11, SSL_read(ssl, buf, sizeof(buf)));
+	EXPECT_EQ("Hey, buddy!", string(buf));
+
+	SSL_shutdown(ssl);
+	SSL_free(ssl);
+	SSL_CTX_free(ssl_ctx);
+}
+
+TEST_F(OpenSSLConnectionTest, FullDuplex)
+{
+	ServerSSLContext* ctx = new ServerSSLContext("test.crt", "test.key");
+	const SSL_METHOD* meth = SSLv23_client_method();
+	struct sockaddr_storage ssladdr;
+	SSL_CTX* ssl_ctx;
+	SSL* ssl;
+	char buf[16];
+	int socks[2];
+	string received;
+
+	memset(&ssladdr, 0, sizeof(struct sockaddr_storage));
+	memset(buf, 0, sizeof(buf));
+
+	EXPECT_FALSE(socketpair(AF_UNIX, SOCK_STREAM, 0, socks))
+		<< "Error establishing socket pair: " << strerror(errno);
+
+	QSingleton<OpenSSLConfig>::GetInstance();
+
+	ASSERT_NE((SSL_CTX*) 0, ssl_ctx = SSL_CTX_new(meth))
+		<< ERR_error_string(ERR_get_error(), NULL);
+	SSL_CTX_set_verify(ssl_ctx, SSL_VERIFY_NONE, NULL);
+	ASSERT_NE((SSL*) 0, ssl = SSL_new(ssl_ctx))
+		<< ERR_error_string(ERR_get_error(), NULL);
+	ASSERT_EQ(1, SSL_set_fd(ssl, socks[1]))
+		<< ERR_error_string(ERR_get_error(), NULL);
+
+	OpenSSLConnectionSetup setup(ssl);
+	setup.Start();
+
+	OpenSSLConnection sslc(0, socks[0], &ssladdr, ctx);
+	setup.WaitForFinished();
+
+	// Sending must not have to wait for the blocked reader.
+	std::thread reader([&sslc, &received]() {
+		received = sslc.Receive();
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+	EXPECT_EQ(11, sslc.Send("Hey, buddy!"));
+	EXPECT_EQ(11, SSL_read(ssl, buf, sizeof(buf)));
+	EXPECT_EQ("Hey, buddy!", string(buf));
+
+	EXPECT_EQ(6, SSL_write(ssl, "Hello!", 6));
+	reader.join();
+	EXPECT_EQ("Hello!", received);
+
+	SSL_shutdown(ssl);
+	SSL_free(ssl);
+	SSL_CTX_free(ssl_ctx);
+}
+
+TEST_F(OpenSSLConnectionTest, TrySendWouldBlock)
+{
+	ServerSSLContext* ctx = new ServerSSLContext("test.crt", "test.key");
+	const SSL_METHOD* meth = SSLv23_client_method();
+	struct sockaddr_storage ssladdr;
+	SSL_CTX* ssl_ctx;
+	SSL* ssl;
+	int socks[2];
+	string chunk(65536, 'x');
+	BufferView view(chunk);
+	IOResult res;
+	ssize_t accepted = 0;
+	ssize_t received = 0;
+
+	memset(&ssladdr, 0, sizeof(struct sockaddr_storage));
+
+	EXPECT_FALSE(socketpair(AF_UNIX, SOCK_STREAM, 0, socks))
+		<< "Error establishing socket pair: " << strerror(errno);
+
+	QSingleton<OpenSSLConfig>::GetInstance();
+
+	ASSERT_NE((SSL_CTX*) 0, ssl_ctx = SSL_CTX_new(meth))
+		<< ERR_error_string(ERR_get_error(), NULL);
+	SSL_CTX_set_verify(ssl_ctx, SSL_VERIFY_NONE, NULL);
+	ASSERT_NE((SSL*) 0, ssl = SSL_new(ssl_ctx))
+		<< ERR_error_string(ERR_get_error(), NULL);
+	ASSERT_EQ(1, SSL_set_fd(ssl, socks[1]))
+		<< ERR_error_string(ERR_get_error(), NULL);
+
+	OpenSSLConnectionSetup setup(ssl);
+	setup.Start();
+
+	OpenSSLConnection sslc(0, socks[0], &ssladdr, ctx);
+	setup.WaitForFinished();
+
+	// Nobody reads, so the socket fills up eventually; this must not
+	// wait for the peer.
+	for (int i = 0; i < 1024; ++i)
+	{
+		res = sslc.TrySendVector(&view, 1);
+		accepted += res.length;
+		if (res.status != kIOOk)
+			break;
+	}
+	ASSERT_EQ(kIOWouldBlock, res.status);
+	EXPECT_EQ(kIOWouldBlock, sslc.TrySendVector(&view, 1).status);
+
+	// Whatever was accepted arrives, followed by later data.
+	std::thread reader([ssl, &received, accepted]() {
+		char buf[16384];
+		int len;
+
+		while (received <= accepted &&
+				(len = SSL_read(ssl, buf, sizeof(buf))) > 0)
+			received += len;
+	});
+	EXPECT_EQ(1, sslc.Send("!"));
+	reader.join();
+	EXPECT_EQ(accepted + 1, received);
+
 	SSL_shutdown(ssl);
 	SSL_free(ssl);
 	SSL_CTX_free(ssl_ctx);
 }
 
+TEST_F(OpenSSLConnectionTest, Shutdown)
+{
+	ServerSSLContext* ctx = new ServerSSLContext("test.crt", "test.key");
+	const SSL_METHOD* meth = SSLv23_client_method();
+	struct sockaddr_storage ssladdr;
+	SSL_CTX* ssl_ctx;
+	SSL* ssl;
+	char buf[16];
+	int socks[2];
+
+	memset(&ssladdr, 0, sizeof(struct sockaddr_storage));
+
+	EXPECT_FALSE(socketpair(AF_UNIX, SOCK_STREAM, 0, socks))
+		<< "Error establishing socket pair: " << strerror(errno);
+
+	QSingleton<OpenSSLConfig>::GetInstance();
+
+	ASSERT_NE((SSL_CTX*) 0, ssl_ctx = SSL_CTX_new(meth))
+		<< ERR_error_string(ERR_get_error(), NULL);
+	SSL_CTX_set_verify(ssl_ctx, SSL_VERIFY_NONE, NULL);
+	ASSERT_NE((SSL*) 0, ssl = SSL_new(ssl_ctx))
+		<< ERR_error_string(ERR_get_error(), NULL);
+	ASSERT_EQ(1, SSL_set_fd(ssl, socks[1]))
+		<< ERR_error_string(ERR_get_error(), NULL);
+
+	OpenSSLConnectionSetup setup(ssl);
+	setup.Start();
+
+	OpenSSLConnection* sslc = new OpenSSLConnection(0, socks[0], &ssladdr,
+			ctx);
+	setup.WaitForFinished();
+
+	// The peer is told about the end of the session before the
+	// connection goes away.
+	EXPECT_EQ(11, sslc->Send("Hey, buddy!"));
+	sslc->Shutdown();
+	EXPECT_EQ(11, SSL_read(ssl, buf, sizeof(buf)));
+	EXPECT_GE(0, SSL_read(ssl, buf, sizeof(buf)));
+	EXPECT_EQ(SSL_ERROR_ZERO_RETURN, SSL_get_error(ssl, 0));
+
+	SSL_free(ssl);
+	SSL_CTX_free(ssl_ctx);
+}
+
 }  // namespace testing
 }  // namespace ssl
 }  // namespace siot
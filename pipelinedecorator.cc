@@ -0,0 +1,455 @@
+/*-
+ * Copyright (c) 2026 Caoimhe Chaos <caoimhechaos@protonmail.com>,
+ *                    Ancient Solutions. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions  of source code must retain  the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions  in   binary  form  must   reproduce  the  above
+ *    copyright  notice, this  list  of conditions  and the  following
+ *    disclaimer in the  documentation and/or other materials provided
+ *    with the distribution.
+ *
+ * THIS  SOFTWARE IS  PROVIDED BY  ANCIENT SOLUTIONS  AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO,  THE IMPLIED WARRANTIES OF  MERCHANTABILITY AND FITNESS
+ * FOR A  PARTICULAR PURPOSE  ARE DISCLAIMED.  IN  NO EVENT  SHALL THE
+ * FOUNDATION  OR CONTRIBUTORS  BE  LIABLE FOR  ANY DIRECT,  INDIRECT,
+ * INCIDENTAL,   SPECIAL,    EXEMPLARY,   OR   CONSEQUENTIAL   DAMAGES
+ * (INCLUDING, BUT NOT LIMITED  TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE,  DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT  LIABILITY,  OR  TORT  (INCLUDING NEGLIGENCE  OR  OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "siot/pipelinedecorator.h"
+#include "siot/connection.h"
+#include "siot/server.h"
+
+#include <errno.h>
+
+#include <string>
+
+namespace toolbox
+{
+namespace siot
+{
+using std::string;
+using threadpp::Mutex;
+using threadpp::MutexLock;
+
+PipelineDecorator::Slot::Slot()
+: flags(0), complete(false)
+{
+}
+
+PipelineDecorator::PipelineDecorator(Connection* wrapped, bool own)
+: wrapped_(wrapped), owned_(own), slots_mtx_(Mutex::Create()),
+	next_slot_(0), head_slot_(0), unsent_flags_(0), sending_(false)
+{
+}
+
+PipelineDecorator::~PipelineDecorator()
+{
+}
+
+uint64_t
+PipelineDecorator::ReserveSlot()
+{
+	MutexLock l(slots_mtx_.Get());
+	uint64_t slot = next_slot_++;
+	slots_[slot] = Slot();
+	return slot;
+}
+
+ssize_t
+PipelineDecorator::SendToSlot(uint64_t slot, string data, int flags)
+{
+	{
+		MutexLock l(slots_mtx_.Get());
+		std::map<uint64_t, Slot>::iterator it = slots_.find(slot);
+
+		if (it == slots_.end() || it->second.complete)
+			throw ClientConnectionException("invalid-slot",
+					"Response sent to a slot which is not "
+					"pending");
+
+		it->second.data += data;
+		it->second.flags |= flags;
+	}
+
+	// The front of the queue can be sent right away.
+	if (!SendDueData())
+		return -1;
+	return data.length();
+}
+
+bool
+PipelineDecorator::CompleteSlot(uint64_t slot)
+{
+	{
+		MutexLock l(slots_mtx_.Get());
+		std::map<uint64_t, Slot>::iterator it = slots_.find(slot);
+
+		if (it == slots_.end() || it->second.complete)
+			throw ClientConnectionException("invalid-slot",
+					"Completion of a slot which is not "
+					"pending");
+
+		it->second.complete = true;
+
+		// Nothing is left to send for the slot if it was at the front
+		// of the queue already.
+		while ((it = slots_.find(head_slot_)) != slots_.end() &&
+				it->second.complete && it->second.data.empty())
+		{
+			slots_.erase(it);
+			++head_slot_;
+		}
+	}
+
+	return SendDueData();
+}
+
+ssize_t
+PipelineDecorator::Respond(uint64_t slot, string data, int flags)
+{
+	ssize_t ret = SendToSlot(slot, data, flags);
+	int error = errno;
+
+	// Completing the slot retries sending, so it reports the same error.
+	if (!CompleteSlot(slot) || ret < 0)
+	{
+		if (ret < 0)
+			errno = error;
+		return -1;
+	}
+	return ret;
+}
+
+bool
+PipelineDecorator::Flush()
+{
+	return SendDueData();
+}
+
+uint64_t
+PipelineDecorator::GetPendingSlots()
+{
+	MutexLock l(slots_mtx_.Get());
+	return slots_.size() + (unsent_.empty() ? 0 : 1);
+}
+
+bool
+PipelineDecorator::TakeDueDataLocked(string* data, int* flags)
+{
+	std::map<uint64_t, Slot>::iterator it;
+
+	// Whatever the connection didn't take last time goes first.
+	if (!unsent_.empty())
+	{
+		data->swap(unsent_);
+		unsent_.clear();
+		*flags = unsent_flags_;
+		return true;
+	}
+
+	while ((it = slots_.find(head_slot_)) != slots_.end())
+	{
+		Slot& slot = it->second;
+		bool found = !slot.data.empty();
+
+		// Data for the front of the queue can go out even if the slot
+		// is incomplete.
+		if (found)
+		{
+			data->swap(slot.data);
+			slot.data.clear();
+			*flags = slot.flags;
+			slot.flags = 0;
+		}
+
+		// Incomplete slots hold up the ones behind them.
+		if (!slot.complete)
+			return found;
+
+		slots_.erase(it);
+		++head_slot_;
+		if (found)
+			return true;
+	}
+
+	return false;
+}
+
+bool
+PipelineDecorator::SendDueData()
+{
+	string data;
+	int flags = 0;
+
+	{
+		MutexLock l(slots_mtx_.Get());
+
+		// Whoever is sending already picks up our data when done.
+		if (sending_ || !TakeDueDataLocked(&data, &flags))
+			return true;
+		sending_ = true;
+	}
+
+	while (true)
+	{
+		size_t offset = 0;
+		ssize_t len = 0;
+		int error = 0;
+
+		try
+		{
+			while (offset < data.size() &&
+					(len = wrapped_->Send(data.substr(offset),
+							      flags)) > 0)
+				offset += len;
+			error = errno;
+		}
+		catch (...)
+		{
+			MutexLock l(slots_mtx_.Get());
+			unsent_ = data.substr(offset);
+			unsent_flags_ = flags;
+			sending_ = false;
+			throw;
+		}
+
+		MutexLock l(slots_mtx_.Get());
+
+		if (offset < data.size())
+		{
+			// The rest has to wait until the connection takes more
+			// data, see Flush().
+			unsent_ = data.substr(offset);
+			unsent_flags_ = flags;
+			sending_ = false;
+			return len == 0 || error == EAGAIN ||
+				error == EWOULDBLOCK || error == EINTR;
+		}
+
+		data.clear();
+		if (!TakeDueDataLocked(&data, &flags))
+		{
+			sending_ = false;
+			return true;
+		}
+	}
+}
+
+ssize_t
+PipelineDecorator::Send(string data, int flags)
+{
+	return wrapped_->Send(data, flags);
+}
+
+ssize_t
+PipelineDecorator::SendVector(const BufferView* views, size_t count, int flags)
+{
+	return wrapped_->SendVector(views, count, flags);
+}
+
+ssize_t
+PipelineDecorator::SendBuffer(const Buffer& data, int flags)
+{
+	return wrapped_->SendBuffer(data, flags);
+}
+
+IOResult
+PipelineDecorator::TrySendVector(const BufferView* views, size_t count,
+		int flags)
+{
+	return wrapped_->TrySendVector(views, count, flags);
+}
+
+ssize_t
+PipelineDecorator::SendZeroCopy(const char* data, size_t len,
+		google::protobuf::Closure* release, int flags)
+{
+	return wrapped_->SendZeroCopy(data, len, release, flags);
+}
+
+ssize_t
+PipelineDecorator::SendFile(int fd, off_t offset, size_t len)
+{
+	return wrapped_->SendFile(fd, offset, len);
+}
+
+string
+PipelineDecorator::Receive(size_t maxlen, int flags)
+{
+	return wrapped_->Receive(maxlen, flags);
+}
+
+ssize_t
+PipelineDecorator::ReceiveInto(char* buf, size_t len, int flags)
+{
+	return wrapped_->ReceiveInto(buf, len, flags);
+}
+
+Buffer
+PipelineDecorator::ReceiveBuffer(size_t maxlen, int flags)
+{
+	return wrapped_->ReceiveBuffer(maxlen, flags);
+}
+
+IOResult
+PipelineDecorator::TryReceiveInto(char* buf, size_t len, int flags)
+{
+	return wrapped_->TryReceiveInto(buf, len, flags);
+}
+
+IOResult
+PipelineDecorator::TryReceiveBuffer(Buffer* data, size_t maxlen, int flags)
+{
+	return wrapped_->TryReceiveBuffer(data, maxlen, flags);
+}
+
+string
+PipelineDecorator::PeerAsText()
+{
+	return wrapped_->PeerAsText();
+}
+
+Server*
+PipelineDecorator::GetServer()
+{
+	return wrapped_->GetServer();
+}
+
+bool
+PipelineDecorator::IsEOF()
+{
+	return wrapped_->IsEOF();
+}
+
+uint64_t
+PipelineDecorator::GetLastUse()
+{
+	return wrapped_->GetLastUse();
+}
+
+void
+PipelineDecorator::SetBlocking(bool blocking)
+{
+	wrapped_->SetBlocking(blocking);
+}
+
+void
+PipelineDecorator::SetWriteQueue(size_t low_watermark, size_t high_watermark)
+{
+	wrapped_->SetWriteQueue(low_watermark, high_watermark);
+}
+
+size_t
+PipelineDecorator::GetWriteQueueSize()
+{
+	return wrapped_->GetWriteQueueSize();
+}
+
+void
+PipelineDecorator::FlushWriteQueue()
+{
+	// Called by the server once the socket is writable again, which is
+	// a good time to try the held back data again.
+	wrapped_->FlushWriteQueue();
+	SendDueData();
+}
+
+void
+PipelineDecorator::SetZeroCopyThreshold(size_t threshold)
+{
+	wrapped_->SetZeroCopyThreshold(threshold);
+}
+
+bool
+PipelineDecorator::ProcessErrorQueue()
+{
+	return wrapped_->ProcessErrorQueue();
+}
+
+void
+PipelineDecorator::ApplySocketOptions(const SocketOptions& options)
+{
+	wrapped_->ApplySocketOptions(options);
+}
+
+void
+PipelineDecorator::SetSchedulingClass(const string& cls, uint32_t weight)
+{
+	wrapped_->SetSchedulingClass(cls, weight);
+}
+
+const string&
+PipelineDecorator::GetSchedulingClass()
+{
+	return wrapped_->GetSchedulingClass();
+}
+
+uint32_t
+PipelineDecorator::GetSchedulingWeight()
+{
+	return wrapped_->GetSchedulingWeight();
+}
+
+int
+PipelineDecorator::GetIncomingCPU()
+{
+	return wrapped_->GetIncomingCPU();
+}
+
+void
+PipelineDecorator::SetWorkerShard(int shard)
+{
+	wrapped_->SetWorkerShard(shard);
+}
+
+int
+PipelineDecorator::GetWorkerShard()
+{
+	return wrapped_->GetWorkerShard();
+}
+
+void
+PipelineDecorator::SetListener(int listener)
+{
+	wrapped_->SetListener(listener);
+}
+
+int
+PipelineDecorator::GetListener()
+{
+	return wrapped_->GetListener();
+}
+
+void
+PipelineDecorator::Shutdown()
+{
+	// We have to deregister ourselves as the client isn't registered.
+	Deregister();
+
+	// Ensure we're the only ones operating on the connection.
+	Lock();
+	if (owned_)
+		wrapped_->Shutdown();
+	delete this;
+}
+
+bool
+PipelineDecorator::IsShutdown()
+{
+	return Connection::IsShutdown() || wrapped_->IsShutdown();
+}
+
+}  // namespace siot
+}  // namespace toolbox
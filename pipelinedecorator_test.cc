@@ -0,0 +1,201 @@
+/**
+ * Tests for the pipeline decorator implementation.
+ */
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <toolbox/scopedptr.h>
+
+#include "siot/connection.h"
+#include "siot/pipelinedecorator.h"
+#include "siot/server.h"
+
+namespace toolbox
+{
+namespace siot
+{
+namespace testing
+{
+using ::testing::InSequence;
+using ::testing::Invoke;
+using ::testing::Return;
+using ::testing::SetErrnoAndReturn;
+using std::string;
+
+class MockConnection : public Connection
+{
+public:
+	MOCK_METHOD2(Receive, string(size_t maxlen, int flags));
+	MOCK_METHOD2(Send, ssize_t(string data, int flags));
+	MOCK_METHOD0(PeerAsText, string());
+	MOCK_METHOD0(GetServer, Server*());
+	MOCK_METHOD0(IsEOF, bool());
+	MOCK_METHOD0(GetLastUse, uint64_t());
+	MOCK_METHOD1(SetBlocking, void(bool));
+	MOCK_METHOD0(Shutdown, void());
+};
+
+class PipelineDecoratorTest : public ::testing::Test
+{
+};
+
+TEST_F(PipelineDecoratorTest, InOrder)
+{
+	MockConnection mc;
+	PipelineDecorator pd(&mc);
+	InSequence s;
+
+	EXPECT_CALL(mc, Send("first\n", 0))
+		.WillOnce(Return(6));
+	EXPECT_CALL(mc, Send("second\n", 0))
+		.WillOnce(Return(7));
+
+	uint64_t one = pd.ReserveSlot();
+	uint64_t two = pd.ReserveSlot();
+	EXPECT_EQ(2, pd.GetPendingSlots());
+	EXPECT_EQ(6, pd.Respond(one, "first\n"));
+	EXPECT_EQ(7, pd.Respond(two, "second\n"));
+	EXPECT_EQ(0, pd.GetPendingSlots());
+}
+
+TEST_F(PipelineDecoratorTest, OutOfOrder)
+{
+	MockConnection mc;
+	PipelineDecorator pd(&mc);
+	InSequence s;
+
+	uint64_t one = pd.ReserveSlot();
+	uint64_t two = pd.ReserveSlot();
+	uint64_t three = pd.ReserveSlot();
+
+	EXPECT_CALL(mc, Send("first\n", 0))
+		.WillOnce(Return(6));
+	EXPECT_CALL(mc, Send("second\n", 0))
+		.WillOnce(Return(7));
+	EXPECT_CALL(mc, Send("third\n", 0))
+		.WillOnce(Return(6));
+
+	// Held back until the first two slots are done.
+	EXPECT_EQ(6, pd.Respond(three, "third\n"));
+	EXPECT_EQ(3, pd.GetPendingSlots());
+	EXPECT_EQ(7, pd.Respond(two, "second\n"));
+	EXPECT_EQ(3, pd.GetPendingSlots());
+	EXPECT_EQ(6, pd.Respond(one, "first\n"));
+	EXPECT_EQ(0, pd.GetPendingSlots());
+}
+
+TEST_F(PipelineDecoratorTest, Streaming)
+{
+	MockConnection mc;
+	PipelineDecorator pd(&mc);
+	InSequence s;
+
+	uint64_t one = pd.ReserveSlot();
+	uint64_t two = pd.ReserveSlot();
+
+	EXPECT_CALL(mc, Send("one, ", 0))
+		.WillOnce(Return(5));
+	EXPECT_CALL(mc, Send("two, ", 0))
+		.WillOnce(Return(5));
+	EXPECT_CALL(mc, Send("three\n", 0))
+		.WillOnce(Return(6));
+	EXPECT_CALL(mc, Send("four\n", 0))
+		.WillOnce(Return(5));
+
+	// Partial data at the front goes out right away.
+	EXPECT_EQ(5, pd.SendToSlot(one, "one, "));
+	EXPECT_EQ(5, pd.SendToSlot(two, "four\n"));
+	EXPECT_EQ(5, pd.SendToSlot(one, "two, "));
+	EXPECT_EQ(6, pd.SendToSlot(one, "three\n"));
+	pd.CompleteSlot(two);
+	pd.CompleteSlot(one);
+	EXPECT_EQ(0, pd.GetPendingSlots());
+}
+
+TEST_F(PipelineDecoratorTest, ShortWrite)
+{
+	MockConnection mc;
+	PipelineDecorator pd(&mc);
+	InSequence s;
+
+	uint64_t one = pd.ReserveSlot();
+	uint64_t two = pd.ReserveSlot();
+
+	EXPECT_CALL(mc, Send("first\n", 0))
+		.WillOnce(Return(2));
+	EXPECT_CALL(mc, Send("rst\n", 0))
+		.Times(4)
+		.WillRepeatedly(SetErrnoAndReturn(EAGAIN, -1));
+	EXPECT_CALL(mc, Send("rst\n", 0))
+		.WillOnce(Return(4));
+	EXPECT_CALL(mc, Send("second\n", 0))
+		.WillOnce(Return(7));
+
+	// The second response has to wait for the rest of the first one,
+	// which is only sent once the caller says so.
+	EXPECT_EQ(6, pd.Respond(one, "first\n"));
+	EXPECT_EQ(7, pd.Respond(two, "second\n"));
+	EXPECT_EQ(2, pd.GetPendingSlots());
+	EXPECT_TRUE(pd.Flush());
+	EXPECT_EQ(0, pd.GetPendingSlots());
+}
+
+TEST_F(PipelineDecoratorTest, SendError)
+{
+	MockConnection mc;
+	PipelineDecorator pd(&mc);
+
+	uint64_t one = pd.ReserveSlot();
+	EXPECT_CALL(mc, Send("first\n", 0))
+		.WillRepeatedly(SetErrnoAndReturn(EPIPE, -1));
+	EXPECT_EQ(-1, pd.Respond(one, "first\n"));
+	EXPECT_EQ(EPIPE, errno);
+}
+
+TEST_F(PipelineDecoratorTest, SendsUnlocked)
+{
+	MockConnection mc;
+	PipelineDecorator pd(&mc);
+	InSequence s;
+	uint64_t two = 0;
+
+	uint64_t one = pd.ReserveSlot();
+
+	// Other requests can be handled while a response is being sent,
+	// and what they send meanwhile goes out right after it.
+	EXPECT_CALL(mc, Send("first\n", 0))
+		.WillOnce(Invoke([&pd, &two](string data, int flags) {
+			two = pd.ReserveSlot();
+			EXPECT_EQ(7, pd.SendToSlot(two, "second\n"));
+			return 6;
+		}));
+	EXPECT_CALL(mc, Send("second\n", 0))
+		.WillOnce(Return(7));
+
+	EXPECT_EQ(6, pd.Respond(one, "first\n"));
+	EXPECT_TRUE(pd.CompleteSlot(two));
+	EXPECT_EQ(0, pd.GetPendingSlots());
+}
+
+TEST_F(PipelineDecoratorTest, InvalidSlot)
+{
+	MockConnection mc;
+	PipelineDecorator pd(&mc);
+
+	EXPECT_THROW(pd.Respond(0, "nothing\n"), ClientConnectionException);
+
+	uint64_t one = pd.ReserveSlot();
+	EXPECT_CALL(mc, Send("first\n", 0))
+		.WillOnce(Return(6));
+	EXPECT_EQ(6, pd.Respond(one, "first\n"));
+	EXPECT_THROW(pd.CompleteSlot(one), ClientConnectionException);
+}
+
+}  // namespace testing
+}  // namespace siot
+}  // namespace toolbox
@@ -31,6 +31,8 @@
 #include "siot/connection.h"
 #include "siot/server.h"
 
+#include <errno.h>
+
 #include <string>
 
 namespace toolbox
@@ -68,6 +70,79 @@ RangeReaderDecorator::Receive(size_t len, int flags)
 	return data;
 }
 
+Buffer
+RangeReaderDecorator::ReceiveBuffer(size_t len, int flags)
+{
+	size_t toread = len;
+
+	if (offset_ >= max_size_)
+		return Buffer();
+
+	if (toread == 0 || toread > max_size_ - offset_)
+		toread = max_size_ - offset_;
+
+	Buffer data = wrapped_->ReceiveBuffer(toread, flags);
+	if (wrapped_->IsEOF())
+		offset_ = max_size_;
+	else
+		offset_ += data.Size();
+	return data;
+}
+
+ssize_t
+RangeReaderDecorator::ReceiveInto(char* buf, size_t len, int flags)
+{
+	if (offset_ >= max_size_)
+		return 0;
+
+	if (len > max_size_ - offset_)
+		len = max_size_ - offset_;
+
+	ssize_t ret = wrapped_->ReceiveInto(buf, len, flags);
+	if (wrapped_->IsEOF())
+		offset_ = max_size_;
+	else if (ret > 0)
+		offset_ += ret;
+	return ret;
+}
+
+IOResult
+RangeReaderDecorator::TryReceiveBuffer(Buffer* data, size_t len, int flags)
+{
+	size_t toread = len;
+
+	*data = Buffer();
+	if (offset_ >= max_size_)
+		return IOResult(kIOClosed);
+
+	if (toread == 0 || toread > max_size_ - offset_)
+		toread = max_size_ - offset_;
+
+	IOResult result = wrapped_->TryReceiveBuffer(data, toread, flags);
+	if (wrapped_->IsEOF())
+		offset_ = max_size_;
+	else if (result.IsOk())
+		offset_ += result.length;
+	return result;
+}
+
+IOResult
+RangeReaderDecorator::TryReceiveInto(char* buf, size_t len, int flags)
+{
+	if (offset_ >= max_size_)
+		return IOResult(kIOClosed);
+
+	if (len > max_size_ - offset_)
+		len = max_size_ - offset_;
+
+	IOResult result = wrapped_->TryReceiveInto(buf, len, flags);
+	if (wrapped_->IsEOF())
+		offset_ = max_size_;
+	else if (result.IsOk())
+		offset_ += result.length;
+	return result;
+}
+
 bool
 RangeReaderDecorator::IsEOF()
 {
@@ -83,6 +158,43 @@ RangeReaderDecorator::Send(string data, int flags)
 		       	"Write attempted on read-only connection");
 }
 
+ssize_t
+RangeReaderDecorator::SendVector(const BufferView* views, size_t count,
+		int flags)
+{
+	throw ClientConnectionException("read-only",
+		       	"Write attempted on read-only connection");
+}
+
+ssize_t
+RangeReaderDecorator::SendBuffer(const Buffer& data, int flags)
+{
+	throw ClientConnectionException("read-only",
+		       	"Write attempted on read-only connection");
+}
+
+IOResult
+RangeReaderDecorator::TrySendVector(const BufferView* views, size_t count,
+		int flags)
+{
+	return IOResult(kIOError, 0, EBADF);
+}
+
+ssize_t
+RangeReaderDecorator::SendZeroCopy(const char* data, size_t len,
+		google::protobuf::Closure* release, int flags)
+{
+	throw ClientConnectionException("read-only",
+		       	"Write attempted on read-only connection");
+}
+
+ssize_t
+RangeReaderDecorator::SendFile(int fd, off_t offset, size_t len)
+{
+	throw ClientConnectionException("read-only",
+		       	"Write attempted on read-only connection");
+}
+
 void
 RangeReaderDecorator::Shutdown()
 {
@@ -126,10 +238,94 @@ RangeReaderDecorator::SetBlocking(bool blocking)
 	wrapped_->SetBlocking(blocking);
 }
 
+void
+RangeReaderDecorator::SetWriteQueue(size_t low_watermark, size_t high_watermark)
+{
+	wrapped_->SetWriteQueue(low_watermark, high_watermark);
+}
+
+size_t
+RangeReaderDecorator::GetWriteQueueSize()
+{
+	return wrapped_->GetWriteQueueSize();
+}
+
+void
+RangeReaderDecorator::FlushWriteQueue()
+{
+	wrapped_->FlushWriteQueue();
+}
+
+void
+RangeReaderDecorator::SetZeroCopyThreshold(size_t threshold)
+{
+	wrapped_->SetZeroCopyThreshold(threshold);
+}
+
+bool
+RangeReaderDecorator::ProcessErrorQueue()
+{
+	return wrapped_->ProcessErrorQueue();
+}
+
+void
+RangeReaderDecorator::ApplySocketOptions(const SocketOptions& options)
+{
+	wrapped_->ApplySocketOptions(options);
+}
+
+void
+RangeReaderDecorator::SetSchedulingClass(const string& cls, uint32_t weight)
+{
+	wrapped_->SetSchedulingClass(cls, weight);
+}
+
+const string&
+RangeReaderDecorator::GetSchedulingClass()
+{
+	return wrapped_->GetSchedulingClass();
+}
+
+uint32_t
+RangeReaderDecorator::GetSchedulingWeight()
+{
+	return wrapped_->GetSchedulingWeight();
+}
+
+int
+RangeReaderDecorator::GetIncomingCPU()
+{
+	return wrapped_->GetIncomingCPU();
+}
+
+void
+RangeReaderDecorator::SetWorkerShard(int shard)
+{
+	wrapped_->SetWorkerShard(shard);
+}
+
+int
+RangeReaderDecorator::GetWorkerShard()
+{
+	return wrapped_->GetWorkerShard();
+}
+
+void
+RangeReaderDecorator::SetListener(int listener)
+{
+	wrapped_->SetListener(listener);
+}
+
+int
+RangeReaderDecorator::GetListener()
+{
+	return wrapped_->GetListener();
+}
+
 bool
 RangeReaderDecorator::IsShutdown()
 {
-	return wrapped_->IsShutdown();
+	return Connection::IsShutdown() || wrapped_->IsShutdown();
 }
 }  // namespace siot
 }  // namespace toolbox
@@ -8,6 +8,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <errno.h>
 
 #include <toolbox/scopedptr.h>
 
@@ -117,6 +118,32 @@ TEST_F(RangeReaderDecoratorTest, ReadPartialUnbounded)
 	rr->Shutdown();
 }
 
+TEST_F(RangeReaderDecoratorTest, TryReceiveBounded)
+{
+	MockConnection mc;
+	RangeReaderDecorator rr(&mc, 12);
+	char buf[32];
+
+	EXPECT_CALL(mc, Receive(12, MSG_DONTWAIT))
+		.WillOnce(Return("hello "));
+	EXPECT_CALL(mc, Receive(6, MSG_DONTWAIT))
+		.WillOnce(Return("world\n"));
+	EXPECT_CALL(mc, IsEOF())
+		.WillRepeatedly(Return(false));
+
+	IOResult result = rr.TryReceiveInto(buf, sizeof(buf));
+	EXPECT_EQ(kIOOk, result.status);
+	EXPECT_EQ(6, result.length);
+	result = rr.TryReceiveInto(buf, sizeof(buf));
+	EXPECT_EQ(kIOOk, result.status);
+	EXPECT_EQ("world\n", string(buf, result.length));
+	EXPECT_EQ(kIOClosed, rr.TryReceiveInto(buf, sizeof(buf)).status);
+
+	result = rr.TrySendBuffer(Buffer("foo", 3));
+	EXPECT_EQ(kIOError, result.status);
+	EXPECT_EQ(EBADF, result.error);
+}
+
 }  // namespace testing
 }  // namespace siot
 }  // namespace toolbox
@@ -27,8 +27,12 @@
  * OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <algorithm>
+#include <chrono>
 #include <string>
 #include <sstream>
+#include <thread>
+#include <vector>
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
@@ -55,6 +59,17 @@
 #ifdef HAVE_MEMORY_H
 #include <memory.h>
 #endif /* HAVE_MEMORY_H */
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif /* HAVE_SYS_MMAN_H */
+#ifdef HAVE_SYS_TIMERFD_H
+#include <sys/timerfd.h>
+#endif /* HAVE_SYS_TIMERFD_H */
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif /* HAVE_FCNTL_H */
+#include <sys/stat.h>
+#include <sys/un.h>
 
 #ifdef HAVE_SYS_ERRNO_H
 #include <sys/errno.h>
@@ -81,7 +96,13 @@
 #include <toolbox/expvar.h>
 #include <thread++/mutex.h>
 
+#include "siot/bufferpool.h"
+#include "siot/loopbackconnection.h"
 #include "siot/server.h"
+#include "siot/sharedmemoryconnection.h"
+#include "fairscheduler.h"
+#include "threadplacement.h"
+#include "workershard.h"
 
 #ifdef _POSIX_SOURCE
 #include "unixsocketconnection.h"
@@ -97,10 +118,20 @@ namespace toolbox
 namespace siot
 {
 using ssl::OpenSSLConnection;
+using threadpp::Mutex;
 using threadpp::MutexLock;
 using threadpp::ReadMutexLock;
 
 static ExpMap<int64_t> client_connection_errors("client-connection-errors");
+static ExpMap<int64_t> steering("siot-connection-steering");
+static ExpMap<int64_t> migrations("siot-connection-migrations");
+
+// Shards which have run fewer callbacks than this since the last check are
+// never considered overloaded; the numbers would mostly be noise.
+static const uint64_t kMinRebalanceDispatches = 64;
+
+// How much of a file Connection::SendFile() maps into memory at a time.
+static const size_t kSendFileChunkSize = 1 << 20;
 #ifdef _POSIX_SOURCE
 static ExpMap<int64_t> accept_errors("accept-errors");
 #ifdef HAVE_EPOLL_CREATE
@@ -109,6 +140,100 @@ static ExpMap<int64_t> epoll_errors("siot-epoll-errors");
 // This should always be 0, but we leave it here for spotting bugs.
 static ExpVar<int64_t> read_after_close("read-after-close");
 #endif /* HAVE_EPOLL_CREATE */
+static ExpMap<int64_t> handovers("siot-handovers");
+static ExpMap<int64_t> listener_rejections("siot-listener-rejections");
+
+// The kinds of messages passed from a server to its successor over the hand
+// over socket. Each message is a single packet, carrying the file descriptor
+// it is about.
+static const char kHandOverListener = 'L';
+static const char kHandOverConnection = 'C';
+static const char kHandOverDone = 'D';
+
+// The largest state ConnectionCallback::SaveState() may store.
+static const size_t kMaxHandOverState = 65536;
+
+// Sends a message of type "type" about the descriptor "fd" (if it isn't -1)
+// with the contents "data" over the hand over socket "sock".
+static bool
+SendHandOverMessage(int sock, char type, int fd, const string& data)
+{
+	struct msghdr msg;
+	struct iovec iov[2];
+	char control[CMSG_SPACE(sizeof(int))];
+
+	memset(&msg, 0, sizeof(msg));
+	iov[0].iov_base = &type;
+	iov[0].iov_len = 1;
+	iov[1].iov_base = const_cast<char*>(data.data());
+	iov[1].iov_len = data.length();
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+
+	if (fd != -1)
+	{
+		memset(control, 0, sizeof(control));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	}
+
+	return sendmsg(sock, &msg, MSG_NOSIGNAL) == (ssize_t) data.length() + 1;
+}
+
+// Receives a message from the hand over socket "sock" into "type", "fd"
+// (-1 if there was no descriptor) and "data".
+static bool
+ReceiveHandOverMessage(int sock, char* type, int* fd, string* data)
+{
+	std::vector<char> buf(kMaxHandOverState + 1);
+	struct msghdr msg;
+	struct iovec iov;
+	char control[CMSG_SPACE(sizeof(int))];
+	int flags = 0;
+
+#ifdef MSG_CMSG_CLOEXEC
+	flags |= MSG_CMSG_CLOEXEC;
+#endif /* MSG_CMSG_CLOEXEC */
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = buf.data();
+	iov.iov_len = buf.size();
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	ssize_t len = recvmsg(sock, &msg, flags);
+	if (len <= 0)
+		return false;
+
+	*fd = -1;
+	for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+			cmsg = CMSG_NXTHDR(&msg, cmsg))
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+				cmsg->cmsg_type == SCM_RIGHTS)
+			memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+
+	*type = buf[0];
+	data->assign(buf.data() + 1, len - 1);
+	return !(msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC));
+}
+
+// Determines whether "fd" refers to a socket.
+static bool
+IsSocket(int fd)
+{
+	int type;
+	socklen_t len = sizeof(type);
+
+	return getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) == 0;
+}
 #endif /* _POSIX_SOURCE */
 
 ServerSetupException::ServerSetupException(const string& errmsg) noexcept
@@ -143,10 +268,16 @@ ClientConnectionException::identifier() const noexcept
 Server::Server(string addr, ConnectionCallback* connected,
 		uint32_t num_threads)
 : connected_(connected), ssl_context_(0), executor_(num_threads + 1),
-	maxconn_(num_threads), num_threads_(num_threads), max_idle_(-1),
-	running_(true)
+	scheduler_(new FairScheduler), maxconn_(num_threads),
+	num_threads_(num_threads), max_idle_(-1),
+	running_(true), deliver_data_(false), write_queue_(false),
+	write_queue_low_(0), write_queue_high_(0), zerocopy_threshold_(0),
+	reactor_priority_(0), numa_aware_(false), max_imbalance_(0),
+	waiters_lock_(Mutex::Create()), last_timer_id_(0)
 #ifdef _POSIX_SOURCE
-	 , connections_lock_(ReadWriteMutex::Create())
+	 , handover_connections_(false), handoverfd_(-1), handed_over_(false),
+	 inherited_listener_(false), shm_capacity_(0), shmfd_(-1),
+	 connections_lock_(ReadWriteMutex::Create()), last_injected_id_(0)
 #endif /* _POSIX_SOURCE */
 {
 #ifdef _POSIX_SOURCE
@@ -172,9 +303,34 @@ Server::~Server()
 		freeaddrinfo(info_);
 		info_ = 0;
 	}
-	shutdown(serverfd_, SHUT_RDWR);
-	close(serverfd_);
+	// Once the listening socket has been handed over, it belongs to the
+	// successor.
+	if (serverfd_ != -1)
+	{
+		shutdown(serverfd_, SHUT_RDWR);
+		close(serverfd_);
+	}
+	if (handoverfd_ != -1)
+	{
+		close(handoverfd_);
+		unlink(handover_path_.c_str());
+	}
+	if (shmfd_ != -1)
+	{
+		close(shmfd_);
+		unlink(shm_path_.c_str());
+	}
+	for (Listener* listener : listeners_)
+		delete listener;
+	for (std::pair<int, string*> inherited : inherited_)
+	{
+		close(inherited.first);
+		delete inherited.second;
+	}
 #endif /* _POSIX_SOURCE */
+
+	for (WorkerShard* shard : shards_)
+		delete shard;
 }
 
 void
@@ -215,17 +371,29 @@ Server::ListenEpoll()
 				this,
 				&Server::ReapConnectionsEpoll));
 
-	error = c_bind2addrinfo(serverfd_, info_);
-	if (error)
+	PinCurrentThread(reactor_cpus_);
+	if (reactor_priority_ > 0)
+		SetCurrentThreadPriority(reactor_priority_);
+
+	// An inherited listening socket is already set up.
+	if (!inherited_listener_)
 	{
-		close(serverfd_);
-		freeaddrinfo(info_);
-		info_ = 0;
-		throw ServerSetupException(strerror(errno));
-	}
+		socket_options_.ApplyToListener(serverfd_);
 
-	if (listen(serverfd_, maxconn_))
-		throw ServerSetupException(strerror(errno));
+		error = c_bind2addrinfo(serverfd_, info_);
+		if (error)
+		{
+			close(serverfd_);
+			freeaddrinfo(info_);
+			info_ = 0;
+			throw ServerSetupException(strerror(errno));
+		}
+
+		if (listen(serverfd_, maxconn_))
+			throw ServerSetupException(strerror(errno));
+
+		socket_options_.ApplyAfterListen(serverfd_);
+	}
 
 	epollfd_ = epoll_create(num_threads_);
 	if (epollfd_ == -1)
@@ -244,11 +412,107 @@ Server::ListenEpoll()
 		throw ServerSetupException("epoll_ctl: " +
 				string(strerror(errno)));
 
+	for (Listener* listener : listeners_)
+	{
+		OpenListener(listener);
+
+		ev.events = EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP;
+		ev.data.fd = listener->fd;
+		if (epoll_ctl(epollfd_, EPOLL_CTL_ADD, listener->fd, &ev) == -1)
+			throw ServerSetupException("epoll_ctl: " +
+					string(strerror(errno)));
+	}
+
+	if (!handover_path_.empty())
+	{
+		struct sockaddr_un addr;
+
+		if (handover_path_.length() >= sizeof(addr.sun_path))
+			throw ServerSetupException("handover path too long: " +
+					handover_path_);
+
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strcpy(addr.sun_path, handover_path_.c_str());
+
+		// A previous instance is done with the socket by now.
+		unlink(handover_path_.c_str());
+		handoverfd_ = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+		if (handoverfd_ == -1 ||
+				bind(handoverfd_, (struct sockaddr*) &addr,
+					sizeof(addr)) == -1 ||
+				listen(handoverfd_, 1) == -1)
+			throw ServerSetupException("handover: " +
+					string(strerror(errno)));
+
+		ev.events = EPOLLIN;
+		ev.data.fd = handoverfd_;
+		if (epoll_ctl(epollfd_, EPOLL_CTL_ADD, handoverfd_, &ev) == -1)
+			throw ServerSetupException("epoll_ctl: " +
+					string(strerror(errno)));
+	}
+
+	if (!shm_path_.empty())
+	{
+		struct sockaddr_un addr;
+
+		if (shm_path_.length() >= sizeof(addr.sun_path))
+			throw ServerSetupException("shared memory path too "
+					"long: " + shm_path_);
+
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strcpy(addr.sun_path, shm_path_.c_str());
+
+		unlink(shm_path_.c_str());
+		shmfd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (shmfd_ == -1 ||
+				bind(shmfd_, (struct sockaddr*) &addr,
+					sizeof(addr)) == -1 ||
+				listen(shmfd_, maxconn_) == -1)
+			throw ServerSetupException("shared memory: " +
+					string(strerror(errno)));
+
+		ev.events = EPOLLIN;
+		ev.data.fd = shmfd_;
+		if (epoll_ctl(epollfd_, EPOLL_CTL_ADD, shmfd_, &ev) == -1)
+			throw ServerSetupException("epoll_ctl: " +
+					string(strerror(errno)));
+	}
+
+	// Carry on with the connections of the previous instance.
+	for (std::pair<int, string*> inherited : inherited_)
+	{
+		struct sockaddr_storage addr;
+		socklen_t addrlen = sizeof(addr);
+
+		memset(&addr, 0, sizeof(addr));
+		getpeername(inherited.first, (struct sockaddr*) &addr,
+				&addrlen);
+
+		Connection* decorated = AddConnectionEpoll(inherited.first,
+				&addr, true);
+		if (!decorated)
+		{
+			delete inherited.second;
+			continue;
+		}
+
+		decorated->ReadLock();
+		Dispatch(decorated, google::protobuf::NewCallback(this,
+					&Server::RestoreAndUnlock, decorated,
+					inherited.second));
+	}
+	inherited_.clear();
+
 	memset(events, 0, num_threads_ * sizeof(struct epoll_event));
 
 	while (running_)
 	{
+		// While draining, connections may also go away without
+		// any events, e.g. when they're reaped.
 		int nfds = epoll_wait(epollfd_, events, num_threads_,
+				handed_over_ ? 1000 :
 				max_idle_ < 0 ? -1 : max_idle_ * 1000);
 		if (nfds == -1)
 		{
@@ -269,18 +533,38 @@ Server::ListenEpoll()
 
 		for (int n = 0; n < nfds; ++n)
 		{
-			if (events[n].data.fd == serverfd_)
+			if (events[n].data.fd == handoverfd_)
+				HandOverEpoll();
+			else if (events[n].data.fd == shmfd_)
+				AcceptSharedMemoryEpoll();
+			else if (events[n].data.fd == serverfd_ ||
+					FindListener(events[n].data.fd) >= 0)
 			{
 				// A connection is waiting on the server
 				// socket. We just accept it and wait for
 				// data on it.
-				ScopedPtr<struct sockaddr_storage> addr(
-						new sockaddr_storage);
+				const int listenfd = events[n].data.fd;
+				const int listener = FindListener(listenfd);
+				struct sockaddr_storage addr;
 				socklen_t addrlen =
 					sizeof(struct sockaddr_storage);
-				int clientfd = accept(serverfd_,
-						(struct sockaddr*) addr.Get(),
+				// Connections are edge triggered, so their
+				// sockets must be non-blocking: handlers read
+				// until there's nothing left.
+#ifdef HAVE_ACCEPT4
+				int clientfd = accept4(listenfd,
+						(struct sockaddr*) &addr,
+						&addrlen,
+						SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else /* !HAVE_ACCEPT4 */
+				int clientfd = accept(listenfd,
+						(struct sockaddr*) &addr,
 						&addrlen);
+				if (clientfd != -1)
+					fcntl(clientfd, F_SETFL,
+						fcntl(clientfd, F_GETFL, 0) |
+						O_NONBLOCK);
+#endif /* HAVE_ACCEPT4 */
 				if (clientfd == -1)
 				{
 					string errmsg =
@@ -290,87 +574,91 @@ Server::ListenEpoll()
 					continue;
 				}
 
-				Connection* conn;
-				if (ssl_context_)
+				if (listener >= 0 &&
+						listeners_[listener]->maxconn > 0 &&
+						listeners_[listener]->connections >=
+						listeners_[listener]->maxconn)
 				{
-					try
-					{
-						conn = new OpenSSLConnection(
-								this, clientfd,
-								addr.Release(),
-								ssl_context_);
-					}
-					catch (ClientConnectionException e)
-					{
-						client_connection_errors.Add(
-								e.identifier(),
-								1);
-					}
-				}
-				else
-				{
-					try
-					{
-						conn = new UNIXSocketConnection(
-								this, clientfd,
-								addr.Release());
-					}
-					catch (ClientConnectionException e)
-					{
-						client_connection_errors.Add(
-								e.identifier(),
-								1);
-					}
+					close(clientfd);
+					listener_rejections.Add(
+						listeners_[listener]->addr, 1);
+					continue;
 				}
-				connections_lock_->Lock();
-				connections_[clientfd] =
-					connected_->AddDecorators(conn);
-				connections_lock_->Unlock();
+
+				// With deferred accepts, the first request is
+				// most likely already waiting, so we read it
+				// right away and only start watching for more
+				// data afterwards.
+				bool speculate = deliver_data_ &&
+					socket_options_.GetDeferAccept() > 0 &&
+					(listener < 0 ||
+					 listeners_[listener]->info);
+
+				Connection* decorated = AddConnectionEpoll(
+						clientfd, &addr, !speculate,
+						listener);
 				memset(events, 0, num_threads_ *
 						sizeof(struct epoll_event));
-
-				ev.events = EPOLLIN | EPOLLRDHUP | EPOLLERR |
-					EPOLLHUP | EPOLLET;
-				ev.data.fd = clientfd;
-
-				if (epoll_ctl(epollfd_, EPOLL_CTL_ADD,
-							clientfd, &ev) == -1)
-				{
-					string errmsg =
-						string(strerror(errno));
-					connected_->ConnectionFailed(
-								"epoll_ctl: " +
-								errmsg);
-					epoll_errors.Add(errmsg, 1);
+				if (!decorated)
 					continue;
-				}
 
-				// Run connected_->ConnectionEstablished(conn)
-				conn->ReadLock();
+				// Run connected_->ConnectionEstablished() with the
+				// same connection the other callbacks will see.
+				decorated->ReadLock();
 				google::protobuf::Closure* cc =
 					google::protobuf::NewCallback(
-							connected_.Get(),
+							CallbackFor(decorated),
 							&ConnectionCallback::ConnectionEstablished,
-							conn);
-				executor_.Add(google::protobuf::NewCallback(
+							decorated);
+				Dispatch(decorated,
+						google::protobuf::NewCallback(
 							this,
 							&Server::LockCallAndUnlock,
-							cc, conn));
+							cc, decorated));
+
+				if (speculate)
+				{
+					decorated->ReadLock();
+					Dispatch(decorated,
+						google::protobuf::NewCallback(
+							this,
+							&Server::SpeculateAndUnlock,
+							decorated, clientfd));
+				}
 			}
+			else if (events[n].data.fd > 0 &&
+					FireTimer(events[n].data.fd))
+				continue;
 			else if (events[n].data.fd > 0)
 			{
-				Connection* conn = connections_[
-					events[n].data.fd];
+				std::map<int, Connection*>::iterator it =
+					connections_.find(events[n].data.fd);
+				Connection* conn = it == connections_.end() ?
+					0 : it->second;
+
+				// Push out whatever is left in the write
+				// queue. This doesn't block, so we can just
+				// do it right here.
+				if (conn && (events[n].events & EPOLLOUT))
+					conn->FlushWriteQueue();
+
+				// Completed zero-copy sends are reported
+				// through the error queue; those aren't
+				// errors of the connection.
+				if (conn && (events[n].events & EPOLLERR) &&
+						conn->ProcessErrorQueue())
+					events[n].events &= ~EPOLLERR;
+
 				if (conn && (events[n].events & (EPOLLHUP |
 								EPOLLRDHUP)))
 				{
 					// Call connected_->ConnectionTerminated(conn);
 					google::protobuf::Closure* cc =
 						google::protobuf::NewCallback(
-							connected_.Get(),
+							CallbackFor(conn),
 							&ConnectionCallback::ConnectionTerminated,
 							conn);
-					executor_.Add(cc);
+					Dispatch(conn, cc);
 					conn->Shutdown();
 				}
 				else if (conn && (events[n].events & EPOLLERR))
@@ -379,17 +667,16 @@ Server::ListenEpoll()
 					conn->ReadLock();
 					google::protobuf::Closure* cc =
 						google::protobuf::NewCallback(
-							connected_.Get(),
+							CallbackFor(conn),
 							&ConnectionCallback::Error,
 							conn);
-					executor_.Add(google::protobuf::NewCallback(
+					Dispatch(conn, google::protobuf::NewCallback(
 								this,
 								&Server::LockCallAndUnlock,
 								cc, conn));
 				}
 				else if (conn && (events[n].events & EPOLLIN))
 				{
-					// Call connected_->DataReady(conn);
 					connections_lock_->Lock();
 					if (connections_.find(events[n].data.fd)
 							== connections_.end())
@@ -398,22 +685,21 @@ Server::ListenEpoll()
 						read_after_close.Add(1);
 						continue;
 					}
-					conn->ReadLock();
-					google::protobuf::Closure* cc =
-						google::protobuf::NewCallback(
-							connected_.Get(),
-							&ConnectionCallback::DataReady,
-							conn);
-					executor_.Add(google::protobuf::NewCallback(
-								this,
-								&Server::LockCallAndUnlock,
-								cc, conn));
+					DispatchReadableLocked(conn);
 					connections_lock_->Unlock();
 				}
 			}
 		}
 
 		memset(events, 0, num_threads_ * sizeof(struct epoll_event));
+
+		// After a hand over, we're done once the last connection is.
+		if (handed_over_)
+		{
+			ReadMutexLock l(connections_lock_.Get());
+			if (connections_.empty())
+				running_ = false;
+		}
 	}
 }
 
@@ -423,33 +709,47 @@ Server::ReapConnectionsEpoll()
 	// TODO(caoimhe): Lock the same lock as above.
 	std::mutex m;
 	const uint64_t max_idle = (uint64_t) max_idle_;
+	size_t lingering = 0;
 
 	while (running_)
 	{
 		std::unique_lock<std::mutex> l(m);
 
+		// Check back soon while closed connections still hold on to
+		// the memory of zero-copy sends.
 		connections_updated_.wait_for(l,
-				std::chrono::milliseconds(max_idle_ > 2 ?
+				std::chrono::milliseconds(
+					max_idle_ > 2 && lingering == 0 ?
 					max_idle_ * 500 : 500));
 
 		if (!running_)
 			break;
 
+		lingering = UNIXSocketConnection::ReapZeroCopy();
+
+		if (numa_aware_)
+			UpdateNUMAStatistics();
+
 		MutexLock lk(connections_lock_.Get());
 		const uint64_t tm = time(NULL);
 
-		for (std::pair<int, Connection*> s : connections_)
+		std::map<int, Connection*>::iterator it = connections_.begin();
+		while (it != connections_.end())
 		{
-			Connection* conn = s.second;
+			const int fd = it->first;
+			Connection* conn = it->second;
 
 			if (conn->IsShutdown() ||
 					(max_idle_ > 0 &&
 					 tm - conn->GetLastUse() > max_idle))
 			{
-				connections_.erase(s.first);
+				it = connections_.erase(it);
 
-				if (epoll_ctl(epollfd_, EPOLL_CTL_DEL,
-							s.first, NULL) == -1)
+				// Injected connections aren't watched by
+				// epoll and have negative numbers.
+				if (fd >= 0 && epoll_ctl(epollfd_,
+							EPOLL_CTL_DEL, fd,
+							NULL) == -1)
 				{
 					string errmsg =
 						string(strerror(errno));
@@ -459,163 +759,1719 @@ Server::ReapConnectionsEpoll()
 					epoll_errors.Add(errmsg, 1);
 				}
 
+				ReleaseListener(conn);
 				if (!conn->IsShutdown())
 				{
+					CallbackFor(conn)->ConnectionTerminated(
+							conn);
 					conn->Shutdown();
-					connected_->ConnectionTerminated(conn);
 				}
 			}
+			else
+				++it;
 		}
+
+		RebalanceShardsLocked();
 	}
 }
-#endif /* HAVE_EPOLL_CREATE */
 
-void
-Server::LockCallAndUnlock(Closure* c, Connection* conn)
+Connection*
+Server::AddConnectionEpoll(int fd, struct sockaddr_storage* addr,
+		bool watch_input, int listener)
 {
-	ReadMutexLock l(connections_lock_.Get());
-	c->Run();
-	conn->Unlock();
-}
-#endif /* _POSIX_SOURCE */
+	const ServerSSLContext* ssl_context = listener < 0 ? ssl_context_ :
+		listeners_[listener]->ssl_context;
+	struct epoll_event ev;
+	Connection* conn = 0;
 
-Server*
-Server::SetMaxConnections(int maxconn)
-{
-	maxconn_ = maxconn;
-	return this;
-}
+	try
+	{
+		if (ssl_context)
+			conn = new OpenSSLConnection(this, fd, addr,
+					ssl_context);
+		else
+			conn = new UNIXSocketConnection(this, fd, addr);
+	}
+	catch (ClientConnectionException e)
+	{
+		client_connection_errors.Add(e.identifier(), 1);
+	}
+	if (!conn)
+	{
+		close(fd);
+		return 0;
+	}
+	if (write_queue_)
+		conn->SetWriteQueue(write_queue_low_, write_queue_high_);
+	if (zerocopy_threshold_ > 0)
+		conn->SetZeroCopyThreshold(zerocopy_threshold_);
+	if (listener < 0 || listeners_[listener]->info)
+		conn->ApplySocketOptions(socket_options_);
+	if (listener >= 0)
+	{
+		conn->SetListener(listener);
+		++listeners_[listener]->connections;
+	}
+	AssignWorkerShard(conn, fd);
 
-Server*
-Server::SetConnectionCallback(ConnectionCallback* connected)
-{
-	connected_.Reset(connected);
-	return this;
+	Connection* decorated = CallbackFor(conn)->AddDecorators(conn);
+	connections_lock_->Lock();
+	connections_[fd] = decorated;
+	connections_lock_->Unlock();
+
+	ev.events = EPOLLRDHUP | EPOLLERR | EPOLLHUP | EPOLLET;
+	if (watch_input)
+		ev.events |= EPOLLIN;
+	ev.data.fd = fd;
+
+	if (epoll_ctl(epollfd_, EPOLL_CTL_ADD, fd, &ev) == -1)
+	{
+		string errmsg = string(strerror(errno));
+		ConnectionCallback* cb = CallbackFor(conn);
+
+		// Nobody will ever hear from the connection, so it mustn't
+		// keep its slot with the listener.
+		connections_lock_->Lock();
+		connections_.erase(fd);
+		connections_lock_->Unlock();
+		ReleaseListener(conn);
+		decorated->Shutdown();
+
+		cb->ConnectionFailed("epoll_ctl: " + errmsg);
+		epoll_errors.Add(errmsg, 1);
+		return 0;
+	}
+
+	return decorated;
 }
 
-Server*
-Server::SetServerSSLContext(const ServerSSLContext* context)
+void
+Server::AcceptSharedMemoryEpoll()
 {
-	ssl_context_ = context;
-	return this;
+	struct epoll_event ev;
+	SharedMemoryConnection* conn = 0;
+
+	int sock = accept(shmfd_, 0, 0);
+	if (sock == -1)
+	{
+		string errmsg = string(strerror(errno));
+		connected_->ConnectionFailed(errmsg);
+		accept_errors.Add(errmsg, 1);
+		return;
+	}
+
+	try
+	{
+		conn = SharedMemoryConnection::Accept(this, sock,
+				shm_capacity_);
+	}
+	catch (ClientConnectionException e)
+	{
+		client_connection_errors.Add(e.identifier(), 1);
+		return;
+	}
+
+	// The connection is known by its event descriptor, which becomes
+	// readable when data arrives. Its socket only reports the client
+	// hanging up, so it's filed under the same number.
+	const int fd = conn->GetEventFD();
+	AssignWorkerShard(conn, fd);
+
+	Connection* decorated = CallbackFor(conn)->AddDecorators(conn);
+	connections_lock_->Lock();
+	connections_[fd] = decorated;
+	connections_lock_->Unlock();
+
+	// Run connected_->ConnectionEstablished() with the same connection
+	// the other callbacks will see.
+	decorated->ReadLock();
+	google::protobuf::Closure* cc = google::protobuf::NewCallback(
+			CallbackFor(decorated),
+			&ConnectionCallback::ConnectionEstablished, decorated);
+	Dispatch(decorated, google::protobuf::NewCallback(this,
+				&Server::LockCallAndUnlock, cc, decorated));
+
+	// Anything the client sent already is reported right away.
+	ev.events = EPOLLIN | EPOLLET;
+	ev.data.fd = fd;
+	if (epoll_ctl(epollfd_, EPOLL_CTL_ADD, fd, &ev) == -1)
+	{
+		string errmsg = string(strerror(errno));
+		connected_->ConnectionFailed("epoll_ctl: " + errmsg);
+		epoll_errors.Add(errmsg, 1);
+	}
+
+	ev.events = EPOLLRDHUP | EPOLLHUP | EPOLLET;
+	if (epoll_ctl(epollfd_, EPOLL_CTL_ADD, conn->GetSocket(), &ev) == -1)
+	{
+		string errmsg = string(strerror(errno));
+		connected_->ConnectionFailed("epoll_ctl: " + errmsg);
+		epoll_errors.Add(errmsg, 1);
+	}
 }
 
 void
-Server::DeferShutdown(Connection* conn)
+Server::HandOverEpoll()
 {
-	// Run conn->Shutdown(). Will not take the connection lock.
-	google::protobuf::Closure* cc =
-		google::protobuf::NewCallback(conn, &Connection::Shutdown);
-	executor_.Add(cc);
+	int ctl = accept(handoverfd_, 0, 0);
+	if (ctl == -1)
+	{
+		handovers.Add("accept: " + string(strerror(errno)), 1);
+		return;
+	}
+
+	// If not even the listening socket makes it over, we just carry on.
+	if (!SendHandOverMessage(ctl, kHandOverListener, serverfd_, ""))
+	{
+		handovers.Add("send: " + string(strerror(errno)), 1);
+		close(ctl);
+		return;
+	}
+
+	// Closing our descriptor leaves the socket and its accept queue
+	// alone, since the successor holds another one.
+	epoll_ctl(epollfd_, EPOLL_CTL_DEL, serverfd_, NULL);
+	close(serverfd_);
+	serverfd_ = -1;
+	handovers.Add("listener", 1);
+
+	if (handover_connections_ && !ssl_context_)
+		HandOverConnectionsEpoll(ctl);
+
+	// The successor takes the path over for the next restart.
+	epoll_ctl(epollfd_, EPOLL_CTL_DEL, handoverfd_, NULL);
+	close(handoverfd_);
+	handoverfd_ = -1;
+	unlink(handover_path_.c_str());
+
+	if (!SendHandOverMessage(ctl, kHandOverDone, -1, ""))
+		handovers.Add("send: " + string(strerror(errno)), 1);
+	close(ctl);
+	handed_over_ = true;
 }
 
 void
-Server::DequeueConnection(Connection* conn)
+Server::HandOverConnectionsEpoll(int ctl)
 {
-	for (std::pair<int, Connection*> it : connections_)
+	std::vector<Connection*> released;
+
 	{
-		if (it.second == conn)
+		MutexLock l(connections_lock_.Get());
+		std::map<int, Connection*>::iterator it = connections_.begin();
+
+		while (it != connections_.end())
 		{
-			MutexLock l(connections_lock_.Get());
-			connections_.erase(it.first);
+			const int fd = it->first;
+			Connection* conn = it->second;
+			bool busy;
+			string state;
 
-			if (epoll_ctl(epollfd_, EPOLL_CTL_DEL, it.first, NULL)
-					== -1 && errno != EBADFD)
+			// Connections someone is waiting for, or which still
+			// have data to send, are finished here.
 			{
-				string errmsg =
-					string(strerror(errno));
-				connected_->ConnectionFailed(
-						"epoll_ctl: " + errmsg);
-				epoll_errors.Add(errmsg, 1);
+				MutexLock wl(waiters_lock_.Get());
+				busy = read_waiters_.count(conn) > 0 ||
+					drain_waiters_.count(conn) > 0;
+				for (std::pair<const int, Timer>& timer :
+						timers_)
+					if (timer.second.conn == conn)
+						busy = true;
+			}
+			if (fd < 0 || !IsSocket(fd) || conn->GetListener() >= 0)
+			{
+				// Only sockets accepted on the address the
+				// server was created for can be passed on;
+				// the successor has no other listeners yet.
+				handovers.Add("kept", 1);
+				++it;
+				continue;
+			}
+			if (busy || conn->IsShutdown() ||
+					conn->GetWriteQueueSize() > 0 ||
+					!conn->TryLock())
+			{
+				handovers.Add("busy", 1);
+				++it;
+				continue;
 			}
 
-			connections_updated_.notify_one();
+			bool saved = CallbackFor(conn)->SaveState(conn, &state);
+			conn->Unlock();
+			if (!saved || state.length() > kMaxHandOverState ||
+					!SendHandOverMessage(ctl,
+						kHandOverConnection, fd, state))
+			{
+				handovers.Add("kept", 1);
+				++it;
+				continue;
+			}
+
+			it = connections_.erase(it);
+			epoll_ctl(epollfd_, EPOLL_CTL_DEL, fd, NULL);
+
+			// Shutting the connection down would shut down the
+			// socket the successor now uses, so we point the
+			// descriptor at a placeholder first.
+			int placeholder = socket(AF_UNIX, SOCK_STREAM, 0);
+			if (placeholder != -1)
+			{
+				dup2(placeholder, fd);
+				close(placeholder);
+			}
+			released.push_back(conn);
+			handovers.Add("connection", 1);
 		}
 	}
-}
-
-void
-Server::SetMaxIdle(int max_idle)
-{
-	max_idle_ = max_idle;
-}
 
-Connection::Connection()
-: mtx_(ReadWriteMutex::Create()), is_shutdown_(false)
-{
+	// The callback has to see the connection before its memory goes
+	// back to the freelist.
+	for (Connection* conn : released)
+	{
+		CallbackFor(conn)->ConnectionTerminated(conn);
+		conn->Shutdown();
+	}
 }
+#endif /* HAVE_EPOLL_CREATE */
 
-Connection::~Connection()
+Server::Listener::Listener()
+: info(0), fd(-1), connected(0), ssl_context(0), maxconn(0), connections(0)
 {
 }
 
-void
-Connection::Shutdown()
+Server::Listener::~Listener()
 {
-	Deregister();
+	if (fd != -1)
+		close(fd);
+	if (fd != -1 && !path.empty())
+		unlink(path.c_str());
+	if (info)
+		freeaddrinfo(info);
+	delete connected;
+	delete ssl_context;
 }
 
 void
-Connection::DeferredShutdown()
+Server::OpenListener(Listener* listener)
 {
-	Server* srv = GetServer();
-	if (srv)
-		srv->DeferShutdown(this);
+	if (listener->info)
+	{
+		listener->fd = socket(listener->info->ai_family, SOCK_STREAM,
+				0);
+		if (listener->fd == -1)
+			throw ServerSetupException(listener->addr + ": " +
+					string(strerror(errno)));
+
+		socket_options_.ApplyToListener(listener->fd);
+		if (c_bind2addrinfo(listener->fd, listener->info))
+			throw ServerSetupException(listener->addr + ": " +
+					string(strerror(errno)));
+	}
 	else
-		Shutdown();
-}
+	{
+		struct sockaddr_un addr;
+
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strcpy(addr.sun_path, listener->path.c_str());
+
+		// Whoever used the path before is gone by now.
+		unlink(listener->path.c_str());
+		listener->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (listener->fd == -1 ||
+				bind(listener->fd, (struct sockaddr*) &addr,
+					sizeof(addr)) == -1)
+			throw ServerSetupException(listener->addr + ": " +
+					string(strerror(errno)));
+	}
 
-void
-Connection::Deregister()
-{
-	Server* srv = this->GetServer();
-	is_shutdown_ = true;
-	if (srv)
-		srv->DequeueConnection(this);
+	if (listen(listener->fd, listener->maxconn > 0 ?
+				listener->maxconn : maxconn_))
+		throw ServerSetupException(listener->addr + ": " +
+				string(strerror(errno)));
+
+	if (listener->info)
+		socket_options_.ApplyAfterListen(listener->fd);
 }
 
-bool
-Connection::IsShutdown()
+int
+Server::FindListener(int fd)
 {
-	return is_shutdown_;
+	for (size_t i = 0; i < listeners_.size(); ++i)
+		if (listeners_[i]->fd == fd)
+			return i;
+	return -1;
 }
 
 void
-Connection::Lock()
+Server::ReleaseListener(Connection* conn)
 {
-	mtx_->Lock();
+	int listener = conn->GetListener();
+
+	if (listener >= 0 && listener < (int) listeners_.size())
+		--listeners_[listener]->connections;
 }
 
-bool
-Connection::TryLock()
+ConnectionCallback*
+Server::CallbackFor(Connection* conn)
 {
-	return mtx_->TryLock();
+	int listener = conn->GetListener();
+
+	if (listener >= 0 && listener < (int) listeners_.size() &&
+			listeners_[listener]->connected)
+		return listeners_[listener]->connected;
+	return connected_.Get();
 }
 
 void
-Connection::Unlock()
+Server::Dispatch(Connection* conn, Closure* c)
 {
-	mtx_->Unlock();
+	int shard = conn->GetWorkerShard();
+
+	if (shard >= 0 && shard < (int) shards_.size())
+	{
+		shards_[shard]->Dispatch(conn->GetSchedulingClass(),
+				conn->GetSchedulingWeight(), c);
+		return;
+	}
+
+	scheduler_->Add(conn->GetSchedulingClass(),
+			conn->GetSchedulingWeight(), c);
+	executor_.Add(google::protobuf::NewCallback(scheduler_.Get(),
+				&FairScheduler::RunNext));
 }
 
 void
-Connection::ReadLock()
+Server::AssignWorkerShard(Connection* conn, int fd)
 {
-	mtx_->ReadLock();
+	if (shards_.empty())
+		return;
+
+	// Prefer the shard on the CPU which handled the packets of the
+	// connection, so its data is still in that CPU's caches.
+	int cpu = conn->GetIncomingCPU();
+	if (cpu >= 0 && cpu < (int) cpu_shards_.size() && cpu_shards_[cpu] >= 0)
+	{
+		conn->SetWorkerShard(cpu_shards_[cpu]);
+		steering.Add("incoming-cpu", 1);
+	}
+	else
+	{
+		conn->SetWorkerShard(fd % shards_.size());
+		steering.Add("spread", 1);
+	}
 }
 
 bool
-Connection::TryReadLock()
+Server::MigrateConnection(Connection* conn, int shard)
 {
-	return mtx_->TryReadLock();
-}
+	if (shard < 0 || shard >= (int) shards_.size())
+		return false;
 
-ConnectionCallback::~ConnectionCallback()
-{
+	// Holding the connection exclusively means there are no callbacks
+	// for it left on the old shard, so none of them can overlap with
+	// the ones on the new shard.
+	if (!conn->TryLock())
+	{
+		migrations.Add("busy", 1);
+		return false;
+	}
+	conn->SetWorkerShard(shard);
+	conn->Unlock();
+
+	migrations.Add("moved", 1);
+	return true;
 }
 
-Connection*
-ConnectionCallback::AddDecorators(Connection* in)
+void
+Server::RebalanceShardsLocked()
+{
+	std::vector<uint64_t> load;
+	size_t hot = 0, cold = 0;
+
+	if (shards_.size() < 2)
+		return;
+
+	for (size_t i = 0; i < shards_.size(); ++i)
+	{
+		load.push_back(shards_[i]->TakeDispatchCount());
+		if (load[i] > load[hot])
+			hot = i;
+		if (load[i] < load[cold])
+			cold = i;
+	}
+
+	if (max_imbalance_ <= 0 || load[hot] < kMinRebalanceDispatches ||
+			load[hot] <= max_imbalance_ * load[cold])
+		return;
+
+	std::vector<Connection*> candidates;
+	for (std::pair<int, Connection*> it : connections_)
+		if (it.second->GetWorkerShard() == (int) hot)
+			candidates.push_back(it.second);
+
+	// Move enough connections to meet in the middle, assuming they all
+	// cause about the same load.
+	size_t moves = candidates.size() * (load[hot] - load[cold]) /
+		(2 * load[hot]);
+	for (size_t i = 0; i < candidates.size() && moves > 0; ++i)
+		if (MigrateConnection(candidates[i], cold))
+			--moves;
+}
+
+void
+Server::WatchWritable(int fd, bool watch)
+{
+#ifdef HAVE_EPOLL_CREATE
+	struct epoll_event ev;
+
+	ev.events = EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP | EPOLLET;
+	if (watch)
+		ev.events |= EPOLLOUT;
+	ev.data.fd = fd;
+
+	if (epoll_ctl(epollfd_, EPOLL_CTL_MOD, fd, &ev) == -1 &&
+			errno != ENOENT && errno != EBADF)
+	{
+		string errmsg = string(strerror(errno));
+		connected_->ConnectionFailed("epoll_ctl: " + errmsg);
+		epoll_errors.Add(errmsg, 1);
+	}
+#endif /* HAVE_EPOLL_CREATE */
+}
+
+Server::ReadWaiter::ReadWaiter()
+: closure(0), readable(false)
+{
+}
+
+Server::Timer::Timer()
+: conn(0), closure(0)
+{
+}
+
+bool
+Server::NotifyWhenReadable(Connection* conn, Closure* c)
+{
+	{
+		MutexLock l(waiters_lock_.Get());
+
+		if (conn->IsShutdown())
+			return false;
+
+		ReadWaiter& waiter = read_waiters_[conn];
+		if (!c || !waiter.readable)
+		{
+			if (c)
+				waiter.closure = c;
+			return true;
+		}
+
+		waiter.readable = false;
+		conn->ShareReadLock();
+	}
+
+	Dispatch(conn, google::protobuf::NewCallback(this,
+				&Server::CallAndUnlock, c, conn));
+	return true;
+}
+
+bool
+Server::TakeReadWaiter(Connection* conn, Closure** c)
+{
+	MutexLock l(waiters_lock_.Get());
+	std::map<Connection*, ReadWaiter>::iterator it =
+		read_waiters_.find(conn);
+
+	if (it == read_waiters_.end())
+		return false;
+
+	*c = it->second.closure;
+	it->second.closure = 0;
+	it->second.readable = (*c == 0);
+	return true;
+}
+
+bool
+Server::NotifyWhenDrained(Connection* conn, Closure* c)
+{
+	MutexLock l(waiters_lock_.Get());
+
+	if (conn->IsShutdown() ||
+			full_queues_.find(conn) == full_queues_.end())
+		return false;
+
+	drain_waiters_[conn] = c;
+	return true;
+}
+
+void
+Server::RunAfter(uint64_t msec, Closure* c)
+{
+	AddTimer(msec, 0, c);
+}
+
+bool
+Server::RunAfter(Connection* conn, uint64_t msec, Closure* c)
+{
+	{
+		MutexLock l(waiters_lock_.Get());
+
+		if (conn->IsShutdown())
+			return false;
+	}
+
+	AddTimer(msec, conn, c);
+	return true;
+}
+
+void
+Server::CallAndUnlock(Closure* c, Connection* conn)
+{
+	// Unlike LockCallAndUnlock(), this doesn't need the connection table,
+	// so connections can be closed while it's locked.
+	c->Run();
+	conn->Unlock();
+}
+
+void
+Server::WakeWaiters(Connection* conn)
+{
+	std::vector<Closure*> waiters;
+
+	{
+		MutexLock l(waiters_lock_.Get());
+		std::map<Connection*, ReadWaiter>::iterator rit =
+			read_waiters_.find(conn);
+		std::map<Connection*, Closure*>::iterator dit =
+			drain_waiters_.find(conn);
+
+		if (rit != read_waiters_.end())
+		{
+			if (rit->second.closure)
+				waiters.push_back(rit->second.closure);
+			read_waiters_.erase(rit);
+		}
+		if (dit != drain_waiters_.end())
+		{
+			waiters.push_back(dit->second);
+			drain_waiters_.erase(dit);
+		}
+		full_queues_.erase(conn);
+
+		// The timers themselves still go off, but won't do anything.
+		for (std::pair<const int, Timer>& timer : timers_)
+		{
+			if (timer.second.conn != conn)
+				continue;
+			waiters.push_back(timer.second.closure);
+			timer.second.conn = 0;
+			timer.second.closure = 0;
+		}
+
+		// The connection is only deleted once all locks on it are gone,
+		// so the waiters can still use it.
+		for (size_t i = 0; i < waiters.size(); ++i)
+			conn->ReadLock();
+	}
+
+	for (Closure* c : waiters)
+		Dispatch(conn, google::protobuf::NewCallback(this,
+					&Server::CallAndUnlock, c, conn));
+}
+
+void
+Server::AddTimer(uint64_t msec, Connection* conn, Closure* c)
+{
+	Timer timer;
+	int id;
+
+	timer.conn = conn;
+	timer.closure = c;
+
+#if defined(HAVE_SYS_TIMERFD_H) && defined(HAVE_EPOLL_CREATE)
+	id = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (id != -1)
+	{
+		struct itimerspec spec;
+		struct epoll_event ev;
+
+		// A zero timeout would disarm the timer.
+		memset(&spec, 0, sizeof(spec));
+		spec.it_value.tv_sec = msec / 1000;
+		spec.it_value.tv_nsec = (msec % 1000) * 1000000;
+		if (msec == 0)
+			spec.it_value.tv_nsec = 1;
+
+		ev.events = EPOLLIN;
+		ev.data.fd = id;
+
+		if (timerfd_settime(id, 0, &spec, 0) == 0)
+		{
+			{
+				MutexLock l(waiters_lock_.Get());
+				timers_[id] = timer;
+			}
+
+			if (epoll_ctl(epollfd_, EPOLL_CTL_ADD, id, &ev) == 0)
+				return;
+
+			MutexLock l(waiters_lock_.Get());
+			timers_.erase(id);
+		}
+		close(id);
+	}
+#endif /* HAVE_SYS_TIMERFD_H && HAVE_EPOLL_CREATE */
+
+	// Without timers, a worker thread has to do the waiting.
+	{
+		MutexLock l(waiters_lock_.Get());
+		id = --last_timer_id_;
+		timers_[id] = timer;
+	}
+	executor_.Add(google::protobuf::NewCallback(this,
+				&Server::SleepAndFireTimer, msec, id));
+}
+
+void
+Server::SleepAndFireTimer(uint64_t msec, int id)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(msec));
+	FireTimer(id);
+}
+
+bool
+Server::FireTimer(int id)
+{
+	Timer timer;
+
+	{
+		MutexLock l(waiters_lock_.Get());
+		std::map<int, Timer>::iterator it = timers_.find(id);
+
+		if (it == timers_.end())
+			return false;
+		timer = it->second;
+		timers_.erase(it);
+
+		// The connection can't go away while it's in the table.
+		if (timer.conn)
+			timer.conn->ReadLock();
+	}
+
+#ifdef HAVE_EPOLL_CREATE
+	if (id >= 0)
+	{
+		epoll_ctl(epollfd_, EPOLL_CTL_DEL, id, NULL);
+		close(id);
+	}
+#endif /* HAVE_EPOLL_CREATE */
+
+	if (timer.conn)
+		Dispatch(timer.conn, google::protobuf::NewCallback(this,
+					&Server::CallAndUnlock, timer.closure,
+					timer.conn));
+	else if (timer.closure)
+		executor_.Add(timer.closure);
+	return true;
+}
+
+void
+Server::NotifyWriteQueue(int fd, bool full)
+{
+	executor_.Add(google::protobuf::NewCallback(this,
+				&Server::WriteQueueCallback, fd, full));
+}
+
+void
+Server::WriteQueueCallback(int fd, bool full)
+{
+	ReadMutexLock l(connections_lock_.Get());
+	std::map<int, Connection*>::iterator it = connections_.find(fd);
+
+	// The connection may have gone away in the meantime.
+	if (it == connections_.end())
+		return;
+
+	Closure* waiter = 0;
+	{
+		MutexLock wl(waiters_lock_.Get());
+
+		if (full)
+			full_queues_.insert(it->second);
+		else
+		{
+			std::map<Connection*, Closure*>::iterator wit =
+				drain_waiters_.find(it->second);
+
+			full_queues_.erase(it->second);
+			if (wit != drain_waiters_.end())
+			{
+				waiter = wit->second;
+				drain_waiters_.erase(wit);
+				it->second->ReadLock();
+			}
+		}
+	}
+
+	if (full)
+		CallbackFor(it->second)->WriteQueueFull(it->second);
+	else
+		CallbackFor(it->second)->WriteQueueDrained(it->second);
+
+	if (waiter)
+		Dispatch(it->second, google::protobuf::NewCallback(this,
+					&Server::CallAndUnlock, waiter,
+					it->second));
+}
+
+void
+Server::LockCallAndUnlock(Closure* c, Connection* conn)
+{
+	ReadMutexLock l(connections_lock_.Get());
+	c->Run();
+	conn->Unlock();
+}
+
+void
+Server::RestoreAndUnlock(Connection* conn, string* state)
+{
+	ReadMutexLock l(connections_lock_.Get());
+	ScopedPtr<string> s(state);
+
+	CallbackFor(conn)->ConnectionRestored(conn, *state);
+	conn->Unlock();
+}
+
+void
+Server::ReceiveCallAndUnlock(Connection* conn)
+{
+	ReadMutexLock l(connections_lock_.Get());
+
+	// The socket is non-blocking, so this stops once it's drained.
+	ReceiveAndDeliver(conn, MSG_DONTWAIT);
+	conn->Unlock();
+}
+
+void
+Server::SpeculateAndUnlock(Connection* conn, int fd)
+{
+	ReadMutexLock l(connections_lock_.Get());
+
+	// There's probably data waiting, but it's not guaranteed, so nothing
+	// may block. Any data arriving after this is reported once we watch
+	// the connection for it.
+	ReceiveAndDeliver(conn, MSG_DONTWAIT);
+
+	// This also starts watching for incoming data. Data which arrived in
+	// the meantime is reported right away.
+	WatchWritable(fd, conn->GetWriteQueueSize() > 0);
+	conn->Unlock();
+}
+
+void
+Server::ReceiveAndDeliver(Connection* conn, int flags)
+{
+	// The connections are edge triggered, so we have to consume all data
+	// which is available right now. Only the first read uses "flags";
+	// the others just pick up leftovers and mustn't block.
+	try
+	{
+		while (!conn->IsEOF())
+		{
+			Buffer data = conn->ReceiveBuffer(-1, flags);
+			if (data.IsEmpty())
+				break;
+
+			CallbackFor(conn)->DataReceived(conn,
+					new Buffer(std::move(data)));
+			flags = MSG_DONTWAIT;
+		}
+	}
+	catch (ClientConnectionException e)
+	{
+		client_connection_errors.Add(e.identifier(), 1);
+		CallbackFor(conn)->Error(conn);
+	}
+}
+#endif /* _POSIX_SOURCE */
+
+Server*
+Server::SetMaxConnections(int maxconn)
+{
+	maxconn_ = maxconn;
+	return this;
+}
+
+Server*
+Server::AddListener(const std::string& addr, ConnectionCallback* connected,
+		const ServerSSLContext* context, int maxconn)
+{
+#ifdef _POSIX_SOURCE
+	Listener* listener = new Listener;
+	static const string kUNIXPrefix = "unix:";
+
+	listener->addr = addr;
+	listener->connected = connected;
+	listener->ssl_context = context;
+	listener->maxconn = maxconn;
+
+	if (addr.compare(0, kUNIXPrefix.length(), kUNIXPrefix) == 0)
+	{
+		struct sockaddr_un un;
+
+		listener->path = addr.substr(kUNIXPrefix.length());
+		if (listener->path.empty() ||
+				listener->path.length() >= sizeof(un.sun_path))
+		{
+			delete listener;
+			throw ServerSetupException("invalid UNIX socket path: " +
+					addr);
+		}
+	}
+	else
+	{
+		int error = c_str2addrinfo(addr.c_str(), &listener->info);
+		if (error)
+		{
+			delete listener;
+			throw ServerSetupException(addr + ": " +
+					string(gai_strerror(error)));
+		}
+	}
+
+	listeners_.push_back(listener);
+#else /* !_POSIX_SOURCE */
+	throw ServerSetupException("listeners: not supported");
+#endif /* _POSIX_SOURCE */
+	return this;
+}
+
+Server*
+Server::SetConnectionCallback(ConnectionCallback* connected)
+{
+	connected_.Reset(connected);
+	return this;
+}
+
+Server*
+Server::SetServerSSLContext(const ServerSSLContext* context)
+{
+	ssl_context_ = context;
+	return this;
+}
+
+Server*
+Server::SetWriteQueue(size_t low_watermark, size_t high_watermark)
+{
+	write_queue_ = true;
+	write_queue_low_ = low_watermark;
+	write_queue_high_ = high_watermark;
+	return this;
+}
+
+Server*
+Server::SetZeroCopyThreshold(size_t threshold)
+{
+	zerocopy_threshold_ = threshold;
+	return this;
+}
+
+Server*
+Server::SetSocketOptions(const SocketOptions& options)
+{
+	socket_options_ = options;
+	return this;
+}
+
+Server*
+Server::SetReactorCPUs(const std::vector<int>& cpus)
+{
+	reactor_cpus_ = cpus;
+	return this;
+}
+
+Server*
+Server::SetReactorPriority(int priority)
+{
+	reactor_priority_ = priority;
+	return this;
+}
+
+Server*
+Server::SetWorkerCPUs(const std::vector<int>& cpus)
+{
+	std::vector<std::vector<int> > cpu_sets;
+
+	for (int cpu : cpus)
+		if (cpu >= 0)
+			cpu_sets.push_back(std::vector<int>(1, cpu));
+
+	numa_aware_ = false;
+	CreateWorkerShards(cpu_sets);
+	return this;
+}
+
+Server*
+Server::SetShardRebalancing(double max_imbalance)
+{
+	max_imbalance_ = max_imbalance;
+	return this;
+}
+
+Server*
+Server::SetNUMAAware(bool aware)
+{
+	std::vector<std::vector<int> > cpu_sets;
+
+	if (aware)
+		for (const NUMANode& node : GetNUMANodes())
+			cpu_sets.push_back(node.cpus);
+
+	numa_aware_ = aware;
+	CreateWorkerShards(cpu_sets);
+	return this;
+}
+
+void
+Server::CreateWorkerShards(const std::vector<std::vector<int> >& cpu_sets)
+{
+	uint32_t threads = cpu_sets.empty() ? 0 :
+		(num_threads_ + cpu_sets.size() - 1) / cpu_sets.size();
+
+	for (WorkerShard* shard : shards_)
+		delete shard;
+	shards_.clear();
+	cpu_shards_.clear();
+
+	for (const std::vector<int>& cpus : cpu_sets)
+	{
+		for (int cpu : cpus)
+		{
+			if (cpu >= (int) cpu_shards_.size())
+				cpu_shards_.resize(cpu + 1, -1);
+			cpu_shards_[cpu] = shards_.size();
+		}
+		shards_.push_back(new WorkerShard(cpus, threads));
+	}
+}
+
+Server*
+Server::SetDataDelivery(bool deliver)
+{
+	deliver_data_ = deliver;
+	return this;
+}
+
+Server*
+Server::SetHandOver(const std::string& path, bool connections)
+{
+#ifdef _POSIX_SOURCE
+	handover_path_ = path;
+	handover_connections_ = connections;
+#endif /* _POSIX_SOURCE */
+	return this;
+}
+
+Server*
+Server::SetSharedMemory(const std::string& path, size_t capacity)
+{
+#ifdef _POSIX_SOURCE
+	shm_path_ = path;
+	shm_capacity_ = capacity;
+#endif /* _POSIX_SOURCE */
+	return this;
+}
+
+Server*
+Server::TakeOver(const std::string& path)
+{
+#ifdef _POSIX_SOURCE
+	struct sockaddr_un addr;
+	int listener = -1;
+	char type = 0;
+
+	if (path.length() >= sizeof(addr.sun_path))
+		throw ServerSetupException("handover path too long: " + path);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path.c_str());
+
+	int sock = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	if (sock == -1)
+		throw ServerSetupException("takeover: " +
+				string(strerror(errno)));
+	if (connect(sock, (struct sockaddr*) &addr, sizeof(addr)) == -1)
+	{
+		string errmsg = strerror(errno);
+		close(sock);
+		throw ServerSetupException("takeover: " + path + ": " + errmsg);
+	}
+
+	while (type != kHandOverDone)
+	{
+		string data;
+		int fd;
+
+		if (!ReceiveHandOverMessage(sock, &type, &fd, &data))
+			break;
+
+		if (type == kHandOverListener && fd != -1)
+		{
+			if (listener != -1)
+				close(listener);
+			listener = fd;
+		}
+		else if (type == kHandOverConnection && fd != -1)
+			inherited_.push_back(std::make_pair(fd,
+						new string(data)));
+		else if (fd != -1)
+			close(fd);
+	}
+	close(sock);
+
+	// Connections which made it over are still ours to serve, even if
+	// the rest of the hand over failed.
+	if (listener == -1)
+		throw ServerSetupException("takeover: no listening socket "
+				"received from " + path);
+
+	close(serverfd_);
+	serverfd_ = listener;
+	inherited_listener_ = true;
+#else /* !_POSIX_SOURCE */
+	throw ServerSetupException("takeover: not supported");
+#endif /* _POSIX_SOURCE */
+	return this;
+}
+
+void
+Server::Execute(Closure* c)
+{
+	executor_.Add(c);
+}
+
+void
+Server::Execute(Connection* conn, Closure* c)
+{
+	conn->ShareReadLock();
+	executor_.Add(google::protobuf::NewCallback(this,
+				&Server::CallAndUnlock, c, conn));
+}
+
+void
+Server::DispatchReadableLocked(Connection* conn)
+{
+	Closure* waiter = 0;
+
+	conn->ReadLock();
+	if (TakeReadWaiter(conn, &waiter))
+	{
+		// Someone is waiting for the data and will read it.
+		if (waiter)
+			Dispatch(conn, google::protobuf::NewCallback(this,
+						&Server::CallAndUnlock, waiter, conn));
+		else
+			conn->Unlock();
+	}
+	else if (deliver_data_)
+	{
+		// Read the data and call connected_->DataReceived(conn, data);
+		Dispatch(conn, google::protobuf::NewCallback(this,
+					&Server::ReceiveCallAndUnlock, conn));
+	}
+	else
+	{
+		// Call connected_->DataReady(conn);
+		google::protobuf::Closure* cc = google::protobuf::NewCallback(
+				CallbackFor(conn), &ConnectionCallback::DataReady,
+				conn);
+		Dispatch(conn, google::protobuf::NewCallback(this,
+					&Server::LockCallAndUnlock, cc, conn));
+	}
+}
+
+Connection*
+Server::InjectConnection(LoopbackConnection* conn)
+{
+	int id;
+
+	connections_lock_->Lock();
+	id = --last_injected_id_;
+	connections_lock_->Unlock();
+
+	AssignWorkerShard(conn, -id);
+
+	Connection* decorated = CallbackFor(conn)->AddDecorators(conn);
+	connections_lock_->Lock();
+	connections_[id] = decorated;
+	connections_lock_->Unlock();
+
+	// Run connected_->ConnectionEstablished() with the same connection
+	// the other callbacks will see.
+	decorated->ReadLock();
+	google::protobuf::Closure* cc = google::protobuf::NewCallback(
+			CallbackFor(decorated),
+			&ConnectionCallback::ConnectionEstablished, decorated);
+	Dispatch(decorated, google::protobuf::NewCallback(this,
+				&Server::LockCallAndUnlock, cc, decorated));
+
+	// From here on, the peer tells us about new data itself; only what
+	// it sent before has to be reported here.
+	if (conn->Attach(this, id))
+		NotifyReadable(id);
+	return decorated;
+}
+
+void
+Server::NotifyReadable(int fd)
+{
+	ReadMutexLock l(connections_lock_.Get());
+	std::map<int, Connection*>::iterator it = connections_.find(fd);
+
+	if (it == connections_.end())
+	{
+		read_after_close.Add(1);
+		return;
+	}
+	DispatchReadableLocked(it->second);
+}
+
+void
+Server::NotifyHangUp(int fd)
+{
+	ReadMutexLock l(connections_lock_.Get());
+	std::map<int, Connection*>::iterator it = connections_.find(fd);
+
+	if (it == connections_.end())
+		return;
+
+	// Call connected_->ConnectionTerminated(conn);
+	Connection* conn = it->second;
+	google::protobuf::Closure* cc = google::protobuf::NewCallback(
+			CallbackFor(conn), &ConnectionCallback::ConnectionTerminated,
+			conn);
+	Dispatch(conn, cc);
+	DeferShutdown(conn);
+}
+
+void
+Server::DeferShutdown(Connection* conn)
+{
+	// Run conn->Shutdown(). Will not take the connection lock.
+	google::protobuf::Closure* cc =
+		google::protobuf::NewCallback(conn, &Connection::Shutdown);
+	executor_.Add(cc);
+}
+
+void
+Server::DequeueConnection(Connection* conn)
+{
+	// Coroutines waiting for the connection have to be told now, while
+	// it is still around.
+	WakeWaiters(conn);
+
+	for (std::pair<int, Connection*> it : connections_)
+	{
+		if (it.second == conn)
+		{
+			MutexLock l(connections_lock_.Get());
+			connections_.erase(it.first);
+			ReleaseListener(conn);
+
+			if (it.first >= 0 &&
+					epoll_ctl(epollfd_, EPOLL_CTL_DEL,
+						it.first, NULL) == -1 &&
+					errno != EBADFD)
+			{
+				string errmsg =
+					string(strerror(errno));
+				connected_->ConnectionFailed(
+						"epoll_ctl: " + errmsg);
+				epoll_errors.Add(errmsg, 1);
+			}
+
+			connections_updated_.notify_one();
+
+			// The iterator has just been invalidated.
+			break;
+		}
+	}
+}
+
+void
+Server::SetMaxIdle(int max_idle)
+{
+	max_idle_ = max_idle;
+}
+
+BufferView::BufferView()
+: data(0), length(0)
+{
+}
+
+BufferView::BufferView(const char* data, size_t length)
+: data(data), length(length)
+{
+}
+
+BufferView::BufferView(const string& data)
+: data(data.data()), length(data.length())
+{
+}
+
+IOResult::IOResult()
+: status(kIOOk), length(0), error(0)
+{
+}
+
+IOResult::IOResult(IOStatus status, ssize_t length, int error)
+: status(status), length(length), error(error)
+{
+}
+
+bool
+IOResult::IsOk() const
+{
+	return status == kIOOk;
+}
+
+// The scheduling class all connections start out in.
+static const string*
+DefaultSchedulingClass()
+{
+	static const string* cls = FairScheduler::Intern(string());
+	return cls;
+}
+
+Connection::Connection()
+: lock_state_(0), is_shutdown_(false),
+	scheduling_class_(DefaultSchedulingClass()), scheduling_weight_(1),
+	worker_shard_(-1), listener_(-1)
+{
+}
+
+Connection::~Connection()
+{
+}
+
+void
+Connection::Shutdown()
+{
+	Deregister();
+}
+
+void
+Connection::DeferredShutdown()
+{
+	Server* srv = GetServer();
+	if (srv)
+		srv->DeferShutdown(this);
+	else
+		Shutdown();
+}
+
+void
+Connection::Deregister()
+{
+	Server* srv = this->GetServer();
+	is_shutdown_ = true;
+	if (srv)
+		srv->DequeueConnection(this);
+}
+
+bool
+Connection::IsShutdown()
+{
+	return is_shutdown_;
+}
+
+ssize_t
+Connection::ReceiveInto(char* buf, size_t len, int flags)
+{
+	string data = Receive(len, flags);
+	size_t copied = std::min(len, data.length());
+
+	memcpy(buf, data.data(), copied);
+	return copied;
+}
+
+Buffer
+Connection::ReceiveBuffer(size_t maxlen, int flags)
+{
+	return Buffer(Receive(maxlen, flags));
+}
+
+Buffer
+Connection::ReceiveAll(size_t maxlen, bool* pending)
+{
+	Buffer all;
+	size_t total = 0;
+
+	if (pending)
+		*pending = false;
+
+	while (!IsEOF())
+	{
+		if (total >= maxlen)
+		{
+			if (pending)
+				*pending = true;
+			break;
+		}
+
+		Buffer data = ReceiveBuffer(maxlen - total, MSG_DONTWAIT);
+		if (data.IsEmpty())
+			break;
+
+		total += data.Size();
+		all.Append(data);
+	}
+
+	return all;
+}
+
+ssize_t
+Connection::SendBuffer(const Buffer& data, int flags)
+{
+	std::vector<BufferView> views;
+
+	for (size_t i = 0; i < data.CountSegments(); ++i)
+		views.push_back(data.GetSegment(i));
+
+	if (views.empty())
+		return 0;
+	return SendVector(&views[0], views.size(), flags);
+}
+
+IOResult
+Connection::TryReceiveInto(char* buf, size_t len, int flags)
+{
+	ssize_t ret;
+
+	try
+	{
+		ret = ReceiveInto(buf, len, flags | MSG_DONTWAIT);
+	}
+	catch (ClientConnectionException& e)
+	{
+		return IOResult(kIOError, 0, EIO);
+	}
+
+	if (ret > 0)
+		return IOResult(kIOOk, ret);
+	if (ret == -1 && errno != EAGAIN && errno != EWOULDBLOCK)
+		return IOResult(kIOError, 0, errno);
+	return IOResult(IsEOF() ? kIOClosed : kIOWouldBlock);
+}
+
+IOResult
+Connection::TryReceiveBuffer(Buffer* data, size_t maxlen, int flags)
+{
+	if (maxlen <= 0 || maxlen > BufferPool::kLargeBufferSize)
+		maxlen = BufferPool::kLargeBufferSize;
+
+	ScopedPtr<PooledBuffer> buf(new PooledBuffer(maxlen));
+	IOResult result = TryReceiveInto(buf->Get(), maxlen, flags);
+
+	if (result.IsOk())
+		*data = Buffer(buf.Release(), result.length);
+	else
+		*data = Buffer();
+	return result;
+}
+
+IOResult
+Connection::TrySendVector(const BufferView* views, size_t count, int flags)
+{
+	ssize_t ret;
+
+	try
+	{
+		ret = SendVector(views, count, flags | MSG_DONTWAIT);
+	}
+	catch (ClientConnectionException& e)
+	{
+		return IOResult(kIOError, 0, EIO);
+	}
+
+	if (ret > 0)
+		return IOResult(kIOOk, ret);
+	if (ret == -1 && errno != EAGAIN && errno != EWOULDBLOCK)
+		return IOResult(kIOError, 0, errno);
+	return IOResult(count > 0 ? kIOWouldBlock : kIOOk);
+}
+
+IOResult
+Connection::TrySendBuffer(const Buffer& data, int flags)
+{
+	std::vector<BufferView> views;
+
+	for (size_t i = 0; i < data.CountSegments(); ++i)
+		views.push_back(data.GetSegment(i));
+
+	if (views.empty())
+		return IOResult();
+	return TrySendVector(&views[0], views.size(), flags);
+}
+
+ssize_t
+Connection::SendVector(const BufferView* views, size_t count, int flags)
+{
+	size_t total = 0;
+	string data;
+
+	for (size_t i = 0; i < count; ++i)
+		total += views[i].length;
+
+	data.reserve(total);
+	for (size_t i = 0; i < count; ++i)
+		data.append(views[i].data, views[i].length);
+
+	return Send(data, flags);
+}
+
+ssize_t
+Connection::SendZeroCopy(const char* data, size_t len, Closure* release,
+		int flags)
+{
+	ssize_t ret = Send(string(data, len), flags);
+	release->Run();
+	return ret;
+}
+
+ssize_t
+Connection::SendFile(int fd, off_t offset, size_t len)
+{
+	const size_t pagesize = sysconf(_SC_PAGESIZE);
+	struct stat st;
+	size_t total = 0;
+
+	// Touching a mapping beyond the end of the file is fatal, so we have
+	// to stop there ourselves.
+	if (fstat(fd, &st) == -1)
+		return -1;
+	if (S_ISREG(st.st_mode))
+	{
+		if (offset >= st.st_size)
+			return 0;
+		len = std::min<size_t>(len, st.st_size - offset);
+	}
+
+	while (total < len)
+	{
+		// mmap() wants a page aligned offset, so we may have to map a
+		// bit of extra data at the start.
+		off_t pos = offset + total;
+		off_t start = pos - (pos % pagesize);
+		size_t skip = pos - start;
+		size_t chunk = std::min(len - total, kSendFileChunkSize - skip);
+		ssize_t sent;
+
+#ifdef HAVE_SYS_MMAN_H
+		void* map = mmap(0, chunk + skip, PROT_READ, MAP_SHARED, fd,
+				start);
+		if (map != MAP_FAILED)
+		{
+			BufferView view((const char*) map + skip, chunk);
+			sent = SendVector(&view, 1);
+			munmap(map, chunk + skip);
+		}
+		else
+#endif /* HAVE_SYS_MMAN_H */
+		{
+			// Not everything can be mapped, e.g. pipes. Those are
+			// read in the old fashioned way.
+			string data(chunk, '\0');
+			ssize_t rlen = pread(fd, &data[0], chunk, pos);
+
+			if (rlen <= 0)
+				break;
+			data.resize(rlen);
+			sent = Send(data);
+		}
+
+		if (sent <= 0)
+			break;
+		total += sent;
+	}
+
+	if (total == 0 && len > 0)
+		return -1;
+	return total;
+}
+
+void
+Connection::SetZeroCopyThreshold(size_t threshold)
+{
+}
+
+bool
+Connection::ProcessErrorQueue()
+{
+	return false;
+}
+
+void
+Connection::ApplySocketOptions(const SocketOptions& options)
+{
+}
+
+void
+Connection::SetWriteQueue(size_t low_watermark, size_t high_watermark)
+{
+}
+
+size_t
+Connection::GetWriteQueueSize()
+{
+	return 0;
+}
+
+void
+Connection::FlushWriteQueue()
+{
+}
+
+void
+Connection::SetSchedulingClass(const string& cls, uint32_t weight)
+{
+	// The class and the weight may briefly be out of step for a
+	// concurrent dispatch, which only affects that one callback.
+	scheduling_class_.store(FairScheduler::Intern(cls),
+			std::memory_order_release);
+	scheduling_weight_.store(weight, std::memory_order_relaxed);
+}
+
+const string&
+Connection::GetSchedulingClass()
+{
+	return *scheduling_class_.load(std::memory_order_acquire);
+}
+
+uint32_t
+Connection::GetSchedulingWeight()
+{
+	return scheduling_weight_.load(std::memory_order_relaxed);
+}
+
+int
+Connection::GetIncomingCPU()
+{
+	return -1;
+}
+
+void
+Connection::SetWorkerShard(int shard)
+{
+	worker_shard_ = shard;
+}
+
+int
+Connection::GetWorkerShard()
+{
+	return worker_shard_;
+}
+
+void
+Connection::SetListener(int listener)
+{
+	listener_ = listener;
+}
+
+int
+Connection::GetListener()
+{
+	return listener_;
+}
+
+// Waits a little before trying to get hold of a connection lock again.
+// The first few rounds only spin, then the thread yields, and in the end it
+// sleeps, since the holder may be a callback which takes a while.
+static void
+LockBackoff(uint32_t* round)
+{
+	if (*round >= 128)
+		std::this_thread::sleep_for(std::chrono::microseconds(
+					std::min<uint32_t>(*round - 127, 1000)));
+	else if (*round >= 64)
+		std::this_thread::yield();
+	++*round;
+}
+
+const uint32_t Connection::kLockClosing;
+
+void
+Connection::Lock()
+{
+	uint32_t round = 0;
+
+	// Setting the bit keeps new readers out, so a busy connection can't
+	// keep us waiting forever. Another thread setting it first has the
+	// lock, or is waiting for it.
+	while (lock_state_.fetch_or(kLockClosing, std::memory_order_acquire) &
+			kLockClosing)
+		LockBackoff(&round);
+
+	// Now the readers which are still in have to finish.
+	round = 0;
+	while (lock_state_.load(std::memory_order_acquire) != kLockClosing)
+		LockBackoff(&round);
+}
+
+bool
+Connection::TryLock()
+{
+	uint32_t expected = 0;
+
+	return lock_state_.compare_exchange_strong(expected, kLockClosing,
+			std::memory_order_acquire);
+}
+
+void
+Connection::Unlock()
+{
+	// Only one thread can hold the exclusive lock, so if it's set, we're
+	// that thread.
+	if (lock_state_.load(std::memory_order_relaxed) == kLockClosing)
+		lock_state_.store(0, std::memory_order_release);
+	else
+		lock_state_.fetch_sub(1, std::memory_order_release);
+}
+
+void
+Connection::ReadLock()
+{
+	uint32_t round = 0;
+
+	while (!TryReadLock())
+		LockBackoff(&round);
+}
+
+void
+Connection::ShareReadLock()
+{
+	lock_state_.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool
+Connection::TryReadLock()
+{
+	uint32_t state = lock_state_.load(std::memory_order_relaxed);
+
+	while (!(state & kLockClosing))
+		if (lock_state_.compare_exchange_weak(state, state + 1,
+					std::memory_order_acquire))
+			return true;
+	return false;
+}
+
+ConnectionCallback::~ConnectionCallback()
+{
+}
+
+Connection*
+ConnectionCallback::AddDecorators(Connection* in)
 {
 	return in;
 }
@@ -625,6 +2481,22 @@ ConnectionCallback::ConnectionFailed(std::string msg)
 {
 }
 
+void
+ConnectionCallback::DataReceived(Connection* conn, Buffer* data)
+{
+	delete data;
+}
+
+void
+ConnectionCallback::WriteQueueFull(Connection* conn)
+{
+}
+
+void
+ConnectionCallback::WriteQueueDrained(Connection* conn)
+{
+}
+
 void
 ConnectionCallback::ConnectionTerminated(Connection* conn)
 {
@@ -634,5 +2506,18 @@ void
 ConnectionCallback::Error(Connection* conn)
 {
 }
+
+bool
+ConnectionCallback::SaveState(Connection* conn, std::string* state)
+{
+	return false;
+}
+
+void
+ConnectionCallback::ConnectionRestored(Connection* conn,
+		const std::string& state)
+{
+	ConnectionEstablished(conn);
+}
 }  // namespace siot
 }  // namespace toolbox
@@ -6,7 +6,9 @@
 #include "config.h"
 #endif /* HAVE_CONFIG_H */
 
+#include <atomic>
 #include <iostream>
+#include <sstream>
 
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
@@ -15,9 +17,12 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netdb.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 #include <clib/clib.h>
 
+#include "siot/loopbackconnection.h"
 #include "siot/server.h"
 
 namespace toolbox
@@ -38,6 +43,9 @@ public:
 	MOCK_METHOD1(ConnectionEstablished, void(Connection* conn));
 	MOCK_METHOD1(DataReady, void(Connection* conn));
 	MOCK_METHOD1(ConnectionTerminated, void(Connection* conn));
+	MOCK_METHOD2(DataReceived, void(Connection* conn, Buffer* data));
+	MOCK_METHOD1(WriteQueueFull, void(Connection* conn));
+	MOCK_METHOD1(WriteQueueDrained, void(Connection* conn));
 };
 
 ACTION(CloseConnection) {
@@ -46,6 +54,87 @@ ACTION(CloseConnection) {
 	arg0->GetServer()->Shutdown();
 }
 
+ACTION(AnswerAndClose) {
+	string data = arg1->AsString();
+	delete arg1;
+	arg0->Send(data.substr(0, 5), 0);
+	arg0->GetServer()->Shutdown();
+}
+
+ACTION_P(SendLots, len) {
+	arg0->Receive();
+	EXPECT_EQ(len, arg0->Send(string(len, 'x'), 0));
+}
+
+ACTION_P(SetFlag, flag) {
+	*flag = true;
+}
+
+ACTION_P(StoreConnection, store) {
+	*store = arg0;
+}
+
+// Echoes whatever arrives with a prefix naming the server, and passes the
+// connections on to the next server with their peer address as state.
+class EchoCallback : public ConnectionCallback
+{
+public:
+	explicit EchoCallback(const string& prefix)
+	: prefix_(prefix), restored(0), terminated(0)
+	{
+	}
+
+	virtual void ConnectionEstablished(Connection* conn)
+	{
+	}
+
+	virtual void DataReady(Connection* conn)
+	{
+		string data = conn->ReceiveAll().AsString();
+		if (data.empty())
+			return;
+		conn->Send(prefix_ + data, 0);
+		if (data == "quit\n")
+			conn->GetServer()->Shutdown();
+	}
+
+	virtual bool SaveState(Connection* conn, string* state)
+	{
+		*state = conn->PeerAsText();
+		return true;
+	}
+
+	virtual void ConnectionRestored(Connection* conn, const string& state)
+	{
+		if (state == conn->PeerAsText())
+			++restored;
+	}
+
+	virtual void ConnectionTerminated(Connection* conn)
+	{
+		++terminated;
+	}
+
+	const string prefix_;
+	std::atomic<int> restored;
+	std::atomic<int> terminated;
+};
+
+// Connects a new TCP socket to "addr".
+static int
+Connect(const string& addr)
+{
+	struct addrinfo* info;
+	int sock = socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP);
+
+	EXPECT_EQ(0, c_str2addrinfo(addr.c_str(), &info))
+		<< "Error converting to addrinfo: " << strerror(errno);
+	EXPECT_EQ(0, c_connect2addrinfo(sock, info))
+		<< "Error connecting: " << strerror(errno);
+	freeaddrinfo(info);
+	return sock;
+}
+
 class ServerTest : public ::testing::Test
 {
 };
@@ -154,6 +243,432 @@ TEST_F(ServerTest, ConnectionTimeout)
 	ct.WaitForFinished();
 }
 
+TEST_F(ServerTest, DataDelivery)
+{
+	struct addrinfo *info;
+	char buf[5];
+	int sock;
+	int fake_argc = 0;
+	char** fake_argv = { 0 };
+	::testing::InitGoogleMock(&fake_argc, fake_argv);
+	ScopedPtr<Server> srv(0);
+	MockConnectionCallback* cb = new MockConnectionCallback();
+
+	ASSERT_NO_THROW(srv.Reset(new Server("[::1]:12348", cb, 1)));
+	srv->SetDataDelivery(true);
+
+	EXPECT_CALL(*cb, ConnectionEstablished(A<Connection*>()))
+		.WillOnce(Return());
+	EXPECT_CALL(*cb, DataReady(A<Connection*>()))
+		.Times(0);
+	EXPECT_CALL(*cb, DataReceived(A<Connection*>(), A<Buffer*>()))
+		.WillOnce(AnswerAndClose());
+
+	ClosureThread ct(NewCallback(srv.Get(), &Server::Listen));
+	ct.Start();
+
+	EXPECT_NE(-1, sock = socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP))
+		<< "Error creating socket: " << strerror(errno);
+
+	EXPECT_EQ(0, c_str2addrinfo("[::1]:12348", &info))
+		<< "Error converting to addrinfo: " << strerror(errno);
+	EXPECT_EQ(0, c_connect2addrinfo(sock, info))
+		<< "Error connecting: " << strerror(errno);
+	freeaddrinfo(info);
+
+	EXPECT_EQ(12, send(sock, "Hello World\n", 12, 0))
+		<< "Error sending: " << strerror(errno);
+	EXPECT_EQ(5, recv(sock, buf, 5, 0))
+		<< "Error receiving: " << strerror(errno);
+	EXPECT_EQ("Hello", string(buf, 5));
+
+	EXPECT_EQ(0, shutdown(sock, SHUT_RDWR))
+		<< "Error shutting down: " << strerror(errno);
+	EXPECT_EQ(0, close(sock))
+		<< "Error closing socket: " << strerror(errno);
+
+	ct.WaitForFinished();
+}
+
+TEST_F(ServerTest, DeferredAccept)
+{
+	struct addrinfo *info;
+	char buf[5];
+	int sock;
+	int fake_argc = 0;
+	char** fake_argv = { 0 };
+	::testing::InitGoogleMock(&fake_argc, fake_argv);
+	ScopedPtr<Server> srv(0);
+	MockConnectionCallback* cb = new MockConnectionCallback();
+	SocketOptions options;
+
+	options.SetDeferAccept(5)->SetNoDelay(true);
+	ASSERT_NO_THROW(srv.Reset(new Server("[::1]:12350", cb, 1)));
+	srv->SetDataDelivery(true)->SetSocketOptions(options);
+
+	EXPECT_CALL(*cb, ConnectionEstablished(A<Connection*>()))
+		.WillOnce(Return());
+	EXPECT_CALL(*cb, DataReady(A<Connection*>()))
+		.Times(0);
+	EXPECT_CALL(*cb, DataReceived(A<Connection*>(), A<Buffer*>()))
+		.WillOnce(AnswerAndClose());
+
+	ClosureThread ct(NewCallback(srv.Get(), &Server::Listen));
+	ct.Start();
+
+	EXPECT_NE(-1, sock = socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP))
+		<< "Error creating socket: " << strerror(errno);
+
+	EXPECT_EQ(0, c_str2addrinfo("[::1]:12350", &info))
+		<< "Error converting to addrinfo: " << strerror(errno);
+	EXPECT_EQ(0, c_connect2addrinfo(sock, info))
+		<< "Error connecting: " << strerror(errno);
+	freeaddrinfo(info);
+
+	// The connection is only accepted once this arrives, and the data
+	// is read right away.
+	EXPECT_EQ(12, send(sock, "Hello World\n", 12, 0))
+		<< "Error sending: " << strerror(errno);
+	EXPECT_EQ(5, recv(sock, buf, 5, 0))
+		<< "Error receiving: " << strerror(errno);
+	EXPECT_EQ("Hello", string(buf, 5));
+
+	EXPECT_EQ(0, shutdown(sock, SHUT_RDWR))
+		<< "Error shutting down: " << strerror(errno);
+	EXPECT_EQ(0, close(sock))
+		<< "Error closing socket: " << strerror(errno);
+
+	ct.WaitForFinished();
+}
+
+TEST_F(ServerTest, WorkerShards)
+{
+	struct addrinfo *info;
+	char buf[5];
+	int sock;
+	int fake_argc = 0;
+	char** fake_argv = { 0 };
+	::testing::InitGoogleMock(&fake_argc, fake_argv);
+	ScopedPtr<Server> srv(0);
+	MockConnectionCallback* cb = new MockConnectionCallback();
+
+	ASSERT_NO_THROW(srv.Reset(new Server("[::1]:12351", cb, 2)));
+	srv->SetDataDelivery(true)
+		->SetWorkerCPUs(std::vector<int>(1, 0))
+		->SetReactorCPUs(std::vector<int>(1, 0));
+
+	EXPECT_CALL(*cb, ConnectionEstablished(A<Connection*>()))
+		.WillOnce(Return());
+	EXPECT_CALL(*cb, DataReady(A<Connection*>()))
+		.Times(0);
+	EXPECT_CALL(*cb, DataReceived(A<Connection*>(), A<Buffer*>()))
+		.WillOnce(AnswerAndClose());
+
+	ClosureThread ct(NewCallback(srv.Get(), &Server::Listen));
+	ct.Start();
+
+	EXPECT_NE(-1, sock = socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP))
+		<< "Error creating socket: " << strerror(errno);
+
+	EXPECT_EQ(0, c_str2addrinfo("[::1]:12351", &info))
+		<< "Error converting to addrinfo: " << strerror(errno);
+	EXPECT_EQ(0, c_connect2addrinfo(sock, info))
+		<< "Error connecting: " << strerror(errno);
+	freeaddrinfo(info);
+
+	EXPECT_EQ(12, send(sock, "Hello World\n", 12, 0))
+		<< "Error sending: " << strerror(errno);
+	EXPECT_EQ(5, recv(sock, buf, 5, 0))
+		<< "Error receiving: " << strerror(errno);
+	EXPECT_EQ("Hello", string(buf, 5));
+
+	EXPECT_EQ(0, shutdown(sock, SHUT_RDWR))
+		<< "Error shutting down: " << strerror(errno);
+	EXPECT_EQ(0, close(sock))
+		<< "Error closing socket: " << strerror(errno);
+
+	ct.WaitForFinished();
+}
+
+TEST_F(ServerTest, Migration)
+{
+	struct addrinfo *info;
+	char buf[5];
+	int sock;
+	int fake_argc = 0;
+	char** fake_argv = { 0 };
+	::testing::InitGoogleMock(&fake_argc, fake_argv);
+	ScopedPtr<Server> srv(0);
+	MockConnectionCallback* cb = new MockConnectionCallback();
+	std::atomic<Connection*> conn(0);
+
+	ASSERT_NO_THROW(srv.Reset(new Server("[::1]:12352", cb, 2)));
+	srv->SetDataDelivery(true)->SetWorkerCPUs(std::vector<int>(2, 0));
+
+	EXPECT_CALL(*cb, ConnectionEstablished(A<Connection*>()))
+		.WillOnce(StoreConnection(&conn));
+	EXPECT_CALL(*cb, DataReceived(A<Connection*>(), A<Buffer*>()))
+		.WillOnce(AnswerAndClose());
+
+	ClosureThread ct(NewCallback(srv.Get(), &Server::Listen));
+	ct.Start();
+
+	EXPECT_NE(-1, sock = socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP))
+		<< "Error creating socket: " << strerror(errno);
+
+	EXPECT_EQ(0, c_str2addrinfo("[::1]:12352", &info))
+		<< "Error converting to addrinfo: " << strerror(errno);
+	EXPECT_EQ(0, c_connect2addrinfo(sock, info))
+		<< "Error connecting: " << strerror(errno);
+	freeaddrinfo(info);
+
+	for (int i = 0; i < 1000 && !conn; ++i)
+		usleep(1000);
+	ASSERT_TRUE(conn != 0);
+
+	// The connection can be moved as soon as ConnectionEstablished() is
+	// done with it.
+	EXPECT_FALSE(srv->MigrateConnection(conn, 2));
+	bool migrated = false;
+	for (int i = 0; i < 1000 && !migrated; ++i)
+		if (!(migrated = srv->MigrateConnection(conn, 0)))
+			usleep(1000);
+	EXPECT_TRUE(migrated);
+	EXPECT_EQ(0, conn.load()->GetWorkerShard());
+
+	EXPECT_EQ(12, send(sock, "Hello World\n", 12, 0))
+		<< "Error sending: " << strerror(errno);
+	EXPECT_EQ(5, recv(sock, buf, 5, 0))
+		<< "Error receiving: " << strerror(errno);
+	EXPECT_EQ("Hello", string(buf, 5));
+
+	EXPECT_EQ(0, shutdown(sock, SHUT_RDWR))
+		<< "Error shutting down: " << strerror(errno);
+	EXPECT_EQ(0, close(sock))
+		<< "Error closing socket: " << strerror(errno);
+
+	ct.WaitForFinished();
+}
+
+TEST_F(ServerTest, WriteQueue)
+{
+	const size_t len = 16 * 1048576;
+	struct addrinfo *info;
+	char buf[65536];
+	size_t received = 0;
+	std::atomic<bool> drained(false);
+	ssize_t rlen;
+	int sock;
+	int fake_argc = 0;
+	char** fake_argv = { 0 };
+	::testing::InitGoogleMock(&fake_argc, fake_argv);
+	ScopedPtr<Server> srv(0);
+	MockConnectionCallback* cb = new MockConnectionCallback();
+
+	ASSERT_NO_THROW(srv.Reset(new Server("[::1]:12349", cb, 1)));
+	srv->SetWriteQueue(4096, 65536);
+
+	EXPECT_CALL(*cb, ConnectionEstablished(A<Connection*>()))
+		.WillOnce(Return());
+	EXPECT_CALL(*cb, DataReady(A<Connection*>()))
+		.WillOnce(SendLots(len));
+	EXPECT_CALL(*cb, WriteQueueFull(A<Connection*>()))
+		.WillOnce(Return());
+	EXPECT_CALL(*cb, WriteQueueDrained(A<Connection*>()))
+		.WillOnce(SetFlag(&drained));
+
+	ClosureThread ct(NewCallback(srv.Get(), &Server::Listen));
+	ct.Start();
+
+	EXPECT_NE(-1, sock = socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP))
+		<< "Error creating socket: " << strerror(errno);
+
+	EXPECT_EQ(0, c_str2addrinfo("[::1]:12349", &info))
+		<< "Error converting to addrinfo: " << strerror(errno);
+	EXPECT_EQ(0, c_connect2addrinfo(sock, info))
+		<< "Error connecting: " << strerror(errno);
+	freeaddrinfo(info);
+
+	EXPECT_EQ(12, send(sock, "Hello World\n", 12, 0))
+		<< "Error sending: " << strerror(errno);
+
+	// The data only arrives in full if the server keeps flushing it.
+	while (received < len &&
+			(rlen = recv(sock, buf, sizeof(buf), 0)) > 0)
+		received += rlen;
+	EXPECT_EQ(len, received);
+
+	// The notifications are delivered asynchronously.
+	for (int i = 0; i < 500 && !drained; ++i)
+		usleep(10000);
+	EXPECT_TRUE(drained);
+
+	srv->Shutdown();
+	EXPECT_EQ(0, shutdown(sock, SHUT_RDWR))
+		<< "Error shutting down: " << strerror(errno);
+	EXPECT_EQ(0, close(sock))
+		<< "Error closing socket: " << strerror(errno);
+
+	ct.WaitForFinished();
+}
+
+TEST_F(ServerTest, HandOver)
+{
+	const string path = "/tmp/siot-handover-test." +
+		std::to_string(getpid());
+	struct addrinfo *info;
+	char buf[16];
+	int old_sock, new_sock;
+	ScopedPtr<Server> old_srv(0);
+	ScopedPtr<Server> new_srv(0);
+	EchoCallback* new_cb = new EchoCallback("new:");
+
+	ASSERT_NO_THROW(old_srv.Reset(new Server("[::1]:12358",
+					new EchoCallback("old:"), 1)));
+	old_srv->SetHandOver(path, true);
+
+	ClosureThread old_ct(NewCallback(old_srv.Get(), &Server::Listen));
+	old_ct.Start();
+
+	EXPECT_EQ(0, c_str2addrinfo("[::1]:12358", &info))
+		<< "Error converting to addrinfo: " << strerror(errno);
+	EXPECT_NE(-1, old_sock = socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP))
+		<< "Error creating socket: " << strerror(errno);
+	EXPECT_EQ(0, c_connect2addrinfo(old_sock, info))
+		<< "Error connecting: " << strerror(errno);
+
+	EXPECT_EQ(4, send(old_sock, "one\n", 4, 0))
+		<< "Error sending: " << strerror(errno);
+	EXPECT_EQ(8, recv(old_sock, buf, sizeof(buf), 0))
+		<< "Error receiving: " << strerror(errno);
+	EXPECT_EQ("old:one\n", string(buf, 8));
+
+	// The new server gets the listener and the idle connection, and the
+	// old one is done once it has nothing left to serve.
+	ASSERT_NO_THROW(new_srv.Reset(new Server("[::1]:12358", new_cb, 1)));
+	new_srv->SetHandOver(path, true);
+	EXPECT_NO_THROW(new_srv->TakeOver(path));
+	old_ct.WaitForFinished();
+
+	ClosureThread new_ct(NewCallback(new_srv.Get(), &Server::Listen));
+	new_ct.Start();
+
+	EXPECT_EQ(4, send(old_sock, "two\n", 4, 0))
+		<< "Error sending: " << strerror(errno);
+	EXPECT_EQ(8, recv(old_sock, buf, sizeof(buf), 0))
+		<< "Error receiving: " << strerror(errno);
+	EXPECT_EQ("new:two\n", string(buf, 8));
+	EXPECT_EQ(1, new_cb->restored);
+
+	// New connections end up in the new server, too.
+	EXPECT_NE(-1, new_sock = socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP))
+		<< "Error creating socket: " << strerror(errno);
+	EXPECT_EQ(0, c_connect2addrinfo(new_sock, info))
+		<< "Error connecting: " << strerror(errno);
+	freeaddrinfo(info);
+
+	EXPECT_EQ(5, send(new_sock, "quit\n", 5, 0))
+		<< "Error sending: " << strerror(errno);
+	EXPECT_EQ(9, recv(new_sock, buf, sizeof(buf), 0))
+		<< "Error receiving: " << strerror(errno);
+	EXPECT_EQ("new:quit\n", string(buf, 9));
+
+	close(old_sock);
+	close(new_sock);
+	new_ct.WaitForFinished();
+}
+
+TEST_F(ServerTest, InjectConnection)
+{
+	EchoCallback* cb = new EchoCallback("one: ");
+	ScopedPtr<Server> srv(0);
+	LoopbackConnection* client;
+	LoopbackConnection* server_end;
+
+	// Injected connections are served without the server listening.
+	ASSERT_NO_THROW(srv.Reset(new Server("[::1]:12359", cb, 2)));
+	LoopbackConnection::CreatePair(&client, &server_end);
+
+	// Data sent before the connection was injected isn't lost.
+	EXPECT_EQ(6, client->Send("early\n"));
+	EXPECT_NE((Connection*) 0, srv->InjectConnection(server_end));
+	EXPECT_EQ("one: early\n", client->Receive());
+
+	for (int i = 0; i < 100; ++i)
+	{
+		EXPECT_EQ(6, client->Send("hello\n"));
+		EXPECT_EQ("one: hello\n", client->Receive());
+	}
+
+	// The server finds out when the client goes away.
+	client->Shutdown();
+	for (int i = 0; i < 500 && cb->terminated == 0; ++i)
+		usleep(1000);
+	EXPECT_EQ(1, cb->terminated);
+
+	// Let the deferred shutdown finish.
+	usleep(10000);
+}
+
+TEST_F(ServerTest, Listeners)
+{
+	EchoCallback* cb = new EchoCallback("main: ");
+	EchoCallback* tcp_cb = new EchoCallback("tcp: ");
+	ScopedPtr<Server> srv(0);
+	std::ostringstream path;
+	struct sockaddr_un addr;
+	int sock[4];
+	char buf[32];
+
+	path << "/tmp/siot-listener-test." << getpid();
+
+	ASSERT_NO_THROW(srv.Reset(new Server("[::1]:12361", cb, 2)));
+	EXPECT_THROW(srv->AddListener("unix:"), ServerSetupException);
+	srv->AddListener("[::1]:12362", tcp_cb);
+	srv->AddListener("unix:" + path.str(), 0, 0, 1);
+
+	ClosureThread ct(NewCallback(srv.Get(), &Server::Listen));
+	ct.Start();
+	usleep(100000);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path.str().c_str());
+
+	sock[0] = Connect("[::1]:12361");
+	sock[1] = Connect("[::1]:12362");
+	for (int i = 2; i < 4; ++i)
+	{
+		sock[i] = socket(AF_UNIX, SOCK_STREAM, 0);
+		EXPECT_EQ(0, connect(sock[i], (struct sockaddr*) &addr,
+					sizeof(addr))) << strerror(errno);
+	}
+
+	// Each listener reports to its own callback, or to the server's.
+	EXPECT_EQ(3, send(sock[1], "hi\n", 3, 0));
+	EXPECT_EQ(8, recv(sock[1], buf, sizeof(buf), 0));
+	EXPECT_EQ("tcp: hi\n", string(buf, 8));
+
+	EXPECT_EQ(3, send(sock[2], "hi\n", 3, 0));
+	EXPECT_EQ(9, recv(sock[2], buf, sizeof(buf), 0));
+	EXPECT_EQ("main: hi\n", string(buf, 9));
+
+	// The UNIX socket only takes one connection at a time.
+	EXPECT_EQ(0, recv(sock[3], buf, sizeof(buf), 0));
+
+	EXPECT_EQ(5, send(sock[0], "quit\n", 5, 0));
+	EXPECT_EQ(11, recv(sock[0], buf, sizeof(buf), 0));
+	EXPECT_EQ("main: quit\n", string(buf, 11));
+
+	for (int i = 0; i < 4; ++i)
+		close(sock[i]);
+	ct.WaitForFinished();
+	srv.Reset(0);
+
+	// The UNIX socket is cleaned up along with the server.
+	EXPECT_NE(0, access(path.str().c_str(), F_OK));
+}
+
 }  // namespace testing
 }  // namespace siot
 }  // namespace toolbox
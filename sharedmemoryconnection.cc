@@ -0,0 +1,671 @@
+/*-
+ * Copyright (c) 2026 Caoimhe Chaos <caoimhechaos@protonmail.com>,
+ *                    Ancient Solutions. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions  of source code must retain  the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions  in   binary  form  must   reproduce  the  above
+ *    copyright  notice, this  list  of conditions  and the  following
+ *    disclaimer in the  documentation and/or other materials provided
+ *    with the distribution.
+ *
+ * THIS  SOFTWARE IS  PROVIDED BY  ANCIENT SOLUTIONS  AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO,  THE IMPLIED WARRANTIES OF  MERCHANTABILITY AND FITNESS
+ * FOR A  PARTICULAR PURPOSE  ARE DISCLAIMED.  IN  NO EVENT  SHALL THE
+ * FOUNDATION  OR CONTRIBUTORS  BE  LIABLE FOR  ANY DIRECT,  INDIRECT,
+ * INCIDENTAL,   SPECIAL,    EXEMPLARY,   OR   CONSEQUENTIAL   DAMAGES
+ * (INCLUDING, BUT NOT LIMITED  TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE,  DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT  LIABILITY,  OR  TORT  (INCLUDING NEGLIGENCE  OR  OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif /* HAVE_SYS_TYPES_H */
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif /* HAVE_SYS_SOCKET_H */
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif /* HAVE_SYS_MMAN_H */
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif /* HAVE_SYS_EVENTFD_H */
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+#ifdef HAVE_SYS_ERRNO_H
+#include <sys/errno.h>
+#endif /* HAVE_SYS_ERRNO_H */
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif /* HAVE_ERRNO_H */
+
+#include <poll.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+
+#include <algorithm>
+#include <new>
+
+#include "siot/bufferpool.h"
+#include "siot/server.h"
+#include "siot/sharedmemoryconnection.h"
+
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_SYS_EVENTFD_H) && \
+	defined(HAVE_MEMFD_CREATE)
+#define SIOT_SHARED_MEMORY 1
+#endif
+
+namespace toolbox
+{
+namespace siot
+{
+// Identifies segments set up by a compatible version of the library.
+static const uint32_t kSegmentMagic = 0x73694d53;
+static const uint32_t kSegmentVersion = 1;
+
+// The data of the rings starts after the first page, which holds the
+// Segment.
+static const size_t kDataOffset = 4096;
+static const size_t kMinCapacity = 4096;
+
+// The descriptors passed to the client: the segment itself, followed by
+// the data and space event descriptors of both sides.
+static const int kNumHandshakeFDs = 5;
+
+// The positions are running byte counts, so the ring is empty if they're
+// equal and full if they're "capacity" apart. Each is only written by one
+// side and lives on a cache line of its own, so the sides don't keep
+// stealing each other's lines. The reader sets "reader_waiting" before
+// going to sleep on an empty ring, and the writer only signals it if it
+// was set; "writer_waiting" does the same for a full ring.
+struct SharedMemoryConnection::Ring
+{
+	alignas(64) std::atomic<uint64_t> head;
+	std::atomic<uint32_t> reader_waiting;
+	alignas(64) std::atomic<uint64_t> tail;
+	std::atomic<uint32_t> writer_waiting;
+};
+
+// rings[i] carries the data sent to side i, where the server is side 0.
+struct SharedMemoryConnection::Segment
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t capacity;
+	std::atomic<uint32_t> closed[2];
+	Ring rings[2];
+};
+
+static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t),
+		"shared atomics must not carry any state of their own");
+
+// Wakes up whoever waits for the event descriptor "fd".
+static void
+Signal(int fd)
+{
+	uint64_t one = 1;
+	ssize_t ret = write(fd, &one, sizeof(one));
+	(void) ret;
+}
+
+#ifdef SIOT_SHARED_MEMORY
+// Sends the descriptors "fds" over the handshake socket "sock".
+static bool
+SendDescriptors(int sock, const int* fds, int count)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	char type = 'S';
+	char control[CMSG_SPACE(kNumHandshakeFDs * sizeof(int))];
+
+	memset(&msg, 0, sizeof(msg));
+	memset(control, 0, sizeof(control));
+	iov.iov_base = &type;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = CMSG_SPACE(count * sizeof(int));
+
+	struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(count * sizeof(int));
+	memcpy(CMSG_DATA(cmsg), fds, count * sizeof(int));
+
+	return sendmsg(sock, &msg, MSG_NOSIGNAL) == 1;
+}
+
+// Receives exactly "count" descriptors into "fds" from the handshake socket
+// "sock".
+static bool
+ReceiveDescriptors(int sock, int* fds, int count)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	char type;
+	char control[CMSG_SPACE(kNumHandshakeFDs * sizeof(int))];
+	int flags = 0;
+	int received = 0;
+
+#ifdef MSG_CMSG_CLOEXEC
+	flags |= MSG_CMSG_CLOEXEC;
+#endif /* MSG_CMSG_CLOEXEC */
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &type;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	if (recvmsg(sock, &msg, flags) != 1)
+		return false;
+
+	for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+			cmsg = CMSG_NXTHDR(&msg, cmsg))
+	{
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+				cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+
+		int n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for (int i = 0; i < n; ++i)
+		{
+			int fd;
+			memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int),
+					sizeof(int));
+			if (received < count)
+				fds[received++] = fd;
+			else
+				close(fd);
+		}
+	}
+
+	if (received == count && type == 'S' &&
+			!(msg.msg_flags & MSG_CTRUNC))
+		return true;
+
+	for (int i = 0; i < received; ++i)
+		close(fds[i]);
+	return false;
+}
+#endif /* SIOT_SHARED_MEMORY */
+
+SharedMemoryConnection*
+SharedMemoryConnection::Connect(const std::string& path)
+{
+#ifdef SIOT_SHARED_MEMORY
+	struct sockaddr_un addr;
+	struct stat st;
+	int fds[kNumHandshakeFDs];
+
+	if (path.length() >= sizeof(addr.sun_path))
+		throw ClientConnectionException("shared memory path",
+				"path too long: " + path);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path.c_str());
+
+	int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock == -1)
+		throw ClientConnectionException("socket",
+				string(strerror(errno)));
+	if (connect(sock, (struct sockaddr*) &addr, sizeof(addr)) == -1)
+	{
+		string errmsg = strerror(errno);
+		close(sock);
+		throw ClientConnectionException("connect", errmsg);
+	}
+	if (!ReceiveDescriptors(sock, fds, kNumHandshakeFDs))
+	{
+		close(sock);
+		throw ClientConnectionException("shared memory handshake",
+				"no segment received");
+	}
+
+	void* mem = MAP_FAILED;
+	if (fstat(fds[0], &st) == 0 && (size_t) st.st_size > kDataOffset)
+		mem = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+				fds[0], 0);
+	close(fds[0]);
+
+	// Don't trust the server any further than necessary: the rings have
+	// to fit into what was mapped.
+	Segment* segment = (Segment*) mem;
+	if (mem == MAP_FAILED || segment->magic != kSegmentMagic ||
+			segment->version != kSegmentVersion ||
+			segment->capacity < kMinCapacity ||
+			(segment->capacity & (segment->capacity - 1)) != 0 ||
+			segment->capacity > ((size_t) st.st_size - kDataOffset) / 2)
+	{
+		if (mem != MAP_FAILED)
+			munmap(mem, st.st_size);
+		for (int i = 0; i < kNumHandshakeFDs; ++i)
+			close(fds[i]);
+		close(sock);
+		throw ClientConnectionException("shared memory handshake",
+				"invalid segment");
+	}
+
+	return new SharedMemoryConnection(0, sock, 1, mem, st.st_size,
+			fds + 1);
+#else /* !SIOT_SHARED_MEMORY */
+	throw ClientConnectionException("shared memory", "not supported");
+#endif /* SIOT_SHARED_MEMORY */
+}
+
+SharedMemoryConnection*
+SharedMemoryConnection::Accept(Server* server, int sock, size_t capacity)
+{
+#ifdef SIOT_SHARED_MEMORY
+	int fds[kNumHandshakeFDs];
+	int created = 0;
+	string error;
+
+	// Positions are masked into the rings, so their size has to be a
+	// power of two.
+	size_t size = kMinCapacity;
+	while (size < capacity)
+		size <<= 1;
+	capacity = size;
+	size = kDataOffset + 2 * capacity;
+
+	fds[created] = memfd_create("siot-shared-memory", MFD_CLOEXEC);
+	if (fds[created] == -1)
+		error = "memfd_create";
+	else
+		++created;
+
+	while (error.empty() && created < kNumHandshakeFDs)
+	{
+		fds[created] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (fds[created] == -1)
+			error = "eventfd";
+		else
+			++created;
+	}
+
+	void* mem = MAP_FAILED;
+	if (error.empty() && ftruncate(fds[0], size) == -1)
+		error = "ftruncate";
+	if (error.empty())
+	{
+		mem = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+				fds[0], 0);
+		if (mem == MAP_FAILED)
+			error = "mmap";
+	}
+
+	if (error.empty())
+	{
+		Segment* segment = new(mem) Segment;
+		segment->magic = kSegmentMagic;
+		segment->version = kSegmentVersion;
+		segment->capacity = capacity;
+		for (int i = 0; i < 2; ++i)
+		{
+			segment->closed[i] = 0;
+			segment->rings[i].head = 0;
+			segment->rings[i].tail = 0;
+			// Nobody has looked at the rings yet, so the first
+			// data has to be announced.
+			segment->rings[i].reader_waiting = 1;
+			segment->rings[i].writer_waiting = 0;
+		}
+
+		if (!SendDescriptors(sock, fds, kNumHandshakeFDs))
+			error = "sendmsg";
+	}
+
+	if (!error.empty())
+	{
+		string errmsg = strerror(errno);
+		if (mem != MAP_FAILED)
+			munmap(mem, size);
+		for (int i = 0; i < created; ++i)
+			close(fds[i]);
+		close(sock);
+		throw ClientConnectionException(error, errmsg);
+	}
+
+	// The client has its own copy of the segment descriptor by now.
+	close(fds[0]);
+	return new SharedMemoryConnection(server, sock, 0, mem, size, fds + 1);
+#else /* !SIOT_SHARED_MEMORY */
+	close(sock);
+	throw ClientConnectionException("shared memory", "not supported");
+#endif /* SIOT_SHARED_MEMORY */
+}
+
+SharedMemoryConnection::SharedMemoryConnection(Server* server, int sock,
+		int side, void* mem, size_t size, const int* eventfds)
+: server_(server), socket_(sock), side_(side), segment_((Segment*) mem),
+	size_(size), blocking_(server == 0), eof_(false), peer_gone_(false),
+	last_use_(time(NULL))
+{
+	char* data = (char*) mem + kDataOffset;
+
+	mask_ = segment_->capacity - 1;
+	rx_ = data + side_ * segment_->capacity;
+	tx_ = data + (1 - side_) * segment_->capacity;
+
+	for (int i = 0; i < 2; ++i)
+	{
+		data_fd_[i] = eventfds[2 * i];
+		space_fd_[i] = eventfds[2 * i + 1];
+	}
+}
+
+SharedMemoryConnection::~SharedMemoryConnection()
+{
+	munmap(segment_, size_);
+	for (int i = 0; i < 2; ++i)
+	{
+		close(data_fd_[i]);
+		close(space_fd_[i]);
+	}
+	close(socket_);
+}
+
+bool
+SharedMemoryConnection::PeerGone()
+{
+	return peer_gone_ || segment_->closed[1 - side_].load();
+}
+
+void
+SharedMemoryConnection::Wait(int fd)
+{
+	struct pollfd pfd[2];
+	uint64_t count;
+
+	// Nothing is ever sent over the socket after the handshake, so it
+	// only becomes readable once the peer hangs up.
+	pfd[0].fd = fd;
+	pfd[0].events = POLLIN;
+	pfd[0].revents = 0;
+	pfd[1].fd = socket_;
+	pfd[1].events = POLLIN;
+	pfd[1].revents = 0;
+
+	if (poll(pfd, 2, -1) <= 0)
+		return;
+	if (pfd[1].revents)
+		peer_gone_ = true;
+	if (pfd[0].revents & POLLIN)
+	{
+		ssize_t ret = read(fd, &count, sizeof(count));
+		(void) ret;
+	}
+}
+
+ssize_t
+SharedMemoryConnection::Read(char* buf, size_t len, bool wait)
+{
+	std::lock_guard<std::mutex> l(read_lock_);
+	Ring& ring = segment_->rings[side_];
+	const uint64_t head = ring.head.load(std::memory_order_relaxed);
+
+	last_use_ = time(NULL);
+	for (;;)
+	{
+		// Check whether the peer is gone first, so everything it sent
+		// before is seen below.
+		bool gone = PeerGone();
+		uint64_t tail = ring.tail.load(std::memory_order_acquire);
+
+		if (tail != head)
+		{
+			size_t n = std::min<uint64_t>(len, tail - head);
+			size_t offset = head & mask_;
+			size_t first = std::min<size_t>(n, mask_ + 1 - offset);
+
+			memcpy(buf, rx_ + offset, first);
+			memcpy(buf + first, rx_, n - first);
+			ring.head.store(head + n);
+
+			// The writer may be waiting for the space.
+			if (ring.writer_waiting.load() &&
+					ring.writer_waiting.exchange(0))
+				Signal(space_fd_[1 - side_]);
+			return n;
+		}
+
+		if (gone)
+		{
+			eof_ = true;
+			return 0;
+		}
+
+		// Ask to be woken up, then make sure nothing slipped in
+		// before the writer could see that.
+		ring.reader_waiting.store(1);
+		if (ring.tail.load() != head || PeerGone())
+			continue;
+
+		if (!wait)
+		{
+			errno = EAGAIN;
+			return -1;
+		}
+		Wait(data_fd_[side_]);
+	}
+}
+
+ssize_t
+SharedMemoryConnection::Write(const BufferView* views, size_t count,
+		bool wait)
+{
+	std::lock_guard<std::mutex> l(write_lock_);
+	Ring& ring = segment_->rings[1 - side_];
+	const uint64_t capacity = mask_ + 1;
+	uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+	ssize_t total = 0;
+	size_t offset = 0;
+
+	last_use_ = time(NULL);
+	while (count > 0)
+	{
+		// "offset" is how much of the first piece was already sent.
+		if (offset == views[0].length)
+		{
+			++views;
+			--count;
+			offset = 0;
+			continue;
+		}
+
+		if (PeerGone())
+		{
+			if (total > 0)
+				break;
+			errno = EPIPE;
+			return -1;
+		}
+
+		uint64_t head = ring.head.load(std::memory_order_acquire);
+		if (tail - head == capacity)
+		{
+			ring.writer_waiting.store(1);
+			if (ring.head.load() != head)
+				continue;
+			if (!wait)
+				break;
+			Wait(space_fd_[side_]);
+			continue;
+		}
+
+		while (count > 0 && tail - head < capacity)
+		{
+			size_t n = std::min<uint64_t>(views[0].length - offset,
+					capacity - (tail - head));
+			size_t pos = tail & mask_;
+			size_t first = std::min<size_t>(n, capacity - pos);
+
+			memcpy(tx_ + pos, views[0].data + offset, first);
+			memcpy(tx_, views[0].data + offset + first, n - first);
+			tail += n;
+			offset += n;
+			total += n;
+
+			if (offset == views[0].length)
+			{
+				++views;
+				--count;
+				offset = 0;
+			}
+		}
+		ring.tail.store(tail);
+
+		// Only wake the reader if it found the ring empty.
+		if (ring.reader_waiting.load() &&
+				ring.reader_waiting.exchange(0))
+			Signal(data_fd_[1 - side_]);
+	}
+
+	if (total == 0 && count > 0)
+	{
+		errno = EAGAIN;
+		return -1;
+	}
+	return total;
+}
+
+string
+SharedMemoryConnection::Receive(size_t maxlen, int flags)
+{
+	if (maxlen <= 0 || maxlen > BufferPool::kLargeBufferSize)
+		maxlen = BufferPool::kLargeBufferSize;
+
+	PooledBuffer buf(maxlen);
+	ssize_t len = ReceiveInto(buf.Get(), maxlen, flags);
+
+	return string(buf.Get(), len > 0 ? len : 0);
+}
+
+ssize_t
+SharedMemoryConnection::ReceiveInto(char* buf, size_t len, int flags)
+{
+	return Read(buf, len, blocking_ && !(flags & MSG_DONTWAIT));
+}
+
+IOResult
+SharedMemoryConnection::TryReceiveInto(char* buf, size_t len, int flags)
+{
+	ssize_t ret = Read(buf, len, false);
+
+	if (ret > 0)
+		return IOResult(kIOOk, ret);
+	if (ret == 0)
+		return IOResult(len > 0 ? kIOClosed : kIOOk);
+	return IOResult(kIOWouldBlock);
+}
+
+ssize_t
+SharedMemoryConnection::Send(string data, int flags)
+{
+	BufferView view(data);
+	return SendVector(&view, 1, flags);
+}
+
+ssize_t
+SharedMemoryConnection::SendVector(const BufferView* views, size_t count,
+		int flags)
+{
+	return Write(views, count, !(flags & MSG_DONTWAIT));
+}
+
+IOResult
+SharedMemoryConnection::TrySendVector(const BufferView* views, size_t count,
+		int flags)
+{
+	ssize_t ret = Write(views, count, false);
+
+	if (ret >= 0)
+		return IOResult(kIOOk, ret);
+	if (errno == EPIPE)
+		return IOResult(kIOClosed);
+	return IOResult(kIOWouldBlock);
+}
+
+string
+SharedMemoryConnection::PeerAsText()
+{
+	return "shared-memory";
+}
+
+Server*
+SharedMemoryConnection::GetServer()
+{
+	return server_;
+}
+
+bool
+SharedMemoryConnection::IsEOF()
+{
+	return eof_;
+}
+
+uint64_t
+SharedMemoryConnection::GetLastUse()
+{
+	return last_use_;
+}
+
+void
+SharedMemoryConnection::SetBlocking(bool blocking)
+{
+	blocking_ = blocking;
+}
+
+int
+SharedMemoryConnection::GetEventFD() const
+{
+	return data_fd_[side_];
+}
+
+int
+SharedMemoryConnection::GetSocket() const
+{
+	return socket_;
+}
+
+void
+SharedMemoryConnection::Shutdown()
+{
+	eof_ = true;
+	Deregister();
+
+	// Ensure we're the only ones operating on the connection.
+	Lock();
+
+	// Wake the peer wherever it waits, so it finds out. Closing the
+	// socket tells it as well, in case it was only watching that.
+	segment_->closed[side_].store(1);
+	Signal(data_fd_[1 - side_]);
+	Signal(space_fd_[1 - side_]);
+	shutdown(socket_, SHUT_RDWR);
+
+	delete this;
+}
+}  // namespace siot
+}  // namespace toolbox
@@ -0,0 +1,258 @@
+/**
+ * Tests for the shared memory connection.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "siot/server.h"
+#include "siot/sharedmemoryconnection.h"
+
+namespace toolbox
+{
+namespace siot
+{
+namespace testing
+{
+using threadpp::ClosureThread;
+using google::protobuf::NewCallback;
+
+// Echoes whatever arrives.
+class EchoCallback : public ConnectionCallback
+{
+public:
+	EchoCallback()
+	: terminated(0)
+	{
+	}
+
+	virtual void ConnectionEstablished(Connection* conn)
+	{
+	}
+
+	virtual void DataReady(Connection* conn)
+	{
+		string data = conn->ReceiveAll().AsString();
+		if (!data.empty())
+			conn->Send(data, 0);
+	}
+
+	virtual void ConnectionTerminated(Connection* conn)
+	{
+		++terminated;
+	}
+
+	std::atomic<int> terminated;
+};
+
+class SharedMemoryConnectionTest : public ::testing::Test
+{
+protected:
+	virtual void SetUp()
+	{
+		std::ostringstream path;
+		path << "/tmp/siot-shm-test." << getpid();
+		path_ = path.str();
+	}
+
+	virtual void TearDown()
+	{
+		unlink(path_.c_str());
+	}
+
+	// Sets up a pair of connections without a server, with "capacity"
+	// bytes in each direction.
+	void CreatePair(SharedMemoryConnection** server,
+			SharedMemoryConnection** client, size_t capacity)
+	{
+		struct sockaddr_un addr;
+		int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strcpy(addr.sun_path, path_.c_str());
+		unlink(path_.c_str());
+		ASSERT_EQ(0, bind(sock, (struct sockaddr*) &addr,
+					sizeof(addr))) << strerror(errno);
+		ASSERT_EQ(0, listen(sock, 1)) << strerror(errno);
+
+		std::thread acceptor([&]() {
+			*server = SharedMemoryConnection::Accept(0,
+					accept(sock, 0, 0), capacity);
+		});
+		*client = SharedMemoryConnection::Connect(path_);
+		acceptor.join();
+		close(sock);
+	}
+
+	string path_;
+};
+
+TEST_F(SharedMemoryConnectionTest, ReadWrite)
+{
+	SharedMemoryConnection* one = 0;
+	SharedMemoryConnection* two = 0;
+
+	CreatePair(&one, &two, 4096);
+	ASSERT_TRUE(one && two);
+
+	EXPECT_EQ(11, one->Send("Hey, buddy!"));
+	EXPECT_EQ("Hey, buddy!", two->Receive());
+
+	EXPECT_EQ(11, two->Send("Hey, buddy!"));
+	EXPECT_EQ("Hey, buddy!", one->Receive());
+
+	// Messages wrap around the end of the ring.
+	string big(3000, 'x');
+	for (int i = 0; i < 10; ++i)
+	{
+		EXPECT_EQ((ssize_t) big.size(), one->Send(big));
+		EXPECT_EQ(big, two->Receive());
+	}
+
+	one->Shutdown();
+	two->Shutdown();
+}
+
+TEST_F(SharedMemoryConnectionTest, Waiting)
+{
+	SharedMemoryConnection* one = 0;
+	SharedMemoryConnection* two = 0;
+	string big(1 << 20, 'x');
+	string received;
+	char buf[16];
+
+	CreatePair(&one, &two, 4096);
+	ASSERT_TRUE(one && two);
+
+	EXPECT_EQ(kIOWouldBlock, two->TryReceiveInto(buf, sizeof(buf)).status);
+
+	// Sending waits for the reader to make space, and receiving waits
+	// for the writer to send more.
+	std::thread reader([&]() {
+		while (received.size() < big.size())
+			received += two->Receive();
+	});
+	EXPECT_EQ((ssize_t) big.size(), one->Send(big));
+	reader.join();
+	EXPECT_EQ(big, received);
+
+	// A full ring takes no more.
+	while (one->TrySendBuffer(Buffer(big.data(), 1000)).IsOk())
+		;
+	EXPECT_EQ(-1, one->Send(big, MSG_DONTWAIT));
+	EXPECT_EQ(EAGAIN, errno);
+
+	one->Shutdown();
+	two->Shutdown();
+}
+
+TEST_F(SharedMemoryConnectionTest, Shutdown)
+{
+	SharedMemoryConnection* one = 0;
+	SharedMemoryConnection* two = 0;
+	char buf[32];
+	ssize_t ret = -1;
+
+	CreatePair(&one, &two, 4096);
+	ASSERT_TRUE(one && two);
+
+	// What was sent before can still be received.
+	EXPECT_EQ(11, one->Send("Hey, buddy!"));
+	std::thread reader([&]() {
+		EXPECT_EQ("Hey, buddy!", two->Receive());
+		ret = two->ReceiveInto(buf, sizeof(buf));
+	});
+	usleep(10000);
+	one->Shutdown();
+	reader.join();
+
+	EXPECT_EQ(0, ret);
+	EXPECT_TRUE(two->IsEOF());
+	EXPECT_EQ(-1, two->Send("Hey, buddy!"));
+	EXPECT_EQ(EPIPE, errno);
+	two->Shutdown();
+}
+
+TEST_F(SharedMemoryConnectionTest, Server)
+{
+	EchoCallback* cb = new EchoCallback();
+	ScopedPtr<Server> srv(0);
+	SharedMemoryConnection* client = 0;
+
+	ASSERT_NO_THROW(srv.Reset(new Server("[::1]:12360", cb, 2)));
+	srv->SetSharedMemory(path_, 8192);
+
+	ClosureThread ct(NewCallback(srv.Get(), &Server::Listen));
+	ct.Start();
+
+	for (int i = 0; i < 100 && !client; ++i)
+	{
+		try
+		{
+			client = SharedMemoryConnection::Connect(path_);
+		}
+		catch (ClientConnectionException e)
+		{
+			usleep(10000);
+		}
+	}
+	ASSERT_TRUE(client != 0);
+
+	for (int i = 0; i < 100; ++i)
+	{
+		EXPECT_EQ(6, client->Send("hello\n"));
+		EXPECT_EQ("hello\n", client->Receive());
+	}
+
+	// Larger than the rings, so both sides have to wait for each
+	// other.
+	string big(100000, 'x');
+	string received;
+	std::thread reader([&]() {
+		while (received.size() < big.size())
+			received += client->Receive();
+	});
+	EXPECT_EQ((ssize_t) big.size(), client->Send(big));
+	reader.join();
+	EXPECT_EQ(big, received);
+
+	// The server finds out when the client goes away.
+	client->Shutdown();
+	for (int i = 0; i < 500 && cb->terminated == 0; ++i)
+		usleep(1000);
+	EXPECT_EQ(1, cb->terminated);
+
+	// Another connection ends the last round, unless there was one
+	// after the shutdown already.
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path_.c_str());
+
+	srv->Shutdown();
+	int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	EXPECT_EQ(0, connect(sock, (struct sockaddr*) &addr, sizeof(addr)))
+		<< strerror(errno);
+	ct.WaitForFinished();
+	close(sock);
+}
+
+}  // namespace testing
+}  // namespace siot
+}  // namespace toolbox
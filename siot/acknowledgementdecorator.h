@@ -69,6 +69,21 @@ public:
 	// all unacknowledged data, including the data which was just read.
 	virtual string Receive(size_t maxlen = 0, int flags = 0);
 
+	// Like Receive(), but returns the data as a Buffer sharing memory
+	// with the data read from the wrapped connection.
+	virtual Buffer ReceiveBuffer(size_t maxlen = 0, int flags = 0);
+
+	// Like Receive(), but copies up to "len" bytes of unacknowledged data
+	// into "buf". With automatic acknowledgement, only the data which was
+	// copied is acknowledged.
+	virtual ssize_t ReceiveInto(char* buf, size_t len, int flags = 0);
+
+	// Like ReceiveBuffer() and ReceiveInto(), but report errors in the
+	// result. Exceeding the buffer size is reported as ENOBUFS.
+	virtual IOResult TryReceiveBuffer(Buffer* data, size_t maxlen = 0,
+			int flags = 0);
+	virtual IOResult TryReceiveInto(char* buf, size_t len, int flags = 0);
+
 	// Acknowledge "bytes" number of bytes from the internal buffer so
 	// they won't be returned again on the next call.
 	virtual bool Acknowledge(size_t bytes);
@@ -86,10 +101,32 @@ public:
 
 	// Forwarded to wrapped connection object.
 	virtual ssize_t Send(string data, int flags = 0);
+	virtual ssize_t SendVector(const BufferView* views, size_t count,
+			int flags = 0);
+	virtual ssize_t SendBuffer(const Buffer& data, int flags = 0);
+	virtual IOResult TrySendVector(const BufferView* views, size_t count,
+			int flags = 0);
+	virtual ssize_t SendZeroCopy(const char* data, size_t len,
+			google::protobuf::Closure* release, int flags = 0);
+	virtual ssize_t SendFile(int fd, off_t offset, size_t len);
 	virtual string PeerAsText();
 	virtual Server* GetServer();
 	virtual uint64_t GetLastUse();
 	virtual void SetBlocking(bool blocking = true);
+	virtual void SetWriteQueue(size_t low_watermark, size_t high_watermark);
+	virtual void SetZeroCopyThreshold(size_t threshold);
+	virtual bool ProcessErrorQueue();
+	virtual void ApplySocketOptions(const SocketOptions& options);
+	virtual size_t GetWriteQueueSize();
+	virtual void FlushWriteQueue();
+	virtual void SetSchedulingClass(const string& cls, uint32_t weight = 1);
+	virtual const string& GetSchedulingClass();
+	virtual uint32_t GetSchedulingWeight();
+	virtual int GetIncomingCPU();
+	virtual void SetWorkerShard(int shard);
+	virtual int GetWorkerShard();
+	virtual void SetListener(int listener);
+	virtual int GetListener();
 	virtual void Shutdown();
 	virtual bool IsShutdown();
 
@@ -98,7 +135,7 @@ private:
 	const bool owned_;
 	const uint64_t max_buffer_size_;
 	bool autoack_;
-	string buffer_;
+	Buffer buffer_;
 };
 
 }  // namespace siot
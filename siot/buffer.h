@@ -0,0 +1,134 @@
+/*-
+ * Copyright (c) 2026 Caoimhe Chaos <caoimhechaos@protonmail.com>,
+ *                    Ancient Solutions. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions  of source code must retain  the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions  in   binary  form  must   reproduce  the  above
+ *    copyright  notice, this  list  of conditions  and the  following
+ *    disclaimer in the  documentation and/or other materials provided
+ *    with the distribution.
+ *
+ * THIS  SOFTWARE IS  PROVIDED BY  ANCIENT SOLUTIONS  AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO,  THE IMPLIED WARRANTIES OF  MERCHANTABILITY AND FITNESS
+ * FOR A  PARTICULAR PURPOSE  ARE DISCLAIMED.  IN  NO EVENT  SHALL THE
+ * FOUNDATION  OR CONTRIBUTORS  BE  LIABLE FOR  ANY DIRECT,  INDIRECT,
+ * INCIDENTAL,   SPECIAL,    EXEMPLARY,   OR   CONSEQUENTIAL   DAMAGES
+ * (INCLUDING, BUT NOT LIMITED  TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE,  DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT  LIABILITY,  OR  TORT  (INCLUDING NEGLIGENCE  OR  OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INCLUDED_SIOT_BUFFER_H
+#define INCLUDED_SIOT_BUFFER_H 1
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace toolbox
+{
+namespace siot
+{
+using std::string;
+class PooledBuffer;
+struct BufferView;
+
+// Memory shared between buffers. The concrete types are internal.
+class BufferStorage;
+
+// A chunk of data which was read from a connection. Buffers are handed to
+// the ConnectionCallback, which then owns them and must delete them when
+// it's done with the data.
+//
+// Buffers refer to reference counted memory, so copying and slicing them is
+// cheap and doesn't copy the data. A buffer may also be a chain of several
+// pieces of memory, which is what Append() produces. Buffers are not safe
+// for use from multiple threads at the same time, even if all accesses
+// only read.
+class Buffer
+{
+public:
+	// Returned by Find() if there is no match.
+	static const size_t npos = static_cast<size_t>(-1);
+
+	// Creates an empty buffer.
+	Buffer();
+
+	// Creates a new buffer holding the data in "data". The contents are
+	// moved into the buffer rather than copied.
+	explicit Buffer(string&& data);
+
+	// Creates a new buffer holding a copy of the "length" bytes at "data".
+	Buffer(const char* data, size_t length);
+
+	// Creates a new buffer holding the first "length" bytes of "pooled",
+	// taking ownership of it.
+	Buffer(PooledBuffer* pooled, size_t length);
+
+	Buffer(const Buffer& other);
+	Buffer(Buffer&& other);
+	Buffer& operator=(const Buffer& other);
+	Buffer& operator=(Buffer&& other);
+	virtual ~Buffer();
+
+	// Pointer to the beginning of the data held by the buffer. If the
+	// buffer is a chain, the pieces are joined into one first.
+	const char* Data() const;
+
+	// Number of bytes held by the buffer.
+	size_t Size() const;
+
+	// Determines whether the buffer holds any data at all.
+	bool IsEmpty() const;
+
+	// Returns a copy of the buffer contents as a string.
+	string AsString() const;
+
+	// Returns a buffer referring to "length" bytes of this buffer,
+	// starting at "offset", without copying them. The length is cut off
+	// at the end of the buffer.
+	Buffer Slice(size_t offset, size_t length = npos) const;
+
+	// Appends the data of "other" to the end of the chain, without copying
+	// it.
+	void Append(const Buffer& other);
+
+	// Returns the position of the first occurrence of "c" at or after
+	// "from", or npos if there is none.
+	size_t Find(char c, size_t from = 0) const;
+
+	// Copies up to "length" bytes starting at "offset" to "dest". Returns
+	// the number of bytes copied.
+	size_t CopyTo(char* dest, size_t length, size_t offset = 0) const;
+
+	// Returns the number of pieces of memory the buffer is made of.
+	size_t CountSegments() const;
+
+	// Returns the piece of memory number "n", e.g. for use with
+	// Connection::SendVector().
+	BufferView GetSegment(size_t n) const;
+
+private:
+	struct Piece
+	{
+		std::shared_ptr<BufferStorage> storage;
+		const char* data;
+		size_t length;
+	};
+
+	mutable std::vector<Piece> pieces_;
+	size_t size_;
+};
+}  // namespace siot
+}  // namespace toolbox
+
+#endif /* INCLUDED_SIOT_BUFFER_H */
@@ -0,0 +1,101 @@
+/*-
+ * Copyright (c) 2026 Caoimhe Chaos <caoimhechaos@protonmail.com>,
+ *                    Ancient Solutions. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions  of source code must retain  the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions  in   binary  form  must   reproduce  the  above
+ *    copyright  notice, this  list  of conditions  and the  following
+ *    disclaimer in the  documentation and/or other materials provided
+ *    with the distribution.
+ *
+ * THIS  SOFTWARE IS  PROVIDED BY  ANCIENT SOLUTIONS  AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO,  THE IMPLIED WARRANTIES OF  MERCHANTABILITY AND FITNESS
+ * FOR A  PARTICULAR PURPOSE  ARE DISCLAIMED.  IN  NO EVENT  SHALL THE
+ * FOUNDATION  OR CONTRIBUTORS  BE  LIABLE FOR  ANY DIRECT,  INDIRECT,
+ * INCIDENTAL,   SPECIAL,    EXEMPLARY,   OR   CONSEQUENTIAL   DAMAGES
+ * (INCLUDING, BUT NOT LIMITED  TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE,  DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT  LIABILITY,  OR  TORT  (INCLUDING NEGLIGENCE  OR  OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INCLUDED_SIOT_BUFFERPOOL_H
+#define INCLUDED_SIOT_BUFFERPOOL_H 1
+
+#include <stddef.h>
+
+namespace toolbox
+{
+namespace siot
+{
+// A library wide pool of fixed size I/O buffers. Buffers come in a few size
+// classes and are carved out of larger slabs, which are never given back to
+// the system. Every thread keeps a small cache of free buffers of its own;
+// the shared part of the pool is only touched to refill or drain those
+// caches in batches. On NUMA systems, there is a shared pool per node with
+// slabs placed on that node; threads take their buffers from the pool of
+// the node they run on, and buffers always go back to the pool they came
+// from.
+class BufferPool
+{
+public:
+	// The available size classes.
+	static const size_t kSmallBufferSize = 4096;
+	static const size_t kMediumBufferSize = 16384;
+	static const size_t kLargeBufferSize = 65536;
+
+	// Returns a buffer of at least "size" bytes. Sizes above the largest
+	// size class are allocated directly from the heap. The buffer must
+	// be returned with Release(), passing the same size.
+	static char* Allocate(size_t size);
+
+	// Returns the buffer "buf", which was obtained with Allocate(size),
+	// to the pool.
+	static void Release(char* buf, size_t size);
+
+	// Returns the number of bytes a buffer allocated with Allocate(size)
+	// can actually hold.
+	static size_t Capacity(size_t size);
+
+	// Tries to back new slabs with huge pages. Slabs which were already
+	// allocated are unaffected. If the system has no huge pages to spare,
+	// regular pages are used.
+	static void SetHugePages(bool enable);
+
+	// Returns the number of bytes allocated for slabs so far.
+	static size_t GetResidentSize();
+};
+
+// Holds a buffer from the BufferPool for as long as it exists.
+class PooledBuffer
+{
+public:
+	// Obtains a buffer of at least "size" bytes from the pool.
+	explicit PooledBuffer(size_t size);
+	~PooledBuffer();
+
+	// Pointer to the beginning of the buffer.
+	char* Get() const;
+
+	// Number of bytes the buffer can hold.
+	size_t Size() const;
+
+private:
+	PooledBuffer(const PooledBuffer&) = delete;
+	PooledBuffer& operator=(const PooledBuffer&) = delete;
+
+	char* data_;
+	size_t size_;
+};
+}  // namespace siot
+}  // namespace toolbox
+
+#endif /* INCLUDED_SIOT_BUFFERPOOL_H */
@@ -30,16 +30,69 @@
 #ifndef INCLUDED_SIOT_CONNECTION_H
 #define INCLUDED_SIOT_CONNECTION_H 1
 
+#include <atomic>
 #include <string>
+#include <sys/types.h>
+#include <google/protobuf/stubs/common.h>
 #include <toolbox/scopedptr.h>
 #include <thread++/mutex.h>
 
+#include "siot/buffer.h"
+
 namespace toolbox
 {
 namespace siot
 {
 using std::string;
 class Server;
+class SocketOptions;
+
+// Refers to a piece of memory which is to be sent over a connection. The
+// memory is not owned by the view and must remain valid until the call
+// using it has returned.
+struct BufferView
+{
+	BufferView();
+	BufferView(const char* data, size_t length);
+	BufferView(const string& data);
+
+	const char* data;
+	size_t length;
+};
+
+// How an I/O operation which doesn't throw exceptions turned out.
+enum IOStatus
+{
+	// Data was transferred; see IOResult::length.
+	kIOOk = 0,
+	// Nothing could be transferred without waiting. Connections which
+	// have to encode the data first may report the part they did take
+	// in IOResult::length.
+	kIOWouldBlock,
+	// The peer has closed the connection.
+	kIOClosed,
+	// The connection failed; see IOResult::error.
+	kIOError,
+};
+
+// The result of one of the Try*() I/O methods of a connection.
+struct IOResult
+{
+	IOResult();
+	IOResult(IOStatus status, ssize_t length = 0, int error = 0);
+
+	// Returns true if data was transferred.
+	bool IsOk() const;
+
+	IOStatus status;
+
+	// The number of bytes transferred.
+	ssize_t length;
+
+	// The errno value describing the failure if "status" is kIOError.
+	// Protocol errors, e.g. in TLS, are reported as EPROTO.
+	int error;
+};
 
 // Prototype of a connection. The implementation may be OS specific.
 class Connection : public threadpp::ReadWriteMutex
@@ -55,9 +108,99 @@ public:
 	// Read up to maxlen bytes from the connection.
 	virtual string Receive(size_t maxlen = -1, int flags = 0) = 0;
 
+	// Reads up to "len" bytes from the connection directly into "buf".
+	// Returns the number of bytes read, 0 if there was nothing to read,
+	// or -1 on errors. The default implementation goes through Receive().
+	virtual ssize_t ReceiveInto(char* buf, size_t len, int flags = 0);
+
+	// Like Receive(), but returns the data as a Buffer, which can be
+	// sliced and passed on without copying. The default implementation
+	// wraps the result of Receive().
+	virtual Buffer ReceiveBuffer(size_t maxlen = -1, int flags = 0);
+
+	// Reads everything which is available without waiting, up to
+	// "maxlen" bytes, as a chain of pooled buffers. Connections are edge
+	// triggered, so ConnectionCallback::DataReady() must read until the
+	// connection is drained, or it won't be told about the rest. If
+	// "pending" is given, it is set to whether reading stopped at
+	// "maxlen" with more data possibly left, which then has to be read
+	// without waiting for another DataReady(). The default implementation
+	// calls ReceiveBuffer() until it comes back empty.
+	virtual Buffer ReceiveAll(size_t maxlen = -1, bool* pending = 0);
+
+	// Like ReceiveInto(), but reports errors and the lack of data in the
+	// result instead of throwing ClientConnectionException. This never
+	// waits for data. The default implementation goes through
+	// ReceiveInto() and catches its exceptions.
+	virtual IOResult TryReceiveInto(char* buf, size_t len, int flags = 0);
+
+	// Like ReceiveBuffer(), but stores the data in "data" and reports
+	// errors in the result instead of throwing. The default
+	// implementation reads into a pooled buffer with TryReceiveInto().
+	virtual IOResult TryReceiveBuffer(Buffer* data, size_t maxlen = -1,
+			int flags = 0);
+
 	// Send the bytes referred to by "data" over the connection.
 	virtual ssize_t Send(string data, int flags = 0) = 0;
 
+	// Send the "count" pieces of memory referred to by "views" over the
+	// connection, in order, as if they had been concatenated. This avoids
+	// having to assemble them into a single string first. The default
+	// implementation does just that, though.
+	virtual ssize_t SendVector(const BufferView* views, size_t count,
+			int flags = 0);
+
+	// Sends all pieces of "data" over the connection. The default
+	// implementation passes them to SendVector().
+	virtual ssize_t SendBuffer(const Buffer& data, int flags = 0);
+
+	// Like SendVector(), but reports errors in the result instead of
+	// throwing, and sends only what the connection takes without waiting
+	// (or queues it, if the write queue is enabled). The default
+	// implementation goes through SendVector() and catches its
+	// exceptions.
+	virtual IOResult TrySendVector(const BufferView* views, size_t count,
+			int flags = 0);
+
+	// Like SendBuffer(), using TrySendVector().
+	IOResult TrySendBuffer(const Buffer& data, int flags = 0);
+
+	// Send the "len" bytes at "data" over the connection without copying
+	// them, if the connection supports it and "len" is at least the
+	// zero-copy threshold (see SetZeroCopyThreshold()). The memory must
+	// remain valid and unmodified until "release" has been run, which
+	// happens once the system no longer needs it. That may only be
+	// after the connection has been shut down, in which case "release"
+	// is run by the server's reaper. The default implementation copies
+	// the data and runs "release" right away.
+	virtual ssize_t SendZeroCopy(const char* data, size_t len,
+			google::protobuf::Closure* release, int flags = 0);
+
+	// Sends "len" bytes from the file "fd", starting at "offset", over the
+	// connection without reading them into a string first. The file
+	// descriptor remains owned by the caller. Returns the number of bytes
+	// sent, or -1 if nothing could be sent. The default implementation
+	// maps the file into memory piece by piece and sends it using
+	// SendVector().
+	virtual ssize_t SendFile(int fd, off_t offset, size_t len);
+
+	// Makes Send() and SendZeroCopy() avoid copying the data into the
+	// kernel for sends of at least "threshold" bytes. A threshold of 0
+	// (the default) disables zero-copy sends. Connections which don't
+	// support them ignore this.
+	virtual void SetZeroCopyThreshold(size_t threshold);
+
+	// Processes pending notifications from the error queue of the
+	// connection, e.g. completions of zero-copy sends. Returns true if
+	// the notifications were all handled, false if there's an actual
+	// error on the connection. This is invoked by the server.
+	virtual bool ProcessErrorQueue();
+
+	// Applies the socket level tuning parameters in "options" to the
+	// connection, replacing the ones the server applied when accepting
+	// it. Connections which aren't backed by a socket ignore this.
+	virtual void ApplySocketOptions(const SocketOptions& options);
+
 	// Get a string describing the peer the socket connects to.
 	virtual string PeerAsText() = 0;
 
@@ -75,6 +218,59 @@ public:
 	// Sets the connection to blocking or non-blocking state.
 	virtual void SetBlocking(bool blocking = true) = 0;
 
+	// Makes Send() queue whatever can't be written to the connection
+	// right away instead of blocking or returning a short count. The
+	// queue is flushed in the background as soon as the peer accepts more
+	// data. When the queue grows beyond "high_watermark" bytes, the server
+	// invokes ConnectionCallback::WriteQueueFull(); once it has shrunk
+	// to "low_watermark" bytes or less, WriteQueueDrained() is invoked.
+	// Connections which don't support queueing ignore this.
+	virtual void SetWriteQueue(size_t low_watermark, size_t high_watermark);
+
+	// Gets the number of bytes waiting in the write queue.
+	virtual size_t GetWriteQueueSize();
+
+	// Writes as much of the write queue to the connection as possible
+	// without blocking. This is invoked by the server when the connection
+	// becomes writable again.
+	virtual void FlushWriteQueue();
+
+	// Assigns the connection to the scheduling class "cls" with the
+	// relative weight "weight". The server shares its worker threads
+	// between the classes in proportion to their weights, so connections
+	// in a class with a higher weight get their callbacks run sooner.
+	// All connections start out in the class "" with a weight of 1. This
+	// may be called from any thread, e.g. from the callbacks, while the
+	// server is dispatching callbacks for the connection.
+	virtual void SetSchedulingClass(const string& cls, uint32_t weight = 1);
+
+	// Gets the name of the scheduling class of the connection. The name
+	// remains valid for the lifetime of the process.
+	virtual const string& GetSchedulingClass();
+
+	// Gets the weight of the scheduling class of the connection.
+	virtual uint32_t GetSchedulingWeight();
+
+	// Gets the CPU on which the system processed the packets most
+	// recently received on the connection, or -1 if that's unknown.
+	virtual int GetIncomingCPU();
+
+	// Assigns the connection to the worker shard "shard" of its server,
+	// i.e. all callbacks for it are run by the threads of that shard
+	// from now on. -1 (the default) means the common worker pool.
+	virtual void SetWorkerShard(int shard);
+
+	// Gets the worker shard the connection is assigned to, or -1.
+	virtual int GetWorkerShard();
+
+	// Records which of the listeners added with Server::AddListener()
+	// accepted the connection. -1 (the default) means the address the
+	// server was created for, or none at all.
+	virtual void SetListener(int listener);
+
+	// Gets the listener which accepted the connection, or -1.
+	virtual int GetListener();
+
 	// Disconnects the socket and removes it from the notification queues.
 	// This should call Deregister() and then close the connection.
 	virtual void Shutdown();
@@ -88,23 +284,46 @@ public:
 	// Deregister().
 	virtual bool IsShutdown();
 
-	// Inherited from Mutex.
+	// Inherited from Mutex. The connection is locked exclusively while
+	// it is being closed.
 	virtual void Lock();
 	virtual bool TryLock();
 	virtual void Unlock();
 
-	// Inherited from ReadWriteMutex.
+	// Inherited from ReadWriteMutex. The connection is read locked while
+	// callbacks are being dispatched for it. Unlike most mutexes, the
+	// lock may be released by a different thread than the one which
+	// acquired it.
 	virtual void ReadLock();
 	virtual bool TryReadLock();
 
+	// Takes another read lock on behalf of a closure the caller hands
+	// the connection on to. Unlike ReadLock(), this doesn't wait for a
+	// pending Lock(), which in turn waits for the caller, so it must
+	// only be called while holding a read lock already.
+	void ShareReadLock();
+
 protected:
 	// Tell the associated server to deregister the connection. If no
 	// server connection was associated, this just cleans up the connection
 	// object.
 	virtual void Deregister();
 
-	ScopedPtr<ReadWriteMutex> mtx_;
+	// State of the connection lock: the number of read locks held, plus
+	// kLockClosing if it is locked exclusively or Lock() is waiting for
+	// the readers to finish. No new read locks are handed out while
+	// kLockClosing is set.
+	static const uint32_t kLockClosing = 0x80000000U;
+	std::atomic<uint32_t> lock_state_;
 	bool is_shutdown_;
+
+	// The server reads the scheduling class from the reactor while
+	// callbacks may change it. The names are interned by the
+	// FairScheduler, so they can be swapped without a lock.
+	std::atomic<const string*> scheduling_class_;
+	std::atomic<uint32_t> scheduling_weight_;
+	std::atomic<int> worker_shard_;
+	int listener_;
 };
 }  // namespace siot
 }  // namespace toolbox
@@ -0,0 +1,424 @@
+/*-
+ * Copyright (c) 2026 Caoimhe Chaos <caoimhechaos@protonmail.com>,
+ *                    Ancient Solutions. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions  of source code must retain  the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions  in   binary  form  must   reproduce  the  above
+ *    copyright  notice, this  list  of conditions  and the  following
+ *    disclaimer in the  documentation and/or other materials provided
+ *    with the distribution.
+ *
+ * THIS  SOFTWARE IS  PROVIDED BY  ANCIENT SOLUTIONS  AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO,  THE IMPLIED WARRANTIES OF  MERCHANTABILITY AND FITNESS
+ * FOR A  PARTICULAR PURPOSE  ARE DISCLAIMED.  IN  NO EVENT  SHALL THE
+ * FOUNDATION  OR CONTRIBUTORS  BE  LIABLE FOR  ANY DIRECT,  INDIRECT,
+ * INCIDENTAL,   SPECIAL,    EXEMPLARY,   OR   CONSEQUENTIAL   DAMAGES
+ * (INCLUDING, BUT NOT LIMITED  TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE,  DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT  LIABILITY,  OR  TORT  (INCLUDING NEGLIGENCE  OR  OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INCLUDED_SIOT_COROUTINE_H
+#define INCLUDED_SIOT_COROUTINE_H 1
+
+// Coroutine support needs C++20; the rest of the library only needs C++11,
+// so this header is empty for older compilers.
+#if defined(__has_include)
+#if __has_include(<coroutine>) && defined(__cpp_impl_coroutine)
+#define SIOT_HAVE_COROUTINES 1
+#endif
+#endif
+
+#ifdef SIOT_HAVE_COROUTINES
+
+#include <sys/socket.h>
+
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+#include <google/protobuf/stubs/common.h>
+
+#include "siot/buffer.h"
+#include "siot/connection.h"
+#include "siot/server.h"
+
+namespace toolbox
+{
+namespace siot
+{
+template<typename T> class Task;
+
+namespace internal
+{
+// Resumes the coroutine at "address". This is what the server runs once a
+// coroutine can continue.
+inline void
+ResumeCoroutine(void* address)
+{
+	std::coroutine_handle<>::from_address(address).resume();
+}
+
+inline google::protobuf::Closure*
+NewResumeCallback(std::coroutine_handle<> h)
+{
+	return google::protobuf::NewCallback(&ResumeCoroutine, h.address());
+}
+
+// Hands control back to whoever awaited the task once it has finished.
+struct FinalAwaiter
+{
+	bool await_ready() noexcept
+	{
+		return false;
+	}
+
+	template<typename P>
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h)
+		noexcept
+	{
+		std::coroutine_handle<> next = h.promise().continuation;
+		if (next)
+			return next;
+		return std::noop_coroutine();
+	}
+
+	void await_resume() noexcept
+	{
+	}
+};
+
+struct PromiseBase
+{
+	std::suspend_always initial_suspend() noexcept
+	{
+		return {};
+	}
+
+	FinalAwaiter final_suspend() noexcept
+	{
+		return {};
+	}
+
+	void unhandled_exception() noexcept
+	{
+		exception = std::current_exception();
+	}
+
+	void Rethrow()
+	{
+		if (exception)
+			std::rethrow_exception(exception);
+	}
+
+	std::coroutine_handle<> continuation;
+	std::exception_ptr exception;
+};
+
+template<typename T>
+struct Promise : PromiseBase
+{
+	void return_value(T v)
+	{
+		value = std::move(v);
+	}
+
+	T Take()
+	{
+		Rethrow();
+		return std::move(*value);
+	}
+
+	std::optional<T> value;
+};
+
+template<>
+struct Promise<void> : PromiseBase
+{
+	void return_void() noexcept
+	{
+	}
+
+	void Take()
+	{
+		Rethrow();
+	}
+};
+
+// Runs a task to completion without anyone waiting for it.
+struct Detached
+{
+	struct promise_type
+	{
+		Detached get_return_object() noexcept
+		{
+			return {};
+		}
+
+		std::suspend_never initial_suspend() noexcept
+		{
+			return {};
+		}
+
+		std::suspend_never final_suspend() noexcept
+		{
+			return {};
+		}
+
+		void return_void() noexcept
+		{
+		}
+
+		void unhandled_exception() noexcept
+		{
+			std::terminate();
+		}
+	};
+};
+
+// Waits until the server sees data arriving on "conn", or until it is
+// closed. Doesn't wait at all if the connection is already shut down.
+class ReadableAwaiter
+{
+public:
+	explicit ReadableAwaiter(Connection* conn)
+	: conn_(conn)
+	{
+	}
+
+	bool await_ready() noexcept
+	{
+		return false;
+	}
+
+	bool await_suspend(std::coroutine_handle<> h)
+	{
+		google::protobuf::Closure* c = NewResumeCallback(h);
+
+		if (conn_->GetServer()->NotifyWhenReadable(conn_, c))
+			return true;
+		delete c;
+		return false;
+	}
+
+	void await_resume() noexcept
+	{
+	}
+
+private:
+	Connection* conn_;
+};
+
+// Waits until the write queue of "conn" has drained, if it is full.
+class DrainedAwaiter
+{
+public:
+	explicit DrainedAwaiter(Connection* conn)
+	: conn_(conn)
+	{
+	}
+
+	bool await_ready() noexcept
+	{
+		return false;
+	}
+
+	bool await_suspend(std::coroutine_handle<> h)
+	{
+		google::protobuf::Closure* c = NewResumeCallback(h);
+
+		if (conn_->GetServer()->NotifyWhenDrained(conn_, c))
+			return true;
+		delete c;
+		return false;
+	}
+
+	void await_resume() noexcept
+	{
+	}
+
+private:
+	Connection* conn_;
+};
+
+Detached RunDetached(Task<void> task);
+}  // namespace internal
+
+// The result of a coroutine which produces a "T". Tasks are lazy: they only
+// start running once they're awaited, or passed to Spawn(). Exceptions
+// thrown in the task are rethrown where it's awaited.
+template<typename T>
+class Task
+{
+public:
+	struct promise_type : internal::Promise<T>
+	{
+		Task get_return_object() noexcept
+		{
+			return Task(std::coroutine_handle<promise_type>::
+					from_promise(*this));
+		}
+	};
+
+	Task(Task&& other) noexcept
+	: handle_(std::exchange(other.handle_, nullptr))
+	{
+	}
+
+	Task(const Task&) = delete;
+	Task& operator=(const Task&) = delete;
+
+	~Task()
+	{
+		if (handle_)
+			handle_.destroy();
+	}
+
+	bool await_ready() noexcept
+	{
+		return false;
+	}
+
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> h)
+		noexcept
+	{
+		handle_.promise().continuation = h;
+		return handle_;
+	}
+
+	T await_resume()
+	{
+		return handle_.promise().Take();
+	}
+
+private:
+	explicit Task(std::coroutine_handle<promise_type> h) noexcept
+	: handle_(h)
+	{
+	}
+
+	std::coroutine_handle<promise_type> handle_;
+};
+
+// Starts running "task" in the calling thread until it first has to wait.
+// Exceptions escaping the task terminate the program, so they must be
+// handled inside.
+//
+// Coroutines working on a connection should be spawned from one of its
+// ConnectionCallback methods: they hold the connection read locked while
+// they run, just like the callbacks, and are continued with the lock held
+// after waiting for the connection. Once a connection has been closed, the
+// coroutine must not use it anymore after its next wait; to close a
+// connection from a coroutine, use Connection::DeferredShutdown().
+inline void
+Spawn(Task<void> task)
+{
+	internal::RunDetached(std::move(task));
+}
+
+// Receives up to "maxlen" bytes from "conn", waiting for data to arrive
+// without blocking a thread. An empty buffer is returned once the
+// connection has been closed. The server of "conn" should not deliver data
+// (see Server::SetDataDelivery()), since DataReady() is no longer invoked
+// for connections read from this way.
+inline Task<Buffer>
+AsyncReceive(Connection* conn, size_t maxlen = -1)
+{
+	// Start recording readiness before reading, so that data arriving
+	// between the read and the wait isn't missed.
+	conn->GetServer()->NotifyWhenReadable(conn, 0);
+
+	for (;;)
+	{
+		Buffer data = conn->ReceiveBuffer(maxlen, MSG_DONTWAIT);
+
+		if (!data.IsEmpty() || conn->IsEOF() || conn->IsShutdown())
+			co_return data;
+
+		co_await internal::ReadableAwaiter(conn);
+	}
+}
+
+// Sends "data" to "conn". If the write queue of the connection fills up,
+// this waits until it has drained again. Without a write queue (see
+// Server::SetWriteQueue()), sending may block the thread.
+inline Task<ssize_t>
+AsyncSend(Connection* conn, Buffer data)
+{
+	ssize_t ret = conn->SendBuffer(data);
+
+	co_await internal::DrainedAwaiter(conn);
+	co_return ret;
+}
+
+// Waits for "duration" without blocking a thread, using the timers of a
+// server. If a connection is given, the coroutine continues with it locked,
+// and early if it is closed in the meantime.
+class Sleep
+{
+public:
+	Sleep(Server* srv, std::chrono::milliseconds duration)
+	: srv_(srv), conn_(0), duration_(duration)
+	{
+	}
+
+	Sleep(Connection* conn, std::chrono::milliseconds duration)
+	: srv_(conn->GetServer()), conn_(conn), duration_(duration)
+	{
+	}
+
+	bool await_ready() noexcept
+	{
+		return false;
+	}
+
+	bool await_suspend(std::coroutine_handle<> h)
+	{
+		uint64_t msec = duration_.count() > 0 ? duration_.count() : 0;
+		google::protobuf::Closure* c = internal::NewResumeCallback(h);
+
+		if (!conn_)
+		{
+			srv_->RunAfter(msec, c);
+			return true;
+		}
+		if (srv_->RunAfter(conn_, msec, c))
+			return true;
+		delete c;
+		return false;
+	}
+
+	void await_resume() noexcept
+	{
+	}
+
+private:
+	Server* srv_;
+	Connection* conn_;
+	std::chrono::milliseconds duration_;
+};
+
+namespace internal
+{
+inline Detached
+RunDetached(Task<void> task)
+{
+	co_await std::move(task);
+}
+}  // namespace internal
+}  // namespace siot
+}  // namespace toolbox
+
+#endif /* SIOT_HAVE_COROUTINES */
+#endif /* INCLUDED_SIOT_COROUTINE_H */
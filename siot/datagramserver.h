@@ -0,0 +1,203 @@
+/*-
+ * Copyright (c) 2026 Caoimhe Chaos <caoimhechaos@protonmail.com>,
+ *                    Ancient Solutions. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions  of source code must retain  the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions  in   binary  form  must   reproduce  the  above
+ *    copyright  notice, this  list  of conditions  and the  following
+ *    disclaimer in the  documentation and/or other materials provided
+ *    with the distribution.
+ *
+ * THIS  SOFTWARE IS  PROVIDED BY  ANCIENT SOLUTIONS  AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO,  THE IMPLIED WARRANTIES OF  MERCHANTABILITY AND FITNESS
+ * FOR A  PARTICULAR PURPOSE  ARE DISCLAIMED.  IN  NO EVENT  SHALL THE
+ * FOUNDATION  OR CONTRIBUTORS  BE  LIABLE FOR  ANY DIRECT,  INDIRECT,
+ * INCIDENTAL,   SPECIAL,    EXEMPLARY,   OR   CONSEQUENTIAL   DAMAGES
+ * (INCLUDING, BUT NOT LIMITED  TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE,  DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT  LIABILITY,  OR  TORT  (INCLUDING NEGLIGENCE  OR  OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INCLUDED_SIOT_DATAGRAMSERVER_H
+#define INCLUDED_SIOT_DATAGRAMSERVER_H 1
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <google/protobuf/stubs/common.h>
+#include <thread++/threadpool.h>
+#include <toolbox/scopedptr.h>
+#include <siot/buffer.h>
+#include <siot/socketoptions.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+namespace toolbox
+{
+namespace siot
+{
+using google::protobuf::Closure;
+
+class DatagramServer;
+class Server;
+
+// A datagram which was received by a DatagramServer, or which is to be sent
+// from it, together with the address of the peer.
+struct Datagram
+{
+	// Creates an empty datagram without a peer.
+	Datagram();
+
+	// Creates a datagram holding "data", to be sent to "peer".
+	Datagram(const Buffer& data, const struct sockaddr* peer,
+			socklen_t peer_length);
+
+	// Creates a datagram holding "data", addressed to the peer which
+	// sent this datagram.
+	Datagram Reply(const Buffer& data) const;
+
+	// Returns the address of the peer in a human readable form.
+	string PeerAsText() const;
+
+	Buffer data;
+	struct sockaddr_storage peer;
+	socklen_t peer_length;
+};
+
+// Prototype of a class to notify when datagrams have been received.
+class DatagramCallback
+{
+public:
+	virtual ~DatagramCallback();
+
+	// This method is invoked in a worker thread for every datagram
+	// "dgram" received by "server".
+	virtual void DatagramReceived(DatagramServer* server,
+			const Datagram& dgram) = 0;
+
+	// This method is invoked in a worker thread with all the datagrams
+	// which were read in one go. The default invokes DatagramReceived()
+	// for each of them in turn; overriding it allows handling them
+	// together, e.g. answering them with DatagramServer::SendBatch().
+	virtual void DatagramsReceived(DatagramServer* server,
+			const std::vector<Datagram>& batch);
+
+	// Report an error which occurred receiving datagrams. By default,
+	// they're ignored.
+	virtual void ReceiveFailed(std::string msg);
+};
+
+// The datagram server binds a UDP socket and hands the datagrams arriving
+// on it to a DatagramCallback. Datagrams are read in batches into buffers
+// from the BufferPool, with one system call per batch where the platform
+// supports it, and each batch is processed in a worker thread. Counts of
+// the datagrams received and sent, and of errors, are exported in the
+// "siot-datagrams-received", "siot-datagrams-sent" and
+// "siot-datagram-errors" variables.
+class DatagramServer
+{
+public:
+	// Create a new datagram server bound to the address specified in
+	// "addr", passing the datagrams received to "callback".
+	// "num_threads" sets the number of worker threads processing them.
+	DatagramServer(std::string addr, DatagramCallback* callback,
+			uint32_t num_threads = 16);
+
+	// Like the above, but processes the datagrams in the worker threads
+	// of "server", so TCP and UDP requests share the same threads.
+	DatagramServer(std::string addr, DatagramCallback* callback,
+			Server* server);
+
+	// Stop listening and close the socket.
+	virtual ~DatagramServer();
+
+	// Set the number of datagrams read with one system call. The default
+	// is 32.
+	DatagramServer* SetBatchSize(size_t batch_size);
+
+	// Set the size of the largest datagram expected. Longer datagrams
+	// are truncated and dropped. The default is 2048 bytes.
+	DatagramServer* SetMaxDatagramSize(size_t size);
+
+	// Lets the system coalesce consecutive datagrams from the same peer
+	// into a single read (UDP_GRO), which saves a lot of work at high
+	// packet rates. They are split up again before being handed to the
+	// callback. Reads then need buffers of the largest size class. This
+	// is disabled by default and should be called before Listen().
+	DatagramServer* SetReceiveOffload(bool enable);
+
+	// Lets the system split consecutive datagrams of equal size to the
+	// same peer, passed to SendBatch(), from a single write (UDP_SEGMENT).
+	// This is enabled by default where the platform supports it. If the
+	// network device turns out not to support it, it is disabled again
+	// automatically.
+	DatagramServer* SetSendOffload(bool enable);
+
+	// Applies the socket tuning parameters in "options" to the socket.
+	// Only the options which aren't specific to TCP have any effect.
+	// This should be called before Listen().
+	DatagramServer* SetSocketOptions(const SocketOptions& options);
+
+	// Sends "dgram" to its peer. Returns false if that failed; the reason
+	// can be found in errno.
+	bool Send(const Datagram& dgram);
+
+	// Sends the "count" datagrams in "dgrams", with as few system calls as
+	// possible. Returns the number of datagrams sent, which is less than
+	// "count" if one of them couldn't be sent; the reason can be found
+	// in errno. This may be used from several threads at the same time.
+	size_t SendBatch(const Datagram* dgrams, size_t count);
+	size_t SendBatch(const std::vector<Datagram>& dgrams);
+
+	// Runs "c" in one of the worker threads of the server.
+	void Execute(Closure* c);
+
+	// Start receiving datagrams. This call will block, so you may want
+	// to start it in a separate thread.
+	void Listen();
+
+	// Instruct the server to stop receiving datagrams. Listen() returns
+	// once the batch being read has been dispatched.
+	void Shutdown();
+
+private:
+	// Creates the socket. Used by the constructors.
+	void Init(const std::string& addr);
+
+	// Hands the datagrams in "batch" to the callback and deletes it.
+	void Deliver(std::vector<Datagram>* batch);
+
+	// Sends as many of the "count" datagrams in "dgrams" as fit into one
+	// batch. Returns the number of datagrams sent, or 0 on error.
+	size_t SendSome(const Datagram* dgrams, size_t count);
+
+	ScopedPtr<DatagramCallback> callback_;
+	ScopedPtr<threadpp::ThreadPool> executor_;
+	Server* server_;
+	size_t batch_size_;
+	size_t max_datagram_size_;
+	bool receive_offload_;
+	std::atomic<bool> send_offload_;
+	std::atomic<bool> running_;
+	SocketOptions socket_options_;
+
+	struct addrinfo* info_;
+	int fd_;
+
+	// Written to by Shutdown() to wake up Listen().
+	int wakeup_[2];
+};
+}  // namespace siot
+}  // namespace toolbox
+
+#endif /* INCLUDED_SIOT_DATAGRAMSERVER_H */
@@ -30,7 +30,6 @@
 #ifndef INCLUDED_SIOT_LINEBUFFERDECORATOR_H
 #define INCLUDED_SIOT_LINEBUFFERDECORATOR_H 1
 
-#include <list>
 #include <string>
 #include <toolbox/scopedptr.h>
 #include <siot/connection.h>
@@ -65,21 +64,67 @@ public:
 	// (\n, \r\n) will be returned as \n at the end of the line.
 	virtual string Receive(size_t ignored = 0, int flags = 0);
 
+	// Like Receive(), but returns the line as a slice of the data read
+	// from the wrapped connection.
+	virtual Buffer ReceiveBuffer(size_t ignored = 0, int flags = 0);
+
+	// Copies up to "len" bytes of the next line into "buf". If the line
+	// doesn't fit, the rest of it is returned by the next call.
+	virtual ssize_t ReceiveInto(char* buf, size_t len, int flags = 0);
+
+	// Like ReceiveBuffer() and ReceiveInto(), but report errors in the
+	// result. Until a complete line has arrived, they report kIOWouldBlock.
+	virtual IOResult TryReceiveBuffer(Buffer* data, size_t ignored = 0,
+			int flags = 0);
+	virtual IOResult TryReceiveInto(char* buf, size_t len, int flags = 0);
+
 	// Forwarded to wrapped connection object.
 	virtual ssize_t Send(string data, int flags = 0);
+	virtual ssize_t SendVector(const BufferView* views, size_t count,
+			int flags = 0);
+	virtual ssize_t SendBuffer(const Buffer& data, int flags = 0);
+	virtual IOResult TrySendVector(const BufferView* views, size_t count,
+			int flags = 0);
+	virtual ssize_t SendZeroCopy(const char* data, size_t len,
+			google::protobuf::Closure* release, int flags = 0);
+	virtual ssize_t SendFile(int fd, off_t offset, size_t len);
 	virtual string PeerAsText();
 	virtual Server* GetServer();
 	virtual bool IsEOF();
 	virtual uint64_t GetLastUse();
 	virtual void SetBlocking(bool blocking = true);
+	virtual void SetWriteQueue(size_t low_watermark, size_t high_watermark);
+	virtual void SetZeroCopyThreshold(size_t threshold);
+	virtual bool ProcessErrorQueue();
+	virtual void ApplySocketOptions(const SocketOptions& options);
+	virtual size_t GetWriteQueueSize();
+	virtual void FlushWriteQueue();
+	virtual void SetSchedulingClass(const string& cls, uint32_t weight = 1);
+	virtual const string& GetSchedulingClass();
+	virtual uint32_t GetSchedulingWeight();
+	virtual int GetIncomingCPU();
+	virtual void SetWorkerShard(int shard);
+	virtual int GetWorkerShard();
+	virtual void SetListener(int listener);
+	virtual int GetListener();
 	virtual void Shutdown();
 	virtual bool IsShutdown();
 
 private:
+	// Reads from the wrapped connection until a complete line is
+	// available and stores it in "line", as a slice of the data which
+	// was read. Returns false if there is no complete line yet. If
+	// "result" is given, the wrapped connection is read without
+	// exceptions and the outcome of the last read is stored there.
+	bool NextLine(Buffer* line, IOResult* result = 0);
+
 	Connection* wrapped_;
 	const bool owned_;
-	string remainder_;
-	std::list<string> remaining_lines_;
+	Buffer remainder_;
+
+	// The rest of a line which was only partially returned by
+	// ReceiveInto().
+	Buffer partial_;
 };
 
 }  // namespace siot
@@ -0,0 +1,113 @@
+/*-
+ * Copyright (c) 2026 Caoimhe Chaos <caoimhechaos@protonmail.com>,
+ *                    Ancient Solutions. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions  of source code must retain  the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions  in   binary  form  must   reproduce  the  above
+ *    copyright  notice, this  list  of conditions  and the  following
+ *    disclaimer in the  documentation and/or other materials provided
+ *    with the distribution.
+ *
+ * THIS  SOFTWARE IS  PROVIDED BY  ANCIENT SOLUTIONS  AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO,  THE IMPLIED WARRANTIES OF  MERCHANTABILITY AND FITNESS
+ * FOR A  PARTICULAR PURPOSE  ARE DISCLAIMED.  IN  NO EVENT  SHALL THE
+ * FOUNDATION  OR CONTRIBUTORS  BE  LIABLE FOR  ANY DIRECT,  INDIRECT,
+ * INCIDENTAL,   SPECIAL,    EXEMPLARY,   OR   CONSEQUENTIAL   DAMAGES
+ * (INCLUDING, BUT NOT LIMITED  TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE,  DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT  LIABILITY,  OR  TORT  (INCLUDING NEGLIGENCE  OR  OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INCLUDED_SIOT_LOOPBACKCONNECTION_H
+#define INCLUDED_SIOT_LOOPBACKCONNECTION_H 1
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <siot/connection.h>
+
+namespace toolbox
+{
+namespace siot
+{
+// A connection between two parts of the same process, which passes the data
+// through a pair of ring buffers in memory rather than through the kernel.
+// One end is usually handed to a Server with Server::InjectConnection(),
+// which then serves it like any connection it accepted, while the other end
+// is used directly, e.g. by a co-located client, or by a benchmark which
+// should only measure the overhead of the library. No system calls are made
+// unless one side has to wait for the other.
+class LoopbackConnection : public Connection
+{
+public:
+	// Creates two connections "one" and "two" which are connected to
+	// each other. Each of them buffers up to "capacity" bytes sent to it
+	// until they are received. Both have to be shut down eventually.
+	static void CreatePair(LoopbackConnection** one,
+			LoopbackConnection** two, size_t capacity = 65536);
+
+	virtual ~LoopbackConnection();
+
+	// Implements Connection. Like for sockets, receiving blocks until
+	// there is data unless the connection is non-blocking or
+	// MSG_DONTWAIT is given, and sending waits for the peer to make
+	// space unless MSG_DONTWAIT is given.
+	virtual string Receive(size_t maxlen = -1, int flags = 0);
+	virtual ssize_t ReceiveInto(char* buf, size_t len, int flags = 0);
+	virtual IOResult TryReceiveInto(char* buf, size_t len, int flags = 0);
+	virtual ssize_t Send(string data, int flags = 0);
+	virtual ssize_t SendVector(const BufferView* views, size_t count,
+			int flags = 0);
+	virtual IOResult TrySendVector(const BufferView* views, size_t count,
+			int flags = 0);
+	virtual string PeerAsText();
+	virtual Server* GetServer();
+	virtual bool IsEOF();
+	virtual uint64_t GetLastUse();
+	virtual void SetBlocking(bool blocking = true);
+	virtual void Shutdown();
+
+	// Makes the connection part of "server", which knows it by the
+	// number "id": data arriving and the peer going away are reported to
+	// the server with Server::NotifyReadable() and Server::NotifyHangUp().
+	// The connection becomes non-blocking. Returns true if data has
+	// arrived already. This is used by Server::InjectConnection().
+	bool Attach(Server* server, int id);
+
+private:
+	// The state shared by both ends.
+	struct Channel;
+
+	LoopbackConnection(const std::shared_ptr<Channel>& channel, int side);
+
+	// Copies up to "len" bytes which arrived for this end to "buf".
+	// Returns the number of bytes copied, 0 if the peer is gone, or -1
+	// with errno set to EAGAIN if there was nothing to receive and
+	// waiting wasn't requested.
+	ssize_t Read(char* buf, size_t len, bool wait);
+
+	// Copies the data in "views" to the peer, waiting for it to make
+	// space if "wait" is true. Returns the number of bytes copied, or -1
+	// with errno set to EAGAIN or EPIPE if nothing could be copied.
+	ssize_t Write(const BufferView* views, size_t count, bool wait);
+
+	std::shared_ptr<Channel> channel_;
+	const int side_;
+	std::atomic<Server*> server_;
+	std::atomic<bool> blocking_;
+	std::atomic<bool> eof_;
+	std::atomic<uint64_t> last_use_;
+};
+}  // namespace siot
+}  // namespace toolbox
+
+#endif /* INCLUDED_SIOT_LOOPBACKCONNECTION_H */
@@ -0,0 +1,197 @@
+/*-
+ * Copyright (c) 2026 Caoimhe Chaos <caoimhechaos@protonmail.com>,
+ *                    Ancient Solutions. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions  of source code must retain  the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions  in   binary  form  must   reproduce  the  above
+ *    copyright  notice, this  list  of conditions  and the  following
+ *    disclaimer in the  documentation and/or other materials provided
+ *    with the distribution.
+ *
+ * THIS  SOFTWARE IS  PROVIDED BY  ANCIENT SOLUTIONS  AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO,  THE IMPLIED WARRANTIES OF  MERCHANTABILITY AND FITNESS
+ * FOR A  PARTICULAR PURPOSE  ARE DISCLAIMED.  IN  NO EVENT  SHALL THE
+ * FOUNDATION  OR CONTRIBUTORS  BE  LIABLE FOR  ANY DIRECT,  INDIRECT,
+ * INCIDENTAL,   SPECIAL,    EXEMPLARY,   OR   CONSEQUENTIAL   DAMAGES
+ * (INCLUDING, BUT NOT LIMITED  TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE,  DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT  LIABILITY,  OR  TORT  (INCLUDING NEGLIGENCE  OR  OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INCLUDED_SIOT_PIPELINEDECORATOR_H
+#define INCLUDED_SIOT_PIPELINEDECORATOR_H 1
+
+#include <map>
+#include <string>
+#include <thread++/mutex.h>
+#include <toolbox/scopedptr.h>
+#include <siot/connection.h>
+
+namespace toolbox
+{
+namespace siot
+{
+using std::string;
+
+/**
+ * Allows multiple requests read from the same connection to be processed
+ * in parallel while still sending the responses in the order the requests
+ * came in. For every request, the handler reserves a response slot using
+ * ReserveSlot() before handing the request off to another thread, e.g. using
+ * Server::Execute(Connection*, Closure*). The response is then written into
+ * the slot using SendToSlot() and the slot is closed with CompleteSlot().
+ * The handler must hold a read lock on the connection while doing so, since
+ * Shutdown() deletes the decorator; Server::Execute(Connection*, Closure*)
+ * takes care of that.
+ *
+ * Data written to the oldest incomplete slot is sent right away; data for
+ * all other slots is held back until all slots before it have been
+ * completed.
+ *
+ * By default, this takes ownership of the connection handle. If you don't
+ * want this behavior, set the own parameter to false.
+ *
+ * The Receive() part is unchanged and may be combined with other decorators,
+ * e.g. the LineBufferDecorator.
+ */
+class PipelineDecorator : public Connection
+{
+public:
+	// Creates a new response sequencer around the connection "wrapped".
+	// If "own" is true (which is the default), this will take ownership
+	// of "wrapped".
+	explicit PipelineDecorator(Connection* wrapped, bool own = true);
+	virtual ~PipelineDecorator();
+
+	// Reserves the next response slot. Slots are sent in the order they
+	// were reserved in.
+	virtual uint64_t ReserveSlot();
+
+	// Appends "data" to the response in the slot "slot". If all slots
+	// reserved before "slot" have been completed, the data is sent right
+	// away; otherwise, it is held back. Returns the length of "data", or
+	// -1 if sending failed, with errno set.
+	//
+	// If the wrapped connection only takes part of the data (e.g. a
+	// non-blocking socket without a write queue), the rest is kept and
+	// sent ahead of everything else on the next call to SendToSlot(),
+	// CompleteSlot() or Flush(). Nothing else retries it, except for the
+	// server flushing the write queue of the connection, so callers which
+	// don't use a write queue have to call Flush() themselves once the
+	// connection is writable again.
+	virtual ssize_t SendToSlot(uint64_t slot, string data, int flags = 0);
+
+	// Marks the response in "slot" as complete. This will send out the
+	// held back responses of all following slots which are now at the
+	// front of the queue. Returns false if sending failed, with errno
+	// set.
+	virtual bool CompleteSlot(uint64_t slot);
+
+	// Sends "data" as the entire response in "slot" and completes it.
+	virtual ssize_t Respond(uint64_t slot, string data, int flags = 0);
+
+	// Sends the data which the wrapped connection didn't take before,
+	// followed by any held back data which is due by now. Returns false
+	// if sending failed, with errno set.
+	virtual bool Flush();
+
+	// Forwarded to the wrapped connection, which the server does once
+	// the socket is writable again. Then sends the data the connection
+	// didn't take before, as Flush() does.
+	virtual void FlushWriteQueue();
+
+	// Returns the number of slots which have been reserved but not yet
+	// completed, plus one if there is data the wrapped connection didn't
+	// take yet.
+	virtual uint64_t GetPendingSlots();
+
+	// Sends data right away, bypassing the sequencing.
+	virtual ssize_t Send(string data, int flags = 0);
+	virtual ssize_t SendVector(const BufferView* views, size_t count,
+			int flags = 0);
+	virtual ssize_t SendBuffer(const Buffer& data, int flags = 0);
+	virtual IOResult TrySendVector(const BufferView* views, size_t count,
+			int flags = 0);
+	virtual ssize_t SendZeroCopy(const char* data, size_t len,
+			google::protobuf::Closure* release, int flags = 0);
+	virtual ssize_t SendFile(int fd, off_t offset, size_t len);
+
+	// Forwarded to wrapped connection object.
+	virtual string Receive(size_t maxlen = -1, int flags = 0);
+	virtual ssize_t ReceiveInto(char* buf, size_t len, int flags = 0);
+	virtual Buffer ReceiveBuffer(size_t maxlen = -1, int flags = 0);
+	virtual IOResult TryReceiveInto(char* buf, size_t len, int flags = 0);
+	virtual IOResult TryReceiveBuffer(Buffer* data, size_t maxlen = -1,
+			int flags = 0);
+	virtual string PeerAsText();
+	virtual Server* GetServer();
+	virtual bool IsEOF();
+	virtual uint64_t GetLastUse();
+	virtual void SetBlocking(bool blocking = true);
+	virtual void SetWriteQueue(size_t low_watermark, size_t high_watermark);
+	virtual void SetZeroCopyThreshold(size_t threshold);
+	virtual bool ProcessErrorQueue();
+	virtual void ApplySocketOptions(const SocketOptions& options);
+	virtual size_t GetWriteQueueSize();
+	virtual void SetSchedulingClass(const string& cls, uint32_t weight = 1);
+	virtual const string& GetSchedulingClass();
+	virtual uint32_t GetSchedulingWeight();
+	virtual int GetIncomingCPU();
+	virtual void SetWorkerShard(int shard);
+	virtual int GetWorkerShard();
+	virtual void SetListener(int listener);
+	virtual int GetListener();
+	virtual void Shutdown();
+	virtual bool IsShutdown();
+
+private:
+	// Held back response for a single slot.
+	struct Slot
+	{
+		Slot();
+
+		string data;
+		int flags;
+		bool complete;
+	};
+
+	// Moves the next piece of data which is due to be sent into "data",
+	// along with its send flags. Returns false if there is none. Must be
+	// called with slots_mtx_ held.
+	bool TakeDueDataLocked(string* data, int* flags);
+
+	// Sends out all held back data which is now at the front of the
+	// queue, until the wrapped connection doesn't take any more. The
+	// data is sent without holding slots_mtx_; only one thread sends
+	// at a time, picking up data which becomes due meanwhile. Returns
+	// false if sending failed.
+	bool SendDueData();
+
+	Connection* wrapped_;
+	const bool owned_;
+	ScopedPtr<threadpp::Mutex> slots_mtx_;
+	std::map<uint64_t, Slot> slots_;
+	uint64_t next_slot_;
+	uint64_t head_slot_;
+
+	// Data which was due, but which the wrapped connection didn't take.
+	string unsent_;
+	int unsent_flags_;
+
+	// Whether a thread is sending data from the slots right now.
+	bool sending_;
+};
+
+}  // namespace siot
+}  // namespace toolbox
+
+#endif /* INCLUDED_SIOT_PIPELINEDECORATOR_H */
@@ -70,13 +70,36 @@ public:
 	// be set to true.
 	virtual string Receive(size_t len = 0, int flags = 0);
 
+	// Like Receive(), but reads directly into "buf".
+	virtual ssize_t ReceiveInto(char* buf, size_t len, int flags = 0);
+
+	// Like Receive(), but passes on the Buffer returned by the wrapped
+	// connection.
+	virtual Buffer ReceiveBuffer(size_t len = 0, int flags = 0);
+
+	// Like ReceiveBuffer() and ReceiveInto(), but report errors in the
+	// result. Once "max_size" bytes have been read, they report kIOClosed.
+	virtual IOResult TryReceiveBuffer(Buffer* data, size_t len = 0,
+			int flags = 0);
+	virtual IOResult TryReceiveInto(char* buf, size_t len, int flags = 0);
+
 	// This will return true when the end-of-line indicator is set on the
 	// underlying connection object or max_size bytes have been read from
 	// the handle.
 	virtual bool IsEOF();
 
-	// Calling Send() will always fail on RangeReaderDecorators.
+	// Calling Send(), SendVector(), SendBuffer(), SendZeroCopy() or
+	// SendFile() will always fail on RangeReaderDecorators.
+	// TrySendVector() reports EBADF.
 	virtual ssize_t Send(string data, int flags = 0);
+	virtual ssize_t SendVector(const BufferView* views, size_t count,
+			int flags = 0);
+	virtual ssize_t SendBuffer(const Buffer& data, int flags = 0);
+	virtual IOResult TrySendVector(const BufferView* views, size_t count,
+			int flags = 0);
+	virtual ssize_t SendZeroCopy(const char* data, size_t len,
+			google::protobuf::Closure* release, int flags = 0);
+	virtual ssize_t SendFile(int fd, off_t offset, size_t len);
 
 	// Advances until the end of max_size, then destroys the
 	// RangeReaderDecorator and, if own was set to true, tells the wrapped
@@ -88,6 +111,20 @@ public:
 	virtual Server* GetServer();
 	virtual uint64_t GetLastUse();
 	virtual void SetBlocking(bool blocking = true);
+	virtual void SetWriteQueue(size_t low_watermark, size_t high_watermark);
+	virtual void SetZeroCopyThreshold(size_t threshold);
+	virtual bool ProcessErrorQueue();
+	virtual void ApplySocketOptions(const SocketOptions& options);
+	virtual size_t GetWriteQueueSize();
+	virtual void FlushWriteQueue();
+	virtual void SetSchedulingClass(const string& cls, uint32_t weight = 1);
+	virtual const string& GetSchedulingClass();
+	virtual uint32_t GetSchedulingWeight();
+	virtual int GetIncomingCPU();
+	virtual void SetWorkerShard(int shard);
+	virtual int GetWorkerShard();
+	virtual void SetListener(int listener);
+	virtual int GetListener();
 	virtual bool IsShutdown();
 
 private:
@@ -35,10 +35,14 @@
 #include <thread++/threadpool.h>
 #include <toolbox/scopedptr.h>
 #include <condition_variable>
+#include <siot/buffer.h>
 #include <siot/connection.h>
+#include <siot/socketoptions.h>
 #include <siot/ssl.h>
 #include <string>
 #include <map>
+#include <set>
+#include <vector>
 
 namespace toolbox
 {
@@ -48,6 +52,10 @@ using google::protobuf::Closure;
 using ssl::ServerSSLContext;
 using threadpp::ReadWriteMutex;
 
+class FairScheduler;
+class LoopbackConnection;
+class WorkerShard;
+
 // Exception for errors which occurr during setup of the server.
 class ServerSetupException : public std::exception
 {
@@ -112,15 +120,48 @@ public:
 	virtual void ConnectionFailed(std::string msg);
 
 	// This indicates that data is available for reading on the given
-	// connection.
+	// connection. Sockets are non-blocking and only signalled again
+	// once new data arrives, so everything which is available should be
+	// read, e.g. with Connection::ReceiveAll().
 	virtual void DataReady(Connection* conn) = 0;
 
+	// If data delivery is enabled on the server (see
+	// Server::SetDataDelivery()), the server reads incoming data itself
+	// and hands it over in "data" instead of invoking DataReady(). The
+	// callback takes ownership of "data". The default is to discard it.
+	virtual void DataReceived(Connection* conn, Buffer* data);
+
+	// This is invoked when the write queue of the connection has grown
+	// beyond its high watermark, i.e. the peer isn't reading the data
+	// as fast as it's being sent. The default is to ignore it.
+	virtual void WriteQueueFull(Connection* conn);
+
+	// This is invoked when the write queue of a connection which was
+	// reported by WriteQueueFull() has shrunk to its low watermark again.
+	// The default is to ignore it.
+	virtual void WriteQueueDrained(Connection* conn);
+
 	// This is invoked to indicate a connection has been terminated and
 	// is about to be removed. The default is to ignore it.
 	virtual void ConnectionTerminated(Connection* conn);
 
 	// This is to report connection errors. The default is to ignore them.
 	virtual void Error(Connection* conn);
+
+	// This is invoked with the connection locked when "conn" is about to
+	// be handed over to a new instance of the server (see
+	// Server::SetHandOver()). It should store whatever the new instance
+	// needs to carry on serving the connection in "state" and return
+	// true, or return false to finish serving the connection here. The
+	// default is to keep all connections.
+	virtual bool SaveState(Connection* conn, std::string* state);
+
+	// This is invoked instead of ConnectionEstablished() for a connection
+	// which was handed over by a previous instance of the server, with
+	// the "state" stored by SaveState() there. The default is to invoke
+	// ConnectionEstablished().
+	virtual void ConnectionRestored(Connection* conn,
+			const std::string& state);
 };
 
 // The server class implements a server which accepts new connections and
@@ -144,6 +185,23 @@ public:
 	// default is SOMAXCONN.
 	Server* SetMaxConnections(int maxconn);
 
+	// Listens on "addr" as well, sharing the worker threads and the
+	// reactor with the address the server was created for. "addr" is
+	// either a host and port like for the constructor, or the path of a
+	// UNIX socket prefixed with "unix:". Connections accepted there are
+	// reported to "connected" rather than to the callback of the server
+	// if it's set, use TLS if "context" is set, and are closed right
+	// away while "maxconn" of them are open already, unless it's 0. The
+	// server takes ownership of "connected" and "context". The socket
+	// options of the server apply to TCP listeners as well. Only the
+	// address the server was created for is passed on by
+	// SetHandOver(), along with its connections. This should be called
+	// before Listen(). Throws a ServerSetupException if "addr" can't
+	// be used.
+	Server* AddListener(const std::string& addr,
+			ConnectionCallback* connected = 0,
+			const ServerSSLContext* context = 0, int maxconn = 0);
+
 	// Set the callback to be invoked when a new connection was
 	// established.
 	Server* SetConnectionCallback(ConnectionCallback* connected);
@@ -154,6 +212,124 @@ public:
 	// Listen(). This will take ownership of "context".
 	Server* SetServerSSLContext(const ServerSSLContext* context);
 
+	// Enables write queues on all new connections, with the given
+	// watermarks. See Connection::SetWriteQueue() for details.
+	Server* SetWriteQueue(size_t low_watermark, size_t high_watermark);
+
+	// Sends data of at least "threshold" bytes on new connections without
+	// copying it into the kernel, where the transport supports it. See
+	// Connection::SetZeroCopyThreshold() for details.
+	Server* SetZeroCopyThreshold(size_t threshold);
+
+	// Applies the socket tuning parameters in "options" to the listening
+	// socket and to every connection accepted from it. This should be
+	// called before Listen(). Individual connections can override them
+	// in ConnectionCallback::AddDecorators() using
+	// Connection::ApplySocketOptions(). If accepts are deferred (see
+	// SocketOptions::SetDeferAccept()) and data delivery is
+	// enabled, the first read on a new connection is attempted right
+	// after accepting it, rather than waiting for it to be reported.
+	Server* SetSocketOptions(const SocketOptions& options);
+
+	// Restricts the thread running Listen() to the CPUs in "cpus". This
+	// should be called before Listen().
+	Server* SetReactorCPUs(const std::vector<int>& cpus);
+
+	// Runs the thread calling Listen() with the SCHED_FIFO real time
+	// policy at the given priority, so it gets to accept connections and
+	// dispatch events ahead of everything else. 0 (the default) leaves
+	// the scheduling policy alone.
+	Server* SetReactorPriority(int priority);
+
+	// Starts a shard of worker threads for each of the CPUs in "cpus",
+	// restricted to run on that CPU. New connections are assigned to the
+	// shard of the CPU which received their packets, or spread across
+	// the shards if that's not known, and all of their callbacks are run
+	// by that shard. Without worker shards, all callbacks are run by the
+	// common worker pool. This should be called before Listen().
+	Server* SetWorkerCPUs(const std::vector<int>& cpus);
+
+	// Like SetWorkerCPUs(), but starts a shard of worker threads for each
+	// NUMA node of the system, restricted to the CPUs of that node. Since
+	// the threads of a shard take their I/O buffers from the memory of
+	// their node, the data of a connection stays on the node which
+	// services it. The system's statistics of remote memory accesses are
+	// exported while the server is running.
+	Server* SetNUMAAware(bool aware);
+
+	// Moves connections between the worker shards when their load drifts
+	// apart: if the busiest shard has run more than "max_imbalance" times
+	// as many callbacks as the least busy one since the last check, some
+	// of its connections are moved over. The check runs along with the
+	// reaping of idle connections. 0 (the default) disables this.
+	Server* SetShardRebalancing(double max_imbalance);
+
+	// Moves the connection "conn", including its decorators and whatever
+	// data they hold, to the worker shard "shard", i.e. all further
+	// callbacks for it are run there. This only works while no callbacks
+	// are queued or running for the connection, so it fails when invoked
+	// from one of them. Returns true if the connection was moved.
+	bool MigrateConnection(Connection* conn, int shard);
+
+	// Lets a new instance of the server take over from this one, e.g.
+	// to restart with a new binary, without dropping any connections.
+	// The server waits on the UNIX socket "path" for another server to
+	// call TakeOver() and passes its listening socket on to it, so
+	// nothing in the accept queue is lost. From then on, this server
+	// only finishes serving its remaining connections, and Listen()
+	// returns once they're gone. If "connections" is true, idle
+	// connections are passed on as well, along with the state stored
+	// for them by ConnectionCallback::SaveState(). TLS connections always
+	// stay, since their session state can't be passed on. This should be
+	// called before Listen().
+	Server* SetHandOver(const std::string& path, bool connections = false);
+
+	// Takes over the listening socket, and possibly connections, from the
+	// server waiting on the UNIX socket "path" (see SetHandOver()). The
+	// server keeps using the listening socket as it is, rather than
+	// binding its own. This should be called before Listen(). Throws a
+	// ServerSetupException if nothing could be taken over.
+	Server* TakeOver(const std::string& path);
+
+	// Accepts connections from processes on the same host on the UNIX
+	// socket "path", which exchange their data through shared memory
+	// (see SharedMemoryConnection), with "capacity" bytes buffered in each
+	// direction. They are served like any other connection, but aren't
+	// passed on by SetHandOver(). This should be called before Listen().
+	Server* SetSharedMemory(const std::string& path,
+			size_t capacity = 1 << 20);
+
+	// Instructs the server to read incoming data from the connections
+	// itself and to pass it to ConnectionCallback::DataReceived(), rather
+	// than just signalling DataReady() and leaving the reading to the
+	// callback. This is disabled by default.
+	Server* SetDataDelivery(bool deliver);
+
+	// Runs "c" in one of the worker threads of the server. This can be
+	// used by handlers to process multiple requests from the same
+	// connection in parallel, e.g. together with the PipelineDecorator.
+	// No lock is held on any connection while "c" runs; see below.
+	void Execute(Closure* c);
+
+	// Like Execute(), but holds a read lock on "conn" while "c" runs, so
+	// the connection can't be shut down and deleted underneath it. This
+	// must be called with "conn" read locked, e.g. from its callbacks. "c"
+	// must use DeferShutdown() rather than shutting down "conn" itself.
+	void Execute(Connection* conn, Closure* c);
+
+	// Serves "conn" like a connection which was just accepted, i.e.
+	// ConnectionEstablished() is called for it, followed by the other
+	// callbacks as data arrives from its peer. Returns the connection as
+	// decorated by ConnectionCallback::AddDecorators(). The server takes
+	// ownership of "conn"; its peer is used directly by the caller.
+	// Injected connections are never handed over to a successor.
+	Connection* InjectConnection(LoopbackConnection* conn);
+
+	// Called by injected connections when data arrived on the empty
+	// connection known as "fd", or its peer went away, respectively.
+	void NotifyReadable(int fd);
+	void NotifyHangUp(int fd);
+
 	// Marks the given connection as to be shut down when the next thread
 	// becomes free. This is useful for shutting down connections from
 	// handlers, which would otherwise block because the handlers are
@@ -164,6 +340,43 @@ public:
 	// are watched (i.e. we stop monitoring events and so forth).
 	void DequeueConnection(Connection* conn);
 
+	// Starts or stops watching the connection on the socket "fd" for
+	// becoming writable again, in which case its write queue is flushed.
+	void WatchWritable(int fd, bool watch);
+
+	// Invokes ConnectionCallback::WriteQueueFull() (if "full" is true)
+	// or ConnectionCallback::WriteQueueDrained() for the connection on the
+	// socket "fd" in a thread of its own.
+	void NotifyWriteQueue(int fd, bool full);
+
+	// Runs "c" once data arrives on the connection "conn", instead of
+	// invoking ConnectionCallback::DataReady() for it, so data delivery
+	// should be disabled for such connections. Like the other callbacks,
+	// "c" runs with the connection read locked. It is also run when the
+	// connection is being closed, so it has to check IsShutdown(). If data
+	// has arrived since the last wait, "c" is run right away. Passing no
+	// closure only starts recording whether data arrives, so none is
+	// missed before the first wait. Returns false without taking "c" if
+	// the connection is already shut down. This must be called with the
+	// connection read locked, e.g. from its callbacks. This allows waiting
+	// for data without blocking a thread; see siot/coroutine.h.
+	bool NotifyWhenReadable(Connection* conn, Closure* c);
+
+	// Runs "c" with "conn" read locked once the write queue of the
+	// connection is no longer full (see ConnectionCallback::WriteQueueFull())
+	// or the connection is being closed. Returns false without taking "c"
+	// if the write queue isn't full or the connection is shut down.
+	bool NotifyWhenDrained(Connection* conn, Closure* c);
+
+	// Runs "c" in a worker thread after "msec" milliseconds.
+	void RunAfter(uint64_t msec, Closure* c);
+
+	// Like RunAfter(), but runs "c" with "conn" read locked. If the
+	// connection is closed before, "c" is run early, while it is being
+	// closed. Returns false without taking "c" if the connection is
+	// already shut down.
+	bool RunAfter(Connection* conn, uint64_t msec, Closure* c);
+
 	// Sets the maximum number of seconds a connection may be idle before
 	// it is automatically terminated. Setting this to 0 or a negative
 	// value (the default) means they're never terminated.
@@ -179,23 +392,138 @@ public:
 	void Shutdown();
 
 private:
+	// Queues the callback "c" for "conn" with the scheduler and tells
+	// the executor to run it when it's due.
+	void Dispatch(Connection* conn, Closure* c);
+
+	// Returns the callback for the connection "conn", depending on which
+	// listener accepted it.
+	ConnectionCallback* CallbackFor(Connection* conn);
+
+	// Assigns the new connection "conn" on socket "fd" to a worker shard.
+	void AssignWorkerShard(Connection* conn, int fd);
+
+	// Moves connections away from the busiest worker shard if the load is
+	// too uneven. The connections lock must be held exclusively.
+	void RebalanceShardsLocked();
+
+	// Replaces the worker shards with one for each entry in "cpu_sets".
+	void CreateWorkerShards(
+			const std::vector<std::vector<int> >& cpu_sets);
+
 	ScopedPtr<ConnectionCallback> connected_;
 	const ServerSSLContext* ssl_context_;
 	threadpp::ThreadPool executor_;
+	ScopedPtr<FairScheduler> scheduler_;
 	int maxconn_;
 	uint32_t num_threads_;
 	int max_idle_;
 	bool running_;
+	bool deliver_data_;
+	bool write_queue_;
+	size_t write_queue_low_;
+	size_t write_queue_high_;
+	size_t zerocopy_threshold_;
+	SocketOptions socket_options_;
+	std::vector<int> reactor_cpus_;
+	int reactor_priority_;
+	std::vector<WorkerShard*> shards_;
+	std::vector<int> cpu_shards_;
+	bool numa_aware_;
+	double max_imbalance_;
+
+	// Connections waited for with NotifyWhenReadable(). If there's no
+	// closure, data which arrived in the meantime is recorded instead.
+	struct ReadWaiter
+	{
+		ReadWaiter();
+
+		Closure* closure;
+		bool readable;
+	};
+
+	// Closures waiting for RunAfter(). The key is the timerfd, or a
+	// negative number if a worker thread is sleeping for it instead.
+	struct Timer
+	{
+		Timer();
+
+		Connection* conn;
+		Closure* closure;
+	};
+
+	ScopedPtr<threadpp::Mutex> waiters_lock_;
+	std::map<Connection*, ReadWaiter> read_waiters_;
+	std::map<Connection*, Closure*> drain_waiters_;
+	std::set<Connection*> full_queues_;
+	std::map<int, Timer> timers_;
+	int last_timer_id_;
+
+	void CallAndUnlock(Closure* c, Connection* conn);
+	void WakeWaiters(Connection* conn);
+	bool TakeReadWaiter(Connection* conn, Closure** c);
+	void AddTimer(uint64_t msec, Connection* conn, Closure* c);
+	void SleepAndFireTimer(uint64_t msec, int id);
+	bool FireTimer(int id);
 
 #ifdef _POSIX_SOURCE
 	struct addrinfo *info_;
 	int serverfd_;
 	int epollfd_;
 
+	// Hot restarts: the socket a successor connects to, whether the
+	// listening socket has been passed on already or was inherited, and
+	// the connections inherited along with their state.
+	std::string handover_path_;
+	bool handover_connections_;
+	int handoverfd_;
+	bool handed_over_;
+	bool inherited_listener_;
+	std::vector<std::pair<int, std::string*> > inherited_;
+
+	// An address added with AddListener(). "info" is 0 for UNIX sockets,
+	// which are bound to "path" instead. "connected" is 0 for listeners
+	// using the callback of the server. "connections" counts the open
+	// connections accepted from it.
+	struct Listener
+	{
+		Listener();
+		~Listener();
+
+		std::string addr;
+		std::string path;
+		struct addrinfo* info;
+		int fd;
+		ConnectionCallback* connected;
+		const ServerSSLContext* ssl_context;
+		int maxconn;
+		std::atomic<int> connections;
+	};
+	std::vector<Listener*> listeners_;
+
+	// The UNIX socket shared memory connections are set up through.
+	std::string shm_path_;
+	size_t shm_capacity_;
+	int shmfd_;
+
 	std::map<int, Connection*> connections_;
 	ScopedPtr<ReadWriteMutex> connections_lock_;
 	std::condition_variable connections_updated_;
+
+	// Injected connections are known by negative numbers, so they can
+	// share the map with the sockets.
+	int last_injected_id_;
+
 	void LockCallAndUnlock(Closure* c, Connection* conn);
+	void DispatchReadableLocked(Connection* conn);
+	void ReceiveCallAndUnlock(Connection* conn);
+	void SpeculateAndUnlock(Connection* conn, int fd);
+	void ReceiveAndDeliver(Connection* conn, int flags);
+	void WriteQueueCallback(int fd, bool full);
+	void RestoreAndUnlock(Connection* conn, std::string* state);
+	void OpenListener(Listener* listener);
+	int FindListener(int fd);
+	void ReleaseListener(Connection* conn);
 
 	void ListenPoll();
 #ifdef HAVE_SELECT
@@ -209,6 +537,11 @@ private:
 #ifdef HAVE_EPOLL_CREATE
 	void ListenEpoll();
 	void ReapConnectionsEpoll();
+	Connection* AddConnectionEpoll(int fd, struct sockaddr_storage* addr,
+			bool watch_input, int listener = -1);
+	void AcceptSharedMemoryEpoll();
+	void HandOverEpoll();
+	void HandOverConnectionsEpoll(int ctl);
 #endif /* HAVE_EPOLL_CREATE */
 #endif /* _POSIX_SOURCE */
 };
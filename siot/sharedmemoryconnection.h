@@ -0,0 +1,147 @@
+/*-
+ * Copyright (c) 2026 Caoimhe Chaos <caoimhechaos@protonmail.com>,
+ *                    Ancient Solutions. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions  of source code must retain  the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions  in   binary  form  must   reproduce  the  above
+ *    copyright  notice, this  list  of conditions  and the  following
+ *    disclaimer in the  documentation and/or other materials provided
+ *    with the distribution.
+ *
+ * THIS  SOFTWARE IS  PROVIDED BY  ANCIENT SOLUTIONS  AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO,  THE IMPLIED WARRANTIES OF  MERCHANTABILITY AND FITNESS
+ * FOR A  PARTICULAR PURPOSE  ARE DISCLAIMED.  IN  NO EVENT  SHALL THE
+ * FOUNDATION  OR CONTRIBUTORS  BE  LIABLE FOR  ANY DIRECT,  INDIRECT,
+ * INCIDENTAL,   SPECIAL,    EXEMPLARY,   OR   CONSEQUENTIAL   DAMAGES
+ * (INCLUDING, BUT NOT LIMITED  TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE,  DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT  LIABILITY,  OR  TORT  (INCLUDING NEGLIGENCE  OR  OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INCLUDED_SIOT_SHAREDMEMORYCONNECTION_H
+#define INCLUDED_SIOT_SHAREDMEMORYCONNECTION_H 1
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <siot/connection.h>
+
+namespace toolbox
+{
+namespace siot
+{
+// A connection to a process on the same host which passes the data through
+// a pair of single-producer, single-consumer ring buffers in a shared memory
+// segment rather than through the network stack. Each message is copied
+// only once into the ring and once out of it, and system calls are only
+// made to wake up a side which is actually waiting.
+//
+// The connection is established through a UNIX socket: the server creates
+// the memory segment and the event descriptors for the wakeups, and passes
+// them to the client over the socket. The socket is kept afterwards, so
+// either side notices when the other goes away. Servers accept these
+// connections after a call to Server::SetSharedMemory(); clients connect
+// with Connect().
+class SharedMemoryConnection : public Connection
+{
+public:
+	// Connects to the server accepting shared memory connections on the
+	// UNIX socket "path". Throws a ClientConnectionException if that
+	// fails. The connection belongs to no server, and it is blocking.
+	static SharedMemoryConnection* Connect(const std::string& path);
+
+	// Sets up a segment holding "capacity" bytes in each direction for
+	// the client which connected to "server" on the socket "sock", and
+	// passes it on to the client. "sock" is owned by the connection
+	// afterwards, or closed if a ClientConnectionException is thrown.
+	// The connection isn't blocking. This is used by the server.
+	static SharedMemoryConnection* Accept(Server* server, int sock,
+			size_t capacity);
+
+	virtual ~SharedMemoryConnection();
+
+	// Implements Connection. Like for sockets, receiving blocks until
+	// there is data unless the connection is non-blocking or
+	// MSG_DONTWAIT is given, and sending waits for the peer to make
+	// space unless MSG_DONTWAIT is given.
+	virtual string Receive(size_t maxlen = -1, int flags = 0);
+	virtual ssize_t ReceiveInto(char* buf, size_t len, int flags = 0);
+	virtual IOResult TryReceiveInto(char* buf, size_t len, int flags = 0);
+	virtual ssize_t Send(string data, int flags = 0);
+	virtual ssize_t SendVector(const BufferView* views, size_t count,
+			int flags = 0);
+	virtual IOResult TrySendVector(const BufferView* views, size_t count,
+			int flags = 0);
+	virtual string PeerAsText();
+	virtual Server* GetServer();
+	virtual bool IsEOF();
+	virtual uint64_t GetLastUse();
+	virtual void SetBlocking(bool blocking = true);
+	virtual void Shutdown();
+
+	// The event descriptor which becomes readable whenever data arrives
+	// while the ring was found empty, and the socket, which hangs up
+	// when the peer goes away. Both are watched by the server.
+	int GetEventFD() const;
+	int GetSocket() const;
+
+private:
+	struct Ring;
+	struct Segment;
+
+	SharedMemoryConnection(Server* server, int sock, int side,
+			void* mem, size_t size, const int* eventfds);
+
+	// Copies up to "len" bytes from the ring to "buf". Returns the
+	// number of bytes copied, 0 if the peer is gone, or -1 with errno
+	// set to EAGAIN if there was nothing to receive and waiting wasn't
+	// requested.
+	ssize_t Read(char* buf, size_t len, bool wait);
+
+	// Copies the data in "views" to the peer's ring, waiting for it to
+	// make space if "wait" is true. Returns the number of bytes copied,
+	// or -1 with errno set to EAGAIN or EPIPE if nothing could be copied.
+	ssize_t Write(const BufferView* views, size_t count, bool wait);
+
+	// Waits for the event descriptor "fd" to be signalled, or for the
+	// peer to go away.
+	void Wait(int fd);
+
+	bool PeerGone();
+
+	Server* server_;
+	const int socket_;
+	const int side_;
+	Segment* segment_;
+	const size_t size_;
+	char* rx_;
+	char* tx_;
+	uint64_t mask_;
+
+	// The descriptors signalled when data arrives for, or space is made
+	// by the reader of, either side.
+	int data_fd_[2];
+	int space_fd_[2];
+
+	// Only one thread at a time may read or write, respectively.
+	std::mutex read_lock_;
+	std::mutex write_lock_;
+
+	std::atomic<bool> blocking_;
+	std::atomic<bool> eof_;
+	std::atomic<bool> peer_gone_;
+	std::atomic<uint64_t> last_use_;
+};
+}  // namespace siot
+}  // namespace toolbox
+
+#endif /* INCLUDED_SIOT_SHAREDMEMORYCONNECTION_H */
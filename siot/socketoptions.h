@@ -0,0 +1,136 @@
+/*-
+ * Copyright (c) 2026 Caoimhe Chaos <caoimhechaos@protonmail.com>,
+ *                    Ancient Solutions. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions  of source code must retain  the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions  in   binary  form  must   reproduce  the  above
+ *    copyright  notice, this  list  of conditions  and the  following
+ *    disclaimer in the  documentation and/or other materials provided
+ *    with the distribution.
+ *
+ * THIS  SOFTWARE IS  PROVIDED BY  ANCIENT SOLUTIONS  AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO,  THE IMPLIED WARRANTIES OF  MERCHANTABILITY AND FITNESS
+ * FOR A  PARTICULAR PURPOSE  ARE DISCLAIMED.  IN  NO EVENT  SHALL THE
+ * FOUNDATION  OR CONTRIBUTORS  BE  LIABLE FOR  ANY DIRECT,  INDIRECT,
+ * INCIDENTAL,   SPECIAL,    EXEMPLARY,   OR   CONSEQUENTIAL   DAMAGES
+ * (INCLUDING, BUT NOT LIMITED  TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE,  DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT  LIABILITY,  OR  TORT  (INCLUDING NEGLIGENCE  OR  OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INCLUDED_SIOT_SOCKETOPTIONS_H
+#define INCLUDED_SIOT_SOCKETOPTIONS_H 1
+
+namespace toolbox
+{
+namespace siot
+{
+// A set of socket level tuning parameters which the server applies to its
+// listening socket and to every connection it accepts. Every parameter is
+// left at the system default unless it has been set explicitly. Options the
+// platform doesn't know about are silently skipped; failures to set an
+// option are counted in the "siot-socket-option-errors" variable, but are
+// otherwise ignored, since none of them are essential.
+class SocketOptions
+{
+public:
+	SocketOptions();
+
+	// Disables (or enables) Nagle's algorithm, i.e. small writes are
+	// sent right away instead of being coalesced.
+	SocketOptions* SetNoDelay(bool nodelay);
+
+	// Sets the size of the kernel receive and send buffers, in bytes.
+	SocketOptions* SetReceiveBufferSize(int size);
+	SocketOptions* SetSendBufferSize(int size);
+
+	// Only accept connections once the client has actually sent data,
+	// or "seconds" have passed. The server uses this to read the first
+	// request right after accepting the connection.
+	SocketOptions* SetDeferAccept(int seconds);
+
+	// Enables TCP Fast Open on the listening socket, with at most
+	// "queue_length" pending connections which haven't completed the
+	// handshake yet.
+	SocketOptions* SetFastOpen(int queue_length);
+
+	// Acknowledge received data right away instead of delaying the
+	// acknowledgements. The system may switch back to delayed
+	// acknowledgements at any time.
+	SocketOptions* SetQuickAck(bool quickack);
+
+	// Enables keepalive probes after the connection has been idle for
+	// "idle" seconds, sent every "interval" seconds, giving up after
+	// "count" probes have been unanswered.
+	SocketOptions* SetKeepAlive(int idle, int interval, int count);
+
+	// Limits the amount of data which has been written but not yet sent
+	// to "bytes". The socket only reports being writable once less data
+	// than that is left, which keeps write queues in user space, where
+	// they can still be dealt with.
+	SocketOptions* SetNotSentLowWatermark(int bytes);
+
+	// Sets the type of service field (or the traffic class for IPv6) of
+	// the outgoing packets.
+	SocketOptions* SetTypeOfService(int tos);
+
+	// Allows several servers to listen on the same address, with the
+	// system distributing new connections between them.
+	SocketOptions* SetReusePort(bool reuseport);
+
+	// Allows a group of "group_size" servers to listen on the same address
+	// and distributes new connections between them by the CPU which
+	// received them: connections which arrived on CPU n go to the server
+	// which was started (n % group_size)th. Together with
+	// Server::SetReactorCPUs() and Server::SetWorkerCPUs(), connections
+	// are thus handled on the CPU whose network queue received them.
+	SocketOptions* SetIncomingCPUSteering(int group_size);
+
+	// Returns the number of seconds accepts are deferred, or 0 if they
+	// are not.
+	int GetDeferAccept() const;
+
+	// Applies the options relevant to a listening socket to "fd". This
+	// should happen before bind() is called on it.
+	void ApplyToListener(int fd) const;
+
+	// Applies the options which can only be set once listen() has been
+	// called on "fd".
+	void ApplyAfterListen(int fd) const;
+
+	// Applies the options relevant to an established connection to "fd".
+	void ApplyToConnection(int fd) const;
+
+private:
+	int nodelay_;
+	int rcvbuf_;
+	int sndbuf_;
+	int defer_accept_;
+	int fastopen_;
+	int quickack_;
+	int keepalive_idle_;
+	int keepalive_interval_;
+	int keepalive_count_;
+	int notsent_lowat_;
+	int tos_;
+	int reuseport_;
+	int steering_group_size_;
+
+	// Applies the options shared by listeners and connections to "fd".
+	// Returns true if "fd" is a TCP socket, i.e. if the TCP specific
+	// options apply as well.
+	bool ApplyCommon(int fd) const;
+};
+}  // namespace siot
+}  // namespace toolbox
+
+#endif /* INCLUDED_SIOT_SOCKETOPTIONS_H */
@@ -0,0 +1,301 @@
+/*-
+ * Copyright (c) 2026 Caoimhe Chaos <caoimhechaos@protonmail.com>,
+ *                    Ancient Solutions. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions  of source code must retain  the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions  in   binary  form  must   reproduce  the  above
+ *    copyright  notice, this  list  of conditions  and the  following
+ *    disclaimer in the  documentation and/or other materials provided
+ *    with the distribution.
+ *
+ * THIS  SOFTWARE IS  PROVIDED BY  ANCIENT SOLUTIONS  AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO,  THE IMPLIED WARRANTIES OF  MERCHANTABILITY AND FITNESS
+ * FOR A  PARTICULAR PURPOSE  ARE DISCLAIMED.  IN  NO EVENT  SHALL THE
+ * FOUNDATION  OR CONTRIBUTORS  BE  LIABLE FOR  ANY DIRECT,  INDIRECT,
+ * INCIDENTAL,   SPECIAL,    EXEMPLARY,   OR   CONSEQUENTIAL   DAMAGES
+ * (INCLUDING, BUT NOT LIMITED  TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE,  DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT  LIABILITY,  OR  TORT  (INCLUDING NEGLIGENCE  OR  OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif /* HAVE_SYS_TYPES_H */
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif /* HAVE_SYS_SOCKET_H */
+#ifdef HAVE_NETINET_IN_H
+#include <netinet/in.h>
+#endif /* HAVE_NETINET_IN_H */
+#ifdef HAVE_NETINET_TCP_H
+#include <netinet/tcp.h>
+#endif /* HAVE_NETINET_TCP_H */
+#ifdef HAVE_LINUX_FILTER_H
+#include <linux/filter.h>
+#endif /* HAVE_LINUX_FILTER_H */
+
+#include <string>
+
+#include <toolbox/expvar.h>
+
+#include "siot/socketoptions.h"
+
+namespace toolbox
+{
+namespace siot
+{
+using std::string;
+
+static ExpMap<int64_t> socket_option_errors("siot-socket-option-errors");
+
+// Sets the integer option "option" at "level" on "fd" to "value", unless
+// "value" is negative, which means it has never been configured.
+static void
+SetIntOption(int fd, int level, int option, int value, const string& name)
+{
+	if (value < 0)
+		return;
+
+	if (setsockopt(fd, level, option, &value, sizeof(value)) == -1)
+		socket_option_errors.Add(name, 1);
+}
+
+// Returns the address family of the socket "fd", or AF_UNSPEC if it can't
+// be determined.
+static int
+SocketFamily(int fd)
+{
+	struct sockaddr_storage addr;
+	socklen_t addrlen = sizeof(addr);
+
+	if (getsockname(fd, (struct sockaddr*) &addr, &addrlen) == -1)
+	{
+		socket_option_errors.Add("getsockname", 1);
+		return AF_UNSPEC;
+	}
+	return addr.ss_family;
+}
+
+SocketOptions::SocketOptions()
+: nodelay_(-1), rcvbuf_(-1), sndbuf_(-1), defer_accept_(-1), fastopen_(-1),
+	quickack_(-1), keepalive_idle_(-1), keepalive_interval_(-1),
+	keepalive_count_(-1), notsent_lowat_(-1), tos_(-1), reuseport_(-1),
+	steering_group_size_(0)
+{
+}
+
+SocketOptions*
+SocketOptions::SetNoDelay(bool nodelay)
+{
+	nodelay_ = nodelay ? 1 : 0;
+	return this;
+}
+
+SocketOptions*
+SocketOptions::SetReceiveBufferSize(int size)
+{
+	rcvbuf_ = size;
+	return this;
+}
+
+SocketOptions*
+SocketOptions::SetSendBufferSize(int size)
+{
+	sndbuf_ = size;
+	return this;
+}
+
+SocketOptions*
+SocketOptions::SetDeferAccept(int seconds)
+{
+	defer_accept_ = seconds;
+	return this;
+}
+
+SocketOptions*
+SocketOptions::SetFastOpen(int queue_length)
+{
+	fastopen_ = queue_length;
+	return this;
+}
+
+SocketOptions*
+SocketOptions::SetQuickAck(bool quickack)
+{
+	quickack_ = quickack ? 1 : 0;
+	return this;
+}
+
+SocketOptions*
+SocketOptions::SetKeepAlive(int idle, int interval, int count)
+{
+	keepalive_idle_ = idle;
+	keepalive_interval_ = interval;
+	keepalive_count_ = count;
+	return this;
+}
+
+SocketOptions*
+SocketOptions::SetNotSentLowWatermark(int bytes)
+{
+	notsent_lowat_ = bytes;
+	return this;
+}
+
+SocketOptions*
+SocketOptions::SetTypeOfService(int tos)
+{
+	tos_ = tos;
+	return this;
+}
+
+SocketOptions*
+SocketOptions::SetReusePort(bool reuseport)
+{
+	reuseport_ = reuseport ? 1 : 0;
+	return this;
+}
+
+SocketOptions*
+SocketOptions::SetIncomingCPUSteering(int group_size)
+{
+	steering_group_size_ = group_size;
+	if (group_size > 0)
+		reuseport_ = 1;
+	return this;
+}
+
+int
+SocketOptions::GetDeferAccept() const
+{
+#ifdef TCP_DEFER_ACCEPT
+	return defer_accept_ > 0 ? defer_accept_ : 0;
+#else /* !TCP_DEFER_ACCEPT */
+	return 0;
+#endif /* TCP_DEFER_ACCEPT */
+}
+
+bool
+SocketOptions::ApplyCommon(int fd) const
+{
+	int family = SocketFamily(fd);
+
+	// The buffer sizes have to be set on the listening socket already
+	// for the TCP window scaling to take them into account.
+	SetIntOption(fd, SOL_SOCKET, SO_RCVBUF, rcvbuf_, "SO_RCVBUF");
+	SetIntOption(fd, SOL_SOCKET, SO_SNDBUF, sndbuf_, "SO_SNDBUF");
+
+	// Everything else only makes sense for TCP.
+	if (family != AF_INET && family != AF_INET6)
+		return false;
+
+#ifdef TCP_NODELAY
+	SetIntOption(fd, IPPROTO_TCP, TCP_NODELAY, nodelay_, "TCP_NODELAY");
+#endif /* TCP_NODELAY */
+
+	if (keepalive_idle_ >= 0 || keepalive_interval_ >= 0 ||
+			keepalive_count_ >= 0)
+	{
+		SetIntOption(fd, SOL_SOCKET, SO_KEEPALIVE, 1, "SO_KEEPALIVE");
+#ifdef TCP_KEEPIDLE
+		SetIntOption(fd, IPPROTO_TCP, TCP_KEEPIDLE, keepalive_idle_,
+				"TCP_KEEPIDLE");
+#endif /* TCP_KEEPIDLE */
+#ifdef TCP_KEEPINTVL
+		SetIntOption(fd, IPPROTO_TCP, TCP_KEEPINTVL,
+				keepalive_interval_, "TCP_KEEPINTVL");
+#endif /* TCP_KEEPINTVL */
+#ifdef TCP_KEEPCNT
+		SetIntOption(fd, IPPROTO_TCP, TCP_KEEPCNT, keepalive_count_,
+				"TCP_KEEPCNT");
+#endif /* TCP_KEEPCNT */
+	}
+
+#ifdef TCP_NOTSENT_LOWAT
+	SetIntOption(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, notsent_lowat_,
+			"TCP_NOTSENT_LOWAT");
+#endif /* TCP_NOTSENT_LOWAT */
+
+	if (family == AF_INET)
+		SetIntOption(fd, IPPROTO_IP, IP_TOS, tos_, "IP_TOS");
+#ifdef IPV6_TCLASS
+	else
+		SetIntOption(fd, IPPROTO_IPV6, IPV6_TCLASS, tos_,
+				"IPV6_TCLASS");
+#endif /* IPV6_TCLASS */
+
+	return true;
+}
+
+void
+SocketOptions::ApplyToListener(int fd) const
+{
+#ifdef SO_REUSEPORT
+	SetIntOption(fd, SOL_SOCKET, SO_REUSEPORT, reuseport_, "SO_REUSEPORT");
+#endif /* SO_REUSEPORT */
+
+	if (!ApplyCommon(fd))
+		return;
+
+#ifdef TCP_DEFER_ACCEPT
+	SetIntOption(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, defer_accept_,
+			"TCP_DEFER_ACCEPT");
+#endif /* TCP_DEFER_ACCEPT */
+#ifdef TCP_FASTOPEN
+	SetIntOption(fd, IPPROTO_TCP, TCP_FASTOPEN, fastopen_,
+			"TCP_FASTOPEN");
+#endif /* TCP_FASTOPEN */
+}
+
+void
+SocketOptions::ApplyAfterListen(int fd) const
+{
+#if defined(HAVE_LINUX_FILTER_H) && defined(SO_ATTACH_REUSEPORT_CBPF)
+	if (steering_group_size_ > 0)
+	{
+		// Picks the socket with the index (CPU % group size) in the
+		// reuseport group, i.e. in the order the sockets were bound.
+		struct sock_filter code[] = {
+			{ BPF_LD | BPF_W | BPF_ABS, 0, 0,
+				(uint32_t) (SKF_AD_OFF + SKF_AD_CPU) },
+			{ BPF_ALU | BPF_MOD | BPF_K, 0, 0,
+				(uint32_t) steering_group_size_ },
+			{ BPF_RET | BPF_A, 0, 0, 0 },
+		};
+		struct sock_fprog prog;
+
+		prog.len = sizeof(code) / sizeof(code[0]);
+		prog.filter = code;
+		if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog,
+					sizeof(prog)) == -1)
+			socket_option_errors.Add("SO_ATTACH_REUSEPORT_CBPF", 1);
+	}
+#endif /* HAVE_LINUX_FILTER_H && SO_ATTACH_REUSEPORT_CBPF */
+}
+
+void
+SocketOptions::ApplyToConnection(int fd) const
+{
+	if (!ApplyCommon(fd))
+		return;
+
+#ifdef TCP_QUICKACK
+	SetIntOption(fd, IPPROTO_TCP, TCP_QUICKACK, quickack_,
+			"TCP_QUICKACK");
+#endif /* TCP_QUICKACK */
+}
+}  // namespace siot
+}  // namespace toolbox
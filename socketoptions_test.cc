@@ -0,0 +1,134 @@
+/**
+ * Tests for the socket tuning parameters.
+ */
+
+#include <gtest/gtest.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "siot/socketoptions.h"
+
+namespace toolbox
+{
+namespace siot
+{
+namespace testing
+{
+class SocketOptionsTest : public ::testing::Test
+{
+};
+
+static int
+GetOption(int fd, int level, int option)
+{
+	int value = -1;
+	socklen_t len = sizeof(value);
+
+	EXPECT_EQ(0, getsockopt(fd, level, option, &value, &len));
+	return value;
+}
+
+TEST_F(SocketOptionsTest, Connection)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	SocketOptions options;
+
+	ASSERT_LE(0, fd);
+	options.SetNoDelay(true)
+		->SetKeepAlive(30, 5, 3)
+		->SetSendBufferSize(65536)
+		->SetTypeOfService(0x10);
+	options.ApplyToConnection(fd);
+
+	EXPECT_NE(0, GetOption(fd, IPPROTO_TCP, TCP_NODELAY));
+	EXPECT_NE(0, GetOption(fd, SOL_SOCKET, SO_KEEPALIVE));
+	EXPECT_EQ(30, GetOption(fd, IPPROTO_TCP, TCP_KEEPIDLE));
+	EXPECT_EQ(5, GetOption(fd, IPPROTO_TCP, TCP_KEEPINTVL));
+	EXPECT_EQ(3, GetOption(fd, IPPROTO_TCP, TCP_KEEPCNT));
+	// The kernel doubles the requested size for its bookkeeping.
+	EXPECT_LE(65536, GetOption(fd, SOL_SOCKET, SO_SNDBUF));
+	EXPECT_EQ(0x10, GetOption(fd, IPPROTO_IP, IP_TOS));
+	close(fd);
+}
+
+TEST_F(SocketOptionsTest, Defaults)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	SocketOptions options;
+
+	ASSERT_LE(0, fd);
+	options.ApplyToListener(fd);
+
+	EXPECT_EQ(0, GetOption(fd, IPPROTO_TCP, TCP_NODELAY));
+	EXPECT_EQ(0, GetOption(fd, SOL_SOCKET, SO_KEEPALIVE));
+	EXPECT_EQ(0, options.GetDeferAccept());
+	close(fd);
+}
+
+TEST_F(SocketOptionsTest, DeferAccept)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	SocketOptions options;
+
+	ASSERT_LE(0, fd);
+	options.SetDeferAccept(5);
+	options.ApplyToListener(fd);
+
+	EXPECT_EQ(5, options.GetDeferAccept());
+	EXPECT_LT(0, GetOption(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT));
+	close(fd);
+}
+
+TEST_F(SocketOptionsTest, IncomingCPUSteering)
+{
+	struct sockaddr_in addr;
+	socklen_t addrlen = sizeof(addr);
+	int fds[2];
+	SocketOptions options;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	options.SetIncomingCPUSteering(2);
+
+	// Both sockets of the group can be bound to the same port.
+	for (int i = 0; i < 2; ++i)
+	{
+		fds[i] = socket(AF_INET, SOCK_STREAM, 0);
+		ASSERT_LE(0, fds[i]);
+		options.ApplyToListener(fds[i]);
+		EXPECT_NE(0, GetOption(fds[i], SOL_SOCKET, SO_REUSEPORT));
+		ASSERT_EQ(0, bind(fds[i], (struct sockaddr*) &addr,
+					sizeof(addr)));
+		ASSERT_EQ(0, listen(fds[i], 1));
+		options.ApplyAfterListen(fds[i]);
+		ASSERT_EQ(0, getsockname(fds[i], (struct sockaddr*) &addr,
+					&addrlen));
+	}
+
+	close(fds[0]);
+	close(fds[1]);
+}
+
+TEST_F(SocketOptionsTest, UNIXSocket)
+{
+	int fds[2];
+	SocketOptions options;
+
+	ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+	options.SetNoDelay(true)->SetSendBufferSize(65536);
+
+	// The TCP options don't apply, but the buffer sizes do.
+	options.ApplyToConnection(fds[0]);
+	EXPECT_LE(65536, GetOption(fds[0], SOL_SOCKET, SO_SNDBUF));
+	close(fds[0]);
+	close(fds[1]);
+}
+}  // namespace testing
+}  // namespace siot
+}  // namespace toolbox
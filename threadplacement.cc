@@ -0,0 +1,275 @@
+/*-
+ * Copyright (c) 2026 Caoimhe Chaos <caoimhechaos@protonmail.com>,
+ *                    Ancient Solutions. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions  of source code must retain  the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions  in   binary  form  must   reproduce  the  above
+ *    copyright  notice, this  list  of conditions  and the  following
+ *    disclaimer in the  documentation and/or other materials provided
+ *    with the distribution.
+ *
+ * THIS  SOFTWARE IS  PROVIDED BY  ANCIENT SOLUTIONS  AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO,  THE IMPLIED WARRANTIES OF  MERCHANTABILITY AND FITNESS
+ * FOR A  PARTICULAR PURPOSE  ARE DISCLAIMED.  IN  NO EVENT  SHALL THE
+ * FOUNDATION  OR CONTRIBUTORS  BE  LIABLE FOR  ANY DIRECT,  INDIRECT,
+ * INCIDENTAL,   SPECIAL,    EXEMPLARY,   OR   CONSEQUENTIAL   DAMAGES
+ * (INCLUDING, BUT NOT LIMITED  TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE,  DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT  LIABILITY,  OR  TORT  (INCLUDING NEGLIGENCE  OR  OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#ifdef HAVE_SCHED_H
+#include <sched.h>
+#endif /* HAVE_SCHED_H */
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif /* HAVE_PTHREAD_H */
+#ifdef HAVE_SYS_SYSCALL_H
+#include <sys/syscall.h>
+#endif /* HAVE_SYS_SYSCALL_H */
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <toolbox/expvar.h>
+
+#include "threadplacement.h"
+
+namespace toolbox
+{
+namespace siot
+{
+using std::string;
+
+static ExpMap<int64_t> placement_errors("siot-thread-placement-errors");
+static ExpMap<int64_t> numa_stats("siot-numa-stats");
+
+// Where the kernel describes the NUMA topology.
+static const string kNodeDir = "/sys/devices/system/node/";
+
+// Memory policy for mbind(), from <numaif.h>, which isn't always around.
+static const int kMemoryPolicyPreferred = 1;
+
+// Parses a list of numbers and ranges such as "0-3,8,10-11" as used by the
+// kernel in "list" and appends the numbers to "out".
+static void
+ParseList(const string& list, std::vector<int>* out)
+{
+	std::stringstream ss(list);
+	string range;
+
+	while (std::getline(ss, range, ','))
+	{
+		int first, last;
+		char dash;
+		std::stringstream rs(range);
+
+		if (!(rs >> first))
+			continue;
+		if (!(rs >> dash >> last) || dash != '-')
+			last = first;
+		for (int i = first; i <= last; ++i)
+			out->push_back(i);
+	}
+}
+
+// Reads the first line of the file "path" into "line".
+static bool
+ReadLine(const string& path, string* line)
+{
+	std::ifstream in(path.c_str());
+
+	return std::getline(in, *line) ? true : false;
+}
+
+// Reads the NUMA topology of the system, falling back to a single node.
+static std::vector<NUMANode>*
+ReadNUMANodes()
+{
+	std::vector<NUMANode>* nodes = new std::vector<NUMANode>;
+	std::vector<int> ids;
+	string line;
+
+	if (ReadLine(kNodeDir + "online", &line))
+		ParseList(line, &ids);
+
+	for (int id : ids)
+	{
+		NUMANode node;
+
+		node.id = id;
+		if (ReadLine(kNodeDir + "node" + std::to_string(id) +
+					"/cpulist", &line))
+			ParseList(line, &node.cpus);
+
+		// Nodes with only memory don't run anything.
+		if (!node.cpus.empty())
+			nodes->push_back(node);
+	}
+
+	if (nodes->empty())
+	{
+		NUMANode node;
+		long ncpus = 1;
+
+#ifdef _SC_NPROCESSORS_CONF
+		ncpus = sysconf(_SC_NPROCESSORS_CONF);
+#endif /* _SC_NPROCESSORS_CONF */
+		node.id = 0;
+		for (long i = 0; i < ncpus; ++i)
+			node.cpus.push_back(i);
+		nodes->push_back(node);
+	}
+
+	return nodes;
+}
+
+bool
+PinCurrentThread(const std::vector<int>& cpus)
+{
+	if (cpus.empty())
+		return true;
+
+#if defined(HAVE_PTHREAD_SETAFFINITY_NP) && defined(CPU_SET)
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	for (int cpu : cpus)
+		if (cpu >= 0 && cpu < CPU_SETSIZE)
+			CPU_SET(cpu, &set);
+
+	if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0)
+		return true;
+#endif /* HAVE_PTHREAD_SETAFFINITY_NP && CPU_SET */
+
+	placement_errors.Add("affinity", 1);
+	return false;
+}
+
+bool
+SetCurrentThreadPriority(int priority)
+{
+#if defined(HAVE_PTHREAD_SETSCHEDPARAM) && defined(SCHED_FIFO)
+	struct sched_param param;
+
+	param.sched_priority = priority;
+	if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0)
+		return true;
+#endif /* HAVE_PTHREAD_SETSCHEDPARAM && SCHED_FIFO */
+
+	placement_errors.Add("priority", 1);
+	return false;
+}
+
+int
+GetCurrentCPU()
+{
+#ifdef HAVE_SCHED_GETCPU
+	return sched_getcpu();
+#else /* !HAVE_SCHED_GETCPU */
+	return -1;
+#endif /* HAVE_SCHED_GETCPU */
+}
+
+const std::vector<NUMANode>&
+GetNUMANodes()
+{
+	// Never destroyed, since it's needed until the very end.
+	static std::vector<NUMANode>* nodes = ReadNUMANodes();
+	return *nodes;
+}
+
+// Maps CPUs to the index of their node.
+static std::vector<int>*
+MapCPUsToNodes()
+{
+	const std::vector<NUMANode>& nodes = GetNUMANodes();
+	std::vector<int>* map = new std::vector<int>;
+
+	for (size_t i = 0; i < nodes.size(); ++i)
+		for (int cpu : nodes[i].cpus)
+		{
+			if (cpu >= (int) map->size())
+				map->resize(cpu + 1, 0);
+			(*map)[cpu] = i;
+		}
+
+	return map;
+}
+
+int
+GetNUMANodeIndex(int cpu)
+{
+	static std::vector<int>* map = MapCPUsToNodes();
+
+	if (cpu < 0 || cpu >= (int) map->size())
+		return 0;
+	return (*map)[cpu];
+}
+
+bool
+BindMemoryToNUMANode(void* mem, size_t len, int node)
+{
+#ifdef SYS_mbind
+	unsigned long mask[16] = { 0 };
+	const unsigned long bits = 8 * sizeof(mask[0]);
+
+	if (node < 0 || node >= (int) (bits * 16))
+		return false;
+
+	mask[node / bits] |= 1UL << (node % bits);
+	if (syscall(SYS_mbind, mem, len, kMemoryPolicyPreferred, mask,
+				bits * 16, 0) == 0)
+		return true;
+#endif /* SYS_mbind */
+
+	placement_errors.Add("mbind", 1);
+	return false;
+}
+
+void
+UpdateNUMAStatistics()
+{
+	static std::mutex mtx;
+	static std::map<string, int64_t> previous;
+	std::lock_guard<std::mutex> l(mtx);
+
+	for (const NUMANode& node : GetNUMANodes())
+	{
+		const string prefix = "node" + std::to_string(node.id);
+		std::ifstream in((kNodeDir + prefix + "/numastat").c_str());
+		string name;
+		int64_t value;
+
+		// Lines look like "numa_miss 1234".
+		while (in >> name >> value)
+		{
+			const string key = prefix + "-" + name;
+
+			numa_stats.Add(key, value - previous[key]);
+			previous[key] = value;
+		}
+	}
+}
+}  // namespace siot
+}  // namespace toolbox
@@ -0,0 +1,83 @@
+/*-
+ * Copyright (c) 2026 Caoimhe Chaos <caoimhechaos@protonmail.com>,
+ *                    Ancient Solutions. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions  of source code must retain  the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions  in   binary  form  must   reproduce  the  above
+ *    copyright  notice, this  list  of conditions  and the  following
+ *    disclaimer in the  documentation and/or other materials provided
+ *    with the distribution.
+ *
+ * THIS  SOFTWARE IS  PROVIDED BY  ANCIENT SOLUTIONS  AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO,  THE IMPLIED WARRANTIES OF  MERCHANTABILITY AND FITNESS
+ * FOR A  PARTICULAR PURPOSE  ARE DISCLAIMED.  IN  NO EVENT  SHALL THE
+ * FOUNDATION  OR CONTRIBUTORS  BE  LIABLE FOR  ANY DIRECT,  INDIRECT,
+ * INCIDENTAL,   SPECIAL,    EXEMPLARY,   OR   CONSEQUENTIAL   DAMAGES
+ * (INCLUDING, BUT NOT LIMITED  TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE,  DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT  LIABILITY,  OR  TORT  (INCLUDING NEGLIGENCE  OR  OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INCLUDED_THREADPLACEMENT_H
+#define INCLUDED_THREADPLACEMENT_H 1
+
+#include <stddef.h>
+
+#include <vector>
+
+namespace toolbox
+{
+namespace siot
+{
+// Restricts the calling thread to run only on the CPUs listed in "cpus".
+// Returns false if the platform doesn't support this or the CPU set was
+// rejected. An empty list leaves the thread alone.
+bool PinCurrentThread(const std::vector<int>& cpus);
+
+// Switches the calling thread to the SCHED_FIFO real time scheduling policy
+// with the given priority. This usually requires special privileges.
+// Returns false if that didn't work.
+bool SetCurrentThreadPriority(int priority);
+
+// Returns the CPU the calling thread is currently running on, or -1 if
+// that can't be determined.
+int GetCurrentCPU();
+
+// A NUMA node of the system and the CPUs which belong to it.
+struct NUMANode
+{
+	int id;
+	std::vector<int> cpus;
+};
+
+// Returns the NUMA nodes of the system. If the system isn't a NUMA system,
+// or the topology can't be determined, all CPUs are reported as part of a
+// single node 0. The topology is only read once.
+const std::vector<NUMANode>& GetNUMANodes();
+
+// Returns the position of the node of "cpu" in GetNUMANodes(), or 0 if
+// "cpu" is unknown.
+int GetNUMANodeIndex(int cpu);
+
+// Asks the system to place the memory pages in the "len" bytes at "mem"
+// on the NUMA node "node" (the id, not the index) when they're first used.
+// Returns false if that isn't supported.
+bool BindMemoryToNUMANode(void* mem, size_t len, int node);
+
+// Exports the system's counters of local and remote memory allocations
+// for every NUMA node in the "siot-numa-stats" variable, where available.
+// Each call adds whatever has changed since the previous one.
+void UpdateNUMAStatistics();
+}  // namespace siot
+}  // namespace toolbox
+
+#endif /* INCLUDED_THREADPLACEMENT_H */
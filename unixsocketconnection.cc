@@ -56,23 +56,76 @@
 #include <errno.h>
 #endif /* HAVE_ERRNO_H */
 
+#ifdef HAVE_LINUX_ERRQUEUE_H
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#endif /* HAVE_LINUX_ERRQUEUE_H */
+
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif /* HAVE_SYS_SENDFILE_H */
+
+#include <limits.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <time.h>
 
 // TODO(caoimhe): get rid of this hack
 #define HAVE_CLIB_HASH_H 1
 #include <clib/clib.h>
 
+#include <thread++/mutex.h>
+#include <toolbox/expvar.h>
+
+#include "siot/bufferpool.h"
 #include "siot/connection.h"
+#include "siot/server.h"
+#include "siot/socketoptions.h"
+#include "connectionfreelist.h"
 #include "unixsocketconnection.h"
 
 namespace toolbox
 {
 namespace siot
 {
+using google::protobuf::Closure;
+using threadpp::Mutex;
+using threadpp::MutexLock;
+
+static ExpVar<int64_t> zerocopy_completed("siot-zerocopy-completed");
+static ExpVar<int64_t> zerocopy_copied("siot-zerocopy-copied");
+static ExpVar<int64_t> zerocopy_lingering("siot-zerocopy-lingering");
+
+static void
+DeleteString(string* s)
+{
+	delete s;
+}
+
+void*
+UNIXSocketConnection::operator new(size_t size)
+{
+	return ConnectionFreelist::ForSize(sizeof(UNIXSocketConnection))
+		->Allocate(size);
+}
+
+void
+UNIXSocketConnection::operator delete(void* ptr, size_t size)
+{
+	ConnectionFreelist::ForSize(sizeof(UNIXSocketConnection))
+		->Release(ptr, size);
+}
+
 UNIXSocketConnection::UNIXSocketConnection(Server* srv, int socketid,
-		struct sockaddr_storage* peer)
-: socket_(socketid), peer_(peer), server_(srv), eof_(false),
-	last_use_(time(NULL))
+		const struct sockaddr_storage* peer)
+: socket_(socketid), peer_(*peer), server_(srv), eof_(false),
+	last_use_(time(NULL)), write_mtx_(Mutex::Create()),
+	write_queue_offset_(0), write_queue_size_(0), low_watermark_(0),
+	high_watermark_(0), write_queue_enabled_(false),
+	write_queue_full_(false), zerocopy_threshold_(0),
+	zerocopy_enabled_(false), zerocopy_next_id_(0)
 {
 }
 
@@ -83,37 +136,668 @@ UNIXSocketConnection::~UNIXSocketConnection()
 string
 UNIXSocketConnection::Receive(size_t maxlen, int flags)
 {
-	ssize_t len;
-	if (maxlen <= 0 || maxlen > 65536)
-		len = 65536;
-	else
-		len = maxlen;
-	ScopedPtr<char> buf(new char[len]);
+	if (maxlen <= 0 || maxlen > BufferPool::kLargeBufferSize)
+		maxlen = BufferPool::kLargeBufferSize;
+
+	PooledBuffer buf(maxlen);
+	ssize_t len = ReceiveInto(buf.Get(), maxlen, flags);
+
+	return string(buf.Get(), len > 0 ? len : 0);
+}
+
+Buffer
+UNIXSocketConnection::ReceiveBuffer(size_t maxlen, int flags)
+{
+	if (maxlen <= 0 || maxlen > BufferPool::kLargeBufferSize)
+		maxlen = BufferPool::kLargeBufferSize;
+
+	// The data is read straight into pooled memory, which the buffer then
+	// takes over.
+	ScopedPtr<PooledBuffer> buf(new PooledBuffer(maxlen));
+	ssize_t len = ReceiveInto(buf->Get(), maxlen, flags);
 
-	len = recv(socket_, buf.Get(), len, flags);
+	if (len <= 0)
+		return Buffer();
+	return Buffer(buf.Release(), len);
+}
+
+ssize_t
+UNIXSocketConnection::ReceiveInto(char* buf, size_t len, int flags)
+{
+	ssize_t ret = recv(socket_, buf, len, flags);
 
-	if (len == -1)
+	if (ret == -1)
 	{
-		len = 0;
 		if (errno == EBADF || errno == EINVAL || errno == ENOTCONN)
 			eof_ = true;
 	}
+	else if (ret == 0 && len > 0)
+		// The peer has closed its end of the connection.
+		eof_ = true;
 	last_use_ = time(NULL);
-	return string(buf.Get(), len);
+	return ret;
+}
+
+IOResult
+UNIXSocketConnection::TryReceiveInto(char* buf, size_t len, int flags)
+{
+	ssize_t ret = UNIXSocketConnection::ReceiveInto(buf, len,
+			flags | MSG_DONTWAIT);
+
+	if (ret > 0)
+		return IOResult(kIOOk, ret);
+	if (ret == 0)
+		return IOResult(len > 0 ? kIOClosed : kIOOk);
+	if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+		return IOResult(kIOWouldBlock);
+	return IOResult(kIOError, 0, errno);
 }
 
 ssize_t
 UNIXSocketConnection::Send(string data, int flags)
 {
 	last_use_ = time(NULL);
-	return send(socket_, data.c_str(), data.size(), flags);
+	if (zerocopy_threshold_ > 0 && data.size() >= zerocopy_threshold_)
+	{
+		// Keep the data around until the kernel is done with it.
+		string* keep = new string(std::move(data));
+		return SendZeroCopy(keep->data(), keep->size(),
+				google::protobuf::NewCallback(&DeleteString,
+					keep), flags);
+	}
+
+	BufferView view(data);
+	if (!write_queue_enabled_)
+		return SendMessage(&view, 1, flags);
+
+	return SendVector(&view, 1, flags);
+}
+
+ssize_t
+UNIXSocketConnection::SendVector(const BufferView* views, size_t count,
+		int flags)
+{
+	last_use_ = time(NULL);
+	if (!write_queue_enabled_)
+		return SendMessage(views, count, flags);
+
+	MutexLock l(write_mtx_.Get());
+	ssize_t total = 0;
+	size_t offset = 0;
+
+	for (size_t i = 0; i < count; ++i)
+		total += views[i].length;
+
+	// Only try to write directly if nothing is queued, otherwise the
+	// data would overtake the queue.
+	if (write_queue_.empty())
+	{
+		ssize_t len = SendMessage(views, count,
+				flags | MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (len == -1)
+		{
+			if (errno != EAGAIN && errno != EWOULDBLOCK &&
+					errno != EINTR)
+				return -1;
+		}
+		else
+			offset = len;
+	}
+
+	if (offset < (size_t) total)
+		QueueLocked(views, count, offset);
+
+	// Everything which was queued counts as sent.
+	return total;
+}
+
+IOResult
+UNIXSocketConnection::TrySendVector(const BufferView* views, size_t count,
+		int flags)
+{
+	// With a write queue, whatever can't be sent now is queued.
+	ssize_t ret = write_queue_enabled_ ?
+		SendVector(views, count, flags) :
+		SendMessage(views, count, flags | MSG_DONTWAIT | MSG_NOSIGNAL);
+
+	last_use_ = time(NULL);
+	if (ret > 0)
+		return IOResult(kIOOk, ret);
+	if (ret == 0)
+		return IOResult();
+	if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+		return IOResult(kIOWouldBlock);
+	if (errno == EPIPE || errno == ECONNRESET)
+		return IOResult(kIOClosed);
+	return IOResult(kIOError, 0, errno);
+}
+
+ssize_t
+UNIXSocketConnection::SendFile(int fd, off_t offset, size_t len)
+{
+	last_use_ = time(NULL);
+
+#ifdef HAVE_SYS_SENDFILE_H
+	// sendfile() can't be told not to block, and the data may have to
+	// wait behind the write queue, so with a write queue it takes the
+	// regular path.
+	if (!write_queue_enabled_)
+	{
+		size_t total = 0;
+
+		while (total < len)
+		{
+			ssize_t sent = sendfile(socket_, fd, &offset,
+					len - total);
+			if (sent == -1)
+			{
+				if (errno == EINTR)
+					continue;
+				if ((errno == EAGAIN || errno == EWOULDBLOCK) &&
+						WaitForSocket(POLLOUT))
+					continue;
+
+				// Some files can't be used with sendfile().
+				if (total == 0 && (errno == EINVAL ||
+							errno == ENOSYS))
+					return Connection::SendFile(fd, offset,
+							len);
+				break;
+			}
+
+			// End of file.
+			if (sent == 0)
+				break;
+			total += sent;
+		}
+
+		if (total == 0 && len > 0)
+			return -1;
+		return total;
+	}
+#endif /* HAVE_SYS_SENDFILE_H */
+
+	return Connection::SendFile(fd, offset, len);
+}
+
+void
+UNIXSocketConnection::QueueLocked(const BufferView* views, size_t count,
+		size_t offset)
+{
+	bool was_empty = write_queue_.empty();
+	string rest;
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (offset >= views[i].length)
+		{
+			offset -= views[i].length;
+			continue;
+		}
+
+		rest.append(views[i].data + offset, views[i].length - offset);
+		offset = 0;
+	}
+
+	write_queue_size_ += rest.size();
+	write_queue_.push_back(std::move(rest));
+
+	if (server_ && was_empty)
+		server_->WatchWritable(socket_, true);
+
+	if (!write_queue_full_ && high_watermark_ > 0 &&
+			write_queue_size_ > high_watermark_)
+	{
+		write_queue_full_ = true;
+		if (server_)
+			server_->NotifyWriteQueue(socket_, true);
+	}
+}
+
+ssize_t
+UNIXSocketConnection::SendZeroCopy(const char* data, size_t len,
+		Closure* release, int flags)
+{
+	last_use_ = time(NULL);
+
+#ifdef MSG_ZEROCOPY
+	if (zerocopy_threshold_ > 0 && len >= zerocopy_threshold_)
+	{
+		MutexLock l(write_mtx_.Get());
+
+		// Data can't be sent from the original memory if it has to
+		// wait behind the write queue.
+		if (write_queue_.empty())
+			return SendZeroCopyLocked(data, len, release, flags);
+	}
+#endif /* MSG_ZEROCOPY */
+
+	BufferView view(data, len);
+	ssize_t ret = SendVector(&view, 1, flags);
+	release->Run();
+	return ret;
+}
+
+#ifdef MSG_ZEROCOPY
+ssize_t
+UNIXSocketConnection::SendZeroCopyLocked(const char* data, size_t len,
+		Closure* release, int flags)
+{
+	ZeroCopySend* zc = new ZeroCopySend;
+	size_t offset = 0;
+	int error = 0;
+
+	// We hold on to the memory ourselves until we're done sending, in
+	// case the first pieces are reported back while we wait below.
+	zc->outstanding = 1;
+	zc->release = release;
+
+	flags |= MSG_ZEROCOPY | MSG_NOSIGNAL;
+	if (write_queue_enabled_)
+		flags |= MSG_DONTWAIT;
+
+	// Every successful call gets a notification of its own, so we have
+	// to wait for all of them before the memory can be released.
+	while (offset < len)
+	{
+		ssize_t sent = send(socket_, data + offset, len - offset,
+				flags);
+		if (sent == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			error = errno;
+
+			// Without a write queue, this waits for the peer even
+			// on non-blocking sockets, like SendMessage() does.
+			// The reactor needs the lock to process completions
+			// meanwhile.
+			if ((error == EAGAIN || error == EWOULDBLOCK) &&
+					!(flags & MSG_DONTWAIT))
+			{
+				bool ready;
+
+				write_mtx_->Unlock();
+				ready = WaitForSocket(POLLOUT);
+				write_mtx_->Lock();
+				if (ready)
+					continue;
+			}
+			break;
+		}
+
+		zerocopy_pending_[zerocopy_next_id_++] = zc;
+		++zc->outstanding;
+		offset += sent;
+	}
+
+	if (offset < len && write_queue_enabled_ &&
+			(error == EAGAIN || error == EWOULDBLOCK))
+	{
+		// The rest is copied into the queue, so only the part which
+		// was sent has to stick around.
+		BufferView view(data, len);
+		QueueLocked(&view, 1, offset);
+		offset = len;
+	}
+
+	// If nothing went out or everything has been reported back
+	// already, the memory isn't needed anymore.
+	if (--zc->outstanding == 0)
+	{
+		delete zc;
+		release->Run();
+	}
+
+	if (offset == 0 && len > 0)
+	{
+		errno = error;
+		return -1;
+	}
+	return offset;
+}
+#endif /* MSG_ZEROCOPY */
+
+void
+UNIXSocketConnection::SetZeroCopyThreshold(size_t threshold)
+{
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+	MutexLock l(write_mtx_.Get());
+	int one = 1;
+
+	if (threshold > 0 && !zerocopy_enabled_)
+	{
+		// Not all sockets support this, e.g. UNIX domain sockets
+		// don't. Those just keep copying.
+		if (setsockopt(socket_, SOL_SOCKET, SO_ZEROCOPY, &one,
+					sizeof(one)) == -1)
+			return;
+		zerocopy_enabled_ = true;
+	}
+
+	zerocopy_threshold_ = threshold;
+#endif /* SO_ZEROCOPY && MSG_ZEROCOPY */
+}
+
+bool
+UNIXSocketConnection::ProcessErrorQueue()
+{
+	bool handled = false;
+
+#if defined(HAVE_LINUX_ERRQUEUE_H) && defined(MSG_ZEROCOPY)
+	std::list<Closure*> released;
+	bool other_errors = false;
+
+	{
+		MutexLock l(write_mtx_.Get());
+		handled = ReadZeroCopyCompletions(socket_, &zerocopy_pending_,
+				&released, &other_errors);
+	}
+
+	for (Closure* c : released)
+		c->Run();
+
+	// Anything else on the error queue is for the reactor to see.
+	if (other_errors)
+		return false;
+#endif /* HAVE_LINUX_ERRQUEUE_H && MSG_ZEROCOPY */
+
+	return handled;
+}
+
+bool
+UNIXSocketConnection::ReadZeroCopyCompletions(int socket,
+		std::map<uint32_t, ZeroCopySend*>* pending,
+		std::list<Closure*>* released, bool* other_errors)
+{
+	bool handled = false;
+
+#if defined(HAVE_LINUX_ERRQUEUE_H) && defined(MSG_ZEROCOPY)
+	while (true)
+	{
+		char control[128];
+		struct msghdr msg;
+		struct cmsghdr* cm;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		if (recvmsg(socket, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+			break;
+
+		for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm))
+		{
+			struct sock_extended_err* err;
+
+			if (!(cm->cmsg_level == SOL_IP &&
+					cm->cmsg_type == IP_RECVERR) &&
+				!(cm->cmsg_level == SOL_IPV6 &&
+					cm->cmsg_type == IPV6_RECVERR))
+				continue;
+
+			err = (struct sock_extended_err*) CMSG_DATA(cm);
+			if (err->ee_errno != 0 ||
+					err->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+			{
+				*other_errors = true;
+				continue;
+			}
+
+			if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+				zerocopy_copied.Add(1);
+
+			// The notification covers the range of send calls from
+			// ee_info to ee_data. Each of them drops one reference
+			// to the memory it was sent from.
+			for (uint32_t id = err->ee_info; ; ++id)
+			{
+				std::map<uint32_t, ZeroCopySend*>::iterator it =
+					pending->find(id);
+
+				if (it != pending->end())
+				{
+					ZeroCopySend* zc = it->second;
+
+					pending->erase(it);
+					zerocopy_completed.Add(1);
+					if (--zc->outstanding == 0)
+					{
+						released->push_back(
+								zc->release);
+						delete zc;
+					}
+				}
+
+				if (id == err->ee_data)
+					break;
+			}
+			handled = true;
+		}
+	}
+#endif /* HAVE_LINUX_ERRQUEUE_H && MSG_ZEROCOPY */
+
+	return handled;
+}
+
+std::list<UNIXSocketConnection::ZeroCopyLinger*>*
+UNIXSocketConnection::LingeringZeroCopy(Mutex** mtx)
+{
+	// Never destroyed, connections may still be shut down during exit.
+	static Mutex* lingering_mtx = Mutex::Create();
+	static std::list<ZeroCopyLinger*>* lingering =
+		new std::list<ZeroCopyLinger*>;
+
+	*mtx = lingering_mtx;
+	return lingering;
+}
+
+size_t
+UNIXSocketConnection::ReapZeroCopy()
+{
+	std::list<Closure*> released;
+	size_t outstanding = 0;
+	Mutex* mtx;
+	std::list<ZeroCopyLinger*>* lingering = LingeringZeroCopy(&mtx);
+
+	{
+		MutexLock l(mtx);
+		std::list<ZeroCopyLinger*>::iterator it = lingering->begin();
+
+		while (it != lingering->end())
+		{
+			ZeroCopyLinger* linger = *it;
+			bool other_errors = false;
+
+			// The socket is gone as soon as the last sends are
+			// reported, so there's nothing else to look at.
+			ReadZeroCopyCompletions(linger->socket,
+					&linger->pending, &released,
+					&other_errors);
+			if (!linger->pending.empty())
+			{
+				outstanding += linger->pending.size();
+				++it;
+				continue;
+			}
+
+			close(linger->socket);
+			delete linger;
+			it = lingering->erase(it);
+		}
+	}
+
+	for (Closure* c : released)
+		c->Run();
+
+	return outstanding;
+}
+
+void
+UNIXSocketConnection::ApplySocketOptions(const SocketOptions& options)
+{
+	options.ApplyToConnection(socket_);
+}
+
+int
+UNIXSocketConnection::GetIncomingCPU()
+{
+#ifdef SO_INCOMING_CPU
+	int cpu = -1;
+	socklen_t len = sizeof(cpu);
+
+	if (getsockopt(socket_, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) == 0)
+		return cpu;
+#endif /* SO_INCOMING_CPU */
+	return -1;
+}
+
+ssize_t
+UNIXSocketConnection::SendMessage(const BufferView* views, size_t count,
+		int flags)
+{
+	struct iovec iov[IOV_MAX];
+	struct msghdr msg;
+	ssize_t total = 0;
+	size_t offset = 0;
+
+	while (count > 0)
+	{
+		size_t batch = count > IOV_MAX ? IOV_MAX : count;
+		size_t expected = 0;
+		ssize_t len;
+
+		// "offset" is how much of the first piece was already sent.
+		for (size_t i = 0; i < batch; ++i)
+		{
+			size_t skip = i == 0 ? offset : 0;
+
+			iov[i].iov_base = const_cast<char*>(views[i].data) + skip;
+			iov[i].iov_len = views[i].length - skip;
+			expected += views[i].length - skip;
+		}
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = batch;
+
+		len = sendmsg(socket_, &msg, flags);
+		if (len == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			if ((errno == EAGAIN || errno == EWOULDBLOCK) &&
+					!(flags & MSG_DONTWAIT) &&
+					WaitForSocket(POLLOUT))
+				continue;
+			return total > 0 ? total : -1;
+		}
+
+		total += len;
+		if ((size_t) len < expected && (flags & MSG_DONTWAIT))
+			break;
+
+		offset += len;
+		while (count > 0 && offset >= views[0].length)
+		{
+			offset -= views[0].length;
+			++views;
+			--count;
+		}
+	}
+
+	return total;
+}
+
+void
+UNIXSocketConnection::SetWriteQueue(size_t low_watermark,
+		size_t high_watermark)
+{
+	MutexLock l(write_mtx_.Get());
+	low_watermark_ = low_watermark;
+	high_watermark_ = high_watermark;
+	write_queue_enabled_ = true;
+}
+
+size_t
+UNIXSocketConnection::GetWriteQueueSize()
+{
+	MutexLock l(write_mtx_.Get());
+	return write_queue_size_;
+}
+
+void
+UNIXSocketConnection::FlushWriteQueue()
+{
+	MutexLock l(write_mtx_.Get());
+	FlushWriteQueueLocked();
+}
+
+void
+UNIXSocketConnection::FlushWriteQueueLocked()
+{
+	while (!write_queue_.empty())
+	{
+		const string& front = write_queue_.front();
+		ssize_t len = send(socket_, front.data() + write_queue_offset_,
+				front.size() - write_queue_offset_,
+				MSG_DONTWAIT | MSG_NOSIGNAL);
+
+		if (len == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+
+			// The connection is broken, there's no point in
+			// keeping the data around.
+			eof_ = true;
+			write_queue_.clear();
+			write_queue_offset_ = 0;
+			write_queue_size_ = 0;
+			break;
+		}
+
+		write_queue_offset_ += len;
+		write_queue_size_ -= len;
+		if (write_queue_offset_ == front.size())
+		{
+			write_queue_.pop_front();
+			write_queue_offset_ = 0;
+		}
+	}
+
+	last_use_ = time(NULL);
+
+	if (write_queue_.empty() && server_)
+		server_->WatchWritable(socket_, false);
+
+	if (write_queue_full_ && write_queue_size_ <= low_watermark_)
+	{
+		write_queue_full_ = false;
+		if (server_)
+			server_->NotifyWriteQueue(socket_, false);
+	}
 }
 
 string
 UNIXSocketConnection::PeerAsText()
 {
-	ScopedPtr<char> addr_str(c_sockaddr2str(peer_));
-	return string(addr_str.Get());
+	// The peer doesn't change, so it only has to be formatted once.
+	std::call_once(peer_text_once_, [this]() {
+		// Clients of UNIX sockets are usually unnamed.
+		if (peer_.ss_family == AF_UNIX)
+		{
+			peer_text_ = string("unix:") +
+				((struct sockaddr_un*) &peer_)->sun_path;
+			return;
+		}
+
+		ScopedPtr<char> addr_str(c_sockaddr2str(&peer_));
+		peer_text_ = addr_str.Get();
+	});
+	return peer_text_;
 }
 
 Server*
@@ -145,10 +829,27 @@ UNIXSocketConnection::SetBlocking(bool blocking)
 	}
 	else
 	{
-		fcntl(socket_, F_SETFL, O_NONBLOCK);
+		int val = fcntl(socket_, F_GETFL, 0);
+		val |= O_NONBLOCK;
+		fcntl(socket_, F_SETFL, val);
 	}
 }
 
+bool
+UNIXSocketConnection::WaitForSocket(short events)
+{
+	struct pollfd pfd;
+
+	pfd.fd = socket_;
+	pfd.events = events;
+	pfd.revents = 0;
+
+	while (poll(&pfd, 1, -1) == -1)
+		if (errno != EINTR)
+			return false;
+	return !(pfd.revents & POLLNVAL);
+}
+
 void
 UNIXSocketConnection::Shutdown()
 {
@@ -157,8 +858,37 @@ UNIXSocketConnection::Shutdown()
 
 	// Ensure we're the only ones operating on the connection.
 	Lock();
+	CloseAndDelete();
+}
+
+void
+UNIXSocketConnection::CloseAndDelete()
+{
+	eof_ = true;
+
+	// The kernel keeps sending from the memory of zero-copy sends until
+	// the peer acknowledged the data, and closing the socket doesn't stop
+	// that. A duplicate of the socket keeps the notifications coming, and
+	// ReapZeroCopy() releases the memory once they arrive. If the socket
+	// can't be duplicated, the memory is never released rather than
+	// released too early.
+	if (!zerocopy_pending_.empty())
+	{
+		ZeroCopyLinger* linger = new ZeroCopyLinger;
+		Mutex* mtx;
+		std::list<ZeroCopyLinger*>* lingering = LingeringZeroCopy(&mtx);
+
+		linger->socket = dup(socket_);
+		linger->pending.swap(zerocopy_pending_);
+		zerocopy_lingering.Add(linger->pending.size());
+
+		MutexLock l(mtx);
+		lingering->push_back(linger);
+	}
+
 	shutdown(socket_, SHUT_RDWR);
 	close(socket_);
+
 	delete this;
 }
 
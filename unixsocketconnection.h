@@ -30,6 +30,13 @@
 #ifndef INCLUDED_UNIXSOCKETCONNECTION_H
 #define INCLUDED_UNIXSOCKETCONNECTION_H 1
 
+#include <atomic>
+#include <deque>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread++/mutex.h>
 #include <toolbox/scopedptr.h>
 #include "siot/connection.h"
 
@@ -42,26 +49,139 @@ using toolbox::ScopedPtr;
 class UNIXSocketConnection : public Connection
 {
 public:
+	// Creates a new connection on the socket "socketid", which is
+	// connected to "peer". The address is copied.
 	explicit UNIXSocketConnection(Server* srv, int socketid,
-			struct sockaddr_storage* peer);
+			const struct sockaddr_storage* peer);
 	virtual ~UNIXSocketConnection();
 
+	// Connection objects are recycled through a freelist.
+	static void* operator new(size_t size);
+	static void operator delete(void* ptr, size_t size);
+
 	// Implements Connection.
 	virtual string Receive(size_t maxlen = -1, int flags = 0);
+	virtual ssize_t ReceiveInto(char* buf, size_t len, int flags = 0);
+	virtual Buffer ReceiveBuffer(size_t maxlen = -1, int flags = 0);
+	virtual IOResult TryReceiveInto(char* buf, size_t len, int flags = 0);
 	virtual ssize_t Send(string data, int flags = 0);
+	virtual ssize_t SendVector(const BufferView* views, size_t count,
+			int flags = 0);
+	virtual IOResult TrySendVector(const BufferView* views, size_t count,
+			int flags = 0);
+	virtual ssize_t SendZeroCopy(const char* data, size_t len,
+			google::protobuf::Closure* release, int flags = 0);
+	virtual ssize_t SendFile(int fd, off_t offset, size_t len);
+	virtual void SetZeroCopyThreshold(size_t threshold);
+	virtual bool ProcessErrorQueue();
+	virtual void ApplySocketOptions(const SocketOptions& options);
+	virtual int GetIncomingCPU();
 	virtual string PeerAsText();
 	virtual Server* GetServer();
 	virtual bool IsEOF();
 	virtual uint64_t GetLastUse();
 	virtual void SetBlocking(bool blocking = true);
+	virtual void SetWriteQueue(size_t low_watermark, size_t high_watermark);
+	virtual size_t GetWriteQueueSize();
+	virtual void FlushWriteQueue();
 	virtual void Shutdown();
 
+	// Releases the memory of zero-copy sends from connections which have
+	// been closed, as far as the kernel has reported them as done. This
+	// never blocks; the server calls it from its reaper. Returns the
+	// number of sends which are still outstanding.
+	static size_t ReapZeroCopy();
+
+protected:
+	// Waits until the socket is ready for "events" (see poll(2)). Sockets
+	// accepted by the server are non-blocking, so this is how calls which
+	// are supposed to block wait for the peer. Returns false on errors.
+	bool WaitForSocket(short events);
+
+	// Closes the socket, hands outstanding zero-copy sends over to
+	// ReapZeroCopy() and deletes the connection. Must be called with the
+	// exclusive Lock() held, which is never released, after Deregister().
+	// This is for subclasses which need to clean up after themselves in
+	// Shutdown() first.
+	void CloseAndDelete();
+
 private:
+	// Sends the pieces in "views" using as few sendmsg() calls as
+	// possible. Unless "flags" contains MSG_DONTWAIT, this waits for the
+	// peer until everything has been sent, even on non-blocking sockets.
+	// Returns the number of bytes sent, or -1 if nothing could be sent at
+	// all.
+	ssize_t SendMessage(const BufferView* views, size_t count, int flags);
+
+	// Appends the pieces in "views" to the write queue, skipping the
+	// first "offset" bytes. Must be called with write_mtx_ held.
+	void QueueLocked(const BufferView* views, size_t count, size_t offset);
+
+	// Sends "data" with MSG_ZEROCOPY and remembers "release" until all
+	// of it has been reported as sent. Must be called with write_mtx_
+	// held.
+	ssize_t SendZeroCopyLocked(const char* data, size_t len,
+			google::protobuf::Closure* release, int flags);
+
+	// Writes out as much of the write queue as the socket will take
+	// right now. Must be called with write_mtx_ held.
+	void FlushWriteQueueLocked();
+
 	int socket_;
-	struct sockaddr_storage* peer_;
+	struct sockaddr_storage peer_;
+	std::once_flag peer_text_once_;
+	string peer_text_;
 	Server* server_;
-	bool eof_;
-	uint64_t last_use_;
+
+	// Touched by both the reading and the writing side.
+	std::atomic<bool> eof_;
+	std::atomic<uint64_t> last_use_;
+
+	ScopedPtr<threadpp::Mutex> write_mtx_;
+	std::deque<string> write_queue_;
+	size_t write_queue_offset_;
+	size_t write_queue_size_;
+	size_t low_watermark_;
+	size_t high_watermark_;
+	bool write_queue_enabled_;
+	bool write_queue_full_;
+
+	// A piece of memory sent with MSG_ZEROCOPY, possibly across several
+	// send calls.
+	struct ZeroCopySend
+	{
+		uint32_t outstanding;
+		google::protobuf::Closure* release;
+	};
+
+	// Zero-copy sends of a closed connection which the kernel hasn't
+	// reported as done yet. "socket" is a duplicate of the connection's
+	// socket, which keeps its error queue around.
+	struct ZeroCopyLinger
+	{
+		int socket;
+		std::map<uint32_t, ZeroCopySend*> pending;
+	};
+
+	// Reads the zero-copy completions from the error queue of "socket"
+	// without blocking, drops the completed sends from "pending" and adds
+	// the release callbacks of the memory which isn't needed anymore to
+	// "released". Sets "other_errors" if there was anything else on the
+	// error queue. Returns true if any completions were read.
+	static bool ReadZeroCopyCompletions(int socket,
+			std::map<uint32_t, ZeroCopySend*>* pending,
+			std::list<google::protobuf::Closure*>* released,
+			bool* other_errors);
+
+	// Returns the zero-copy sends of closed connections, see
+	// ReapZeroCopy(), and sets "mtx" to the mutex protecting them.
+	static std::list<ZeroCopyLinger*>* LingeringZeroCopy(
+			threadpp::Mutex** mtx);
+
+	size_t zerocopy_threshold_;
+	bool zerocopy_enabled_;
+	uint32_t zerocopy_next_id_;
+	std::map<uint32_t, ZeroCopySend*> zerocopy_pending_;
 };
 }  // namespace siot
 }  // namespace toolbox
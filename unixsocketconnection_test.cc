@@ -7,6 +7,16 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <google/protobuf/stubs/common.h>
 
 #include "unixsocketconnection.h"
 
@@ -41,6 +51,530 @@ TEST_F(UnixSocketConnectionTest, ReadWrite)
 	EXPECT_EQ("Hey, buddy!", one.Receive());
 }
 
+TEST_F(UnixSocketConnectionTest, Locking)
+{
+	struct sockaddr_storage addr;
+	int socks[2];
+
+	memset(&addr, 0, sizeof(struct sockaddr_storage));
+	EXPECT_FALSE(socketpair(AF_UNIX, SOCK_STREAM, 0, socks))
+		<< "Error establishing socket pair: " << strerror(errno);
+
+	UNIXSocketConnection conn(0, socks[0], &addr);
+
+	EXPECT_TRUE(conn.TryReadLock());
+	EXPECT_TRUE(conn.TryReadLock());
+	EXPECT_FALSE(conn.TryLock());
+
+	// Read locks may be released by other threads.
+	std::thread t([&conn]() {
+		conn.Unlock();
+		conn.Unlock();
+	});
+	t.join();
+
+	EXPECT_TRUE(conn.TryLock());
+	EXPECT_FALSE(conn.TryReadLock());
+	EXPECT_FALSE(conn.TryLock());
+	conn.Unlock();
+
+	conn.ReadLock();
+	conn.Unlock();
+	conn.Lock();
+	conn.Unlock();
+	close(socks[1]);
+}
+
+TEST_F(UnixSocketConnectionTest, LockingBusy)
+{
+	struct sockaddr_storage addr;
+	int socks[2];
+	std::atomic<bool> locked(false);
+	std::atomic<bool> stop(false);
+	std::vector<std::thread> readers;
+
+	memset(&addr, 0, sizeof(struct sockaddr_storage));
+	EXPECT_FALSE(socketpair(AF_UNIX, SOCK_STREAM, 0, socks))
+		<< "Error establishing socket pair: " << strerror(errno);
+
+	UNIXSocketConnection conn(0, socks[0], &addr);
+
+	// Readers keep coming, so there's always one holding the lock.
+	conn.ReadLock();
+	for (int i = 0; i < 4; ++i)
+		readers.push_back(std::thread([&conn, &stop]() {
+			while (!stop)
+				if (conn.TryReadLock())
+				{
+					std::this_thread::sleep_for(
+						std::chrono::milliseconds(1));
+					conn.Unlock();
+				}
+		}));
+
+	std::thread writer([&conn, &locked]() {
+		conn.Lock();
+		locked = true;
+		conn.Unlock();
+	});
+
+	// Once the writer is waiting, no more readers get in, and it gets
+	// the lock as soon as the ones inside are done.
+	bool blocked = false;
+	for (int i = 0; i < 5000 && !blocked; ++i)
+	{
+		if (!conn.TryReadLock())
+			blocked = true;
+		else
+		{
+			conn.Unlock();
+			std::this_thread::sleep_for(
+					std::chrono::milliseconds(1));
+		}
+	}
+	EXPECT_TRUE(blocked);
+	conn.Unlock();
+
+	for (int i = 0; i < 5000 && !locked; ++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	EXPECT_TRUE(locked);
+
+	stop = true;
+	writer.join();
+	for (std::thread& t : readers)
+		t.join();
+	close(socks[1]);
+}
+
+TEST_F(UnixSocketConnectionTest, ReceiveInto)
+{
+	struct sockaddr_storage oneaddr, twoaddr;
+	int socks[2];
+	char buf[32];
+
+	memset(&oneaddr, 0, sizeof(struct sockaddr_storage));
+	memset(&twoaddr, 0, sizeof(struct sockaddr_storage));
+
+	EXPECT_FALSE(socketpair(AF_UNIX, SOCK_STREAM, 0, socks))
+		<< "Error establishing socket pair: " << strerror(errno);
+
+	UNIXSocketConnection one(0, socks[0], &oneaddr);
+	UNIXSocketConnection two(0, socks[1], &twoaddr);
+
+	EXPECT_EQ(11, one.Send("Hey, buddy!"));
+	EXPECT_EQ(4, two.ReceiveInto(buf, 4));
+	EXPECT_EQ("Hey,", string(buf, 4));
+	EXPECT_EQ(7, two.ReceiveInto(buf, sizeof(buf)));
+	EXPECT_EQ(" buddy!", string(buf, 7));
+	EXPECT_EQ(-1, two.ReceiveInto(buf, sizeof(buf), MSG_DONTWAIT));
+}
+
+TEST_F(UnixSocketConnectionTest, ReceiveAll)
+{
+	struct sockaddr_storage oneaddr, twoaddr;
+	int socks[2];
+	bool pending = true;
+
+	memset(&oneaddr, 0, sizeof(struct sockaddr_storage));
+	memset(&twoaddr, 0, sizeof(struct sockaddr_storage));
+
+	EXPECT_FALSE(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0,
+				socks))
+		<< "Error establishing socket pair: " << strerror(errno);
+
+	UNIXSocketConnection one(0, socks[0], &oneaddr);
+	UNIXSocketConnection two(0, socks[1], &twoaddr);
+
+	// Nothing there yet, which must not block.
+	EXPECT_TRUE(two.ReceiveAll(-1, &pending).IsEmpty());
+	EXPECT_FALSE(pending);
+
+	string big(100000, 'x');
+	EXPECT_EQ(11, one.Send("Hey, buddy!"));
+	EXPECT_EQ(100000, one.Send(big));
+
+	Buffer data = two.ReceiveAll(4, &pending);
+	EXPECT_EQ("Hey,", data.AsString());
+	EXPECT_TRUE(pending);
+
+	data = two.ReceiveAll(-1, &pending);
+	EXPECT_EQ(" buddy!" + big, data.AsString());
+	EXPECT_FALSE(pending);
+	EXPECT_LT(1, data.CountSegments());
+}
+
+TEST_F(UnixSocketConnectionTest, TryReceiveAndSend)
+{
+	struct sockaddr_storage oneaddr, twoaddr;
+	int socks[2];
+	char buf[32];
+	Buffer data;
+
+	memset(&oneaddr, 0, sizeof(struct sockaddr_storage));
+	memset(&twoaddr, 0, sizeof(struct sockaddr_storage));
+
+	EXPECT_FALSE(socketpair(AF_UNIX, SOCK_STREAM, 0, socks))
+		<< "Error establishing socket pair: " << strerror(errno);
+
+	UNIXSocketConnection one(0, socks[0], &oneaddr);
+	UNIXSocketConnection two(0, socks[1], &twoaddr);
+
+	// Even blocking sockets aren't waited for.
+	EXPECT_EQ(kIOWouldBlock, two.TryReceiveInto(buf, sizeof(buf)).status);
+
+	IOResult result = one.TrySendBuffer(Buffer("Hey, buddy!", 11));
+	EXPECT_EQ(kIOOk, result.status);
+	EXPECT_EQ(11, result.length);
+
+	result = two.TryReceiveBuffer(&data);
+	EXPECT_EQ(kIOOk, result.status);
+	EXPECT_EQ("Hey, buddy!", data.AsString());
+
+	// Fill up the socket until it takes no more.
+	string big(1 << 20, 'x');
+	BufferView view(big);
+	while ((result = one.TrySendVector(&view, 1)).IsOk())
+		;
+	EXPECT_EQ(kIOWouldBlock, result.status);
+
+	shutdown(socks[0], SHUT_WR);
+	while ((result = two.TryReceiveInto(buf, sizeof(buf))).IsOk())
+		;
+	EXPECT_EQ(kIOClosed, result.status);
+	EXPECT_TRUE(two.IsEOF());
+}
+
+TEST_F(UnixSocketConnectionTest, NonBlockingSend)
+{
+	struct sockaddr_storage oneaddr, twoaddr;
+	int socks[2];
+	string big(4 << 20, 'x');
+	string received;
+
+	memset(&oneaddr, 0, sizeof(struct sockaddr_storage));
+	memset(&twoaddr, 0, sizeof(struct sockaddr_storage));
+
+	EXPECT_FALSE(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0,
+				socks))
+		<< "Error establishing socket pair: " << strerror(errno);
+
+	UNIXSocketConnection one(0, socks[0], &oneaddr);
+	UNIXSocketConnection two(0, socks[1], &twoaddr);
+
+	// Without a write queue, Send() waits for the peer to take all of
+	// the data, even though the socket doesn't block.
+	std::thread reader([&]() {
+		while (received.size() < big.size())
+			received += two.ReceiveAll().AsString();
+	});
+	EXPECT_EQ((ssize_t) big.size(), one.Send(big));
+	reader.join();
+	EXPECT_EQ(big, received);
+}
+
+TEST_F(UnixSocketConnectionTest, SendVector)
+{
+	struct sockaddr_storage oneaddr, twoaddr;
+	int socks[2];
+	string header("Hey, ");
+	string body("buddy!");
+	BufferView views[] = { header, BufferView(body.data(), 3),
+		BufferView(body.data() + 3, 3) };
+
+	memset(&oneaddr, 0, sizeof(struct sockaddr_storage));
+	memset(&twoaddr, 0, sizeof(struct sockaddr_storage));
+
+	EXPECT_FALSE(socketpair(AF_UNIX, SOCK_STREAM, 0, socks))
+		<< "Error establishing socket pair: " << strerror(errno);
+
+	UNIXSocketConnection one(0, socks[0], &oneaddr);
+	UNIXSocketConnection two(0, socks[1], &twoaddr);
+
+	EXPECT_EQ(11, one.SendVector(views, 3));
+	EXPECT_EQ("Hey, buddy!", two.Receive());
+
+	one.SetWriteQueue(0, 0);
+	EXPECT_EQ(11, one.SendVector(views, 3));
+	EXPECT_EQ("Hey, buddy!", two.Receive());
+}
+
+TEST_F(UnixSocketConnectionTest, WriteQueue)
+{
+	struct sockaddr_storage oneaddr, twoaddr;
+	int socks[2];
+	int bufsize = 4096;
+	string data;
+	string received;
+
+	memset(&oneaddr, 0, sizeof(struct sockaddr_storage));
+	memset(&twoaddr, 0, sizeof(struct sockaddr_storage));
+
+	EXPECT_FALSE(socketpair(AF_UNIX, SOCK_STREAM, 0, socks))
+		<< "Error establishing socket pair: " << strerror(errno);
+	EXPECT_FALSE(setsockopt(socks[0], SOL_SOCKET, SO_SNDBUF, &bufsize,
+				sizeof(bufsize)))
+		<< "Error setting send buffer size: " << strerror(errno);
+
+	UNIXSocketConnection one(0, socks[0], &oneaddr);
+	UNIXSocketConnection two(0, socks[1], &twoaddr);
+
+	for (int i = 0; i < 65536; ++i)
+		data += char('a' + i % 26);
+
+	// Way more than fits into the socket buffer, but it mustn't block.
+	one.SetWriteQueue(1024, 32768);
+	EXPECT_EQ(data.size(), one.Send(data));
+	EXPECT_EQ(11, one.Send("Hey, buddy!"));
+	EXPECT_LT(0, one.GetWriteQueueSize());
+
+	while (received.size() < data.size() + 11)
+	{
+		received += two.Receive();
+		one.FlushWriteQueue();
+	}
+
+	EXPECT_EQ(0, one.GetWriteQueueSize());
+	EXPECT_EQ(data + "Hey, buddy!", received);
+}
+
+TEST_F(UnixSocketConnectionTest, SendFile)
+{
+	struct sockaddr_storage oneaddr, twoaddr;
+	int socks[2];
+	char path[] = "/tmp/siot-sendfile-XXXXXX";
+	int fd;
+	string data;
+	string received;
+
+	memset(&oneaddr, 0, sizeof(struct sockaddr_storage));
+	memset(&twoaddr, 0, sizeof(struct sockaddr_storage));
+
+	EXPECT_FALSE(socketpair(AF_UNIX, SOCK_STREAM, 0, socks))
+		<< "Error establishing socket pair: " << strerror(errno);
+
+	fd = mkstemp(path);
+	ASSERT_LE(0, fd) << "Error creating file: " << strerror(errno);
+	unlink(path);
+
+	for (int i = 0; i < 20000; ++i)
+		data += char('a' + i % 26);
+	ASSERT_EQ(data.size(), write(fd, data.data(), data.size()));
+
+	UNIXSocketConnection one(0, socks[0], &oneaddr);
+	UNIXSocketConnection two(0, socks[1], &twoaddr);
+
+	// Starting in the middle of a page.
+	EXPECT_EQ(10000, one.SendFile(fd, 5000, 10000));
+	while (received.size() < 10000)
+		received += two.Receive();
+	EXPECT_EQ(data.substr(5000, 10000), received);
+
+	// With a write queue, the file is mapped into memory instead.
+	received.clear();
+	one.SetWriteQueue(0, 0);
+	EXPECT_EQ(10000, one.SendFile(fd, 5000, 10000));
+	while (received.size() < 10000)
+		received += two.Receive();
+	EXPECT_EQ(data.substr(5000, 10000), received);
+
+	// Reading past the end of the file only sends what's there.
+	received.clear();
+	EXPECT_EQ(1000, one.SendFile(fd, 19000, 5000));
+	while (received.size() < 1000)
+		received += two.Receive();
+	EXPECT_EQ(data.substr(19000), received);
+
+	close(fd);
+}
+
+static void
+SetTrue(bool* flag)
+{
+	*flag = true;
+}
+
+TEST_F(UnixSocketConnectionTest, ZeroCopy)
+{
+	struct sockaddr_storage oneaddr, twoaddr;
+	struct sockaddr_in addr;
+	socklen_t addrlen = sizeof(addr);
+	int listener, onefd, twofd;
+	bool released = false;
+	string data;
+	string received;
+
+	memset(&oneaddr, 0, sizeof(struct sockaddr_storage));
+	memset(&twoaddr, 0, sizeof(struct sockaddr_storage));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	// Zero-copy sending is only supported on TCP sockets, so we need a
+	// real connection over the loopback interface.
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	ASSERT_LE(0, listener) << "Error creating socket: " << strerror(errno);
+	ASSERT_FALSE(bind(listener, (struct sockaddr*) &addr, sizeof(addr)))
+		<< "Error binding socket: " << strerror(errno);
+	ASSERT_FALSE(listen(listener, 1))
+		<< "Error listening on socket: " << strerror(errno);
+	ASSERT_FALSE(getsockname(listener, (struct sockaddr*) &addr,
+				&addrlen))
+		<< "Error determining socket address: " << strerror(errno);
+
+	onefd = socket(AF_INET, SOCK_STREAM, 0);
+	ASSERT_FALSE(connect(onefd, (struct sockaddr*) &addr, sizeof(addr)))
+		<< "Error connecting: " << strerror(errno);
+	twofd = accept(listener, 0, 0);
+	ASSERT_LE(0, twofd) << "Error accepting: " << strerror(errno);
+	close(listener);
+
+	UNIXSocketConnection one(0, onefd, &oneaddr);
+	UNIXSocketConnection two(0, twofd, &twoaddr);
+
+	for (int i = 0; i < 65536; ++i)
+		data += char('a' + i % 26);
+
+	// The release callback may only run once the kernel is done with the
+	// data. If zero-copy isn't available, it runs right away.
+	one.SetZeroCopyThreshold(4096);
+	EXPECT_EQ(data.size(), one.SendZeroCopy(data.data(), data.size(),
+				google::protobuf::NewCallback(&SetTrue,
+					&released)));
+
+	while (received.size() < data.size())
+		received += two.Receive();
+	EXPECT_EQ(data, received);
+
+	for (int i = 0; i < 1000 && !released; ++i)
+		if (!one.ProcessErrorQueue())
+			usleep(1000);
+	EXPECT_TRUE(released);
+
+	// The data went through the network stack, so it is known which
+	// CPU received it.
+	EXPECT_LE(0, two.GetIncomingCPU());
+}
+
+TEST_F(UnixSocketConnectionTest, ZeroCopyFullBuffer)
+{
+	struct sockaddr_storage oneaddr, twoaddr;
+	struct sockaddr_in addr;
+	socklen_t addrlen = sizeof(addr);
+	int listener, onefd, twofd;
+	string filler(65536, '-');
+	string big(4 << 20, 'x');
+	string received;
+	size_t filled = 0;
+	ssize_t len;
+
+	memset(&oneaddr, 0, sizeof(struct sockaddr_storage));
+	memset(&twoaddr, 0, sizeof(struct sockaddr_storage));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	ASSERT_LE(0, listener) << "Error creating socket: " << strerror(errno);
+	ASSERT_FALSE(bind(listener, (struct sockaddr*) &addr, sizeof(addr)))
+		<< "Error binding socket: " << strerror(errno);
+	ASSERT_FALSE(listen(listener, 1))
+		<< "Error listening on socket: " << strerror(errno);
+	ASSERT_FALSE(getsockname(listener, (struct sockaddr*) &addr,
+				&addrlen))
+		<< "Error determining socket address: " << strerror(errno);
+
+	onefd = socket(AF_INET, SOCK_STREAM, 0);
+	ASSERT_FALSE(connect(onefd, (struct sockaddr*) &addr, sizeof(addr)))
+		<< "Error connecting: " << strerror(errno);
+	twofd = accept(listener, 0, 0);
+	ASSERT_LE(0, twofd) << "Error accepting: " << strerror(errno);
+	close(listener);
+
+	// Like the sockets accepted by the server.
+	fcntl(onefd, F_SETFL, fcntl(onefd, F_GETFL) | O_NONBLOCK);
+
+	UNIXSocketConnection one(0, onefd, &oneaddr);
+	UNIXSocketConnection two(0, twofd, &twoaddr);
+
+	// Nobody reads yet, so the socket doesn't take any more data.
+	while ((len = send(onefd, filler.data(), filler.size(),
+					MSG_DONTWAIT)) > 0)
+		filled += len;
+
+	// Large sends go out without copying, and still wait for the peer
+	// to take all of the data.
+	one.SetZeroCopyThreshold(4096);
+	std::thread reader([&]() {
+		while (received.size() < filled + big.size())
+			received += two.Receive();
+	});
+	EXPECT_EQ((ssize_t) big.size(), one.Send(big));
+	reader.join();
+	EXPECT_EQ(big, received.substr(filled));
+}
+
+TEST_F(UnixSocketConnectionTest, ZeroCopyShutdown)
+{
+	struct sockaddr_storage oneaddr, twoaddr;
+	struct sockaddr_in addr;
+	socklen_t addrlen = sizeof(addr);
+	int listener, onefd, twofd;
+	bool released = false;
+	string data;
+	string received;
+
+	memset(&oneaddr, 0, sizeof(struct sockaddr_storage));
+	memset(&twoaddr, 0, sizeof(struct sockaddr_storage));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	ASSERT_LE(0, listener) << "Error creating socket: " << strerror(errno);
+	ASSERT_FALSE(bind(listener, (struct sockaddr*) &addr, sizeof(addr)))
+		<< "Error binding socket: " << strerror(errno);
+	ASSERT_FALSE(listen(listener, 1))
+		<< "Error listening on socket: " << strerror(errno);
+	ASSERT_FALSE(getsockname(listener, (struct sockaddr*) &addr,
+				&addrlen))
+		<< "Error determining socket address: " << strerror(errno);
+
+	onefd = socket(AF_INET, SOCK_STREAM, 0);
+	ASSERT_FALSE(connect(onefd, (struct sockaddr*) &addr, sizeof(addr)))
+		<< "Error connecting: " << strerror(errno);
+	twofd = accept(listener, 0, 0);
+	ASSERT_LE(0, twofd) << "Error accepting: " << strerror(errno);
+	close(listener);
+
+	UNIXSocketConnection* one = new UNIXSocketConnection(0, onefd,
+			&oneaddr);
+	UNIXSocketConnection two(0, twofd, &twoaddr);
+
+	for (int i = 0; i < 65536; ++i)
+		data += char('a' + i % 26);
+
+	// Shutting down doesn't wait for the kernel to be done with the data,
+	// which still reaches the peer. The memory is released by
+	// ReapZeroCopy() once the kernel has reported it as done.
+	one->SetZeroCopyThreshold(4096);
+	EXPECT_EQ(data.size(), one->SendZeroCopy(data.data(), data.size(),
+				google::protobuf::NewCallback(&SetTrue,
+					&released)));
+	one->Shutdown();
+
+	while (received.size() < data.size() && !two.IsEOF())
+		received += two.Receive();
+	EXPECT_EQ(data, received);
+
+	for (int i = 0; i < 1000 && !released; ++i)
+	{
+		if (UNIXSocketConnection::ReapZeroCopy() > 0)
+			usleep(1000);
+	}
+	EXPECT_TRUE(released);
+	EXPECT_EQ(0U, UNIXSocketConnection::ReapZeroCopy());
+}
+
 }  // namespace testing
 }  // namespace siot
 }  // namespace toolbox
@@ -0,0 +1,114 @@
+/*-
+ * Copyright (c) 2026 Caoimhe Chaos <caoimhechaos@protonmail.com>,
+ *                    Ancient Solutions. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions  of source code must retain  the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions  in   binary  form  must   reproduce  the  above
+ *    copyright  notice, this  list  of conditions  and the  following
+ *    disclaimer in the  documentation and/or other materials provided
+ *    with the distribution.
+ *
+ * THIS  SOFTWARE IS  PROVIDED BY  ANCIENT SOLUTIONS  AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO,  THE IMPLIED WARRANTIES OF  MERCHANTABILITY AND FITNESS
+ * FOR A  PARTICULAR PURPOSE  ARE DISCLAIMED.  IN  NO EVENT  SHALL THE
+ * FOUNDATION  OR CONTRIBUTORS  BE  LIABLE FOR  ANY DIRECT,  INDIRECT,
+ * INCIDENTAL,   SPECIAL,    EXEMPLARY,   OR   CONSEQUENTIAL   DAMAGES
+ * (INCLUDING, BUT NOT LIMITED  TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE,  DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT  LIABILITY,  OR  TORT  (INCLUDING NEGLIGENCE  OR  OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "fairscheduler.h"
+#include "threadplacement.h"
+#include "workershard.h"
+
+namespace toolbox
+{
+namespace siot
+{
+// Protects the placement of the threads of new shards.
+static std::mutex placement_mtx;
+static std::condition_variable placement_done;
+
+// Progress of placing the threads of a new shard.
+struct WorkerShard::Placement
+{
+	uint32_t threads;
+	uint32_t arrived;
+	uint32_t departed;
+};
+
+WorkerShard::WorkerShard(const std::vector<int>& cpus, uint32_t num_threads)
+: cpus_(cpus), dispatched_(0), scheduler_(new FairScheduler),
+	executor_(num_threads)
+{
+	Placement p = { num_threads, 0, 0 };
+
+	// The threads of the pool can't be addressed directly, so every one
+	// of them has to pin itself. Each placement closure waits for all the
+	// others, so no thread gets to run two of them.
+	for (uint32_t i = 0; i < num_threads; ++i)
+		executor_.Add(google::protobuf::NewCallback(this,
+					&WorkerShard::PlaceThread, &p));
+
+	std::unique_lock<std::mutex> l(placement_mtx);
+	while (p.departed < p.threads)
+		placement_done.wait(l);
+}
+
+WorkerShard::~WorkerShard()
+{
+}
+
+void
+WorkerShard::PlaceThread(Placement* p)
+{
+	PinCurrentThread(cpus_);
+
+	std::unique_lock<std::mutex> l(placement_mtx);
+	++p->arrived;
+	placement_done.notify_all();
+	while (p->arrived < p->threads)
+		placement_done.wait(l);
+
+	// "p" is gone once the last thread has left.
+	++p->departed;
+	placement_done.notify_all();
+}
+
+void
+WorkerShard::Dispatch(const string& cls, uint32_t weight, Closure* c)
+{
+	++dispatched_;
+	scheduler_->Add(cls, weight, c);
+	executor_.Add(google::protobuf::NewCallback(scheduler_.Get(),
+				&FairScheduler::RunNext));
+}
+
+const std::vector<int>&
+WorkerShard::GetCPUs() const
+{
+	return cpus_;
+}
+
+uint64_t
+WorkerShard::TakeDispatchCount()
+{
+	return dispatched_.exchange(0);
+}
+}  // namespace siot
+}  // namespace toolbox
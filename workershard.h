@@ -0,0 +1,84 @@
+/*-
+ * Copyright (c) 2026 Caoimhe Chaos <caoimhechaos@protonmail.com>,
+ *                    Ancient Solutions. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions  of source code must retain  the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions  in   binary  form  must   reproduce  the  above
+ *    copyright  notice, this  list  of conditions  and the  following
+ *    disclaimer in the  documentation and/or other materials provided
+ *    with the distribution.
+ *
+ * THIS  SOFTWARE IS  PROVIDED BY  ANCIENT SOLUTIONS  AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO,  THE IMPLIED WARRANTIES OF  MERCHANTABILITY AND FITNESS
+ * FOR A  PARTICULAR PURPOSE  ARE DISCLAIMED.  IN  NO EVENT  SHALL THE
+ * FOUNDATION  OR CONTRIBUTORS  BE  LIABLE FOR  ANY DIRECT,  INDIRECT,
+ * INCIDENTAL,   SPECIAL,    EXEMPLARY,   OR   CONSEQUENTIAL   DAMAGES
+ * (INCLUDING, BUT NOT LIMITED  TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE,  DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT  LIABILITY,  OR  TORT  (INCLUDING NEGLIGENCE  OR  OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INCLUDED_WORKERSHARD_H
+#define INCLUDED_WORKERSHARD_H 1
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include <google/protobuf/stubs/common.h>
+#include <thread++/threadpool.h>
+#include <toolbox/scopedptr.h>
+
+namespace toolbox
+{
+namespace siot
+{
+using google::protobuf::Closure;
+using std::string;
+
+class FairScheduler;
+
+// A group of worker threads which only run on a given set of CPUs, with a
+// scheduler of its own. The server assigns each connection to one shard, so
+// all callbacks of the connection run close to where its data is processed.
+class WorkerShard
+{
+public:
+	// Starts "num_threads" threads restricted to the CPUs in "cpus".
+	// This blocks until all of them have been placed.
+	WorkerShard(const std::vector<int>& cpus, uint32_t num_threads);
+	virtual ~WorkerShard();
+
+	// Queues "c" in the scheduling class "cls" of the shard and runs it
+	// on one of the threads of the shard when it's due.
+	void Dispatch(const string& cls, uint32_t weight, Closure* c);
+
+	// Gets the CPUs the threads of the shard are running on.
+	const std::vector<int>& GetCPUs() const;
+
+	// Returns the number of closures dispatched to the shard since the
+	// previous call. This is used to compare the load of the shards.
+	uint64_t TakeDispatchCount();
+
+private:
+	struct Placement;
+	void PlaceThread(Placement* p);
+
+	const std::vector<int> cpus_;
+	std::atomic<uint64_t> dispatched_;
+	ScopedPtr<FairScheduler> scheduler_;
+	threadpp::ThreadPool executor_;
+};
+}  // namespace siot
+}  // namespace toolbox
+
+#endif /* INCLUDED_WORKERSHARD_H */
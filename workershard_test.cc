@@ -0,0 +1,87 @@
+/**
+ * Tests for the CPU bound worker shards.
+ */
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include "threadplacement.h"
+#include "workershard.h"
+
+namespace toolbox
+{
+namespace siot
+{
+namespace testing
+{
+class WorkerShardTest : public ::testing::Test
+{
+};
+
+struct Observation
+{
+	std::mutex mtx;
+	std::condition_variable done;
+	int runs;
+	std::vector<int> cpus;
+};
+
+static void
+RecordCPU(Observation* obs)
+{
+	std::unique_lock<std::mutex> l(obs->mtx);
+	obs->cpus.push_back(GetCurrentCPU());
+	++obs->runs;
+	obs->done.notify_all();
+}
+
+TEST_F(WorkerShardTest, RunsOnItsCPU)
+{
+	WorkerShard shard(std::vector<int>(1, 0), 3);
+	Observation obs;
+
+	obs.runs = 0;
+	for (int i = 0; i < 20; ++i)
+		shard.Dispatch("", 1, google::protobuf::NewCallback(
+					&RecordCPU, &obs));
+
+	std::unique_lock<std::mutex> l(obs.mtx);
+	while (obs.runs < 20)
+		obs.done.wait(l);
+
+	for (int cpu : obs.cpus)
+		EXPECT_EQ(0, cpu);
+	EXPECT_EQ(std::vector<int>(1, 0), shard.GetCPUs());
+}
+
+TEST_F(WorkerShardTest, NUMANodes)
+{
+	const std::vector<NUMANode>& nodes = GetNUMANodes();
+	int cpu = GetCurrentCPU();
+
+	// Every system has at least one node, and the CPU we're running on
+	// must be part of one.
+	ASSERT_LT(0, nodes.size());
+	ASSERT_LE(0, cpu);
+
+	int index = GetNUMANodeIndex(cpu);
+	ASSERT_LE(0, index);
+	ASSERT_GT(nodes.size(), index);
+	EXPECT_NE(nodes[index].cpus.end(), std::find(nodes[index].cpus.begin(),
+				nodes[index].cpus.end(), cpu));
+	EXPECT_EQ(0, GetNUMANodeIndex(-1));
+}
+
+TEST_F(WorkerShardTest, PinCurrentThread)
+{
+	EXPECT_TRUE(PinCurrentThread(std::vector<int>()));
+	EXPECT_FALSE(PinCurrentThread(std::vector<int>(1, 1 << 20)));
+}
+}  // namespace testing
+}  // namespace siot
+}  // namespace toolbox